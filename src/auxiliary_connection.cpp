@@ -0,0 +1,447 @@
+#include "auxiliary_connection.hpp"
+#include "virtual_switch.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+AuxiliaryConnection::AuxiliaryConnection(
+		boost::asio::io_service& io,
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		uint8_t auxiliary_id)
+	:
+		OpenflowConnection::OpenflowConnection(io),
+		virtual_switch(virtual_switch),
+		auxiliary_id(auxiliary_id),
+		connected(false),
+		closed(false),
+		connection_backoff_timer(io) {
+}
+
+AuxiliaryConnection::pointer AuxiliaryConnection::shared_from_this() {
+	return boost::static_pointer_cast<AuxiliaryConnection>(
+			OpenflowConnection::shared_from_this());
+}
+
+void AuxiliaryConnection::connect(const boost::asio::ip::tcp::endpoint& endpoint) {
+	this->endpoint = endpoint;
+	socket.async_connect(
+		endpoint,
+		boost::bind(
+			&AuxiliaryConnection::handle_connect,
+			shared_from_this(),
+			boost::asio::placeholders::error));
+}
+
+void AuxiliaryConnection::handle_connect(const boost::system::error_code& error) {
+	if( !error ) {
+		OpenflowConnection::start();
+		connected = true;
+		BOOST_LOG_TRIVIAL(info) << *this << " started";
+	}
+	else if( error.value() != boost::asio::error::operation_aborted && !closed ) {
+		// The main connection keeps working without this connection
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " couldn't connect: " << error.message();
+		schedule_reconnect();
+	}
+}
+
+void AuxiliaryConnection::schedule_reconnect() {
+	// Use the same backoff as the main connection
+	connection_backoff_timer.expires_from_now(
+		boost::posix_time::milliseconds(500));
+	connection_backoff_timer.async_wait(
+		boost::bind(
+			&AuxiliaryConnection::backoff_expired,
+			shared_from_this(),
+			boost::asio::placeholders::error));
+}
+
+void AuxiliaryConnection::backoff_expired(const boost::system::error_code& error) {
+	if( !error && !closed ) {
+		BOOST_LOG_TRIVIAL(trace) << *this << " trying to connect again";
+		connect(endpoint);
+	}
+}
+
+void AuxiliaryConnection::stop() {
+	// A network error can stop this connection more than once
+	bool was_connected = connected;
+	connected = false;
+	OpenflowConnection::stop();
+
+	// The PacketIns use the other connections in the meantime
+	if( was_connected && !closed ) {
+		schedule_reconnect();
+	}
+}
+
+void AuxiliaryConnection::close() {
+	closed = true;
+	connection_backoff_timer.cancel();
+	stop();
+}
+
+bool AuxiliaryConnection::is_connected() const {
+	return connected;
+}
+
+void AuxiliaryConnection::print_to_stream(std::ostream& os) const {
+	auto virtual_switch_ptr = virtual_switch.lock();
+	os << "[Auxiliary connection " << (int) auxiliary_id << " of ";
+	if( virtual_switch_ptr != nullptr ) {
+		virtual_switch_ptr->print_to_stream(os);
+	}
+	os << "]";
+}
+
+template<
+	class libfluid_message,
+	void (VirtualSwitch::*handle_function)(libfluid_message&)>
+void AuxiliaryConnection::forward_to_virtual_switch(libfluid_message& message) {
+	auto virtual_switch_ptr = virtual_switch.lock();
+	if( virtual_switch_ptr == nullptr || !virtual_switch_ptr->is_connected() ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received message while the main connection is down";
+		return;
+	}
+	// The responses to this message go back over this connection
+	virtual_switch_ptr->set_reply_connection(shared_from_this());
+	((*virtual_switch_ptr).*handle_function)(message);
+	virtual_switch_ptr->set_reply_connection(nullptr);
+}
+
+void AuxiliaryConnection::handle_error(fluid_msg::of13::Error& error_message) {
+	BOOST_LOG_TRIVIAL(error) << *this
+		<< " received error Type=" << error_message.err_type()
+		<< " Code=" << error_message.code();
+}
+
+void AuxiliaryConnection::handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received features_request";
+
+	auto virtual_switch_ptr = virtual_switch.lock();
+	if( virtual_switch_ptr == nullptr ) {
+		return;
+	}
+
+	// The controller matches this connection to the main
+	// connection by the datapath id and auxiliary id
+	fluid_msg::of13::FeaturesReply features_reply =
+		virtual_switch_ptr->make_features_reply(
+			features_request_message.xid(),
+			auxiliary_id);
+	send_message_response(features_reply);
+}
+
+void AuxiliaryConnection::handle_features_reply(fluid_msg::of13::FeaturesReply& features_reply_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::FeaturesReply,
+		&VirtualSwitch::handle_features_reply>(features_reply_message);
+}
+
+void AuxiliaryConnection::handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::GetConfigRequest,
+		&VirtualSwitch::handle_config_request>(config_request_message);
+}
+
+void AuxiliaryConnection::handle_config_reply(fluid_msg::of13::GetConfigReply& config_reply_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::GetConfigReply,
+		&VirtualSwitch::handle_config_reply>(config_reply_message);
+}
+
+void AuxiliaryConnection::handle_set_config(fluid_msg::of13::SetConfig& set_config_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::SetConfig,
+		&VirtualSwitch::handle_set_config>(set_config_message);
+}
+
+void AuxiliaryConnection::handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::BarrierRequest,
+		&VirtualSwitch::handle_barrier_request>(barrier_request_message);
+}
+
+void AuxiliaryConnection::handle_barrier_reply(fluid_msg::of13::BarrierReply& barrier_reply_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::BarrierReply,
+		&VirtualSwitch::handle_barrier_reply>(barrier_reply_message);
+}
+
+void AuxiliaryConnection::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::PacketIn,
+		&VirtualSwitch::handle_packet_in>(packet_in_message);
+}
+
+void AuxiliaryConnection::handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::PacketOut,
+		&VirtualSwitch::handle_packet_out>(packet_out_message);
+}
+
+void AuxiliaryConnection::handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::FlowRemoved,
+		&VirtualSwitch::handle_flow_removed>(flow_removed_message);
+}
+
+void AuxiliaryConnection::handle_port_status(fluid_msg::of13::PortStatus& port_status_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::PortStatus,
+		&VirtualSwitch::handle_port_status>(port_status_message);
+}
+
+void AuxiliaryConnection::handle_flow_mod(fluid_msg::of13::FlowMod& flow_mod_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::FlowMod,
+		&VirtualSwitch::handle_flow_mod>(flow_mod_message);
+}
+
+void AuxiliaryConnection::handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::GroupMod,
+		&VirtualSwitch::handle_group_mod>(group_mod_message);
+}
+
+void AuxiliaryConnection::handle_port_mod(fluid_msg::of13::PortMod& port_mod_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::PortMod,
+		&VirtualSwitch::handle_port_mod>(port_mod_message);
+}
+
+void AuxiliaryConnection::handle_table_mod(fluid_msg::of13::TableMod& table_mod_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::TableMod,
+		&VirtualSwitch::handle_table_mod>(table_mod_message);
+}
+
+void AuxiliaryConnection::handle_meter_mod(fluid_msg::of13::MeterMod& meter_mod_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MeterMod,
+		&VirtualSwitch::handle_meter_mod>(meter_mod_message);
+}
+
+void AuxiliaryConnection::handle_queue_config_request(fluid_msg::of13::QueueGetConfigRequest& queue_config_request) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::QueueGetConfigRequest,
+		&VirtualSwitch::handle_queue_config_request>(queue_config_request);
+}
+
+void AuxiliaryConnection::handle_queue_config_reply(fluid_msg::of13::QueueGetConfigReply& queue_config_reply) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::QueueGetConfigReply,
+		&VirtualSwitch::handle_queue_config_reply>(queue_config_reply);
+}
+
+void AuxiliaryConnection::handle_role_request(fluid_msg::of13::RoleRequest& role_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::RoleRequest,
+		&VirtualSwitch::handle_role_request>(role_request_message);
+}
+
+void AuxiliaryConnection::handle_role_reply(fluid_msg::of13::RoleReply& role_reply_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::RoleReply,
+		&VirtualSwitch::handle_role_reply>(role_reply_message);
+}
+
+void AuxiliaryConnection::handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::GetAsyncRequest,
+		&VirtualSwitch::handle_get_async_request>(async_request_message);
+}
+
+void AuxiliaryConnection::handle_get_async_reply(fluid_msg::of13::GetAsyncReply& async_reply_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::GetAsyncReply,
+		&VirtualSwitch::handle_get_async_reply>(async_reply_message);
+}
+
+void AuxiliaryConnection::handle_set_async(fluid_msg::of13::SetAsync& set_async_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::SetAsync,
+		&VirtualSwitch::handle_set_async>(set_async_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_desc(fluid_msg::of13::MultipartRequestDesc& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestDesc,
+		&VirtualSwitch::handle_multipart_request_desc>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_flow(fluid_msg::of13::MultipartRequestFlow& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestFlow,
+		&VirtualSwitch::handle_multipart_request_flow>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_aggregate(fluid_msg::of13::MultipartRequestAggregate& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestAggregate,
+		&VirtualSwitch::handle_multipart_request_aggregate>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_table(fluid_msg::of13::MultipartRequestTable& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestTable,
+		&VirtualSwitch::handle_multipart_request_table>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_port_stats(fluid_msg::of13::MultipartRequestPortStats& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestPortStats,
+		&VirtualSwitch::handle_multipart_request_port_stats>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_queue(fluid_msg::of13::MultipartRequestQueue& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestQueue,
+		&VirtualSwitch::handle_multipart_request_queue>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_group(fluid_msg::of13::MultipartRequestGroup& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestGroup,
+		&VirtualSwitch::handle_multipart_request_group>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_group_desc(fluid_msg::of13::MultipartRequestGroupDesc& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestGroupDesc,
+		&VirtualSwitch::handle_multipart_request_group_desc>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_group_features(fluid_msg::of13::MultipartRequestGroupFeatures& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestGroupFeatures,
+		&VirtualSwitch::handle_multipart_request_group_features>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_meter(fluid_msg::of13::MultipartRequestMeter& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestMeter,
+		&VirtualSwitch::handle_multipart_request_meter>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_meter_config(fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestMeterConfig,
+		&VirtualSwitch::handle_multipart_request_meter_config>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestMeterFeatures,
+		&VirtualSwitch::handle_multipart_request_meter_features>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message) {
+	forward_to_virtual_switch<
+		std::vector<uint8_t>,
+		&VirtualSwitch::handle_multipart_request_table_features>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_port_desc(fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestPortDescription,
+		&VirtualSwitch::handle_multipart_request_port_desc>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_request_experimenter(fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartRequestExperimenter,
+		&VirtualSwitch::handle_multipart_request_experimenter>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_desc(fluid_msg::of13::MultipartReplyDesc& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyDesc,
+		&VirtualSwitch::handle_multipart_reply_desc>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_flow(fluid_msg::of13::MultipartReplyFlow& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyFlow,
+		&VirtualSwitch::handle_multipart_reply_flow>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_aggregate(fluid_msg::of13::MultipartReplyAggregate& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyAggregate,
+		&VirtualSwitch::handle_multipart_reply_aggregate>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_table(fluid_msg::of13::MultipartReplyTable& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyTable,
+		&VirtualSwitch::handle_multipart_reply_table>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_port_stats(fluid_msg::of13::MultipartReplyPortStats& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyPortStats,
+		&VirtualSwitch::handle_multipart_reply_port_stats>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_queue(fluid_msg::of13::MultipartReplyQueue& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyQueue,
+		&VirtualSwitch::handle_multipart_reply_queue>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_group(fluid_msg::of13::MultipartReplyGroup& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyGroup,
+		&VirtualSwitch::handle_multipart_reply_group>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_group_desc(fluid_msg::of13::MultipartReplyGroupDesc& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyGroupDesc,
+		&VirtualSwitch::handle_multipart_reply_group_desc>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_group_features(fluid_msg::of13::MultipartReplyGroupFeatures& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyGroupFeatures,
+		&VirtualSwitch::handle_multipart_reply_group_features>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_meter(fluid_msg::of13::MultipartReplyMeter& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyMeter,
+		&VirtualSwitch::handle_multipart_reply_meter>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_meter_config(fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyMeterConfig,
+		&VirtualSwitch::handle_multipart_reply_meter_config>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyMeterFeatures,
+		&VirtualSwitch::handle_multipart_reply_meter_features>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_request_message) {
+	forward_to_virtual_switch<
+		std::vector<uint8_t>,
+		&VirtualSwitch::handle_multipart_reply_table_features>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_port_desc(fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyPortDescription,
+		&VirtualSwitch::handle_multipart_reply_port_desc>(multipart_request_message);
+}
+
+void AuxiliaryConnection::handle_multipart_reply_experimenter(fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message) {
+	forward_to_virtual_switch<
+		fluid_msg::of13::MultipartReplyExperimenter,
+		&VirtualSwitch::handle_multipart_reply_experimenter>(multipart_request_message);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <boost/weak_ptr.hpp>
+
+#include "openflow_connection.hpp"
+
+class VirtualSwitch;
+
+/// An auxiliary connection of a virtual switch to its controller
+/**
+ * Openflow 1.3 allows a switch to open extra connections to the
+ * controller next to the main connection. The hypervisor sends
+ * the PacketIns of a virtual switch over these connections so
+ * they don't wait behind large replies on the main connection.
+ *
+ * Messages the controller sends over an auxiliary connection are
+ * handled by the virtual switch as if they were received over
+ * the main connection, the responses are sent back over the
+ * auxiliary connection. A connection that fails or drops is
+ * tried again until the main connection stops.
+ */
+class AuxiliaryConnection : public OpenflowConnection {
+private:
+	/// The virtual switch this is an auxiliary connection of
+	boost::weak_ptr<VirtualSwitch> virtual_switch;
+	/// The id of this auxiliary connection, always larger than 0
+	uint8_t auxiliary_id;
+	/// If the connection to the controller is established
+	bool connected;
+	/// If the main connection closed this connection for good
+	bool closed;
+
+	/// The endpoint of the controller
+	boost::asio::ip::tcp::endpoint endpoint;
+	/// The timer used to backoff between connection attempts
+	boost::asio::deadline_timer connection_backoff_timer;
+	/// Try connecting again after the backoff
+	void schedule_reconnect();
+	/// The function called when the timer expires
+	void backoff_expired(const boost::system::error_code& error);
+
+	/// The callback when the connection succeeds
+	void handle_connect(const boost::system::error_code& error);
+
+	/// Pass a message on to the virtual switch
+	template<
+		class libfluid_message,
+		void (VirtualSwitch::*handle_function)(libfluid_message&)>
+	void forward_to_virtual_switch(libfluid_message& message);
+public:
+	typedef boost::shared_ptr<AuxiliaryConnection> pointer;
+
+	/// Allow creating a shared pointer of this class
+	pointer shared_from_this();
+
+	/// Create a new auxiliary connection
+	AuxiliaryConnection(
+		boost::asio::io_service& io,
+		boost::shared_ptr<VirtualSwitch> virtual_switch,
+		uint8_t auxiliary_id);
+
+	/// Connect to the controller
+	void connect(const boost::asio::ip::tcp::endpoint& endpoint);
+	/// Stop this connection, it connects again after the backoff
+	void stop();
+	/// Stop this connection for good
+	void close();
+	/// Returns if this connection is currently connected
+	bool is_connected() const;
+
+	/// Print this connection to a stream
+	void print_to_stream(std::ostream& os) const;
+
+	/// Handle openflow messages
+	void handle_error           (fluid_msg::of13::Error& error_message);
+	void handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message);
+	void handle_features_reply  (fluid_msg::of13::FeaturesReply& features_reply_message);
+
+	void handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message);
+	void handle_config_reply  (fluid_msg::of13::GetConfigReply& config_reply_message);
+	void handle_set_config    (fluid_msg::of13::SetConfig& set_config_message);
+
+	void handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message);
+	void handle_barrier_reply  (fluid_msg::of13::BarrierReply& barrier_reply_message);
+
+	void handle_packet_in (fluid_msg::of13::PacketIn& packet_in_message);
+	void handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message);
+
+	void handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message);
+	void handle_port_status (fluid_msg::of13::PortStatus& port_status_message);
+
+	void handle_flow_mod (fluid_msg::of13::FlowMod& flow_mod_message);
+	void handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message);
+	void handle_port_mod (fluid_msg::of13::PortMod& port_mod_message);
+	void handle_table_mod(fluid_msg::of13::TableMod& table_mod_message);
+	void handle_meter_mod(fluid_msg::of13::MeterMod& meter_mod_message);
+
+	void handle_queue_config_request(fluid_msg::of13::QueueGetConfigRequest& queue_config_request);
+	void handle_queue_config_reply  (fluid_msg::of13::QueueGetConfigReply& queue_config_reply);
+
+	void handle_role_request(fluid_msg::of13::RoleRequest& role_request_message);
+	void handle_role_reply  (fluid_msg::of13::RoleReply& role_reply_message);
+
+	void handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message);
+	void handle_get_async_reply  (fluid_msg::of13::GetAsyncReply& async_reply_message);
+	void handle_set_async        (fluid_msg::of13::SetAsync& set_async_message);
+
+	void handle_multipart_request_desc          (fluid_msg::of13::MultipartRequestDesc& multipart_request_message);
+	void handle_multipart_request_flow          (fluid_msg::of13::MultipartRequestFlow& multipart_request_message);
+	void handle_multipart_request_aggregate     (fluid_msg::of13::MultipartRequestAggregate& multipart_request_message);
+	void handle_multipart_request_table         (fluid_msg::of13::MultipartRequestTable& multipart_request_message);
+	void handle_multipart_request_port_stats    (fluid_msg::of13::MultipartRequestPortStats& multipart_request_message);
+	void handle_multipart_request_queue         (fluid_msg::of13::MultipartRequestQueue& multipart_request_message);
+	void handle_multipart_request_group         (fluid_msg::of13::MultipartRequestGroup& multipart_request_message);
+	void handle_multipart_request_group_desc    (fluid_msg::of13::MultipartRequestGroupDesc& multipart_request_message);
+	void handle_multipart_request_group_features(fluid_msg::of13::MultipartRequestGroupFeatures& multipart_request_message);
+	void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message);
+	void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message);
+	void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message);
+	void handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message);
+	void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message);
+	void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message);
+	void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message);
+	void handle_multipart_reply_flow          (fluid_msg::of13::MultipartReplyFlow& multipart_request_message);
+	void handle_multipart_reply_aggregate     (fluid_msg::of13::MultipartReplyAggregate& multipart_request_message);
+	void handle_multipart_reply_table         (fluid_msg::of13::MultipartReplyTable& multipart_request_message);
+	void handle_multipart_reply_port_stats    (fluid_msg::of13::MultipartReplyPortStats& multipart_request_message);
+	void handle_multipart_reply_queue         (fluid_msg::of13::MultipartReplyQueue& multipart_request_message);
+	void handle_multipart_reply_group         (fluid_msg::of13::MultipartReplyGroup& multipart_request_message);
+	void handle_multipart_reply_group_desc    (fluid_msg::of13::MultipartReplyGroupDesc& multipart_request_message);
+	void handle_multipart_reply_group_features(fluid_msg::of13::MultipartReplyGroupFeatures& multipart_request_message);
+	void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message);
+	void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message);
+	void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message);
+	void handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_request_message);
+	void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message);
+	void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message);
+};
@@ -0,0 +1,107 @@
+#include "configuration.hpp"
+#include "tag.hpp"
+
+#include <set>
+
+std::vector<SliceConfiguration> parse_slice_configurations(
+		const boost::property_tree::ptree& config_tree) {
+	std::vector<SliceConfiguration> configurations;
+
+	for( const auto &slice_pair : config_tree.get_child("slices") ) {
+		auto& slice_ptree = slice_pair.second;
+
+		SliceConfiguration slice;
+		slice.controller_endpoint = boost::asio::ip::tcp::endpoint(
+			boost::asio::ip::address_v4::from_string(
+				slice_ptree.get_child("controller").get<std::string>("ip")),
+			slice_ptree.get_child("controller").get<int>("port"));
+		slice.max_rate = slice_ptree.get<int>("max_rate");
+
+		// The PacketIn rate limit is optional, 0 means unlimited
+		slice.packet_in_rate  = slice_ptree.get<int>("packet_in_rate", 0);
+		slice.packet_in_burst = slice_ptree.get<int>("packet_in_burst", slice.packet_in_rate);
+
+		// Optionally send PacketIns over auxiliary connections
+		slice.auxiliary_connections = slice_ptree.get<int>("auxiliary_connections", 0);
+
+		// The amount of rules per physical switch is optional, 0 is unlimited
+		slice.max_flows = slice_ptree.get<int>("max_flows", 0);
+
+		for( const auto &virtual_switch_pair : slice_ptree.get_child("virtual_switches") ) {
+			auto& virtual_switch_ptree = virtual_switch_pair.second;
+
+			VirtualSwitchConfiguration virtual_switch;
+			virtual_switch.datapath_id     = virtual_switch_ptree.get<uint64_t>("datapath_id");
+			virtual_switch.packet_in_rate  = virtual_switch_ptree.get<int>("packet_in_rate", 0);
+			virtual_switch.packet_in_burst = virtual_switch_ptree.get<int>(
+				"packet_in_burst",
+				virtual_switch.packet_in_rate);
+
+			for( const auto &port_pair : virtual_switch_ptree.get_child("ports") ) {
+				auto& port_ptree = port_pair.second;
+
+				uint32_t virtual_port         =
+					port_ptree.get<uint32_t>("virtual_port");
+				uint64_t physical_datapath_id =
+					port_ptree.get<uint64_t>("physical_datapath_id");
+				uint32_t physical_port        =
+					port_ptree.get<uint32_t>("physical_port");
+
+				virtual_switch.ports[virtual_port] =
+					std::make_pair(physical_datapath_id, physical_port);
+			}
+
+			slice.virtual_switches.push_back(virtual_switch);
+		}
+
+		configurations.push_back(slice);
+	}
+
+	return configurations;
+}
+
+std::vector<std::string> check_tag_limits(
+		const std::vector<SliceConfiguration>& configurations) {
+	std::vector<std::string> problems;
+
+	// Slice id 0 and the highest slice id are reserved
+	if( configurations.size() > VLANTag::max_slice_id-1u ) {
+		problems.push_back(
+			"Too many slices, the tag layout allows " +
+			std::to_string(VLANTag::max_slice_id-1) + " slices");
+	}
+
+	// The virtual switch id is in the metadata and the cookies,
+	// id 0 isn't used
+	size_t num_virtual_switches = 0;
+	for( const auto& slice : configurations ) {
+		num_virtual_switches += slice.virtual_switches.size();
+	}
+	if( num_virtual_switches > MetadataTag::max_virtual_switch_id ) {
+		problems.push_back(
+			"Too many virtual switches, the metadata allows " +
+			std::to_string(MetadataTag::max_virtual_switch_id) + " virtual switches");
+	}
+
+	// The ports get an index in the VLAN tag per physical switch,
+	// the highest value is reserved for the links
+	std::map<uint64_t,std::set<uint32_t>> used_ports;
+	for( const auto& slice : configurations ) {
+		for( const auto& virtual_switch : slice.virtual_switches ) {
+			for( const auto& port_pair : virtual_switch.ports ) {
+				used_ports[port_pair.second.first].insert(port_pair.second.second);
+			}
+		}
+	}
+	for( const auto& used_ports_pair : used_ports ) {
+		if( used_ports_pair.second.size() > VLANTag::max_port_id ) {
+			problems.push_back(
+				"Physical switch " + std::to_string(used_ports_pair.first) +
+				" has " + std::to_string(used_ports_pair.second.size()) +
+				" ports in use, the tag layout allows " +
+				std::to_string(VLANTag::max_port_id) + " ports per switch");
+		}
+	}
+
+	return problems;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+/// The configuration of a virtual switch as read from the file
+struct VirtualSwitchConfiguration {
+	uint64_t datapath_id;
+	int packet_in_rate;
+	int packet_in_burst;
+	/// virtual port -> (physical datapath id, physical port)
+	std::map<uint32_t,std::pair<uint64_t,uint32_t>> ports;
+};
+
+/// The configuration of a slice as read from the file
+struct SliceConfiguration {
+	boost::asio::ip::tcp::endpoint controller_endpoint;
+	int max_rate;
+	int packet_in_rate;
+	int packet_in_burst;
+	int auxiliary_connections;
+	int max_flows;
+	std::vector<VirtualSwitchConfiguration> virtual_switches;
+};
+
+/// Read the slices from a configuration file
+/**
+ * This throws if a required key is missing or has the wrong type.
+ */
+std::vector<SliceConfiguration> parse_slice_configurations(
+	const boost::property_tree::ptree& config_tree);
+
+/// Check if the slices fit in the tags of the hypervisor
+/**
+ * \return A description of every limit that is exceeded,
+ *   empty if the configuration fits
+ */
+std::vector<std::string> check_tag_limits(
+	const std::vector<SliceConfiguration>& configurations);
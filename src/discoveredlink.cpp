@@ -36,11 +36,11 @@ void DiscoveredLink::timeout(const boost::system::error_code& error) {
 
 	BOOST_LOG_TRIVIAL(info) << *this << " timed out";
 
-	// Stop this discovered link, this call doesn't really
+	// Remove this discovered link, stopping it doesn't really
 	// do anything since it only cancels the timer that doesn't
 	// have any handlers attached to it since this handler
 	// just fired.
-	stop();
+	remove();
 }
 
 int DiscoveredLink::get_other_switch_id(int switch_id) const {
@@ -61,6 +61,18 @@ int DiscoveredLink::get_port_number(int switch_id) const {
 	}
 }
 
+bool DiscoveredLink::connects(
+		int switch_id_a,
+		uint32_t port_number_a,
+		int switch_id_b,
+		uint32_t port_number_b) const {
+	return
+		(switch_id_1 == switch_id_a && port_number_1 == port_number_a &&
+		 switch_id_2 == switch_id_b && port_number_2 == port_number_b) ||
+		(switch_id_1 == switch_id_b && port_number_1 == port_number_b &&
+		 switch_id_2 == switch_id_a && port_number_2 == port_number_a);
+}
+
 void DiscoveredLink::reset_timer() {
 	// Reset the expiry date to further in the future
 	liveness_timer.expires_from_now(
@@ -99,6 +111,15 @@ void DiscoveredLink::stop() {
 	hypervisor->calculate_routes();
 }
 
+void DiscoveredLink::remove() {
+	hypervisor->forget_link(
+		switch_id_1,
+		port_number_1,
+		switch_id_2,
+		port_number_2);
+	stop();
+}
+
 void DiscoveredLink::print_to_stream(std::ostream& os) const {
 	os << "[DiscoveredLink between ("
 		<< switch_id_1 << "," << port_number_1 << ") and ("
@@ -29,11 +29,24 @@ public:
 	int get_other_switch_id(int switch_id) const;
 	/// Return the port on the switch connected to this link
 	int get_port_number(int switch_id) const;
+	/// Return if this link is between these two ports
+	bool connects(
+		int switch_id_a,
+		uint32_t port_number_a,
+		int switch_id_b,
+		uint32_t port_number_b) const;
 
 	/// Start this discovered link
 	void start();
 	/// Stop this discovered link
 	void stop();
+	/// Stop this discovered link because it doesn't exist anymore
+	/**
+	 * Unlike stop this also removes the link from the state
+	 * journal, a link stopped because a switch disconnected is
+	 * restored when the switch connects again.
+	 */
+	void remove();
 
 	/// Reset the liveness timer
 	void reset_timer();
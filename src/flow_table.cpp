@@ -0,0 +1,586 @@
+#include "flow_table.hpp"
+
+#include <algorithm>
+
+namespace {
+	/// Read a big endian integer from a buffer
+	uint32_t read_uint32(const uint8_t* buffer) {
+		return
+			(uint32_t(buffer[0])<<24) |
+			(uint32_t(buffer[1])<<16) |
+			(uint32_t(buffer[2])<< 8) |
+			 uint32_t(buffer[3]);
+	}
+
+	/// Append a header to a key
+	void append_header(std::string& key, uint32_t header) {
+		key.push_back((header>>24) & 0xff);
+		key.push_back((header>>16) & 0xff);
+		key.push_back((header>> 8) & 0xff);
+		key.push_back( header      & 0xff);
+	}
+
+	/// Check if an action outputs to a port or group
+	bool action_outputs_to(fluid_msg::Action* action, uint32_t out_port, uint32_t out_group) {
+		if( out_port != fluid_msg::of13::OFPP_ANY &&
+				action->type() == fluid_msg::of13::OFPAT_OUTPUT &&
+				((fluid_msg::of13::OutputAction*) action)->port() == out_port ) {
+			return true;
+		}
+		if( out_group != fluid_msg::of13::OFPG_ANY &&
+				action->type() == fluid_msg::of13::OFPAT_GROUP &&
+				((fluid_msg::of13::GroupAction*) action)->group_id() == out_group ) {
+			return true;
+		}
+		return false;
+	}
+}
+
+FlowTable::FlowTable() :
+	total_size(0) {
+}
+
+void FlowTable::set_listener(std::function<void(fluid_msg::of13::FlowMod&,bool)> listener) {
+	this->listener = listener;
+}
+
+FlowTable::ParsedMatch FlowTable::parse_match(fluid_msg::of13::Match match) {
+	// Parse the packed match instead of the libfluid classes,
+	// this handles every field the same way
+	std::vector<uint8_t> packed_match(((match.length()+7)/8)*8, 0);
+	match.pack(packed_match.data());
+
+	ParsedMatch parsed_match;
+
+	// Skip the type and length of the match
+	size_t offset = 4;
+	while( offset+4 <= match.length() ) {
+		uint32_t oxm_header = read_uint32(&packed_match[offset]);
+		bool has_mask       = (oxm_header>>8) & 1;
+		size_t length       = oxm_header & 0xff;
+		offset += 4;
+		if( offset+length > match.length() ) break;
+
+		MatchField field;
+		field.header = oxm_header >> 9;
+		if( has_mask ) {
+			field.value.assign((const char*) &packed_match[offset], length/2);
+			field.mask.assign((const char*) &packed_match[offset+length/2], length/2);
+		}
+		else {
+			field.value.assign((const char*) &packed_match[offset], length);
+			field.mask.assign(length, (char) 0xff);
+		}
+		// Bits outside the mask don't matter
+		for( size_t i=0; i<field.value.size(); ++i ) {
+			field.value[i] &= field.mask[i];
+		}
+		parsed_match.push_back(field);
+
+		offset += length;
+	}
+
+	std::sort(
+		parsed_match.begin(),
+		parsed_match.end(),
+		[](const MatchField& field_1, const MatchField& field_2) {
+			return field_1.header < field_2.header;
+		});
+	return parsed_match;
+}
+
+std::string FlowTable::make_tuple_key(const ParsedMatch& match) {
+	std::string key;
+	for( const MatchField& field : match ) {
+		append_header(key, field.header);
+		key.push_back(field.mask.size());
+		key.append(field.mask);
+	}
+	return key;
+}
+
+std::string FlowTable::make_value_key(const ParsedMatch& match) {
+	std::string key;
+	for( const MatchField& field : match ) {
+		key.append(field.value);
+	}
+	return key;
+}
+
+bool FlowTable::make_overlap_key(
+		const std::string& tuple_key,
+		const ParsedMatch& match,
+		std::string& value_key) {
+	// Walk the tuple key and the match at the same time,
+	// both are ordered by header
+	auto field_it = match.begin();
+	size_t offset = 0;
+	while( offset < tuple_key.size() ) {
+		uint32_t header  = read_uint32((const uint8_t*) &tuple_key[offset]);
+		size_t length    = (uint8_t) tuple_key[offset+4];
+		const char* mask = &tuple_key[offset+5];
+		offset += 5+length;
+
+		while( field_it != match.end() && field_it->header < header ) {
+			++field_it;
+		}
+		// A field the match wildcards overlaps every value
+		if( field_it == match.end() ||
+				field_it->header != header ||
+				field_it->mask.size() != length ) {
+			return false;
+		}
+
+		// The rules overlap if they agree on the bits of the tuple,
+		// this only works if the match has all these bits
+		for( size_t i=0; i<length; ++i ) {
+			if( (mask[i] & field_it->mask[i]) != mask[i] ) return false;
+			value_key.push_back(field_it->value[i] & mask[i]);
+		}
+	}
+	return true;
+}
+
+bool FlowTable::tuple_covers(const std::string& tuple_key, const ParsedMatch& request) {
+	// Walk the tuple key and the request at the same time,
+	// both are ordered by header
+	size_t offset = 0;
+	for( const MatchField& field : request ) {
+		bool found = false;
+		while( offset < tuple_key.size() ) {
+			uint32_t header = read_uint32((const uint8_t*) &tuple_key[offset]);
+			size_t length   = (uint8_t) tuple_key[offset+4];
+			const char* mask = &tuple_key[offset+5];
+			offset += 5+length;
+
+			if( header < field.header ) continue;
+			if( header > field.header || length != field.mask.size() ) return false;
+
+			// The tuple has to match at least the bits of the request
+			for( size_t i=0; i<length; ++i ) {
+				if( (mask[i] & field.mask[i]) != field.mask[i] ) return false;
+			}
+			found = true;
+			break;
+		}
+		if( !found ) return false;
+	}
+	return true;
+}
+
+bool FlowTable::entry_covers(const ParsedMatch& entry, const ParsedMatch& request) {
+	auto entry_it = entry.begin();
+	for( const MatchField& field : request ) {
+		while( entry_it != entry.end() && entry_it->header < field.header ) {
+			++entry_it;
+		}
+		if( entry_it == entry.end() ||
+				entry_it->header != field.header ||
+				entry_it->value.size() != field.value.size() ) {
+			return false;
+		}
+		for( size_t i=0; i<field.value.size(); ++i ) {
+			if( (entry_it->mask[i] & field.mask[i]) != field.mask[i] ||
+					(entry_it->value[i] & field.mask[i]) != field.value[i] ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool FlowTable::overlaps(const ParsedMatch& match_1, const ParsedMatch& match_2) {
+	// Fields only in one of the matches are wildcarded in the
+	// other, only the bits both fields match on can conflict
+	auto it_1 = match_1.begin();
+	auto it_2 = match_2.begin();
+	while( it_1 != match_1.end() && it_2 != match_2.end() ) {
+		if( it_1->header < it_2->header ) {
+			++it_1;
+		}
+		else if( it_1->header > it_2->header ) {
+			++it_2;
+		}
+		else {
+			size_t length = std::min(it_1->value.size(), it_2->value.size());
+			for( size_t i=0; i<length; ++i ) {
+				if( (it_1->value[i] ^ it_2->value[i]) & it_1->mask[i] & it_2->mask[i] ) {
+					return false;
+				}
+			}
+			++it_1;
+			++it_2;
+		}
+	}
+	return true;
+}
+
+bool FlowTable::passes_filters(
+		fluid_msg::of13::FlowMod& entry,
+		fluid_msg::of13::FlowMod& request,
+		bool check_outputs) {
+	if( (entry.cookie() & request.cookie_mask()) !=
+			(request.cookie() & request.cookie_mask()) ) {
+		return false;
+	}
+
+	// Only delete requests filter on outputs
+	if( !check_outputs ||
+			(request.out_port()  == fluid_msg::of13::OFPP_ANY &&
+			 request.out_group() == fluid_msg::of13::OFPG_ANY) ) {
+		return true;
+	}
+
+	fluid_msg::of13::InstructionSet instruction_set = entry.instructions();
+	for( fluid_msg::of13::Instruction* instruction : instruction_set.instruction_set() ) {
+		if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_ACTIONS ) {
+			fluid_msg::ActionSet action_set =
+				((fluid_msg::of13::WriteActions*) instruction)->actions();
+			for( fluid_msg::Action* action : action_set.action_set() ) {
+				if( action_outputs_to(action, request.out_port(), request.out_group()) ) {
+					return true;
+				}
+			}
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_APPLY_ACTIONS ) {
+			fluid_msg::ActionList action_list =
+				((fluid_msg::of13::ApplyActions*) instruction)->actions();
+			for( fluid_msg::Action* action : action_list.action_list() ) {
+				if( action_outputs_to(action, request.out_port(), request.out_group()) ) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+size_t FlowTable::for_each_match(
+		fluid_msg::of13::FlowMod& request,
+		bool strict,
+		bool check_outputs,
+		std::function<bool(Entry&)> function) {
+	ParsedMatch request_match = parse_match(request.match());
+	std::string tuple_key     = make_tuple_key(request_match);
+	std::string value_key     = make_value_key(request_match);
+
+	size_t matched = 0;
+
+	// Only delete requests can apply to all tables
+	auto table_it  = tables.begin();
+	auto table_end = tables.end();
+	if( request.table_id() != fluid_msg::of13::OFPTT_ALL ) {
+		table_it  = tables.find(request.table_id());
+		table_end = table_it;
+		if( table_it != tables.end() ) ++table_end;
+	}
+
+	for( ; table_it != table_end; ++table_it ) {
+		Table& table = table_it->second;
+
+		// Apply the function to the matching rules in a tuple
+		auto search_tuple = [&](Tuple& tuple, bool same_tuple) {
+			// In the same tuple the masked values have to be equal, so
+			// the rules can be found with a single lookup
+			auto entries_it  = tuple.entries.begin();
+			auto entries_end = tuple.entries.end();
+			if( same_tuple ) {
+				entries_it  = tuple.entries.find(value_key);
+				entries_end = entries_it;
+				if( entries_it != tuple.entries.end() ) ++entries_end;
+			}
+
+			while( entries_it != entries_end ) {
+				auto& priority_map = entries_it->second;
+
+				auto priority_it = priority_map.begin();
+				while( priority_it != priority_map.end() ) {
+					Entry& entry = priority_it->second;
+					if( (strict && priority_it->first != request.priority()) ||
+							(!same_tuple && !entry_covers(entry.match, request_match)) ||
+							!passes_filters(entry.flow_mod, request, check_outputs) ) {
+						++priority_it;
+						continue;
+					}
+
+					++matched;
+					if( function(entry) ) {
+						--table.priorities[priority_it->first];
+						--tuple.priorities[priority_it->first];
+						--tuple.size;
+						--total_size;
+						priority_it = priority_map.erase(priority_it);
+					}
+					else {
+						++priority_it;
+					}
+				}
+
+				if( priority_map.empty() ) {
+					entries_it = tuple.entries.erase(entries_it);
+				}
+				else {
+					++entries_it;
+				}
+			}
+		};
+
+		// A strict request only applies to its own tuple, a non-strict
+		// request to the tuples that are at least as specific
+		auto tuple_it = table.tuples.begin();
+		while( tuple_it != table.tuples.end() ) {
+			if( strict ) {
+				tuple_it = table.tuples.find(tuple_key);
+				if( tuple_it == table.tuples.end() ) break;
+				search_tuple(tuple_it->second, true);
+			}
+			else if( tuple_it->first == tuple_key ) {
+				search_tuple(tuple_it->second, true);
+			}
+			else if( tuple_covers(tuple_it->first, request_match) ) {
+				search_tuple(tuple_it->second, false);
+			}
+
+			// Remove the empty tuples so they aren't searched anymore
+			if( tuple_it->second.size == 0 ) {
+				tuple_it = table.tuples.erase(tuple_it);
+			}
+			else {
+				++tuple_it;
+			}
+			if( strict ) break;
+		}
+	}
+
+	return matched;
+}
+
+std::string FlowTable::make_key(fluid_msg::of13::FlowMod& flow_mod) {
+	return make_key(flow_mod.table_id(), flow_mod.priority(), flow_mod.match());
+}
+
+std::string FlowTable::make_key(
+		uint8_t table_id,
+		uint16_t priority,
+		fluid_msg::of13::Match match) {
+	ParsedMatch parsed_match = parse_match(match);
+
+	std::string key;
+	key.append((const char*) &table_id, sizeof(table_id));
+	key.append((const char*) &priority, sizeof(priority));
+	key.append(make_tuple_key(parsed_match));
+	key.append(make_value_key(parsed_match));
+	return key;
+}
+
+bool FlowTable::contains(fluid_msg::of13::FlowMod& flow_mod) {
+	auto table_it = tables.find(flow_mod.table_id());
+	if( table_it == tables.end() ) {
+		return false;
+	}
+
+	ParsedMatch match = parse_match(flow_mod.match());
+	auto tuple_it = table_it->second.tuples.find(make_tuple_key(match));
+	if( tuple_it == table_it->second.tuples.end() ) {
+		return false;
+	}
+
+	auto entries_it = tuple_it->second.entries.find(make_value_key(match));
+	return
+		entries_it != tuple_it->second.entries.end() &&
+		entries_it->second.count(flow_mod.priority()) > 0;
+}
+
+fluid_msg::of13::FlowMod* FlowTable::lookup(uint8_t table_id, const PacketFields& fields) {
+	auto table_it = tables.find(table_id);
+	if( table_it == tables.end() ) {
+		return nullptr;
+	}
+
+	fluid_msg::of13::FlowMod* best = nullptr;
+	for( auto& tuple_pair : table_it->second.tuples ) {
+		const std::string& tuple_key = tuple_pair.first;
+
+		// Mask the fields of the packet like the rules in this
+		// tuple, then a single lookup finds the matching rules
+		std::string value_key;
+		bool has_fields = true;
+		size_t offset   = 0;
+		while( offset < tuple_key.size() ) {
+			uint32_t header  = read_uint32((const uint8_t*) &tuple_key[offset]);
+			size_t length    = (uint8_t) tuple_key[offset+4];
+			const char* mask = &tuple_key[offset+5];
+			offset += 5+length;
+
+			auto field_it = fields.find(header);
+			if( field_it == fields.end() || field_it->second.size() != length ) {
+				has_fields = false;
+				break;
+			}
+			for( size_t i=0; i<length; ++i ) {
+				value_key.push_back(field_it->second[i] & mask[i]);
+			}
+		}
+		if( !has_fields ) continue;
+
+		auto entries_it = tuple_pair.second.entries.find(value_key);
+		if( entries_it == tuple_pair.second.entries.end() ) continue;
+
+		// The priorities are ordered, the last one is the highest
+		Entry& entry = entries_it->second.rbegin()->second;
+		if( best == nullptr || entry.flow_mod.priority() > best->priority() ) {
+			best = &entry.flow_mod;
+		}
+	}
+	return best;
+}
+
+void FlowTable::for_each_overlapping(
+		fluid_msg::of13::FlowMod& flow_mod,
+		std::function<void(fluid_msg::of13::FlowMod&)> function) {
+	auto table_it = tables.find(flow_mod.table_id());
+	if( table_it == tables.end() ) {
+		return;
+	}
+
+	ParsedMatch match     = parse_match(flow_mod.match());
+	std::string tuple_key = make_tuple_key(match);
+	std::string value_key = make_value_key(match);
+
+	for( auto& tuple_pair : table_it->second.tuples ) {
+		for( auto& entries_pair : tuple_pair.second.entries ) {
+			bool same_match =
+				tuple_pair.first == tuple_key &&
+				entries_pair.first == value_key;
+			for( auto& priority_pair : entries_pair.second ) {
+				if( same_match && priority_pair.first == flow_mod.priority() ) continue;
+				if( overlaps(priority_pair.second.match, match) ) {
+					function(priority_pair.second.flow_mod);
+				}
+			}
+		}
+	}
+}
+
+bool FlowTable::add(fluid_msg::of13::FlowMod& flow_mod) {
+	ParsedMatch match = parse_match(flow_mod.match());
+	Table& table      = tables[flow_mod.table_id()];
+
+	// Rules with the same priority can't overlap, skip this
+	// check if there are no rules with this priority at all
+	if( (flow_mod.flags() & fluid_msg::of13::OFPFF_CHECK_OVERLAP) &&
+			table.priorities[flow_mod.priority()] > 0 ) {
+		for( auto& tuple_pair : table.tuples ) {
+			Tuple& tuple = tuple_pair.second;
+			auto priority_it = tuple.priorities.find(flow_mod.priority());
+			if( priority_it == tuple.priorities.end() || priority_it->second == 0 ) {
+				continue;
+			}
+
+			// Usually the rules in a tuple that overlap the new rule
+			// have a single masked value, otherwise look at them all
+			std::string value_key;
+			if( make_overlap_key(tuple_pair.first, match, value_key) ) {
+				auto entries_it = tuple.entries.find(value_key);
+				if( entries_it != tuple.entries.end() &&
+						entries_it->second.count(flow_mod.priority()) > 0 ) {
+					return false;
+				}
+				continue;
+			}
+			for( auto& entries_pair : tuple.entries ) {
+				auto entry_it = entries_pair.second.find(flow_mod.priority());
+				if( entry_it != entries_pair.second.end() &&
+						overlaps(entry_it->second.match, match) ) {
+					return false;
+				}
+			}
+		}
+	}
+
+	Tuple& tuple = table.tuples[make_tuple_key(match)];
+	auto& priority_map = tuple.entries[make_value_key(match)];
+
+	// An identical rule is replaced
+	auto entry_it = priority_map.find(flow_mod.priority());
+	if( entry_it != priority_map.end() ) {
+		priority_map.erase(entry_it);
+	}
+	else {
+		++table.priorities[flow_mod.priority()];
+		++tuple.priorities[flow_mod.priority()];
+		++tuple.size;
+		++total_size;
+	}
+
+	Entry& entry = priority_map.emplace(
+		flow_mod.priority(),
+		Entry{match, flow_mod}).first->second;
+	entry.flow_mod.command(fluid_msg::of13::OFPFC_ADD);
+	entry.flow_mod.buffer_id(OFP_NO_BUFFER);
+	entry.flow_mod.flags(flow_mod.flags() & ~fluid_msg::of13::OFPFF_CHECK_OVERLAP);
+	if( listener ) {
+		listener(entry.flow_mod, false);
+	}
+	return true;
+}
+
+size_t FlowTable::modify(fluid_msg::of13::FlowMod& flow_mod, bool strict) {
+	return for_each_match(
+		flow_mod,
+		strict,
+		false,
+		[this,&flow_mod](Entry& entry) {
+			// Only the instructions change, the cookie is a filter
+			entry.flow_mod.instructions(flow_mod.instructions());
+			if( listener ) {
+				listener(entry.flow_mod, false);
+			}
+			return false;
+		});
+}
+
+size_t FlowTable::remove(
+		fluid_msg::of13::FlowMod& flow_mod,
+		bool strict,
+		std::function<void(fluid_msg::of13::FlowMod&)> removed) {
+	return for_each_match(
+		flow_mod,
+		strict,
+		true,
+		[this,&removed](Entry& entry) {
+			if( removed ) {
+				removed(entry.flow_mod);
+			}
+			if( listener ) {
+				listener(entry.flow_mod, true);
+			}
+			return true;
+		});
+}
+
+void FlowTable::clear() {
+	if( listener ) {
+		for_each([this](fluid_msg::of13::FlowMod& flow_mod) {
+			listener(flow_mod, true);
+		});
+	}
+	tables.clear();
+	total_size = 0;
+}
+
+size_t FlowTable::size() const {
+	return total_size;
+}
+
+void FlowTable::for_each(std::function<void(fluid_msg::of13::FlowMod&)> function) {
+	for( auto& table_pair : tables ) {
+		for( auto& tuple_pair : table_pair.second.tuples ) {
+			for( auto& entries_pair : tuple_pair.second.entries ) {
+				for( auto& priority_pair : entries_pair.second ) {
+					function(priority_pair.second.flow_mod);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include <fluid/of13msg.hh>
+
+#include "packet_fields.hpp"
+
+/// A mirror of the flow tables of a virtual switch
+/**
+ * The rules are stored as the controller sent them, so before
+ * the table id's and ports are rewritten for a physical switch.
+ * This allows evaluating modify and delete requests without
+ * sending them to all physical switches, checking for overlapping
+ * rules and installing the rules again.
+ *
+ * The rules are indexed with tuple space search. Rules matching
+ * on the same fields with the same masks are in the same tuple,
+ * within a tuple rules are found by hashing the masked values.
+ * Strict lookups only need a single hash lookup, non-strict
+ * lookups only look at the tuples that are at least as specific
+ * as the request.
+ */
+class FlowTable {
+private:
+	/// A single field of a match
+	struct MatchField {
+		/// The OXM class and field, without the mask bit and length
+		uint32_t header;
+		/// The value with the mask applied
+		std::string value;
+		/// The mask, all ones if the field isn't masked
+		std::string mask;
+	};
+	/// A match as a list of fields ordered by header
+	typedef std::vector<MatchField> ParsedMatch;
+
+	/// A rule in the mirror
+	struct Entry {
+		ParsedMatch match;
+		fluid_msg::of13::FlowMod flow_mod;
+	};
+	/// All the rules with the same fields and masks
+	struct Tuple {
+		/// masked values -> priority -> rule
+		std::unordered_map<
+			std::string,
+			std::map<uint16_t,Entry>> entries;
+		/// The amount of rules in this tuple
+		size_t size;
+		/// The amount of rules per priority in this tuple
+		std::unordered_map<uint16_t,size_t> priorities;
+	};
+	/// A single flow table
+	struct Table {
+		/// The tuples by the fields and masks they match on
+		std::unordered_map<std::string,Tuple> tuples;
+		/// The amount of rules per priority, used to skip overlap checks
+		std::unordered_map<uint16_t,size_t> priorities;
+	};
+	/// The tables by their table id as the controller knows it
+	std::map<uint8_t,Table> tables;
+	/// The amount of rules in all tables
+	size_t total_size;
+	/// Called with every rule that is added, changed or removed
+	std::function<void(fluid_msg::of13::FlowMod&,bool)> listener;
+
+	/// Parse the OXM fields of a match
+	static ParsedMatch parse_match(fluid_msg::of13::Match match);
+	/// Create the key of the tuple a match belongs in
+	static std::string make_tuple_key(const ParsedMatch& match);
+	/// Create the key of a match within its tuple
+	static std::string make_value_key(const ParsedMatch& match);
+
+	/// Create the key of the rules in a tuple that overlap a match
+	/**
+	 * \return False if the tuple matches bits the match doesn't,
+	 *   the rules then can't be found with a single lookup
+	 */
+	static bool make_overlap_key(
+		const std::string& tuple_key,
+		const ParsedMatch& match,
+		std::string& value_key);
+	/// Check if a tuple key only contains rules as specific as a request
+	static bool tuple_covers(const std::string& tuple_key, const ParsedMatch& request);
+	/// Check if a rule is as specific as a request
+	static bool entry_covers(const ParsedMatch& entry, const ParsedMatch& request);
+	/// Check if a packet exists that matches both matches
+	static bool overlaps(const ParsedMatch& match_1, const ParsedMatch& match_2);
+	/// Check if a rule passes the cookie, out_port and out_group filters
+	static bool passes_filters(
+		fluid_msg::of13::FlowMod& entry,
+		fluid_msg::of13::FlowMod& request,
+		bool check_outputs);
+
+	/// Call a function with every rule a request applies to
+	/**
+	 * The function returns true if the rule should be removed.
+	 * \return The amount of rules the request applied to
+	 */
+	size_t for_each_match(
+		fluid_msg::of13::FlowMod& request,
+		bool strict,
+		bool check_outputs,
+		std::function<bool(Entry&)> function);
+
+public:
+	/// Create an empty flow table mirror
+	FlowTable();
+
+	/// Set the function called with every rule that changes
+	/**
+	 * It is called with the rule after it is added or changed, or
+	 * before it is removed. The second argument is true if the rule
+	 * is removed.
+	 */
+	void set_listener(std::function<void(fluid_msg::of13::FlowMod&,bool)> listener);
+
+	/// Create a key that identifies a rule by its table, priority and match
+	static std::string make_key(fluid_msg::of13::FlowMod& flow_mod);
+	/// Create the same key from the parts of a rule
+	/**
+	 * The fields are parsed and ordered, so switches that reorder
+	 * or normalise the fields of a match give the same key.
+	 */
+	static std::string make_key(
+		uint8_t table_id,
+		uint16_t priority,
+		fluid_msg::of13::Match match);
+
+	/// Check if a rule with the same table, priority and match exists
+	bool contains(fluid_msg::of13::FlowMod& flow_mod);
+	/// Find the rule with the highest priority that matches a packet
+	/**
+	 * A rule matching on a field the packet doesn't have never
+	 * matches, so rules on fields that can't be parsed are skipped.
+	 * \return nullptr if no rule matches
+	 */
+	fluid_msg::of13::FlowMod* lookup(uint8_t table_id, const PacketFields& fields);
+	/// Call a function with the other rules in the table that overlap a rule
+	void for_each_overlapping(
+		fluid_msg::of13::FlowMod& flow_mod,
+		std::function<void(fluid_msg::of13::FlowMod&)> function);
+	/// Add a rule, this replaces an identical rule
+	/**
+	 * \return False if the OFPFF_CHECK_OVERLAP flag is set and the
+	 *   rule overlaps another rule, the rule isn't added then
+	 */
+	bool add(fluid_msg::of13::FlowMod& flow_mod);
+	/// Change the instructions of rules
+	/**
+	 * \return The amount of rules that were changed
+	 */
+	size_t modify(fluid_msg::of13::FlowMod& flow_mod, bool strict);
+	/// Remove rules
+	/**
+	 * \param removed Called with every rule before it is removed
+	 * \return The amount of rules that were removed
+	 */
+	size_t remove(
+		fluid_msg::of13::FlowMod& flow_mod,
+		bool strict,
+		std::function<void(fluid_msg::of13::FlowMod&)> removed = nullptr);
+	/// Remove all rules
+	void clear();
+
+	/// Return the amount of rules in all tables
+	size_t size() const;
+
+	/// Call a function with every rule as an add flowmod
+	void for_each(std::function<void(fluid_msg::of13::FlowMod&)> function);
+};
@@ -4,7 +4,10 @@
 #include "physical_switch.hpp"
 #include "tag.hpp"
 
+#include <string>
 #include <iostream>
+#include <stdexcept>
+#include <algorithm>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -12,16 +15,61 @@
 #include <boost/log/trivial.hpp>
 #include <boost/make_shared.hpp>
 
+namespace {
+	/// Parse the eviction policy of the flow cache
+	FlowCachePolicy parse_flow_cache(const std::string& policy) {
+		if( policy == "none" ) {
+			return no_flow_cache;
+		}
+		else if( policy == "lru" ) {
+			return least_recently_used;
+		}
+		else if( policy == "lfu" ) {
+			return least_frequently_used;
+		}
+		throw std::runtime_error("Unknown flow_cache policy " + policy);
+	}
+}
+
 Hypervisor::Hypervisor( boost::asio::io_service& io ) :
-	signals(io, SIGINT, SIGTERM),
-	switch_acceptor(io) {
+	signals(io, SIGINT, SIGTERM, SIGUSR1, SIGHUP),
+	switch_acceptor(io),
+	use_meters(false),
+	reconcile_flows(false),
+	error_packet_in_rate(100),
+	statistics_poll_period(1000),
+	statistics_max_age(1000),
+	packet_buffer_slots(256),
+	packet_buffer_ttl(1000),
+	reconnect_grace_period(0),
+	table_capacity(0),
+	flow_cache(no_flow_cache),
+	cache_miss_rate(1000),
+	single_table_max_tables(0),
+	state_journal_sync_scheduled(false),
+	packet_in_forwarding_scheduled(false) {
 }
 
 void Hypervisor::handle_signals(
 	const boost::system::error_code& error,
 	int signal_number
 ) {
-	if( !error ) {
+	if( !error && (signal_number == SIGUSR1 || signal_number == SIGHUP) ) {
+		if( signal_number == SIGUSR1 ) {
+			log_packet_in_statistics();
+		}
+		else {
+			reload_configuration();
+		}
+
+		// Keep listening for signals
+		signals.async_wait(boost::bind(
+			&Hypervisor::handle_signals,
+			this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::signal_number));
+	}
+	else if( !error ) {
 		BOOST_LOG_TRIVIAL(info) << "Received signal " << signal_number;
 		stop();
 	}
@@ -30,6 +78,52 @@ void Hypervisor::handle_signals(
 	}
 }
 
+void Hypervisor::schedule_packet_in_forwarding() {
+	if( packet_in_forwarding_scheduled ) {
+		return;
+	}
+	packet_in_forwarding_scheduled = true;
+
+	// Forward from the event loop so reading from other
+	// connections is interleaved with forwarding PacketIns
+	switch_acceptor.get_io_service().post(
+		boost::bind(
+			&Hypervisor::forward_packet_ins,
+			this));
+}
+
+void Hypervisor::forward_packet_ins() {
+	packet_in_forwarding_scheduled = false;
+
+	// Every round each slice can forward this many packet bytes,
+	// this is large enough to always forward at least 1 packet
+	constexpr size_t packet_in_quantum = 16384;
+
+	bool packet_ins_left = false;
+	for( Slice& slice : slices ) {
+		if( slice.forward_packet_ins(packet_in_quantum) ) {
+			packet_ins_left = true;
+		}
+	}
+
+	if( packet_ins_left ) {
+		schedule_packet_in_forwarding();
+	}
+}
+
+void Hypervisor::log_packet_in_statistics() {
+	for( const Slice& slice : slices ) {
+		BOOST_LOG_TRIVIAL(info) << "Slice " << slice.get_id()
+			<< " packet_in forwarded=" << slice.get_packet_in_forwarded()
+			<< " dropped=" << slice.get_packet_in_dropped();
+
+		for( const auto& vs_pair : slice.get_virtual_switches() ) {
+			BOOST_LOG_TRIVIAL(info) << *vs_pair.second
+				<< " packet_in dropped=" << vs_pair.second->get_packet_in_dropped();
+		}
+	}
+}
+
 void Hypervisor::start_accept() {
 	boost::shared_ptr<boost::asio::ip::tcp::socket> new_socket =
 		boost::make_shared<boost::asio::ip::tcp::socket>(
@@ -48,8 +142,12 @@ void Hypervisor::handle_accept(
 		const boost::system::error_code& error,
 		boost::shared_ptr<boost::asio::ip::tcp::socket> socket) {
 	if( !error ) {
-		// Reserve a switch id
-		int id = physical_switch_id_allocator.new_id();
+		// Reserve a switch id, the id's of the switches in the state
+		// journal are kept for them until the datapath id is known
+		int id = physical_switch_id_allocator.new_id(
+			[this](int id) {
+				return is_journaled_id(StateJournal::physical_switch_binding, id);
+			});
 
 		// Add the physical switch to the list
 		physical_switches.emplace(
@@ -71,6 +169,154 @@ void Hypervisor::handle_accept(
 	}
 }
 
+void Hypervisor::record_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2) {
+	auto switch_1 = get_physical_switch(switch_id_1);
+	auto switch_2 = get_physical_switch(switch_id_2);
+	if( !state_journal.is_open() || switch_1 == nullptr || switch_2 == nullptr ) {
+		return;
+	}
+
+	state_journal.add_link(
+		StateJournal::LinkEnd(switch_1->get_features().datapath_id, port_number_1),
+		StateJournal::LinkEnd(switch_2->get_features().datapath_id, port_number_2));
+	schedule_state_journal_sync();
+}
+
+void Hypervisor::forget_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2) {
+	auto switch_1 = get_physical_switch(switch_id_1);
+	auto switch_2 = get_physical_switch(switch_id_2);
+	if( !state_journal.is_open() || switch_1 == nullptr || switch_2 == nullptr ) {
+		return;
+	}
+
+	state_journal.remove_link(
+		StateJournal::LinkEnd(switch_1->get_features().datapath_id, port_number_1),
+		StateJournal::LinkEnd(switch_2->get_features().datapath_id, port_number_2));
+	schedule_state_journal_sync();
+}
+
+std::vector<StateJournal::LinkEnd> Hypervisor::get_journaled_links(
+		uint64_t datapath_id,
+		uint32_t port_number) const {
+	return state_journal.get_links(
+		StateJournal::LinkEnd(datapath_id, port_number));
+}
+
+void Hypervisor::record_rule(
+		uint64_t datapath_id,
+		StateJournal::RuleKind kind,
+		const std::string& key,
+		fluid_msg::OFMsg& message) {
+	if( !state_journal.is_open() ) {
+		return;
+	}
+
+	state_journal.set_rule(
+		datapath_id,
+		kind,
+		key,
+		OpenflowConnection::pack_message(message));
+	schedule_state_journal_sync();
+}
+
+void Hypervisor::forget_rule(
+		uint64_t datapath_id,
+		StateJournal::RuleKind kind,
+		const std::string& key) {
+	if( !state_journal.is_open() ) {
+		return;
+	}
+
+	state_journal.remove_rule(datapath_id, kind, key);
+	schedule_state_journal_sync();
+}
+
+std::vector<std::vector<uint8_t>> Hypervisor::get_journaled_rules(
+		uint64_t datapath_id,
+		StateJournal::RuleKind kind) const {
+	return state_journal.get_rules(datapath_id, kind);
+}
+
+void Hypervisor::schedule_state_journal_sync() {
+	if( state_journal_sync_scheduled ) {
+		return;
+	}
+	state_journal_sync_scheduled = true;
+
+	// Writing to disk is started from the event loop, so many
+	// changes at once only cause a single sync
+	switch_acceptor.get_io_service().post(
+		boost::bind(
+			&Hypervisor::sync_state_journal,
+			this));
+}
+
+void Hypervisor::sync_state_journal() {
+	state_journal_sync_scheduled = false;
+	state_journal.sync();
+}
+
+int Hypervisor::get_journaled_id(
+		StateJournal::BindingKind kind,
+		uint64_t datapath_id) const {
+	return state_journal.get_binding(kind, datapath_id);
+}
+
+bool Hypervisor::is_journaled_id(StateJournal::BindingKind kind, int id) const {
+	return state_journal.is_bound(kind, id);
+}
+
+void Hypervisor::record_id(
+		StateJournal::BindingKind kind,
+		uint64_t datapath_id,
+		int id) {
+	if( !state_journal.is_open() ) {
+		return;
+	}
+
+	state_journal.set_binding(kind, datapath_id, id);
+	schedule_state_journal_sync();
+}
+
+int Hypervisor::bind_physical_switch_id(uint64_t datapath_id, int switch_id) {
+	int journaled_id = get_journaled_id(
+		StateJournal::physical_switch_binding,
+		datapath_id);
+
+	// A switch without a journaled id keeps the id it got
+	if( journaled_id == -1 ) {
+		record_id(StateJournal::physical_switch_binding, datapath_id, switch_id);
+		return switch_id;
+	}
+	if( journaled_id == switch_id ) {
+		return switch_id;
+	}
+
+	// The id can still be used by an earlier connection of the
+	// same switch, then this connection keeps the id it got and
+	// the rules it installs refer to that one
+	if( !physical_switch_id_allocator.reserve_id(journaled_id) ) {
+		BOOST_LOG_TRIVIAL(warning) << "Physical switch " << switch_id
+			<< " can't take its journaled id " << journaled_id
+			<< ", it is still in use";
+		record_id(StateJournal::physical_switch_binding, datapath_id, switch_id);
+		return switch_id;
+	}
+
+	physical_switches[journaled_id] = physical_switches.at(switch_id);
+	physical_switches.erase(switch_id);
+	physical_switch_id_allocator.free_id(switch_id);
+	return journaled_id;
+}
+
 void Hypervisor::register_physical_switch(uint64_t datapath_id, int switch_id) {
 	datapath_id_to_switch_id[datapath_id] = switch_id;
 }
@@ -127,6 +373,50 @@ bool Hypervisor::get_use_meters() const {
 	return use_meters;
 }
 
+bool Hypervisor::get_reconcile_flows() const {
+	return reconcile_flows;
+}
+
+int Hypervisor::get_error_packet_in_rate() const {
+	return error_packet_in_rate;
+}
+
+int Hypervisor::get_statistics_poll_period() const {
+	return statistics_poll_period;
+}
+
+int Hypervisor::get_statistics_max_age() const {
+	return statistics_max_age;
+}
+
+int Hypervisor::get_packet_buffer_slots() const {
+	return packet_buffer_slots;
+}
+
+int Hypervisor::get_packet_buffer_ttl() const {
+	return packet_buffer_ttl;
+}
+
+int Hypervisor::get_reconnect_grace_period() const {
+	return reconnect_grace_period;
+}
+
+int Hypervisor::get_table_capacity() const {
+	return table_capacity;
+}
+
+FlowCachePolicy Hypervisor::get_flow_cache() const {
+	return flow_cache;
+}
+
+int Hypervisor::get_cache_miss_rate() const {
+	return cache_miss_rate;
+}
+
+int Hypervisor::get_single_table_max_tables() const {
+	return single_table_max_tables;
+}
+
 void Hypervisor::start() {
 	// Register the handler for signals
 	signals.async_wait(boost::bind(
@@ -198,6 +488,12 @@ void Hypervisor::calculate_routes() {
 	// Let all the virtual switches check if they should go online/down
 	for( Slice& s : slices ) s.check_online();
 
+	// Calculate the trees the virtual switches flood over, the switches
+	// in a tree need a flood index before the rules refer to it
+	for( auto& vs : virtual_switches ) vs.second->calculate_flood_tree();
+	for( auto& ps : physical_switches ) ps.second->update_flood_indices();
+	for( auto& vs : virtual_switches ) vs.second->check_flood_tree();
+
 	// Let all physical switches check if the dynamic forwarding rules need to update
 	for( auto &ps : physical_switches ) ps.second->update_dynamic_rules();
 
@@ -254,56 +550,356 @@ void Hypervisor::start_listening( int port ) {
 	switch_acceptor.listen();
 }
 
-void Hypervisor::load_configuration( std::string filename ) {
-	// Read the configuration file into memory
-	boost::property_tree::ptree config_tree;
-	boost::property_tree::json_parser::read_json( filename, config_tree );
+std::vector<SliceConfiguration> Hypervisor::parse_slices(
+		const boost::property_tree::ptree& config_tree) {
+	std::vector<SliceConfiguration> configurations =
+		parse_slice_configurations(config_tree);
 
-	// Start listening for physical switches
-	start_listening(config_tree.get<int>("switch_endpoint_port"));
+	std::vector<std::string> problems = check_tag_limits(configurations);
+	if( !problems.empty() ) {
+		throw std::runtime_error(problems.front());
+	}
 
-	// Retrieve if meters are used
-	use_meters = config_tree.get<bool>("use_meters");
+	return configurations;
+}
 
-	// Create the internal structure
-	for( const auto &slice_pair : config_tree.get_child("slices") ) {
-		auto& slice_ptree = slice_pair.second;
+void Hypervisor::apply_settings(const boost::property_tree::ptree& config_tree) {
+	error_packet_in_rate = config_tree.get<int>(
+		"error_packet_in_rate",
+		error_packet_in_rate);
+
+	// Retrieve if rules already in a switch should be taken
+	// over, this only affects switches that connect later
+	reconcile_flows = config_tree.get<bool>(
+		"reconcile_flows",
+		reconcile_flows);
+
+	// Retrieve how often statistics are polled, these
+	// values are optional in the configuration file
+	statistics_poll_period = config_tree.get<int>(
+		"statistics_poll_period",
+		statistics_poll_period);
+	statistics_max_age = config_tree.get<int>(
+		"statistics_max_age",
+		statistics_poll_period);
+
+	// Retrieve the size of the packet buffers, a size
+	// of 0 disables buffering packets in the hypervisor
+	packet_buffer_slots = config_tree.get<int>(
+		"packet_buffer_slots",
+		packet_buffer_slots);
+	packet_buffer_ttl = config_tree.get<int>(
+		"packet_buffer_ttl",
+		packet_buffer_ttl);
+
+	// Retrieve how long virtual switches keep their controller
+	// connection while a physical switch reconnects, 0 disables it
+	reconnect_grace_period = config_tree.get<int>(
+		"reconnect_grace_period",
+		reconnect_grace_period);
+
+	// Retrieve how many entries fit in a table of the physical
+	// switches, FlowMods that don't fit anymore are rejected
+	table_capacity = config_tree.get<int>(
+		"table_capacity",
+		table_capacity);
+
+	// Retrieve up to how many tables a physical switch gets the
+	// single reserved table layout, this applies to the switches
+	// that connect afterwards
+	single_table_max_tables = config_tree.get<int>(
+		"single_table_max_tables",
+		single_table_max_tables);
+
+	// Retrieve how many cache misses per second a virtual switch
+	// can send to the hypervisor, 0 removes the limit
+	cache_miss_rate = config_tree.get<int>(
+		"cache_miss_rate",
+		cache_miss_rate);
+	for( auto& virtual_switch_pair : virtual_switches ) {
+		virtual_switch_pair.second->set_cache_miss_limit(cache_miss_rate);
+	}
+}
 
-		int max_rate   = slice_ptree.get<int>("max_rate");
-		std::string ip = slice_ptree.get_child("controller").get<std::string>("ip");
-		int port       = slice_ptree.get_child("controller").get<int>("port");
-		slices.emplace_back( slices.size()+1, max_rate, ip, port, this );
+void Hypervisor::add_virtual_switch(
+		Slice& slice,
+		const VirtualSwitchConfiguration& configuration) {
+	slice.add_new_virtual_switch(
+		switch_acceptor.get_io_service(),
+		configuration.datapath_id);
 
-		Slice& slice = slices.back();
+	VirtualSwitch::pointer virtual_switch =
+		slice.get_virtual_switch_by_datapath_id(configuration.datapath_id);
 
-		for( const auto &virtual_switch_pair : slice_ptree.get_child("virtual_switches") ) {
-			auto& virtual_switch_ptree = virtual_switch_pair.second;
+	virtual_switches[virtual_switch->get_id()] = virtual_switch;
 
-			uint64_t datapath_id = virtual_switch_ptree.get<uint64_t>("datapath_id");
-			slice.add_new_virtual_switch(
-					switch_acceptor.get_io_service(),
-					datapath_id);
+	virtual_switch->set_packet_in_limit(
+		configuration.packet_in_rate,
+		configuration.packet_in_burst);
+	virtual_switch->set_cache_miss_limit(cache_miss_rate);
 
-			VirtualSwitch::pointer virtual_switch =
-				slice.get_virtual_switch_by_datapath_id(datapath_id);
+	for( const auto& port : configuration.ports ) {
+		virtual_switch->add_port(
+			port.first,
+			port.second.first,
+			port.second.second);
+	}
+}
 
-			virtual_switches[virtual_switch->get_id()] = virtual_switch;
+void Hypervisor::add_slice(const SliceConfiguration& configuration) {
+	slices.emplace_back(
+		slice_id_allocator.new_id(),
+		configuration.max_rate,
+		configuration.controller_endpoint.address().to_string(),
+		configuration.controller_endpoint.port(),
+		this);
+
+	Slice& slice = slices.back();
+	slice.set_packet_in_limit(
+		configuration.packet_in_rate,
+		configuration.packet_in_burst);
+	slice.set_auxiliary_connections(
+		configuration.auxiliary_connections);
+	slice.set_max_flows(configuration.max_flows);
+
+	// The physical switches that are already connected need
+	// the meters and port rules of this slice
+	for( auto& ps : physical_switches ) {
+		ps.second->add_slice(slice);
+	}
 
-			for( const auto &port_pair : virtual_switch_ptree.get_child("ports") ) {
-				auto& port_ptree = port_pair.second;
+	for( const auto& virtual_switch : configuration.virtual_switches ) {
+		add_virtual_switch(slice, virtual_switch);
+	}
 
-				uint32_t virtual_port         =
-					port_ptree.get<uint32_t>("virtual_port");
-				uint64_t physical_datapath_id =
-					port_ptree.get<uint64_t>("physical_datapath_id");
-				uint32_t physical_port        =
-					port_ptree.get<uint32_t>("physical_port");
+	BOOST_LOG_TRIVIAL(info) << "Added slice " << slice.get_id()
+		<< " with controller " << configuration.controller_endpoint;
+}
 
-				virtual_switch->add_port(
-					virtual_port,
-					physical_datapath_id,
-					physical_port);
-			}
+void Hypervisor::update_slice(Slice& slice, const SliceConfiguration& configuration) {
+	// Update the rates, the meters are modified in place
+	bool meters_changed =
+		slice.get_max_rate() != configuration.max_rate ||
+		slice.get_packet_in_rate() != configuration.packet_in_rate;
+	slice.set_max_rate(configuration.max_rate);
+	slice.set_packet_in_limit(
+		configuration.packet_in_rate,
+		configuration.packet_in_burst);
+	if( meters_changed ) {
+		for( auto& ps : physical_switches ) {
+			ps.second->update_slice(slice);
+		}
+	}
+	// This is used the next time the virtual switches connect
+	slice.set_auxiliary_connections(configuration.auxiliary_connections);
+	// The rules already installed stay, new rules have to fit
+	slice.set_max_flows(configuration.max_flows);
+
+	// Remove the virtual switches that are not configured anymore
+	std::vector<uint64_t> removed_datapath_ids;
+	for( const auto& vs_pair : slice.get_virtual_switches() ) {
+		auto config_it = std::find_if(
+			configuration.virtual_switches.begin(),
+			configuration.virtual_switches.end(),
+			[&vs_pair](const VirtualSwitchConfiguration& vs_config) {
+				return vs_config.datapath_id == vs_pair.first;
+			});
+		if( config_it == configuration.virtual_switches.end() ) {
+			removed_datapath_ids.push_back(vs_pair.first);
+		}
+	}
+	for( uint64_t datapath_id : removed_datapath_ids ) {
+		auto virtual_switch = slice.get_virtual_switch_by_datapath_id(datapath_id);
+		BOOST_LOG_TRIVIAL(info) << "Removing " << *virtual_switch;
+		virtual_switches.erase(virtual_switch->get_id());
+		slice.remove_virtual_switch(datapath_id);
+	}
+
+	for( const auto& vs_config : configuration.virtual_switches ) {
+		auto virtual_switch =
+			slice.get_virtual_switch_by_datapath_id(vs_config.datapath_id);
+
+		// Add the new virtual switches
+		if( virtual_switch == nullptr ) {
+			add_virtual_switch(slice, vs_config);
+			continue;
+		}
+
+		virtual_switch->set_packet_in_limit(
+			vs_config.packet_in_rate,
+			vs_config.packet_in_burst);
+
+		// Check if the ports of this switch changed
+		std::map<uint32_t,std::pair<uint64_t,uint32_t>> current_ports;
+		for( const auto& port_pair : virtual_switch->get_port_to_physical_switch() ) {
+			current_ports[port_pair.first] = std::make_pair(
+				port_pair.second,
+				virtual_switch
+					->get_port_map(port_pair.second)
+					.get_physical(port_pair.first));
+		}
+		if( current_ports == vs_config.ports ) {
+			continue;
+		}
+
+		// The controller has to learn the new ports and the rules
+		// of the removed ports have to go, so reconnect this switch.
+		// It goes online again after the routes are recalculated.
+		BOOST_LOG_TRIVIAL(info) << "Changing the ports of " << *virtual_switch;
+		virtual_switch->go_down();
+		for( const auto& port : current_ports ) {
+			virtual_switch->remove_port(port.first);
+		}
+		for( const auto& port : vs_config.ports ) {
+			virtual_switch->add_port(
+				port.first,
+				port.second.first,
+				port.second.second);
 		}
 	}
 }
+
+void Hypervisor::remove_slice(Slice& slice) {
+	BOOST_LOG_TRIVIAL(info) << "Removing slice " << slice.get_id()
+		<< " with controller " << slice.get_controller_endpoint();
+
+	// Stopping the virtual switches removes their flows and groups
+	slice.stop();
+
+	// Then the meters and port rules of the slice can go
+	for( auto& ps : physical_switches ) {
+		ps.second->remove_slice(slice);
+	}
+
+	for( const auto& vs_pair : slice.get_virtual_switches() ) {
+		virtual_switches.erase(vs_pair.second->get_id());
+	}
+	slice_id_allocator.free_id(slice.get_id());
+}
+
+void Hypervisor::apply_slices(const std::vector<SliceConfiguration>& configurations) {
+	// Remove the slices that are not configured anymore. Enabling or
+	// disabling the controller meter of a slice changes all its flows,
+	// those slices are removed and added again.
+	auto slice_it = slices.begin();
+	while( slice_it != slices.end() ) {
+		auto config_it = std::find_if(
+			configurations.begin(),
+			configurations.end(),
+			[&slice_it](const SliceConfiguration& configuration) {
+				return configuration.controller_endpoint ==
+					slice_it->get_controller_endpoint();
+			});
+
+		bool recreate =
+			config_it != configurations.end() &&
+			use_meters &&
+			(slice_it->get_packet_in_rate() > 0) != (config_it->packet_in_rate > 0);
+
+		if( config_it == configurations.end() || recreate ) {
+			remove_slice(*slice_it);
+			slice_it = slices.erase(slice_it);
+		}
+		else {
+			++slice_it;
+		}
+	}
+
+	// Add the new slices and update the existing ones
+	for( const auto& configuration : configurations ) {
+		auto existing_it = std::find_if(
+			slices.begin(),
+			slices.end(),
+			[&configuration](Slice& slice) {
+				return configuration.controller_endpoint ==
+					slice.get_controller_endpoint();
+			});
+
+		if( existing_it == slices.end() ) {
+			add_slice(configuration);
+		}
+		else {
+			update_slice(*existing_it, configuration);
+		}
+	}
+}
+
+void Hypervisor::reload_configuration() {
+	BOOST_LOG_TRIVIAL(info) << "Reloading configuration " << configuration_filename;
+
+	// Read everything before changing anything, a broken
+	// configuration file leaves the hypervisor as it was
+	boost::property_tree::ptree config_tree;
+	std::vector<SliceConfiguration> configurations;
+	try {
+		boost::property_tree::json_parser::read_json(
+			configuration_filename,
+			config_tree);
+		configurations = parse_slices(config_tree);
+
+		if( config_tree.get<bool>("use_meters") != use_meters ) {
+			BOOST_LOG_TRIVIAL(warning) <<
+				"Changing use_meters requires a restart, ignoring it";
+		}
+		if( config_tree.get<int>("switch_endpoint_port") !=
+				switch_acceptor.local_endpoint().port() ) {
+			BOOST_LOG_TRIVIAL(warning) <<
+				"Changing switch_endpoint_port requires a restart, ignoring it";
+		}
+		if( parse_flow_cache(config_tree.get<std::string>("flow_cache", "none")) != flow_cache ) {
+			BOOST_LOG_TRIVIAL(warning) <<
+				"Changing flow_cache requires a restart, ignoring it";
+		}
+	}
+	catch( const std::exception& e ) {
+		BOOST_LOG_TRIVIAL(error) << "Invalid configuration, not reloading: " << e.what();
+		return;
+	}
+
+	apply_settings(config_tree);
+	apply_slices(configurations);
+
+	// Start the new slices
+	for( Slice& s : slices ) {
+		if( !s.is_started() ) s.start();
+	}
+
+	// Let the virtual switches go online or down and update the
+	// port rules, this only touches the changed virtual switches
+	calculate_routes();
+}
+
+void Hypervisor::load_configuration( std::string filename ) {
+	// Remember the file so it can be reloaded
+	configuration_filename = filename;
+
+	// Read the configuration file into memory
+	boost::property_tree::ptree config_tree;
+	boost::property_tree::json_parser::read_json( filename, config_tree );
+
+	// Start listening for physical switches
+	start_listening(config_tree.get<int>("switch_endpoint_port"));
+
+	// Retrieve if meters are used
+	use_meters = config_tree.get<bool>("use_meters");
+
+	// Retrieve if the physical switches only get the rules that
+	// are used, the other rules are kept in the hypervisor
+	flow_cache = parse_flow_cache(
+		config_tree.get<std::string>("flow_cache", "none"));
+
+	// Restore the known links and rules from the optional state
+	// journal, this is only done at startup
+	std::string state_journal_file = config_tree.get<std::string>(
+		"state_journal", "");
+	if( !state_journal_file.empty() ) {
+		state_journal.open(
+			state_journal_file,
+			config_tree.get<size_t>("state_journal_size", 16*1024*1024));
+	}
+
+	apply_settings(config_tree);
+
+	// Create the internal structure
+	apply_slices(parse_slices(config_tree));
+}
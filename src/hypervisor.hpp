@@ -1,18 +1,29 @@
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 #include <list>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 #include "physical_switch.hpp"
 #include "id_allocator.hpp"
+#include "state_journal.hpp"
+#include "configuration.hpp"
 #include "tag.hpp"
 
 class Slice;
 
+/// How the rules are evicted from the flow cache of the physical switches
+enum FlowCachePolicy {
+	no_flow_cache,
+	least_recently_used,
+	least_frequently_used
+};
+
 /// The top-level class
 class Hypervisor {
 private:
@@ -21,12 +32,101 @@ private:
 
 	/// The slices in this hypervisor
 	std::list<Slice> slices;
+	/// The allocator for slice id's
+	/**
+	 * The highest slice id is used to tag the topology discovery
+	 * packets, so it can't be given to a slice.
+	 */
+	IdAllocator<1,VLANTag::max_slice_id-1> slice_id_allocator;
+
+	/// The file the configuration was loaded from
+	std::string configuration_filename;
+
+	/// Read the slices from a configuration file
+	/**
+	 * This throws if the configuration is invalid or doesn't fit in
+	 * the tags, nothing is changed in the hypervisor.
+	 */
+	static std::vector<SliceConfiguration> parse_slices(
+		const boost::property_tree::ptree& config_tree);
+	/// Read the optional settings from a configuration file
+	void apply_settings(const boost::property_tree::ptree& config_tree);
+	/// Make the slices match the configuration
+	/**
+	 * Slices are identified by their controller endpoint and
+	 * virtual switches by their datapath id. Only the slices and
+	 * virtual switches that changed are touched, the others keep
+	 * their controller connection and their rules.
+	 */
+	void apply_slices(const std::vector<SliceConfiguration>& configurations);
+	/// Create a new slice
+	void add_slice(const SliceConfiguration& configuration);
+	/// Apply a changed configuration to an existing slice
+	void update_slice(Slice& slice, const SliceConfiguration& configuration);
+	/// Stop a slice and remove its rules from the physical switches
+	/**
+	 * The slice still has to be erased from the list of slices.
+	 */
+	void remove_slice(Slice& slice);
+	/// Create a new virtual switch in a slice
+	void add_virtual_switch(
+		Slice& slice,
+		const VirtualSwitchConfiguration& configuration);
+	/// Reload the configuration file while running
+	void reload_configuration();
 
 	/// If meters are used in this instance
 	bool use_meters;
+	/// If the rules in connecting switches are reconciled instead of removed
+	bool reconcile_flows;
+
+	/// The maximum rate of packets hitting the error rules
+	int error_packet_in_rate;
+
+	/// The period in ms to poll statistics from the physical switches
+	int statistics_poll_period;
+	/// How old in ms cached statistics can be to answer a controller
+	int statistics_max_age;
+
+	/// The amount of packets each virtual switch can buffer
+	int packet_buffer_slots;
+	/// How long in ms buffered packets are kept
+	int packet_buffer_ttl;
+
+	/// How long in ms virtual switches stay connected without a physical switch
+	int reconnect_grace_period;
+
+	/// The amount of entries in every table of a physical switch, 0 to use the table features
+	int table_capacity;
+	/// How the rules are evicted from the flow cache, if it is used
+	FlowCachePolicy flow_cache;
+	/// The maximum rate of cache misses of every virtual switch
+	int cache_miss_rate;
+	/// Physical switches with at most this many tables only get 1 reserved table
+	int single_table_max_tables;
+
+	/// The journal of the discovered links
+	StateJournal state_journal;
+	/// If writing the state journal to disk is scheduled
+	bool state_journal_sync_scheduled;
+	/// Schedule writing the changes to the state journal to disk
+	void schedule_state_journal_sync();
+	/// Write the changes to the state journal to disk
+	void sync_state_journal();
+
+	/// If forwarding the queued PacketIns is scheduled
+	bool packet_in_forwarding_scheduled;
+	/// Forward the queued PacketIns round robin over the slices
+	void forward_packet_ins();
+	/// Log the amount of forwarded and dropped PacketIns
+	void log_packet_in_statistics();
 
 	/// The allocator for physical switch id's
-	IdAllocator<0,VLANTag::max_switch_id> physical_switch_id_allocator;
+	/**
+	 * The highest switch id marks the packets on a shared link,
+	 * so it can't be given to a switch.
+	 */
+	IdAllocator<0,SwitchVLANTag::max_switch_id-1> physical_switch_id_allocator;
 	/// The physical switches registered at this hypervisor
 	std::unordered_map<int,PhysicalSwitch::pointer> physical_switches;
 	/// A map from datapath id to switch id
@@ -69,12 +169,93 @@ public:
 
 	/// Return if this hypervisor uses meters
 	bool get_use_meters() const;
+	/// Return if the rules in connecting switches should be reconciled
+	bool get_reconcile_flows() const;
+	/// Return the maximum rate of packets hitting the error rules
+	int get_error_packet_in_rate() const;
+	/// Return the period in ms between statistics polls
+	int get_statistics_poll_period() const;
+	/// Return how old in ms cached statistics can be
+	int get_statistics_max_age() const;
+	/// Return the amount of packets each virtual switch can buffer
+	int get_packet_buffer_slots() const;
+	/// Return how long in ms buffered packets are kept
+	int get_packet_buffer_ttl() const;
+	/// Return how long in ms virtual switches wait for physical switches
+	int get_reconnect_grace_period() const;
+	/// Return the amount of entries in a physical table, 0 to use the table features
+	int get_table_capacity() const;
+	/// Return how rules are evicted from the flow cache
+	FlowCachePolicy get_flow_cache() const;
+	/// Return the maximum rate of cache misses of every virtual switch
+	int get_cache_miss_rate() const;
+	/// Return up to how many tables a physical switch only gets 1 reserved table
+	int get_single_table_max_tables() const;
 
 	/// Get the physical switches in the hypervisor
 	const std::unordered_map<int,PhysicalSwitch::pointer>& get_physical_switches() const;
 	/// Get slices
 	const std::list<Slice>& get_slices() const;
 
+	/// Schedule forwarding the PacketIns queued in the slices
+	void schedule_packet_in_forwarding();
+
+	/// Record a discovered link in the state journal
+	void record_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2);
+	/// Record that a link disappeared in the state journal
+	void forget_link(
+		int switch_id_1,
+		uint32_t port_number_1,
+		int switch_id_2,
+		uint32_t port_number_2);
+	/// Return the other ends of the links in the state journal at a port
+	std::vector<StateJournal::LinkEnd> get_journaled_links(
+		uint64_t datapath_id,
+		uint32_t port_number) const;
+	/// Record a rule of a controller in the state journal
+	/**
+	 * \param datapath_id The datapath id of the virtual switch
+	 * \param key Identifies the rule within the virtual switch
+	 */
+	void record_rule(
+		uint64_t datapath_id,
+		StateJournal::RuleKind kind,
+		const std::string& key,
+		fluid_msg::OFMsg& message);
+	/// Record that a rule of a controller was removed in the state journal
+	void forget_rule(
+		uint64_t datapath_id,
+		StateJournal::RuleKind kind,
+		const std::string& key);
+	/// Return the packed rules of a virtual switch in the state journal
+	std::vector<std::vector<uint8_t>> get_journaled_rules(
+		uint64_t datapath_id,
+		StateJournal::RuleKind kind) const;
+
+	/// Return the id a switch had in a previous run, -1 if unknown
+	int get_journaled_id(
+		StateJournal::BindingKind kind,
+		uint64_t datapath_id) const;
+	/// Return if an id is kept in the state journal for a switch
+	bool is_journaled_id(StateJournal::BindingKind kind, int id) const;
+	/// Record the id of a switch in the state journal
+	void record_id(
+		StateJournal::BindingKind kind,
+		uint64_t datapath_id,
+		int id);
+	/// Give a physical switch the id it had in a previous run
+	/**
+	 * The id of a physical switch is allocated before its datapath
+	 * id is known, this swaps it for the journaled id if that one
+	 * is free.
+	 * \return The id the physical switch has to use
+	 */
+	int bind_physical_switch_id(uint64_t datapath_id, int switch_id);
+
 	/// Register a physical switch
 	void register_physical_switch(uint64_t datapath_id,int switch_id);
 	/// Unregister a physical switch
@@ -89,5 +270,9 @@ public:
 	void print_switch_distances(std::ostream& os);
 
 	/// Load configuration from file
+	/**
+	 * Sending SIGHUP reloads this file, slices and virtual switches
+	 * can then be added, changed and removed while running.
+	 */
 	void load_configuration( std::string filename );
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <set>
+#include <vector>
 
 /// Keep track and allocate id's
 /**
@@ -41,6 +42,51 @@ public:
 		return id;
 	}
 
+	/// Allocate a new id, the reserved id's are only given out last
+	/**
+	 * \param is_reserved Returns if an id is kept for another user
+	 */
+	template<class Predicate>
+	int new_id(Predicate is_reserved) {
+		std::vector<int> skipped;
+		int id = -1;
+		while( amount_left() > 0 ) {
+			int candidate = new_id();
+			if( !is_reserved(candidate) ) {
+				id = candidate;
+				break;
+			}
+			skipped.push_back(candidate);
+		}
+		for( int skipped_id : skipped ) {
+			free_id(skipped_id);
+		}
+
+		// Take a reserved id if nothing else is left
+		if( id == -1 ) {
+			id = new_id();
+		}
+		return id;
+	}
+
+	/// Allocate a specific id
+	/**
+	 * \return False if the id is already in use
+	 */
+	bool reserve_id(int id) {
+		if( id < (int) min || id > (int) max ) {
+			return false;
+		}
+		if( id >= next ) {
+			for( int returned_id=next; returned_id<id; ++returned_id ) {
+				returned_ids.insert(returned_id);
+			}
+			next = id+1;
+			return true;
+		}
+		return returned_ids.erase(id) > 0;
+	}
+
 	/// Free a reserved id
 	void free_id(int id) {
 		returned_ids.insert(id);
@@ -1,6 +1,7 @@
 #include "openflow_connection.hpp"
 
 #include <iostream>
+#include <algorithm>
 
 #include <boost/bind.hpp>
 #include <boost/log/trivial.hpp>
@@ -8,6 +9,7 @@
 OpenflowConnection::OpenflowConnection( boost::asio::ip::tcp::socket& socket ) :
 	// Construct the socket of this connection from an existing socket
 	socket(std::move(socket)),
+	send_queue_in_flight(0),
 	echo_timer(socket.get_io_service(),boost::posix_time::milliseconds(0)),
 	echo_received(true),
 	next_xid(0) {
@@ -16,6 +18,7 @@ OpenflowConnection::OpenflowConnection( boost::asio::ip::tcp::socket& socket ) :
 OpenflowConnection::OpenflowConnection( boost::asio::io_service& io ) :
 	// Construct a new socket
 	socket(io),
+	send_queue_in_flight(0),
 	echo_timer(io,boost::posix_time::milliseconds(0)),
 	echo_received(true),
 	next_xid(0) {
@@ -45,6 +48,15 @@ void OpenflowConnection::handle_network_error(
 }
 
 void OpenflowConnection::start() {
+	// Messages that were queued when a previous connection over
+	// this socket broke would keep the send chain from starting
+	{
+		boost::lock_guard<boost::mutex> guard(send_queue_mutex);
+		send_queue.erase(
+			send_queue.begin()+send_queue_in_flight,
+			send_queue.end());
+	}
+
 	// Start listening for openflow messages
 	start_receive_message();
 
@@ -67,6 +79,11 @@ void OpenflowConnection::stop() {
 	echo_timer.cancel();
 }
 
+bool OpenflowConnection::handle_raw_packet_in(std::vector<uint8_t>& message) {
+	// By default every PacketIn is unpacked
+	return false;
+}
+
 void OpenflowConnection::start_receive_message() {
 	// Make sure the message buffer is large enough
 	if( message_buffer.size() < 8 ) message_buffer.resize(8);
@@ -213,9 +230,13 @@ void OpenflowConnection::receive_body(
 					&OpenflowConnection::handle_multipart_request_meter_features>();
 				break;
 			case fluid_msg::of13::OFPMP_TABLE_FEATURES:
-				receive_message<
-					fluid_msg::of13::MultipartRequestTableFeatures,
-					&OpenflowConnection::handle_multipart_request_table_features>();
+				{
+					// libfluid crashes on the properties, so this
+					// message is parsed by hand
+					size_t length = message_buffer[2]*256+message_buffer[3];
+					message_buffer.resize(length);
+					handle_multipart_request_table_features(message_buffer);
+				}
 				break;
 			case fluid_msg::of13::OFPMP_PORT_DESC:
 				receive_message<
@@ -299,10 +320,13 @@ void OpenflowConnection::receive_body(
 					&OpenflowConnection::handle_multipart_reply_meter_features>();
 				break;
 			case fluid_msg::of13::OFPMP_TABLE_FEATURES:
-				// This segfaults at fluid/of13/of13common.cc:1185 because prop==NULL
-				//receive_message<
-				//	fluid_msg::of13::MultipartReplyTableFeatures,
-				//	&OpenflowConnection::handle_multipart_reply_table_features>();
+				{
+					// Unpacking this segfaults at fluid/of13/of13common.cc:1185
+					// because prop==NULL, so this message is parsed by hand
+					size_t length = message_buffer[2]*256+message_buffer[3];
+					message_buffer.resize(length);
+					handle_multipart_reply_table_features(message_buffer);
+				}
 				break;
 			case fluid_msg::of13::OFPMP_PORT_DESC:
 				receive_message<
@@ -394,9 +418,17 @@ void OpenflowConnection::receive_body(
 		break;
 
 	case fluid_msg::of13::OFPT_PACKET_IN:
-		receive_message<
-			fluid_msg::of13::PacketIn,
-			&OpenflowConnection::handle_packet_in>();
+		{
+			// Give the fast path the chance to forward the message
+			// without unpacking it, it can take the buffer with it
+			size_t length = message_buffer[2]*256+message_buffer[3];
+			message_buffer.resize(length);
+			if( !handle_raw_packet_in(message_buffer) ) {
+				receive_message<
+					fluid_msg::of13::PacketIn,
+					&OpenflowConnection::handle_packet_in>();
+			}
+		}
 		break;
 
 	case fluid_msg::of13::OFPT_PACKET_OUT:
@@ -501,11 +533,40 @@ void OpenflowConnection::receive_body(
 uint32_t OpenflowConnection::send_message(fluid_msg::OFMsg& message) {
 	uint32_t xid = next_xid++;
 	message.xid(xid);
-	send_message_response(message);
+	queue_message(pack_message(message));
 	return xid;
 }
 
+uint32_t OpenflowConnection::send_raw_message(std::vector<uint8_t> message) {
+	// Write the xid in the header
+	uint32_t xid = next_xid++;
+	message[4] = (xid>>24) & 0xff;
+	message[5] = (xid>>16) & 0xff;
+	message[6] = (xid>>8)  & 0xff;
+	message[7] = xid       & 0xff;
+
+	queue_message(std::move(message));
+	return xid;
+}
+
+void OpenflowConnection::send_raw_message_response(std::vector<uint8_t> message) {
+	queue_message(std::move(message));
+}
+
+std::vector<uint8_t> OpenflowConnection::pack_message(fluid_msg::OFMsg& message) {
+	// Create the buffer from the message, copy it into a
+	// vector and free the buffer again.
+	uint8_t* buffer = message.pack();
+	std::vector<uint8_t> msg( buffer, buffer+message.length() );
+	fluid_msg::OFMsg::free_buffer( buffer );
+	return msg;
+}
+
 void OpenflowConnection::send_message_response(fluid_msg::OFMsg& message) {
+	queue_message(pack_message(message));
+}
+
+void OpenflowConnection::queue_message(std::vector<uint8_t>&& message) {
 	// Get the lock for the message queue
 	boost::lock_guard<boost::mutex> guard(send_queue_mutex);
 
@@ -515,15 +576,8 @@ void OpenflowConnection::send_message_response(fluid_msg::OFMsg& message) {
 	// being send there will be a message in the queue.
 	bool startup_send_chain = (send_queue.size()==0);
 
-	// Create the buffer from the message, copy it into a
-	// vector and free the buffer again.
-	uint8_t* buffer = message.pack();
-	std::vector<uint8_t> msg( message.length() );
-	for( size_t i=0; i<msg.size(); ++i ) msg[i]=buffer[i];
-	fluid_msg::OFMsg::free_buffer( buffer );
-
 	// Add the message to the queue
-	send_queue.push( std::move(msg) );
+	send_queue.push_back( std::move(message) );
 
 	// Startup the send chain if needed
 	if( startup_send_chain ) send_message_queue_head();
@@ -540,17 +594,44 @@ void OpenflowConnection::send_error_response(uint16_t err_type, uint16_t code, f
 	send_message_response(error_message);
 }
 
+void OpenflowConnection::send_error_response(uint16_t err_type, uint16_t code, const std::vector<uint8_t>& message) {
+	// The error contains at least 64 bytes of the failed message
+	constexpr size_t max_error_data = 64;
+
+	uint32_t xid = (message[4]<<24) | (message[5]<<16) | (message[6]<<8) | message[7];
+	fluid_msg::of13::Error error_message(
+			xid,
+			err_type,
+			code,
+			const_cast<uint8_t*>(&message[0]),
+			std::min(message.size(), max_error_data)
+		);
+	send_message_response(error_message);
+}
+
 void OpenflowConnection::send_message_queue_head() {
 	BOOST_LOG_TRIVIAL(trace) << *this << " sending message, current queue length: " << send_queue.size();
 
+	// Don't let a single write grow without bound
+	constexpr size_t max_write_size = 65536;
+
 	// The function calling this function should own the
-	// message_queue_mutex. Send the entirety of the message
+	// message_queue_mutex. Send the entirety of the messages
 	// in the front of the queue. Pointer and references
 	// to elements of the queue should stay valid while
-	// pushing and popping elements..
+	// pushing and popping elements at the ends.
+	std::vector<boost::asio::const_buffer> buffers;
+	size_t write_size = 0;
+	for( const auto& message : send_queue ) {
+		if( !buffers.empty() && write_size+message.size() > max_write_size ) break;
+		buffers.push_back(boost::asio::buffer(message));
+		write_size += message.size();
+	}
+	send_queue_in_flight = buffers.size();
+
 	boost::asio::async_write(
 		socket,
-		boost::asio::buffer(send_queue.front()),
+		buffers,
 		boost::bind(
 			&OpenflowConnection::handle_send_message,
 			shared_from_this(),
@@ -564,8 +645,11 @@ void OpenflowConnection::handle_send_message(
 	// Get the lock for the message queue
 	boost::lock_guard<boost::mutex> guard(send_queue_mutex);
 
-	// Remove the element of the queue that was just sent
-	send_queue.pop();
+	// Remove the elements of the queue that were just sent
+	send_queue.erase(
+		send_queue.begin(),
+		send_queue.begin()+send_queue_in_flight);
+	send_queue_in_flight = 0;
 
 	if( !error ) {
 		// If there are more elements in the queue to send,
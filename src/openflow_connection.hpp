@@ -1,7 +1,7 @@
 #pragma once
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <string>
 
 #include <boost/asio.hpp>
@@ -38,11 +38,19 @@ private:
 	boost::mutex send_queue_mutex;
 	/// The queue of messages that need to be send
 	/**
-	 * The element at the front is the message currently
+	 * The elements at the front are the messages currently
 	 * being send.
 	 */
-	std::queue<std::vector<uint8_t>> send_queue;
-	/// Send a message over this connection
+	std::deque<std::vector<uint8_t>> send_queue;
+	/// The amount of messages at the front of the queue being send
+	size_t send_queue_in_flight;
+	/// Add a packed message to the send queue
+	void queue_message(std::vector<uint8_t>&& message);
+	/// Send the messages in the queue over this connection
+	/**
+	 * Multiple queued messages are written at once, this keeps
+	 * the amount of writes low when many rules are installed.
+	 */
 	void send_message_queue_head();
 	/// Handle a send message
 	void handle_send_message(const boost::system::error_code& error, std::size_t bytes_transferred);
@@ -83,6 +91,14 @@ protected:
 	virtual void handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message) = 0;
 	virtual void handle_barrier_reply  (fluid_msg::of13::BarrierReply& barrier_reply_message) = 0;
 
+	/// Handle a PacketIn before it is unpacked
+	/**
+	 * This allows forwarding a PacketIn without unpacking it. If
+	 * this returns true the message was handled and the message
+	 * can have been moved away, otherwise the message is unpacked
+	 * and passed to handle_packet_in.
+	 */
+	virtual bool handle_raw_packet_in(std::vector<uint8_t>& message);
 	virtual void handle_packet_in (fluid_msg::of13::PacketIn& packet_in_message) = 0;
 	virtual void handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message) = 0;
 
@@ -107,7 +123,12 @@ protected:
 	virtual void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message) = 0;
 	virtual void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message) = 0;
 	virtual void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message) = 0;
+	/// Handle a table features request as it came over the wire
+	/**
+	 * libfluid crashes on the properties of table features messages,
+	 * so these are handed over without unpacking them.
+	 */
+	virtual void handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message) = 0;
 	virtual void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message) = 0;
 	virtual void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message) = 0;
 	virtual void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message) = 0;
@@ -122,7 +143,8 @@ protected:
 	virtual void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message) = 0;
 	virtual void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message) = 0;
 	virtual void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message) = 0;
-	virtual void handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message) = 0;
+	/// Handle a table features reply as it came over the wire
+	virtual void handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_request_message) = 0;
 	virtual void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message) = 0;
 	virtual void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message) = 0;
 
@@ -153,9 +175,26 @@ public:
 	 */
 	uint32_t send_message(fluid_msg::OFMsg& message);
 	/// Send a message over this connection without rewriting xid
-	void send_message_response(fluid_msg::OFMsg& message);
+	/**
+	 * Every response goes through this function, a connection
+	 * that answers requests received elsewhere overrides it.
+	 */
+	virtual void send_message_response(fluid_msg::OFMsg& message);
+	/// Send a packed openflow message over this connection with a correct xid
+	/**
+	 * The buffer is moved into the send queue so it isn't copied.
+	 * \return The xid given to the message
+	 */
+	uint32_t send_raw_message(std::vector<uint8_t> message);
+	/// Send a packed openflow message over this connection without rewriting xid
+	virtual void send_raw_message_response(std::vector<uint8_t> message);
 	/// Send an error message as a response
 	void send_error_response(uint16_t err_type, uint16_t code, fluid_msg::OFMsg& message);
+	/// Send an error message as a response to a packed message
+	void send_error_response(uint16_t err_type, uint16_t code, const std::vector<uint8_t>& message);
+
+	/// Pack a libfluid message into a buffer as it goes over the wire
+	static std::vector<uint8_t> pack_message(fluid_msg::OFMsg& message);
 
 	/// Print this connection to a stream
 	virtual void print_to_stream(std::ostream& os) const = 0;
@@ -0,0 +1,126 @@
+#include "packet_buffer.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+constexpr size_t PacketBuffer::max_slots;
+constexpr uint32_t PacketBuffer::no_buffer;
+
+PacketBuffer::PacketBuffer() :
+	slot_size(0),
+	ttl(boost::posix_time::milliseconds(0)) {
+}
+
+uint32_t PacketBuffer::make_buffer_id(uint16_t index) const {
+	return (uint32_t(slots[index].generation) << 16) | index;
+}
+
+void PacketBuffer::release(uint16_t index) {
+	Slot& slot = slots[index];
+	slot.used = false;
+	++slot.generation;
+	free_slots.push_back(index);
+}
+
+void PacketBuffer::expire() {
+	boost::posix_time::ptime now =
+		boost::posix_time::microsec_clock::universal_time();
+
+	while( !store_order.empty() ) {
+		uint32_t buffer_id = store_order.front();
+		uint16_t index     = buffer_id & 0xffff;
+		Slot& slot         = slots[index];
+
+		// The packet was already retrieved, the slot might
+		// even be in use again by a newer packet
+		if( !slot.used || make_buffer_id(index) != buffer_id ) {
+			store_order.pop_front();
+			continue;
+		}
+		// The oldest packet hasn't expired, so no packet has
+		if( slot.expires > now ) {
+			break;
+		}
+
+		release(index);
+		store_order.pop_front();
+	}
+}
+
+void PacketBuffer::configure(size_t num_slots, size_t slot_size, int ttl_ms) {
+	num_slots = std::min(num_slots, max_slots);
+
+	this->slot_size = slot_size;
+	this->ttl       = boost::posix_time::milliseconds(ttl_ms);
+
+	arena.assign(num_slots*slot_size, 0);
+	slots.assign(num_slots, Slot{0, false, 0, 0, boost::posix_time::ptime()});
+	clear();
+}
+
+void PacketBuffer::clear() {
+	store_order.clear();
+	free_slots.clear();
+	for( size_t i=slots.size(); i>0; --i ) {
+		if( slots[i-1].used ) {
+			slots[i-1].used = false;
+			++slots[i-1].generation;
+		}
+		// Push in reverse so the lowest slot is used first
+		free_slots.push_back(i-1);
+	}
+}
+
+size_t PacketBuffer::size() const {
+	return slots.size();
+}
+
+uint32_t PacketBuffer::store(const uint8_t* data, size_t length, uint32_t in_port) {
+	if( length > slot_size ) {
+		return no_buffer;
+	}
+
+	expire();
+	if( free_slots.empty() ) {
+		return no_buffer;
+	}
+
+	uint16_t index = free_slots.back();
+	free_slots.pop_back();
+
+	Slot& slot   = slots[index];
+	slot.used    = true;
+	slot.length  = length;
+	slot.in_port = in_port;
+	slot.expires = boost::posix_time::microsec_clock::universal_time() + ttl;
+	std::memcpy(&arena[index*slot_size], data, length);
+
+	uint32_t buffer_id = make_buffer_id(index);
+	store_order.push_back(buffer_id);
+	return buffer_id;
+}
+
+bool PacketBuffer::retrieve(
+		uint32_t buffer_id,
+		std::vector<uint8_t>& data,
+		uint32_t& in_port) {
+	expire();
+
+	uint16_t index = buffer_id & 0xffff;
+	if( index >= slots.size() ) {
+		return false;
+	}
+	Slot& slot = slots[index];
+	if( !slot.used || make_buffer_id(index) != buffer_id ) {
+		return false;
+	}
+
+	data.assign(
+		arena.begin() + index*slot_size,
+		arena.begin() + index*slot_size + slot.length);
+	in_port = slot.in_port;
+
+	// A buffered packet can only be used once
+	release(index);
+	return true;
+}
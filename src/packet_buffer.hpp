@@ -0,0 +1,90 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+/// A store for packets the controller can refer to with a buffer_id
+/**
+ * The physical switches are always asked to send the complete
+ * packet to the hypervisor, keeping track of on which physical
+ * switch a packet is buffered becomes too difficult. This
+ * class buffers packets in the hypervisor instead so the
+ * PacketIn sent to the controller can be truncated.
+ *
+ * The packets are stored in an arena of fixed-size slots. A
+ * buffer_id contains the slot index in the lower 16 bits and
+ * a generation counter in the upper 16 bits, so an id of a
+ * slot that was reused is never resolved to the wrong packet.
+ * Packets that are not used within the ttl are dropped.
+ */
+class PacketBuffer {
+private:
+	struct Slot {
+		/// Incremented every time the slot is released
+		uint16_t generation;
+		/// If this slot contains a packet
+		bool used;
+		/// The length of the packet in this slot
+		size_t length;
+		/// The port the packet was received on
+		uint32_t in_port;
+		/// When this packet should be dropped
+		boost::posix_time::ptime expires;
+	};
+
+	/// The maximum size of a single packet
+	size_t slot_size;
+	/// How long packets are kept
+	boost::posix_time::time_duration ttl;
+
+	/// The memory containing the packets of all slots
+	std::vector<uint8_t> arena;
+	/// The information of every slot
+	std::vector<Slot> slots;
+	/// The indices of the slots that are not used
+	std::vector<uint16_t> free_slots;
+	/// The buffer_ids in the order they were stored
+	/**
+	 * Since all packets have the same ttl the oldest packet
+	 * always expires first, this allows expiring packets
+	 * without scanning all slots.
+	 */
+	std::deque<uint32_t> store_order;
+
+	/// Create the buffer_id for a slot
+	uint32_t make_buffer_id(uint16_t index) const;
+	/// Make a slot available again
+	void release(uint16_t index);
+	/// Release all slots with an expired packet
+	void expire();
+public:
+	/// The maximum amount of slots, this keeps
+	/// buffer_ids away from OFP_NO_BUFFER
+	static constexpr size_t max_slots = 0x8000;
+	/// The buffer_id returned when a packet wasn't stored
+	static constexpr uint32_t no_buffer = 0xffffffff;
+
+	/// Create an empty packet buffer without slots
+	PacketBuffer();
+
+	/// Allocate the slots, this drops all stored packets
+	void configure(size_t num_slots, size_t slot_size, int ttl_ms);
+	/// Drop all stored packets
+	void clear();
+	/// Return the amount of slots in this buffer
+	size_t size() const;
+
+	/// Store a packet, returns no_buffer if the packet wasn't stored
+	uint32_t store(const uint8_t* data, size_t length, uint32_t in_port);
+	/// Retrieve and remove a packet
+	/**
+	 * Returns false if the buffer_id is unknown or expired.
+	 */
+	bool retrieve(
+		uint32_t buffer_id,
+		std::vector<uint8_t>& data,
+		uint32_t& in_port);
+};
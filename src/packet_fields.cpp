@@ -0,0 +1,174 @@
+#include "packet_fields.hpp"
+
+#include <fluid/of13msg.hh>
+
+namespace {
+	constexpr uint16_t ether_type_vlan = 0x8100;
+	constexpr uint16_t ether_type_qinq = 0x88a8;
+	constexpr uint16_t ether_type_ipv4 = 0x0800;
+	constexpr uint16_t ether_type_ipv6 = 0x86dd;
+	constexpr uint16_t ether_type_arp  = 0x0806;
+
+	constexpr uint8_t ip_proto_icmpv4 = 1;
+	constexpr uint8_t ip_proto_tcp    = 6;
+	constexpr uint8_t ip_proto_udp    = 17;
+	constexpr uint8_t ip_proto_icmpv6 = 58;
+	constexpr uint8_t ip_proto_sctp   = 132;
+
+	/// The VLAN id match value of a packet with a VLAN tag
+	constexpr uint16_t vid_present = 0x1000;
+
+	/// Read a big endian 16 bit integer from a buffer
+	uint16_t read_uint16(const uint8_t* buffer) {
+		return (uint16_t(buffer[0])<<8) | buffer[1];
+	}
+
+	/// Store a field with the bytes of the packet as value
+	void set_field(PacketFields& fields, uint8_t field, const uint8_t* value, size_t length) {
+		fields[make_basic_field_header(field)].assign((const char*) value, length);
+	}
+
+	/// Store a field with a computed value
+	void set_field_value(PacketFields& fields, uint8_t field, uint32_t value, size_t length) {
+		std::string& field_value = fields[make_basic_field_header(field)];
+		field_value.clear();
+		for( size_t i=length; i>0; --i ) {
+			field_value.push_back((value>>(8*(i-1))) & 0xff);
+		}
+	}
+
+	/// Parse the transport ports or ICMP type and code
+	void parse_transport(
+			PacketFields& fields,
+			uint8_t ip_proto,
+			const uint8_t* data,
+			size_t length) {
+		uint8_t src_field, dst_field;
+		switch( ip_proto ) {
+		case ip_proto_tcp:
+			src_field = fluid_msg::of13::OFPXMT_OFB_TCP_SRC;
+			dst_field = fluid_msg::of13::OFPXMT_OFB_TCP_DST;
+			break;
+		case ip_proto_udp:
+			src_field = fluid_msg::of13::OFPXMT_OFB_UDP_SRC;
+			dst_field = fluid_msg::of13::OFPXMT_OFB_UDP_DST;
+			break;
+		case ip_proto_sctp:
+			src_field = fluid_msg::of13::OFPXMT_OFB_SCTP_SRC;
+			dst_field = fluid_msg::of13::OFPXMT_OFB_SCTP_DST;
+			break;
+		case ip_proto_icmpv4:
+			src_field = fluid_msg::of13::OFPXMT_OFB_ICMPV4_TYPE;
+			dst_field = fluid_msg::of13::OFPXMT_OFB_ICMPV4_CODE;
+			break;
+		case ip_proto_icmpv6:
+			src_field = fluid_msg::of13::OFPXMT_OFB_ICMPV6_TYPE;
+			dst_field = fluid_msg::of13::OFPXMT_OFB_ICMPV6_CODE;
+			break;
+		default:
+			return;
+		}
+
+		if( ip_proto == ip_proto_icmpv4 || ip_proto == ip_proto_icmpv6 ) {
+			if( length < 2 ) return;
+			set_field(fields, src_field, &data[0], 1);
+			set_field(fields, dst_field, &data[1], 1);
+		}
+		else {
+			if( length < 4 ) return;
+			set_field(fields, src_field, &data[0], 2);
+			set_field(fields, dst_field, &data[2], 2);
+		}
+	}
+}
+
+uint32_t make_basic_field_header(uint8_t field) {
+	return (uint32_t(fluid_msg::of13::OFPXMC_OPENFLOW_BASIC)<<7) | field;
+}
+
+PacketFields parse_packet_fields(const uint8_t* data, size_t length) {
+	PacketFields fields;
+
+	// Ethernet header
+	if( length < 14 ) {
+		return fields;
+	}
+	set_field(fields, fluid_msg::of13::OFPXMT_OFB_ETH_DST, &data[0], 6);
+	set_field(fields, fluid_msg::of13::OFPXMT_OFB_ETH_SRC, &data[6], 6);
+	uint16_t ether_type = read_uint16(&data[12]);
+	size_t offset = 14;
+
+	// Only the outer VLAN tag can be matched on
+	if( ether_type == ether_type_vlan || ether_type == ether_type_qinq ) {
+		if( length < offset+4 ) {
+			return fields;
+		}
+		uint16_t tci = read_uint16(&data[offset]);
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_VLAN_VID, vid_present | (tci & 0x0fff), 2);
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_VLAN_PCP, tci >> 13, 1);
+		ether_type = read_uint16(&data[offset+2]);
+		offset += 4;
+	}
+	else {
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_VLAN_VID, 0, 2);
+	}
+	set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_ETH_TYPE, ether_type, 2);
+
+	const uint8_t* payload = &data[offset];
+	size_t payload_length  = length - offset;
+
+	if( ether_type == ether_type_arp ) {
+		// Only ARP for IPv4 over ethernet has the fields openflow knows
+		if( payload_length < 28 ) {
+			return fields;
+		}
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_ARP_OP,  &payload[6],  2);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_ARP_SHA, &payload[8],  6);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_ARP_SPA, &payload[14], 4);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_ARP_THA, &payload[18], 6);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_ARP_TPA, &payload[24], 4);
+	}
+	else if( ether_type == ether_type_ipv4 ) {
+		if( payload_length < 20 ) {
+			return fields;
+		}
+		size_t header_length = (payload[0] & 0x0f)*4;
+		uint8_t ip_proto     = payload[9];
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_IP_DSCP, payload[1] >> 2, 1);
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_IP_ECN,  payload[1] & 0x03, 1);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_IP_PROTO, &payload[9], 1);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_IPV4_SRC, &payload[12], 4);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_IPV4_DST, &payload[16], 4);
+
+		// Only the first fragment contains the transport header
+		bool later_fragment = (read_uint16(&payload[6]) & 0x1fff) != 0;
+		if( !later_fragment && header_length >= 20 && payload_length >= header_length ) {
+			parse_transport(
+				fields,
+				ip_proto,
+				&payload[header_length],
+				payload_length - header_length);
+		}
+	}
+	else if( ether_type == ether_type_ipv6 ) {
+		if( payload_length < 40 ) {
+			return fields;
+		}
+		uint8_t traffic_class = ((payload[0] & 0x0f) << 4) | (payload[1] >> 4);
+		uint32_t flow_label   =
+			(uint32_t(payload[1] & 0x0f)<<16) | read_uint16(&payload[2]);
+		uint8_t ip_proto      = payload[6];
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_IP_DSCP, traffic_class >> 2, 1);
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_IP_ECN,  traffic_class & 0x03, 1);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_IP_PROTO, &payload[6], 1);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_IPV6_SRC, &payload[8],  16);
+		set_field(fields, fluid_msg::of13::OFPXMT_OFB_IPV6_DST, &payload[24], 16);
+		set_field_value(fields, fluid_msg::of13::OFPXMT_OFB_IPV6_FLABEL, flow_label, 4);
+
+		// Extension headers are not walked, the next header is
+		// used as the ip protocol like the switch would without them
+		parse_transport(fields, ip_proto, &payload[40], payload_length - 40);
+	}
+
+	return fields;
+}
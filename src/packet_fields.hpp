@@ -0,0 +1,25 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <cstdint>
+
+/// The values of the match fields of a packet
+/**
+ * OXM class and field -> value as it would be in a match, the
+ * headers use the same format as the match fields in the flow
+ * table mirror. Only the fields the packet has are present.
+ */
+typedef std::map<uint32_t,std::string> PacketFields;
+
+/// Create the header of a field in the openflow basic class
+uint32_t make_basic_field_header(uint8_t field);
+
+/// Parse the match fields from the headers of a packet
+/**
+ * Ethernet, a single VLAN tag, ARP, IPv4, IPv6 without extension
+ * headers, TCP, UDP, SCTP, ICMPv4 and ICMPv6 are parsed. The
+ * pipeline fields like the in_port are not part of the packet
+ * and have to be added separately.
+ */
+PacketFields parse_packet_fields(const uint8_t* data, size_t length);
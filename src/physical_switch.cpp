@@ -5,9 +5,17 @@
 #include "slice.hpp"
 
 #include "tag.hpp"
+#include "raw_packet_in.hpp"
 
 #include <boost/log/trivial.hpp>
 
+constexpr uint32_t PhysicalSwitch::error_meter_id;
+constexpr uint32_t PhysicalSwitch::first_tenant_group_id;
+constexpr uint64_t PhysicalSwitch::cache_miss_cookie;
+constexpr uint16_t PhysicalSwitch::single_table_port_priority;
+constexpr uint16_t PhysicalSwitch::single_table_topology_priority;
+constexpr size_t   PhysicalSwitch::entries_per_tenant_flow;
+
 PhysicalSwitch::PhysicalSwitch(
 		boost::asio::ip::tcp::socket& socket,
 		int id,
@@ -15,7 +23,17 @@ PhysicalSwitch::PhysicalSwitch(
 	:
 		OpenflowConnection::OpenflowConnection(socket),
 		topology_discovery_timer(socket.get_io_service()),
+		statistics_timer(socket.get_io_service()),
+		reconcile_timer(socket.get_io_service()),
+		single_reserved_table(false),
+		table_features_pending(false),
+		table_features_xid(0),
+		features_received(false),
+		reconciling(false),
+		reconcile_features_received(false),
 		topology_discovery_port(0),
+		table_stats_polling(false),
+		table_stats_xid(0),
 		id(id),
 		hypervisor(hypervisor),
 		state(unregistered) {
@@ -31,6 +49,14 @@ const struct PhysicalSwitch::Features& PhysicalSwitch::get_features() const {
 	return features;
 }
 
+uint8_t PhysicalSwitch::get_reserved_tables() const {
+	return single_reserved_table ? 1 : 2;
+}
+
+uint8_t PhysicalSwitch::get_transit_table() const {
+	return single_reserved_table ? 0 : 1;
+}
+
 const fluid_msg::of13::GroupFeatures& PhysicalSwitch::get_group_features() const {
 	return group_features;
 }
@@ -43,6 +69,15 @@ const std::unordered_map<uint32_t,PhysicalSwitch::Port>& PhysicalSwitch::get_por
 	return ports;
 }
 
+bool PhysicalSwitch::get_port_index(uint32_t port_no, uint32_t& port_index) const {
+	auto it = port_indices.find(port_no);
+	if( it == port_indices.end() ) {
+		return false;
+	}
+	port_index = it->second;
+	return true;
+}
+
 void PhysicalSwitch::register_interest(boost::shared_ptr<VirtualSwitch> switch_pointer) {
 	BOOST_LOG_TRIVIAL(trace) << *switch_pointer << " registered interest at " << *this;
 
@@ -55,20 +90,26 @@ void PhysicalSwitch::register_interest(boost::shared_ptr<VirtualSwitch> switch_p
 		needed_port.rule_installed = false;
 		needed_port.virtual_switch = switch_pointer;
 		needed_ports[port_map_pair.second][switch_pointer->get_id()] = needed_port;
+
+		// Give the port an index in the VLAN tag if it has none yet
+		if( port_indices.count(port_map_pair.second) == 0 ) {
+			if( port_index_allocator.amount_left() == 0 ) {
+				BOOST_LOG_TRIVIAL(error) << *this << " has no port index left for port "
+					<< port_map_pair.second;
+				continue;
+			}
+			port_indices[port_map_pair.second] = port_index_allocator.new_id();
+		}
 	}
 
 	// Create the rewrite entry
-	RewriteEntry& rewrite_entry  = rewrite_map[switch_pointer->get_id()];
-	rewrite_entry.flood_group_id = group_id_allocator.new_id();
-
-	// Create the flood group create message
-	fluid_msg::of13::GroupMod group_mod;
-	group_mod.command(fluid_msg::of13::OFPGC_ADD);
-	group_mod.group_type(fluid_msg::of13::OFPGT_ALL);
-	group_mod.group_id(rewrite_entry.flood_group_id);
+	RewriteEntry& rewrite_entry   = rewrite_map[switch_pointer->get_id()];
+	rewrite_entry.flood_group_id  = make_flood_group_id(switch_pointer->get_id());
+	rewrite_entry.flood_over_tree = false;
 
 	// Loop over all virtual ports and reserve group id's to output
-	// for them
+	// for them, the ports are ordered so the id's stay the same
+	size_t port_index = 0;
 	for( const auto& virtual_physical_pair :
 			switch_pointer->get_port_to_physical_switch() ) {
 		const uint32_t& virtual_port  = virtual_physical_pair.first;
@@ -77,26 +118,27 @@ void PhysicalSwitch::register_interest(boost::shared_ptr<VirtualSwitch> switch_p
 		// been pushed to the switch, on the next call to
 		// update_dynamic_rules will the group be created.
 		OutputGroup& output_group = rewrite_entry.output_groups[virtual_port];
-		output_group.group_id     = group_id_allocator.new_id();
+		output_group.group_id     = make_output_group_id(switch_pointer->get_id(), port_index++);
 		output_group.state        = OutputGroup::State::no_rule;
-
-		// Create the bucket that forward to this virtual port
-		fluid_msg::of13::Bucket bucket;
-		bucket.weight(0);
-		bucket.watch_port(fluid_msg::of13::OFPP_ANY);
-		bucket.watch_group(fluid_msg::of13::OFPG_ANY);
-		fluid_msg::ActionSet action_set;
-		action_set.add_action(
-			new fluid_msg::of13::GroupAction(output_group.group_id));
-		bucket.actions(action_set);
-		group_mod.add_bucket(bucket);
+		output_group.foreign_switch_id  = -1;
+		output_group.foreign_port_index = 0;
 	}
 
-	// Send the group create message
-	send_message(group_mod);
+	// Create the flood group, it floods over the tree once
+	// the dynamic rules are updated
+	send_flood_group(
+		switch_pointer->get_id(),
+		rewrite_entry,
+		group_create_command(rewrite_entry.flood_group_id));
 }
 
 void PhysicalSwitch::remove_interest(boost::shared_ptr<VirtualSwitch> switch_pointer) {
+	// A virtual switch that never connected to its controller
+	// didn't register its interest
+	if( rewrite_map.find(switch_pointer->get_id()) == rewrite_map.end() ) {
+		return;
+	}
+
 	BOOST_LOG_TRIVIAL(trace) << *switch_pointer << " removed interest at " << *this;
 
 	// Remove the needed ports
@@ -106,35 +148,109 @@ void PhysicalSwitch::remove_interest(boost::shared_ptr<VirtualSwitch> switch_poi
 		needed_ports.at(port_map_pair.second).erase(switch_pointer->get_id());
 		if( needed_ports.at(port_map_pair.second).size() == 0 ) {
 			needed_ports.erase(port_map_pair.second);
+
+			// The rules using the index are removed when the
+			// dynamic rules are updated
+			auto index_it = port_indices.find(port_map_pair.second);
+			if( index_it != port_indices.end() ) {
+				port_index_allocator.free_id(index_it->second);
+				port_indices.erase(index_it);
+			}
 		}
 	}
 
+	// Delete the flows of the virtual switch first, they
+	// can still refer to the groups that are deleted below
+	{
+		// Every rule of the virtual switch carries its id in the
+		// cookie, so a single delete removes them from all tables
+		CookieTag cookie_tag;
+		cookie_tag.set_virtual_switch(switch_pointer->get_id());
+
+		fluid_msg::of13::FlowMod flowmod;
+		flowmod.command(fluid_msg::of13::OFPFC_DELETE);
+		flowmod.table_id(fluid_msg::of13::OFPTT_ALL);
+		flowmod.out_port(fluid_msg::of13::OFPP_ANY);
+		flowmod.out_group(fluid_msg::of13::OFPG_ANY);
+		flowmod.cookie(cookie_tag.get_cookie());
+		flowmod.cookie_mask(cookie_tag.get_cookie_mask());
+		flowmod.buffer_id(OFP_NO_BUFFER);
+		send_message(flowmod);
+	}
+	if( hypervisor->get_flow_cache() != no_flow_cache ) {
+		send_cache_miss_rule(switch_pointer->get_id(), fluid_msg::of13::OFPFC_DELETE_STRICT);
+	}
+	forget_tenant_flows(switch_pointer->get_id());
+
 	// Retrieve the rewrite_entry
 	RewriteEntry& rewrite_entry = rewrite_map.at(switch_pointer->get_id());
-	// TODO Delete flood group and return id
 
-	// Loop over all virtual ports and reserve group id's to output
-	// for them
-	for( const auto& virtual_physical_pair :
-			switch_pointer->get_port_to_physical_switch() ) {
-		const uint32_t& virtual_port  = virtual_physical_pair.first;
-
-		// TODO Delete output group id's and return id's, clear output_groups
+	// The groups created by the controller can refer to the
+	// flood and output groups, so delete them first
+	for( const auto& group_id_pair :
+			rewrite_entry.group_id_map.get_virtual_to_physical() ) {
+		delete_group(group_id_pair.second);
+		group_id_allocator.free_id(group_id_pair.second);
+	}
+	// The flood group refers to the flood tree group, which
+	// refers to the output groups
+	delete_group(rewrite_entry.flood_group_id);
+	remove_flood_tree_entry(switch_pointer->get_id());
+	for( const auto& output_group_pair : rewrite_entry.output_groups ) {
+		const OutputGroup& output_group = output_group_pair.second;
+
+		// Groups without a rule were never created in the switch
+		if( output_group.state != OutputGroup::State::no_rule ) {
+			delete_group(output_group.group_id);
+		}
 	}
 
 	rewrite_map.erase(switch_pointer->get_id());
+}
+
+uint32_t PhysicalSwitch::make_flood_group_id(int virtual_switch_id) {
+	return uint32_t(virtual_switch_id) << 16;
+}
 
-	// TODO Delete the used group id's and return id's
+uint32_t PhysicalSwitch::make_output_group_id(int virtual_switch_id, size_t port_index) {
+	// The lower 16 bits of the flood group id are 0
+	return (uint32_t(virtual_switch_id) << 16) | uint32_t(port_index+1);
+}
 
-	// TODO Delete the pushed flowmods
+uint32_t PhysicalSwitch::make_flood_tree_group_id(int virtual_switch_id) {
+	return (uint32_t(virtual_switch_id) << 16) | 0xffff;
 }
 
-void PhysicalSwitch::send_request_message(
+uint32_t PhysicalSwitch::make_switch_group_id(int physical_switch_id) {
+	// Group id 0 is the controller group
+	return uint32_t(physical_switch_id) + 1;
+}
+
+void PhysicalSwitch::delete_group(uint32_t group_id) {
+	fluid_msg::of13::GroupMod group_mod;
+	group_mod.command(fluid_msg::of13::OFPGC_DELETE);
+	group_mod.group_type(fluid_msg::of13::OFPGT_ALL);
+	group_mod.group_id(group_id);
+	send_message(group_mod);
+}
+
+uint16_t PhysicalSwitch::group_create_command(uint32_t group_id) {
+	// Take over a group left behind by a previous run
+	if( existing_groups.erase(group_id) ) {
+		return fluid_msg::of13::OFPGC_MODIFY;
+	}
+	return fluid_msg::of13::OFPGC_ADD;
+}
+
+uint32_t PhysicalSwitch::send_request_message(
 		fluid_msg::OFMsg& message,
 		boost::weak_ptr<VirtualSwitch> virtual_switch) {
+	// Save the xid before send_message overwrites it
+	uint32_t original_xid = message.xid();
 	uint32_t xid = send_message(message);
-	xid_map[xid].original_xid   = message.xid();
+	xid_map[xid].original_xid   = original_xid;
 	xid_map[xid].virtual_switch = virtual_switch;
+	return xid;
 }
 
 void PhysicalSwitch::start() {
@@ -171,31 +287,45 @@ void PhysicalSwitch::start() {
 		send_message( port_description_message );
 	}
 
-	// Delete all the flow rules already in the switch
-	{
-		fluid_msg::of13::FlowMod flowmod;
-		flowmod.command( fluid_msg::of13::OFPFC_DELETE );
-		flowmod.table_id( fluid_msg::of13::OFPTT_ALL );
-		flowmod.cookie_mask(0);
-		flowmod.buffer_id(OFP_NO_BUFFER);
-		send_message( flowmod );
-	}
+	// Request the capabilities of the tables, the tables of the
+	// controllers are mapped when these are known
+	table_features_xid     = send_raw_message(make_table_features_request());
+	table_features_pending = true;
 
-	// Send a barrier request to make sure the delete command
-	// is executed before any new rules are added
-	{
-		fluid_msg::of13::BarrierRequest barrier;
-		send_message(barrier);
+	if( hypervisor->get_reconcile_flows() ) {
+		// Keep the rules already in the switch so the traffic keeps
+		// flowing, the rules are created when the groups and meters
+		// in the switch are known
+		start_reconcile();
 	}
+	else {
+		// Delete all the flow rules already in the switch
+		{
+			fluid_msg::of13::FlowMod flowmod;
+			flowmod.command( fluid_msg::of13::OFPFC_DELETE );
+			flowmod.table_id( fluid_msg::of13::OFPTT_ALL );
+			flowmod.cookie_mask(0);
+			flowmod.buffer_id(OFP_NO_BUFFER);
+			send_message( flowmod );
+		}
 
-	// Create the rest of the initial rules
-	create_static_rules();
-	// Create the dynamic rules
-	update_dynamic_rules();
+		// Send a barrier request to make sure the delete command
+		// is executed before any new rules are added
+		{
+			fluid_msg::of13::BarrierRequest barrier;
+			send_message(barrier);
+		}
+
+		// The rules are created when the features reply tells
+		// which layout of the tables this switch gets
+	}
 
 	// Start sending topology discovery messages
 	schedule_topology_discovery_message();
 
+	// Start polling statistics
+	schedule_statistics_poll();
+
 	BOOST_LOG_TRIVIAL(info) << *this << " started";
 }
 
@@ -203,6 +333,25 @@ void PhysicalSwitch::stop() {
 	// Stop the topology discovery
 	topology_discovery_timer.cancel();
 
+	// Stop polling statistics, the polls in progress will never be
+	// answered so the waiting callbacks get what is in the cache
+	statistics_timer.cancel();
+	reconcile_timer.cancel();
+	stop_statistics_polls();
+
+	// The barriers forwarded to this switch will never be answered
+	std::set<boost::shared_ptr<VirtualSwitch>> requesting_switches;
+	for( const auto& xid_pair : xid_map ) {
+		auto virtual_switch = xid_pair.second.virtual_switch.lock();
+		if( virtual_switch != nullptr ) {
+			requesting_switches.insert(virtual_switch);
+		}
+	}
+	xid_map.clear();
+	for( auto& virtual_switch : requesting_switches ) {
+		virtual_switch->handle_physical_switch_stopped(id);
+	}
+
 	// Stop all the discovered links
 	for( auto& port : ports ) {
 		auto link = port.second.link;
@@ -246,12 +395,14 @@ void PhysicalSwitch::handle_port( fluid_msg::of13::Port& port, uint8_t reason )
 		// Create the port structure
 		ports[port.port_no()].port_data = port;
 		ports[port.port_no()].state     = Port::State::no_rule;
+		ports[port.port_no()].slice_rules_installed = false;
+		ports[port.port_no()].slice_rules_index     = 0;
 	}
 	else {
 		if( reason == fluid_msg::of13::OFPPR_DELETE ) {
 			// Delete this port from the switch
 			if( ports.at(port.port_no()).link != nullptr ) {
-				ports.at(port.port_no()).link->stop();
+				ports.at(port.port_no()).link->remove();
 			}
 			ports.erase(port.port_no());
 			port_status_message.reason(fluid_msg::of13::OFPPR_DELETE);
@@ -272,6 +423,8 @@ void PhysicalSwitch::handle_port( fluid_msg::of13::Port& port, uint8_t reason )
 			auto& switch_pointer = switch_pointer_pair.second.virtual_switch;
 			// Skip if this virtual switch is not online
 			if( !switch_pointer->is_connected() ) continue;
+			// Skip if the controller isn't interested in this reason
+			if( !switch_pointer->wants_port_status(port_status_message.reason()) ) continue;
 
 			// Rewrite the port number
 			port.port_no(
@@ -366,6 +519,32 @@ void PhysicalSwitch::handle_error(fluid_msg::of13::Error& error_message) {
 	BOOST_LOG_TRIVIAL(info) << *this
 		<< " received error Type=" << error_message.err_type()
 		<< " Code=" << error_message.code();
+
+	// If a statistics poll failed give the waiting virtual
+	// switches the last known statistics
+	abort_statistics_poll(error_message.xid());
+
+	// A switch without group or meter support can't describe
+	// them, reconcile without that description
+	if( pending_descriptions.erase(error_message.xid()) ) {
+		check_reconcile_complete();
+	}
+
+	// A switch that can't describe its tables uses all of them
+	if( table_features_pending && error_message.xid() == table_features_xid ) {
+		table_features_pending = false;
+		table_features.clear();
+		start_using_switch();
+	}
+
+	// The FlowMods of the controllers are only sent if they fit,
+	// so the switch has fewer entries than configured
+	if( error_message.err_type() == fluid_msg::of13::OFPET_FLOW_MOD_FAILED &&
+			error_message.code() == fluid_msg::of13::OFPFMFC_TABLE_FULL ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " has a full table, it has fewer entries than its capacity";
+	}
+
 	// TODO
 }
 
@@ -381,15 +560,14 @@ void PhysicalSwitch::handle_features_reply(fluid_msg::of13::FeaturesReply& featu
 	features.n_tables     = features_reply_message.n_tables();
 	features.capabilities = features_reply_message.capabilities();
 
-	// Register this physical switch at the hypervisor
-	hypervisor->register_physical_switch(features.datapath_id,id);
-	state = registered;
+	// Take the id this switch had in the previous run, the rules
+	// it kept refer to that id
+	if( state != registered ) {
+		id = hypervisor->bind_physical_switch_id(features.datapath_id, id);
+	}
 
-	// This can potentially allow a virtual switch that only depends
-	// on this switch to come online. Execute check_online for all
-	// virtual switches.
-	//for( Slice& s : hypervisor->get_slices() ) s.check_online();
-	hypervisor->calculate_routes();
+	features_received = true;
+	start_using_switch();
 }
 
 void PhysicalSwitch::handle_config_reply(fluid_msg::of13::GetConfigReply& config_reply_message) {
@@ -402,11 +580,65 @@ void PhysicalSwitch::handle_config_reply(fluid_msg::of13::GetConfigReply& config
 void PhysicalSwitch::handle_barrier_reply(fluid_msg::of13::BarrierReply& barrier_reply_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received barrier_reply";
 
-	// TODO
-	// Figure out who requested this
-	// Mark this switch as done
-	// If all physical switches are done
-	//   send BarrierReply
+	// Figure out who requested this, barriers send by the
+	// hypervisor itself are not stored in the xid map
+	auto it = xid_map.find(barrier_reply_message.xid());
+	if( it == xid_map.end() ) {
+		BOOST_LOG_TRIVIAL(trace) << *this << " barrier_reply was for the hypervisor";
+		return;
+	}
+	RequestSource request_source = it->second;
+	xid_map.erase(it);
+
+	// Mark this switch as done at the virtual switch, the virtual
+	// switch sends the BarrierReply once all physical switches are done
+	auto virtual_switch = request_source.virtual_switch.lock();
+	if( virtual_switch != nullptr ) {
+		virtual_switch->handle_physical_barrier_reply(
+			request_source.original_xid,
+			id);
+	}
+}
+
+bool PhysicalSwitch::handle_raw_packet_in(std::vector<uint8_t>& message) {
+	// Only the PacketIns of the virtual switches take the fast path, the
+	// PacketIns of the hypervisor rules don't have the metadata set
+	RawPacketIn packet_in(message);
+	if( !packet_in.parse() ||
+			!packet_in.has_in_port() ||
+			!packet_in.has_metadata() ) {
+		return false;
+	}
+
+	// Figure out to what controller to forward this packet
+	MetadataTag metadata_tag(
+		packet_in.get_metadata(),
+		packet_in.get_metadata_mask());
+	VirtualSwitch* virtual_switch =
+		hypervisor->get_virtual_switch(metadata_tag.get_virtual_switch());
+	if( virtual_switch == nullptr ) {
+		return false;
+	}
+	// Drop the PacketIn before any work is done if the
+	// controller isn't interested in it
+	if( !virtual_switch->wants_packet_in(packet_in.get_reason()) ) {
+		return true;
+	}
+
+	// Rewrite the in port to the virtual in port
+	const auto& port_map = virtual_switch->get_port_map(features.datapath_id);
+	if( !port_map.has_physical(packet_in.get_in_port()) ) {
+		return false;
+	}
+	BOOST_LOG_TRIVIAL(trace) << *this
+		<< " received packet_in on port " << packet_in.get_in_port();
+	packet_in.set_in_port(port_map.get_virtual(packet_in.get_in_port()));
+	// Give the controller the cookie it set on the rule
+	packet_in.set_cookie(CookieTag(packet_in.get_cookie()).get_tenant_cookie());
+
+	// Hand the buffer to the virtual switch without copying it
+	virtual_switch->send_raw_packet_in(std::move(message));
+	return true;
 }
 
 void PhysicalSwitch::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_message) {
@@ -452,7 +684,9 @@ void PhysicalSwitch::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_messa
 				}
 			}
 			if( virtual_switch != nullptr && only_one_virtual_switch ) {
-				virtual_switch->send_message(packet_in_message);
+				if( virtual_switch->wants_packet_in(packet_in_message.reason()) ) {
+					virtual_switch->send_packet_in(packet_in_message);
+				}
 			}
 			else {
 				BOOST_LOG_TRIVIAL(error) << *this
@@ -473,20 +707,53 @@ void PhysicalSwitch::handle_packet_in(fluid_msg::of13::PacketIn& packet_in_messa
 		// Get the switch to send the packet in to
 		VirtualSwitch* virtual_switch =
 			hypervisor->get_virtual_switch(metadata_tag.get_virtual_switch());
+		// The packet didn't match a rule that is installed, the
+		// controller doesn't know about the flow cache
+		if( packet_in_message.cookie() == cache_miss_cookie ) {
+			if( virtual_switch != nullptr ) {
+				virtual_switch->handle_cache_miss(features.datapath_id, packet_in_message);
+			}
+			return;
+		}
+		// Skip the PacketIns the controller isn't interested in
+		if( !virtual_switch->wants_packet_in(packet_in_message.reason()) ) {
+			return;
+		}
 		// Rewrite the in port to the virtual in port
 		const auto& port_map = virtual_switch->get_port_map(features.datapath_id);
 		in_port_tlv->value(port_map.get_virtual(in_port_tlv->value()));
-		// Always remove the buffer information, it becomes difficult to keep
-		// track on what physical switch the message is actually buffered.
-		packet_in_message.buffer_id(OFP_NO_BUFFER);
-		// Send the message
-		virtual_switch->send_message(packet_in_message);
+		// Give the controller the cookie it set on the rule
+		packet_in_message.cookie(
+			CookieTag(packet_in_message.cookie()).get_tenant_cookie());
+		// Send the message, the virtual switch buffers the packet itself
+		virtual_switch->send_packet_in(packet_in_message);
 	}
 }
 
 void PhysicalSwitch::handle_flow_removed(fluid_msg::of13::FlowRemoved& flow_removed_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received flow_removed";
-	// TODO
+
+	// The cookie tells which virtual switch pushed the rule,
+	// the rules of the hypervisor itself are never reported
+	CookieTag cookie_tag(flow_removed_message.cookie());
+	if( !cookie_tag.is_virtual_switch() ) {
+		return;
+	}
+	VirtualSwitch* virtual_switch =
+		hypervisor->get_virtual_switch(cookie_tag.get_virtual_switch());
+	if( virtual_switch == nullptr || !virtual_switch->is_connected() ) {
+		return;
+	}
+
+	// Turn the rule back into the rule the controller pushed
+	bool group_copy = false;
+	if( !restore_flow_removed(flow_removed_message, group_copy, virtual_switch) ) {
+		return;
+	}
+	virtual_switch->send_flow_removed(
+		flow_removed_message,
+		group_copy,
+		features.datapath_id);
 }
 void PhysicalSwitch::handle_port_status(fluid_msg::of13::PortStatus& port_status_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received port_status";
@@ -495,6 +762,11 @@ void PhysicalSwitch::handle_port_status(fluid_msg::of13::PortStatus& port_status
 	fluid_msg::of13::Port port = port_status_message.desc();
 	handle_port( port, port_status_message.reason() );
 
+	// A new port can complete a link from the state journal
+	if( restore_links() ) {
+		hypervisor->calculate_routes();
+	}
+
 	// Potentially a new port was added, update the dynamic rules
 	update_dynamic_rules();
 }
@@ -520,7 +792,9 @@ void PhysicalSwitch::handle_multipart_reply_meter_features(fluid_msg::of13::Mult
 		if( (multipart_reply_message.meter_features().band_types()&fluid_msg::of13::OFPMBT_DROP) == 0 ) {
 			BOOST_LOG_TRIVIAL(error) << *this << " switch doesn't support drop meter band type";
 		}
-		if( multipart_reply_message.meter_features().max_meter() < hypervisor->get_slices().size() ) {
+		// Every slice can use a data plane and a controller meter
+		// and the hypervisor uses a meter for the error rules
+		if( multipart_reply_message.meter_features().max_meter() < 2*hypervisor->get_slices().size()+1 ) {
 			BOOST_LOG_TRIVIAL(error) << *this << " switch doesn't support enough meters";
 		}
 	}
@@ -536,6 +810,11 @@ void PhysicalSwitch::handle_multipart_reply_port_desc(fluid_msg::of13::Multipart
 		handle_port( port, fluid_msg::of13::OFPPR_ADD );
 	}
 
+	// The new ports can complete links from the state journal
+	if( restore_links() ) {
+		hypervisor->calculate_routes();
+	}
+
 	// Add the rules dropping/forwarding traffic about these new ports
 	update_dynamic_rules();
 }
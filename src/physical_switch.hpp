@@ -1,19 +1,26 @@
 #pragma once
 
+#include <map>
 #include <set>
+#include <string>
+#include <vector>
+#include <functional>
 #include <unordered_set>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
 
+#include "tag.hpp"
 #include "id_allocator.hpp"
 #include "bidirectional_map.hpp"
+#include "table_features.hpp"
 
 #include "openflow_connection.hpp"
 
 class DiscoveredLink;
 class VirtualSwitch;
 class Hypervisor;
+class Slice;
 
 namespace topology {
 	/// The value used for infinite for floyd-warshall, this value should
@@ -63,15 +70,6 @@ private:
 	std::unordered_map<
 		uint32_t,
 		RequestSource> xid_map;
-	/// Send a message that needs a response
-	/**
-	 * This version stores the original xid this message was
-	 * send with so the response can be forwarded to the appropriate
-	 * virtual switch.
-	 */
-	void send_request_message(
-		fluid_msg::OFMsg& message,
-		boost::weak_ptr<VirtualSwitch> virtual_switch);
 
 	/// Represents a port on this switch as it is in the network below
 	struct Port {
@@ -90,6 +88,10 @@ private:
 		boost::shared_ptr<DiscoveredLink> link;
 		/// The data concerning this port
 		fluid_msg::of13::Port port_data;
+		/// If the rules in table 1 outputting to this port are installed
+		bool slice_rules_installed;
+		/// The port index the rules in table 1 match on
+		uint32_t slice_rules_index;
 	};
 	/// The ports attached to this switch, port_id -> port
 	std::unordered_map<
@@ -110,6 +112,21 @@ private:
 		// A map from virtual switch id -> NeededPort
 		std::unordered_map<uint32_t,NeededPort>> needed_ports;
 
+	/// The index of the needed ports in the VLAN tag, port_id -> index
+	/**
+	 * The VLAN tag only has a few bits for the port, so the port
+	 * numbers of a switch are often too high or too sparse to fit
+	 * in it. Only the ports a virtual switch outputs to get a dense
+	 * index, the index stays the same while the port is needed.
+	 */
+	std::unordered_map<uint32_t,uint32_t> port_indices;
+	IdAllocator<0,VLANTag::max_port_id-1> port_index_allocator;
+	/// Find the index of a port in the VLAN tag
+	/**
+	 * \return False if the port isn't needed by a virtual switch
+	 */
+	bool get_port_index(uint32_t port_no, uint32_t& port_index) const;
+
 	/// Handle information about a port we received
 	/**
 	 * Two messages contain port information, the PortStatus
@@ -120,11 +137,40 @@ private:
 	 */
 	void handle_port(fluid_msg::of13::Port& port, uint8_t reason);
 
-	/// Allocate valid group id's
+	/// Allocate group id's for the groups of the controllers
 	/**
 	 * The group with id 0 is reserved to output to the controller.
+	 * The groups of the hypervisor itself get an id derived from the
+	 * virtual switch id below first_tenant_group_id, so these stay
+	 * the same when the hypervisor restarts.
+	 */
+	IdAllocator<0x20000000,fluid_msg::of13::OFPG_MAX> group_id_allocator;
+	/// The first group id allocated for the groups of the controllers
+	static constexpr uint32_t first_tenant_group_id = 0x20000000;
+	/// The id of the flood group of a virtual switch
+	static uint32_t make_flood_group_id(int virtual_switch_id);
+	/// The id of the output group of the n-th port of a virtual switch
+	static uint32_t make_output_group_id(int virtual_switch_id, size_t port_index);
+	/// The id of the group that floods over the spanning tree of a virtual switch
+	/**
+	 * The lower 16 bits of the output groups never reach 0xffff.
 	 */
-	IdAllocator<1,UINT32_MAX> group_id_allocator;
+	static uint32_t make_flood_tree_group_id(int virtual_switch_id);
+	/// The id of the group that adds the outer tag towards a physical switch
+	/**
+	 * These groups are only used in the double tag layout, their id's
+	 * are below the groups of the virtual switches since those start
+	 * at virtual switch id 1.
+	 */
+	static uint32_t make_switch_group_id(int physical_switch_id);
+	/// Delete a group from the switch
+	void delete_group(uint32_t group_id);
+	/// Return the GroupMod command to create a group
+	/**
+	 * This is a modify if the group was left in the switch
+	 * by a previous run of the hypervisor.
+	 */
+	uint16_t group_create_command(uint32_t group_id);
 	/// A group created to be used as output port in a virtual switch
 	struct OutputGroup {
 		/// The group id of this OutputGroup
@@ -140,11 +186,16 @@ private:
 		static const std::string state_to_string(State state);
 		/// The physical port this rule currently outputs over
 		uint32_t output_port;
+		/// The switch and port index in the tag of a switch rule
+		int foreign_switch_id;
+		uint32_t foreign_port_index;
 	};
 	/// An entry with the rewrite information for 1 virtual switch
 	struct RewriteEntry {
 		/// The group id for the flood action
 		uint32_t flood_group_id;
+		/// If the flood group refers to the flood tree group
+		bool flood_over_tree;
 		/// A bidirectional mapping between virtual group id <-> physical group id
 		bidirectional_map<uint32_t,uint32_t> group_id_map;
 		/// A map from (virtual port id) -> OutputGroup
@@ -159,6 +210,52 @@ private:
 	 * created.
 	 */
 	std::unordered_map<int, RewriteEntry> rewrite_map;
+	/// Send the flood group of a virtual switch
+	/**
+	 * The flood group outputs to every virtual port separately, or
+	 * refers to the flood tree group when flooding over the tree.
+	 */
+	void send_flood_group(
+		int virtual_switch_id,
+		const RewriteEntry& rewrite_entry,
+		uint16_t command);
+
+	/// The part of the flood tree of a virtual switch in this switch
+	struct FloodTreeEntry {
+		/// The index in the VLAN tag floods arrive with
+		uint32_t index;
+		/// The slice of the virtual switch
+		int slice_id;
+		/// If this switch is still in the tree of the virtual switch
+		bool in_tree;
+		/// If the rule and group are in the switch
+		bool installed;
+		/// The tree port -> (physical switch id, flood index) it forwards to
+		std::map<uint32_t,std::pair<int,uint32_t>> neighbors;
+		/// The output groups of the virtual ports on this switch
+		std::set<uint32_t> local_groups;
+	};
+	/// The flood trees this switch is in, virtual switch id -> FloodTreeEntry
+	/**
+	 * The flood indices come out of the port indices, a packet
+	 * tagged with a flood index is flooded further over the tree
+	 * and to the virtual ports on this switch.
+	 */
+	std::map<int,FloodTreeEntry> flood_tree_entries;
+	/// Send the rule in table 1 that floods the packets arriving over the tree
+	void send_flood_tree_rule(
+		int virtual_switch_id,
+		const FloodTreeEntry& entry,
+		uint16_t command);
+	/// Send the group flooding over the tree of a virtual switch
+	void send_flood_tree_group(
+		int virtual_switch_id,
+		const FloodTreeEntry& entry,
+		uint16_t command);
+	/// Delete the rule and group of a flood tree and free its index
+	void remove_flood_tree_entry(int virtual_switch_id);
+	/// Bring the rules and groups of the flood trees in line with the trees
+	void update_flood_tree_rules();
 
 
 	/// The timer that when fired sends a topology discovery packet
@@ -174,6 +271,22 @@ private:
 	/// Handle a packet in for topology discovery
 	void handle_topology_discovery_packet_in(
 		fluid_msg::of13::PacketIn& packet_in_message);
+	/// Create a link between a port of this switch and another switch
+	/**
+	 * \return If the link could be created
+	 */
+	bool create_link(
+		uint32_t port_number,
+		boost::shared_ptr<PhysicalSwitch> other_switch,
+		uint32_t other_port_number);
+	/// Create the links in the state journal that can be created
+	/**
+	 * A link is restored once both switches are registered and
+	 * have the ports of the link, if the link doesn't exist anymore
+	 * it times out like a discovered link.
+	 * \return If any link was restored
+	 */
+	bool restore_links();
 
 	/// The distance from this switch to other switches (switch_id -> distance)
 	std::unordered_map<int,int> dist;
@@ -182,12 +295,217 @@ private:
 	/// The currently set port to forward traffic to for each switch (switch id -> port number)
 	std::unordered_map<int,uint32_t> current_next;
 
+	/// The meter limiting the packets hitting the error rules
+	static constexpr uint32_t error_meter_id = 1;
+	/// Add, modify or delete a meter dropping packets above rate packets per second
+	void send_meter(uint32_t meter_id, int rate, uint16_t command);
+	/// Send the meters of a slice with a MeterMod command
+	void send_slice_meters(const Slice& slice, uint16_t command);
+	/// Send the rule in table 1 that outputs the packets of a slice over a port
+	void send_port_slice_rule(
+		uint32_t port_no,
+		uint32_t port_index,
+		Port::State state,
+		int slice_id,
+		uint16_t command);
+	/// Bring the rules in table 1 of a port in line with its state and index
+	/**
+	 * \param state_changed If the actions of installed rules need to change
+	 */
+	void update_port_slice_rules(uint32_t port_no, Port& port, bool state_changed);
+
 	/// Setup the flow table with the static initial rules
 	void create_static_rules();
 
+	/// If the hypervisor only reserves table 0 in this switch
+	/**
+	 * Switches with few tables merge the rules of table 1 into
+	 * table 0, the priorities keep them apart. The rules of the
+	 * ports of hosts have a higher priority than the rules
+	 * forwarding tagged packets, so only packets arriving over a
+	 * link or from the controller reach those. The tenant tables
+	 * are mapped from table 1 on in this layout.
+	 */
+	bool single_reserved_table;
+	/// The priorities that differ in the single reserved table layout
+	static constexpr uint16_t single_table_port_priority     = 40;
+	static constexpr uint16_t single_table_topology_priority = 50;
+	/// Choose the layout of the hypervisor tables from the features
+	void choose_table_layout();
+	/// Return the table with the rules that forward tagged packets
+	uint8_t get_transit_table() const;
+
+	/// The capabilities of the tables by table id
+	/**
+	 * This is empty if the switch didn't describe its tables,
+	 * all tables are assumed to fit the rules of the controllers
+	 * then.
+	 */
+	std::map<uint8_t,TableFeatures> table_features;
+	/// If the table features reply is still being received
+	bool table_features_pending;
+	/// The xid of the table features request
+	uint32_t table_features_xid;
+	/// If the features reply was received
+	bool features_received;
+	/// The physical table of every table of the controllers
+	/**
+	 * The tables of the controllers are placed in order on the
+	 * tables after the reserved tables that can hold their rules.
+	 * Those tables match on the masked metadata, have room for
+	 * entries and can be reached from the table before them.
+	 * This includes exact match tables that match the metadata
+	 * with a mask, the controllers see the capabilities of every
+	 * table so they can place their rules on the tables that fit.
+	 */
+	std::vector<uint8_t> tenant_tables;
+	/// Map the tables of the controllers onto the physical tables
+	void map_tenant_tables();
+	/// Get the capabilities of a physical table, nullptr if unknown
+	const TableFeatures* get_table_features(uint8_t table_id) const;
+	/// Start using this switch when the features of it are known
+	/**
+	 * This waits for both the features reply and the table
+	 * features, the tables have to be mapped before any rule is
+	 * installed.
+	 */
+	void start_using_switch();
+
+	/// Every rule of a controller is installed twice, once for the
+	/// packets from a port and once for the packets from a group
+	static constexpr size_t entries_per_tenant_flow = 2;
+
+	/// If the rules already in the switch are being reconciled
+	/**
+	 * Instead of deleting all rules when the switch connects, the
+	 * hypervisor first learns which groups and meters exist, then
+	 * installs its rules over the existing ones and finally
+	 * removes the rules it didn't install again. This keeps the
+	 * traffic flowing when the hypervisor restarts.
+	 */
+	bool reconciling;
+	/// If the features reply was received while reconciling
+	bool reconcile_features_received;
+	/// The xids of the group and meter descriptions not yet received
+	std::set<uint32_t> pending_descriptions;
+	/// The groups found in the switch that are not claimed yet
+	/**
+	 * group id -> the ports the buckets of the group output to
+	 */
+	std::map<uint32_t,std::set<uint32_t>> existing_groups;
+	/// The meters found in the switch that are not claimed yet
+	std::set<uint32_t> existing_meters;
+	/// Check if an output group left behind by the previous run can be kept
+	/**
+	 * The output groups are numbered by the position of the port
+	 * in the virtual switch, after the ports changed an existing
+	 * group with the number can output to another port.
+	 */
+	bool is_current_output_group(
+		uint32_t group_id,
+		const VirtualSwitch* virtual_switch) const;
+	/// The table, priority and match of the rules of the hypervisor
+	std::set<std::string> hypervisor_flows;
+	/// The timer that delays removing the rules that are left over
+	boost::asio::deadline_timer reconcile_timer;
+	/// Request the groups and meters in the switch
+	void start_reconcile();
+	/// Finish reconciling when all descriptions are received
+	void check_reconcile_complete();
+	/// Install the rules and remove the left over groups and meters
+	void finish_reconcile();
+	/// Request the flows after links had time to be discovered
+	void request_left_over_flows(const boost::system::error_code& error);
+	/// Delete the flows the hypervisor didn't install again
+	void delete_left_over_flows(const std::vector<fluid_msg::of13::FlowStats>& flow_stats);
+	/// Send a FlowMod for a rule in the tables of the hypervisor
+	/**
+	 * This keeps track of the rules of the hypervisor, so the
+	 * rules that are left over can be found while reconciling.
+	 */
+	void send_hypervisor_flow_mod(fluid_msg::of13::FlowMod& flowmod);
+
+	/// The statistics of one type polled from this switch
+	/**
+	 * All virtual switches are answered from the same cache
+	 * so the load on the switch doesn't depend on the amount
+	 * of controllers requesting statistics.
+	 */
+	template<class Stats>
+	struct StatisticsCache {
+		/// The statistics of the last completed poll
+		std::vector<Stats> entries;
+		/// The statistics of the poll in progress
+		std::vector<Stats> incoming;
+		/// When the last poll completed
+		boost::posix_time::ptime updated;
+		/// If a poll is in progress
+		bool polling = false;
+		/// The xid of the poll in progress
+		uint32_t xid = 0;
+		/// If a virtual switch asked for these statistics since the last poll
+		bool used = false;
+		/// The callbacks waiting for the poll in progress
+		std::vector<std::function<void(const std::vector<Stats>&)>> waiting;
+	};
+	/// The cached flow statistics of all flows on this switch
+	StatisticsCache<fluid_msg::of13::FlowStats> flow_stats_cache;
+	/// The cached port statistics of all ports on this switch
+	StatisticsCache<fluid_msg::of13::PortStats> port_stats_cache;
+	/// The timer that when fired polls the used statistics
+	boost::asio::deadline_timer statistics_timer;
+	/// Schedule the next statistics poll
+	void schedule_statistics_poll();
+	/// Poll the statistics that were used since the last poll
+	void poll_statistics(const boost::system::error_code& error);
+	/// Send a request for all flow statistics if none is in progress
+	void send_flow_stats_poll();
+	/// Send a request for all port statistics if none is in progress
+	void send_port_stats_poll();
+	/// Stop waiting for a statistics poll that failed
+	void abort_statistics_poll(uint32_t xid);
+	/// Give the callbacks waiting for a poll the cached statistics
+	/**
+	 * This is called when the switch stops, the polls in progress
+	 * are never answered then.
+	 */
+	void stop_statistics_polls();
+
+	/// The rules of the controllers, virtual switch id -> table id -> amount
+	std::unordered_map<int,std::map<uint8_t,size_t>> tenant_flows;
+	/// The rules of all controllers together, table id -> amount
+	std::map<uint8_t,size_t> tenant_table_flows;
+	/// The entries the hypervisor didn't count, table id -> amount
+	/**
+	 * These are the rules of the hypervisor and the rules left
+	 * over in the switch, they are found with the table statistics.
+	 */
+	std::map<uint8_t,size_t> uncounted_table_flows;
+	/// The rules of the controllers when the table statistics were requested
+	std::map<uint8_t,size_t> table_stats_counted;
+	/// If a table statistics request is in progress
+	bool table_stats_polling;
+	/// The xid of the table statistics request in progress
+	uint32_t table_stats_xid;
+	/// Request the table statistics to find the uncounted entries
+	void send_table_stats_request();
+	/// Forget the rules of a virtual switch that are removed
+	void forget_tenant_flows(int virtual_switch_id);
+
+	/// The cookie of the rules that send the misses of the flow cache to the hypervisor
+	static constexpr uint64_t cache_miss_cookie = 0x100000000;
+	/// Give the virtual switches the usage of their cached rules and their rules with an idle timeout
+	void update_flow_usage(const std::vector<fluid_msg::of13::FlowStats>& flow_stats);
+	/// Return if the usage of the rules is needed by a virtual switch
+	bool needs_flow_usage() const;
+
 public:
 	typedef boost::shared_ptr<PhysicalSwitch> pointer;
 
+	/// The callback types used to return cached statistics
+	typedef std::function<void(const std::vector<fluid_msg::of13::FlowStats>&)> FlowStatsCallback;
+	typedef std::function<void(const std::vector<fluid_msg::of13::PortStats>&)> PortStatsCallback;
+
 	/// The constructor
 	PhysicalSwitch(
 			boost::asio::ip::tcp::socket& socket,
@@ -207,6 +525,90 @@ public:
 	/// Get the ports on this switch
 	const std::unordered_map<uint32_t,Port>& get_ports() const;
 
+	/// Get the amount of tables the hypervisor reserves
+	/**
+	 * The tables of the controllers are mapped onto the
+	 * tables after these.
+	 */
+	uint8_t get_reserved_tables() const;
+	/// Get the amount of tables the controllers can use
+	uint8_t get_tenant_table_count() const;
+	/// Get the physical table of a table of the controllers
+	/**
+	 * A table that isn't mapped is moved to the first table
+	 * that doesn't exist, the switch rejects the rules in it.
+	 */
+	uint8_t get_physical_table(uint8_t tenant_table) const;
+	/// Get the table of the controllers of a physical table
+	/**
+	 * \return False if the physical table isn't used by the controllers
+	 */
+	bool get_tenant_table(uint8_t physical_table, uint8_t& tenant_table) const;
+	/// Get the capabilities of a table as the controllers see it
+	/**
+	 * The table ids, metadata bits and entries are those the
+	 * controllers can use, instructions the hypervisor doesn't
+	 * allow are left out.
+	 * \return False if the switch didn't describe this table
+	 */
+	bool get_tenant_table_features(uint8_t tenant_table, TableFeatures& table) const;
+
+	/// Send a message that needs a response
+	/**
+	 * This version stores the original xid this message was
+	 * send with so the response can be forwarded to the appropriate
+	 * virtual switch.
+	 * \return The xid given to the message
+	 */
+	uint32_t send_request_message(
+		fluid_msg::OFMsg& message,
+		boost::weak_ptr<VirtualSwitch> virtual_switch);
+
+	/// Get the flow statistics of all flows on this switch
+	/**
+	 * If the cached statistics are recent enough the callback is
+	 * called directly, otherwise it is called when the next poll
+	 * completes.
+	 */
+	void get_flow_stats(FlowStatsCallback callback);
+	/// Get the port statistics of all ports on this switch
+	/**
+	 * Works the same as get_flow_stats.
+	 */
+	void get_port_stats(PortStatsCallback callback);
+	/// Check if a port is used by multiple virtual switches
+	bool is_port_shared(uint32_t port_no) const;
+
+	/// Count rules of a controller added to or removed from a table
+	/**
+	 * Every rule of a controller takes 2 entries in the table,
+	 * the change is in rules of the controller.
+	 */
+	void count_tenant_flows(uint8_t table_id, int virtual_switch_id, int change);
+	/// Return the amount of entries in a table, 0 if unknown
+	/**
+	 * This is the max_entries of the table features of the table,
+	 * the table_capacity key overrides it.
+	 */
+	size_t get_table_capacity(uint8_t table_id) const;
+	/// Return if the amount of entries of the tables is known
+	bool knows_table_capacity() const;
+	/// Return how many more rules of a controller fit in this switch
+	/**
+	 * The rules have to fit in the table and the slice has to stay
+	 * within the amount of rules it can have in this switch.
+	 */
+	size_t get_room_for_tenant_flows(uint8_t table_id, const VirtualSwitch* virtual_switch) const;
+	/// Check if a new rule of a controller fits in this switch
+	bool has_room_for_tenant_flow(uint8_t table_id, const VirtualSwitch* virtual_switch) const;
+	/// Send the rule that sends the misses of the flow cache of a virtual switch to the hypervisor
+	/**
+	 * The rule has the lowest priority in the first table of the
+	 * virtual switch, it catches the packets that don't match
+	 * any of the rules that are installed.
+	 */
+	void send_cache_miss_rule(int virtual_switch_id, uint16_t command);
+
 	/// Register a virtual switch interest
 	void register_interest(boost::shared_ptr<VirtualSwitch> virtual_switch);
 	/// Remove a virtual switch interest
@@ -237,7 +639,33 @@ public:
 	void set_next(int switch_id, uint32_t port_number);
 
 	/// Update the dynamic rules and groups after the topology has changed
+	/**
+	 * delftvisor-plan predicts the amount of these rules, plan_switch
+	 * in plan.cpp has to follow changes to the rules.
+	 */
 	void update_dynamic_rules();
+	/// Give this switch a flood index for the flood trees it is in
+	/**
+	 * This is called for all switches after the flood trees are
+	 * calculated and before the dynamic rules are updated, so the
+	 * indices of the neighbours are known.
+	 */
+	void update_flood_indices();
+	/// Get the index floods of a virtual switch arrive with
+	/**
+	 * \return False if this switch isn't in the flood tree
+	 */
+	bool get_flood_index(int virtual_switch_id, uint32_t& flood_index) const;
+
+	/// Create the meters and rules of a slice added while running
+	void add_slice(const Slice& slice);
+	/// Update the meters of a slice after its rates changed
+	void update_slice(const Slice& slice);
+	/// Delete the meters and rules of a slice removed while running
+	/**
+	 * The virtual switches of the slice should already be stopped.
+	 */
+	void remove_slice(const Slice& slice);
 
 	/// Rewrite a group id for a specific virtual switch
 	uint32_t get_rewritten_group_id(
@@ -267,6 +695,45 @@ public:
 		fluid_msg::of13::Match& match,
 		const VirtualSwitch* virtual_switch);
 
+	/// Undo the rewriting of a FlowRemoved message
+	/**
+	 * Works the same as restore_flow_stats.
+	 * \return If the flow belonged to the virtual switch
+	 */
+	bool restore_flow_removed(
+		fluid_msg::of13::FlowRemoved& flow_removed,
+		bool& group_copy,
+		const VirtualSwitch* virtual_switch);
+	/// Undo the rewriting of a flow statistics entry
+	/**
+	 * Turns a flow as it exists in this physical switch back
+	 * into the flow as the virtual switch pushed it.
+	 * \param group_copy Set to true if this is the copy of the rule
+	 * that matches packets with the group bit set
+	 * \return If the flow belongs to the virtual switch
+	 */
+	bool restore_flow_stats(
+		fluid_msg::of13::FlowStats& flow_stats,
+		bool& group_copy,
+		const VirtualSwitch* virtual_switch);
+	/// Undo the rewriting of a match of a rule
+	/**
+	 * Removes the metadata tag and rewrites the in_port back to
+	 * the virtual port.
+	 * \return If the match belongs to a rule of the virtual switch
+	 */
+	bool restore_match(
+		fluid_msg::of13::Match& match,
+		bool& group_copy,
+		const VirtualSwitch* virtual_switch);
+	/// Undo the rewriting of a single action
+	/**
+	 * \return A newly allocated action as the virtual switch knows it
+	 */
+	fluid_msg::Action* restore_action(
+		fluid_msg::Action* action,
+		const VirtualSwitch* virtual_switch);
+
 	/// The message handling functions
 	void handle_error(fluid_msg::of13::Error& error_message);
 	void handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message);
@@ -279,6 +746,7 @@ public:
 	void handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message);
 	void handle_barrier_reply  (fluid_msg::of13::BarrierReply& barrier_reply_message);
 
+	bool handle_raw_packet_in(std::vector<uint8_t>& message);
 	void handle_packet_in (fluid_msg::of13::PacketIn& packet_in_message);
 	void handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message);
 
@@ -318,7 +786,7 @@ public:
 	void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message);
 	void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message);
 	void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message);
-	void handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message);
+	void handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message);
 	void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message);
 	void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message);
 	void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message);
@@ -333,7 +801,7 @@ public:
 	void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message);
 	void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message);
 	void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message);
-	void handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message);
+	void handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_request_message);
 	void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message);
 	void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message);
 };
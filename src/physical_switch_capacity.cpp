@@ -0,0 +1,219 @@
+#include "physical_switch.hpp"
+#include "virtual_switch.hpp"
+#include "hypervisor.hpp"
+#include "slice.hpp"
+
+#include "tag.hpp"
+
+#include <limits>
+#include <algorithm>
+
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// Get the amount stored for a table, 0 if there is none
+	size_t get_table_amount(const std::map<uint8_t,size_t>& amounts, uint8_t table_id) {
+		auto it = amounts.find(table_id);
+		return it == amounts.end() ? 0 : it->second;
+	}
+}
+
+void PhysicalSwitch::count_tenant_flows(uint8_t table_id, int virtual_switch_id, int change) {
+	size_t& virtual_switch_flows = tenant_flows[virtual_switch_id][table_id];
+	size_t& table_flows          = tenant_table_flows[table_id];
+
+	if( change >= 0 ) {
+		virtual_switch_flows += change;
+		table_flows          += change;
+	}
+	else {
+		// Never count below 0, a removed rule can be counted
+		// before the physical switch reconnected
+		size_t removed = std::min(virtual_switch_flows, (size_t) -change);
+		virtual_switch_flows -= removed;
+		table_flows          -= removed;
+	}
+}
+
+size_t PhysicalSwitch::get_table_capacity(uint8_t table_id) const {
+	int table_capacity = hypervisor->get_table_capacity();
+	if( table_capacity > 0 ) {
+		return table_capacity;
+	}
+
+	const TableFeatures* table = get_table_features(table_id);
+	return table == nullptr ? 0 : table->max_entries;
+}
+
+bool PhysicalSwitch::knows_table_capacity() const {
+	return hypervisor->get_table_capacity() > 0 || !table_features.empty();
+}
+
+size_t PhysicalSwitch::get_room_for_tenant_flows(
+		uint8_t table_id,
+		const VirtualSwitch* virtual_switch) const {
+	size_t room = std::numeric_limits<size_t>::max();
+
+	// Both entries of every rule have to fit in the table
+	size_t table_capacity = get_table_capacity(table_id);
+	if( table_capacity > 0 ) {
+		size_t used =
+			entries_per_tenant_flow*get_table_amount(tenant_table_flows, table_id) +
+			get_table_amount(uncounted_table_flows, table_id);
+		room = used < table_capacity ?
+			(table_capacity - used) / entries_per_tenant_flow :
+			0;
+	}
+
+	// The slice has to stay within its share of this switch
+	const Slice* slice = virtual_switch->get_slice();
+	if( slice->get_max_flows() > 0 ) {
+		size_t slice_flows = 0;
+		for( const auto& vs_pair : slice->get_virtual_switches() ) {
+			auto it = tenant_flows.find(vs_pair.second->get_id());
+			if( it == tenant_flows.end() ) continue;
+			for( const auto& table_pair : it->second ) {
+				slice_flows += table_pair.second;
+			}
+		}
+		size_t max_flows = slice->get_max_flows();
+		room = std::min(room, slice_flows < max_flows ? max_flows - slice_flows : 0);
+	}
+
+	return room;
+}
+
+bool PhysicalSwitch::has_room_for_tenant_flow(
+		uint8_t table_id,
+		const VirtualSwitch* virtual_switch) const {
+	if( get_room_for_tenant_flows(table_id, virtual_switch) == 0 ) {
+		BOOST_LOG_TRIVIAL(info) << *this << " has no room left in table "
+			<< (int) table_id << " for " << *virtual_switch;
+		return false;
+	}
+	return true;
+}
+
+void PhysicalSwitch::forget_tenant_flows(int virtual_switch_id) {
+	auto it = tenant_flows.find(virtual_switch_id);
+	if( it == tenant_flows.end() ) {
+		return;
+	}
+
+	for( const auto& table_pair : it->second ) {
+		size_t& table_flows = tenant_table_flows[table_pair.first];
+		table_flows -= std::min(table_flows, table_pair.second);
+	}
+	tenant_flows.erase(it);
+}
+
+void PhysicalSwitch::send_table_stats_request() {
+	if( table_stats_polling ) {
+		return;
+	}
+	table_stats_polling = true;
+
+	// The reply counts the rules sent before the request, so
+	// remember how many of those the hypervisor counted
+	table_stats_counted = tenant_table_flows;
+
+	fluid_msg::of13::MultipartRequestTable request(
+		0,  // The xid will be set by send_message
+		0); // The only flag is the more flag indicating more messages follow
+	table_stats_xid = send_message(request);
+}
+
+void PhysicalSwitch::handle_multipart_reply_table(fluid_msg::of13::MultipartReplyTable& multipart_reply_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart reply table";
+
+	if( !table_stats_polling || multipart_reply_message.xid() != table_stats_xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested table statistics";
+		return;
+	}
+
+	for( fluid_msg::of13::TableStats& table_stats : multipart_reply_message.table_stats() ) {
+		size_t counted =
+			entries_per_tenant_flow*get_table_amount(table_stats_counted, table_stats.table_id());
+		size_t active  = table_stats.active_count();
+		uncounted_table_flows[table_stats.table_id()] =
+			active > counted ? active - counted : 0;
+	}
+
+	// The last part doesn't have the more flag set
+	if( !(multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE) ) {
+		table_stats_polling = false;
+	}
+}
+
+void PhysicalSwitch::send_cache_miss_rule(int virtual_switch_id, uint16_t command) {
+	fluid_msg::of13::FlowMod flowmod;
+	flowmod.command(command);
+	flowmod.table_id(get_physical_table(0));
+	flowmod.priority(0);
+	flowmod.cookie(cache_miss_cookie);
+	flowmod.out_port(fluid_msg::of13::OFPP_ANY);
+	flowmod.out_group(fluid_msg::of13::OFPG_ANY);
+	flowmod.buffer_id(OFP_NO_BUFFER);
+
+	// Match both copies of the rules of the virtual switch
+	MetadataTag metadata_tag;
+	metadata_tag.set_virtual_switch(virtual_switch_id);
+	metadata_tag.add_to_match(flowmod);
+
+	// The misses count as PacketIns of the slice, so a flood of
+	// new flows is limited in the switch itself
+	const VirtualSwitch* virtual_switch = hypervisor->get_virtual_switch(virtual_switch_id);
+	if( hypervisor->get_use_meters() &&
+			virtual_switch != nullptr &&
+			virtual_switch->get_slice()->get_packet_in_rate() > 0 ) {
+		flowmod.add_instruction(
+			new fluid_msg::of13::Meter(
+				virtual_switch->get_slice()->get_controller_meter_id()));
+	}
+
+	// The hypervisor needs the complete packet to find the rule
+	fluid_msg::of13::ApplyActions apply_actions;
+	apply_actions.add_action(
+		new fluid_msg::of13::OutputAction(
+			fluid_msg::of13::OFPP_CONTROLLER,
+			fluid_msg::of13::OFPCML_NO_BUFFER));
+	flowmod.add_instruction(apply_actions);
+
+	send_message(flowmod);
+}
+
+bool PhysicalSwitch::needs_flow_usage() const {
+	if( hypervisor->get_flow_cache() != no_flow_cache ) {
+		return true;
+	}
+
+	for( const auto& rewrite_pair : rewrite_map ) {
+		const VirtualSwitch* virtual_switch =
+			hypervisor->get_virtual_switch(rewrite_pair.first);
+		if( virtual_switch != nullptr && virtual_switch->has_idle_flows() ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void PhysicalSwitch::update_flow_usage(
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats) {
+	// The virtual switches that use this switch, also the ones
+	// without a rule left in it
+	std::set<int> virtual_switch_ids;
+	for( const auto& rewrite_pair : rewrite_map ) {
+		virtual_switch_ids.insert(rewrite_pair.first);
+	}
+
+	for( int virtual_switch_id : virtual_switch_ids ) {
+		VirtualSwitch* virtual_switch = hypervisor->get_virtual_switch(virtual_switch_id);
+		if( virtual_switch == nullptr ) continue;
+		if( hypervisor->get_flow_cache() != no_flow_cache ) {
+			virtual_switch->update_flow_cache_usage(shared_from_this(), flow_stats);
+		}
+		if( virtual_switch->has_idle_flows() ) {
+			virtual_switch->update_idle_flows(shared_from_this(), flow_stats);
+		}
+	}
+}
@@ -0,0 +1,297 @@
+#include "physical_switch.hpp"
+#include "virtual_switch.hpp"
+#include "hypervisor.hpp"
+#include "discoveredlink.hpp"
+#include "slice.hpp"
+
+#include "tag.hpp"
+
+#include <boost/log/trivial.hpp>
+
+void PhysicalSwitch::send_flood_group(
+		int virtual_switch_id,
+		const RewriteEntry& rewrite_entry,
+		uint16_t command) {
+	fluid_msg::of13::GroupMod group_mod;
+	group_mod.command(command);
+	group_mod.group_type(fluid_msg::of13::OFPGT_ALL);
+	group_mod.group_id(rewrite_entry.flood_group_id);
+
+	// The flood tree group outputs to the ports on this switch itself
+	std::vector<uint32_t> group_ids;
+	if( rewrite_entry.flood_over_tree ) {
+		group_ids.push_back(make_flood_tree_group_id(virtual_switch_id));
+	}
+	else {
+		for( const auto& output_group_pair : rewrite_entry.output_groups ) {
+			group_ids.push_back(output_group_pair.second.group_id);
+		}
+	}
+
+	for( uint32_t group_id : group_ids ) {
+		fluid_msg::of13::Bucket bucket;
+		bucket.weight(0);
+		bucket.watch_port(fluid_msg::of13::OFPP_ANY);
+		bucket.watch_group(fluid_msg::of13::OFPG_ANY);
+		fluid_msg::ActionSet action_set;
+		action_set.add_action(
+			new fluid_msg::of13::GroupAction(group_id));
+		bucket.actions(action_set);
+		group_mod.add_bucket(bucket);
+	}
+
+	send_message(group_mod);
+}
+
+void PhysicalSwitch::send_flood_tree_rule(
+		int virtual_switch_id,
+		const FloodTreeEntry& entry,
+		uint16_t command) {
+	fluid_msg::of13::FlowMod flowmod;
+	flowmod.command(command);
+	flowmod.priority(10);
+	flowmod.cookie(make_flood_tree_group_id(virtual_switch_id));
+	flowmod.table_id(get_transit_table());
+	flowmod.buffer_id(OFP_NO_BUFFER);
+
+	// The flood index is a port index no port on this switch has
+	VLANTag vlan_tag;
+	vlan_tag.set_switch(id);
+	vlan_tag.set_port(entry.index);
+	vlan_tag.set_slice(entry.slice_id);
+	vlan_tag.add_to_match(flowmod);
+
+	if( command != fluid_msg::of13::OFPFC_DELETE_STRICT ) {
+		// The buckets of the group push their own tag
+		fluid_msg::of13::ApplyActions apply_actions;
+		apply_actions.add_action(
+			new fluid_msg::of13::PopVLANAction());
+		flowmod.add_instruction(apply_actions);
+
+		fluid_msg::of13::WriteActions write_actions;
+		write_actions.add_action(
+			new fluid_msg::of13::GroupAction(
+				make_flood_tree_group_id(virtual_switch_id)));
+		flowmod.add_instruction(write_actions);
+	}
+
+	send_hypervisor_flow_mod(flowmod);
+}
+
+void PhysicalSwitch::send_flood_tree_group(
+		int virtual_switch_id,
+		const FloodTreeEntry& entry,
+		uint16_t command) {
+	fluid_msg::of13::GroupMod group_mod;
+	group_mod.command(command);
+	group_mod.group_type(fluid_msg::of13::OFPGT_ALL);
+	group_mod.group_id(make_flood_tree_group_id(virtual_switch_id));
+
+	// Copy the packet to the virtual ports on this switch
+	for( uint32_t group_id : entry.local_groups ) {
+		fluid_msg::of13::Bucket bucket;
+		bucket.weight(0);
+		bucket.watch_port(fluid_msg::of13::OFPP_ANY);
+		bucket.watch_group(fluid_msg::of13::OFPG_ANY);
+		fluid_msg::ActionSet action_set;
+		action_set.add_action(
+			new fluid_msg::of13::GroupAction(group_id));
+		bucket.actions(action_set);
+		group_mod.add_bucket(bucket);
+	}
+
+	// Copy the packet to every neighbour in the tree, the switch
+	// doesn't output a packet over the port it arrived on so the
+	// packet never goes back over the link it came from
+	for( const auto& neighbor_pair : entry.neighbors ) {
+		fluid_msg::of13::Bucket bucket;
+		bucket.weight(0);
+		bucket.watch_port(fluid_msg::of13::OFPP_ANY);
+		bucket.watch_group(fluid_msg::of13::OFPG_ANY);
+
+		fluid_msg::ActionSet action_set;
+		action_set.add_action(
+			new fluid_msg::of13::PushVLANAction(0x8100));
+		// The neighbour is next to this switch, so in the double
+		// tag layout it doesn't need the outer tag
+		VLANTag vlan_tag;
+		vlan_tag.set_switch(neighbor_pair.second.first);
+		vlan_tag.set_port(neighbor_pair.second.second);
+		vlan_tag.set_slice(entry.slice_id);
+		vlan_tag.add_to_actions(action_set);
+		action_set.add_action(
+			new fluid_msg::of13::OutputAction(
+				neighbor_pair.first,
+				fluid_msg::of13::OFPCML_NO_BUFFER));
+
+		bucket.actions(action_set);
+		group_mod.add_bucket(bucket);
+	}
+
+	send_message(group_mod);
+}
+
+void PhysicalSwitch::remove_flood_tree_entry(int virtual_switch_id) {
+	auto entry_it = flood_tree_entries.find(virtual_switch_id);
+	if( entry_it == flood_tree_entries.end() ) {
+		return;
+	}
+
+	// The rule refers to the group, so delete it first
+	if( entry_it->second.installed ) {
+		send_flood_tree_rule(
+			virtual_switch_id,
+			entry_it->second,
+			fluid_msg::of13::OFPFC_DELETE_STRICT);
+		delete_group(make_flood_tree_group_id(virtual_switch_id));
+	}
+
+	port_index_allocator.free_id(entry_it->second.index);
+	flood_tree_entries.erase(entry_it);
+}
+
+void PhysicalSwitch::update_flood_indices() {
+	for( auto& entry_pair : flood_tree_entries ) {
+		entry_pair.second.in_tree = false;
+	}
+
+	// A switch without rules can't forward floods
+	if( reconciling || state != registered ) {
+		return;
+	}
+
+	for( const Slice& slice : hypervisor->get_slices() ) {
+		for( const auto& virtual_switch_pair : slice.get_virtual_switches() ) {
+			const VirtualSwitch::pointer& virtual_switch = virtual_switch_pair.second;
+			if( virtual_switch->get_flood_tree_ports(id) == nullptr ) continue;
+
+			// The index stays the same while this switch is in the tree
+			auto entry_it = flood_tree_entries.find(virtual_switch->get_id());
+			if( entry_it != flood_tree_entries.end() ) {
+				entry_it->second.in_tree = true;
+				continue;
+			}
+
+			if( port_index_allocator.amount_left() == 0 ) {
+				BOOST_LOG_TRIVIAL(error) << *this << " has no port index left to flood "
+					<< *virtual_switch << " over a tree";
+				continue;
+			}
+
+			FloodTreeEntry& entry = flood_tree_entries[virtual_switch->get_id()];
+			entry.index     = port_index_allocator.new_id();
+			entry.slice_id  = slice.get_id();
+			entry.in_tree   = true;
+			entry.installed = false;
+		}
+	}
+}
+
+bool PhysicalSwitch::get_flood_index(int virtual_switch_id, uint32_t& flood_index) const {
+	auto entry_it = flood_tree_entries.find(virtual_switch_id);
+	if( entry_it == flood_tree_entries.end() || !entry_it->second.in_tree ) {
+		return false;
+	}
+	flood_index = entry_it->second.index;
+	return true;
+}
+
+void PhysicalSwitch::update_flood_tree_rules() {
+	// Remove the trees this switch isn't part of anymore
+	auto entry_it = flood_tree_entries.begin();
+	while( entry_it != flood_tree_entries.end() ) {
+		int virtual_switch_id = (entry_it++)->first;
+		const VirtualSwitch* virtual_switch =
+			hypervisor->get_virtual_switch(virtual_switch_id);
+		if( flood_tree_entries.at(virtual_switch_id).in_tree &&
+				virtual_switch != nullptr &&
+				virtual_switch->get_flood_tree_ports(id) != nullptr ) {
+			continue;
+		}
+
+		// Flood to every port separately before the tree group is deleted
+		auto rewrite_it = rewrite_map.find(virtual_switch_id);
+		if( rewrite_it != rewrite_map.end() && rewrite_it->second.flood_over_tree ) {
+			rewrite_it->second.flood_over_tree = false;
+			send_flood_group(
+				virtual_switch_id,
+				rewrite_it->second,
+				fluid_msg::of13::OFPGC_MODIFY);
+		}
+
+		remove_flood_tree_entry(virtual_switch_id);
+	}
+
+	for( auto& entry_pair : flood_tree_entries ) {
+		const int& virtual_switch_id = entry_pair.first;
+		FloodTreeEntry& entry        = entry_pair.second;
+		const VirtualSwitch* virtual_switch =
+			hypervisor->get_virtual_switch(virtual_switch_id);
+
+		// The output groups of the virtual ports on this switch, the
+		// switches the tree only passes through have none
+		std::set<uint32_t> local_groups;
+		auto rewrite_it = rewrite_map.find(virtual_switch_id);
+		if( rewrite_it != rewrite_map.end() ) {
+			for( const auto& port_pair : virtual_switch->get_port_to_physical_switch() ) {
+				if( port_pair.second != features.datapath_id ) continue;
+
+				const OutputGroup& output_group =
+					rewrite_it->second.output_groups.at(port_pair.first);
+				if( output_group.state != OutputGroup::State::no_rule ) {
+					local_groups.insert(output_group.group_id);
+				}
+			}
+		}
+
+		// The neighbours the packet is flooded to over the tree
+		std::map<uint32_t,std::pair<int,uint32_t>> neighbors;
+		for( uint32_t port_no : *virtual_switch->get_flood_tree_ports(id) ) {
+			auto port_it = ports.find(port_no);
+			int other_id = -1;
+			uint32_t other_index;
+			if( port_it != ports.end() && port_it->second.link != nullptr ) {
+				other_id = port_it->second.link->get_other_switch_id(id);
+			}
+			PhysicalSwitch::pointer other_switch = hypervisor->get_physical_switch(other_id);
+			if( other_switch == nullptr ||
+					!other_switch->get_flood_index(virtual_switch_id, other_index) ) {
+				BOOST_LOG_TRIVIAL(warning) << *this << " can't flood "
+					<< *virtual_switch << " over port " << port_no;
+				continue;
+			}
+			neighbors[port_no] = std::make_pair(other_id, other_index);
+		}
+
+		if( !entry.installed ) {
+			entry.local_groups = local_groups;
+			entry.neighbors    = neighbors;
+			send_flood_tree_group(
+				virtual_switch_id,
+				entry,
+				group_create_command(make_flood_tree_group_id(virtual_switch_id)));
+			send_flood_tree_rule(
+				virtual_switch_id,
+				entry,
+				fluid_msg::of13::OFPFC_ADD);
+			entry.installed = true;
+		}
+		else if( entry.local_groups != local_groups || entry.neighbors != neighbors ) {
+			entry.local_groups = local_groups;
+			entry.neighbors    = neighbors;
+			send_flood_tree_group(
+				virtual_switch_id,
+				entry,
+				fluid_msg::of13::OFPGC_MODIFY);
+		}
+
+		// Floods from the ports on this switch start at the tree group
+		if( rewrite_it != rewrite_map.end() && !rewrite_it->second.flood_over_tree ) {
+			rewrite_it->second.flood_over_tree = true;
+			send_flood_group(
+				virtual_switch_id,
+				rewrite_it->second,
+				fluid_msg::of13::OFPGC_MODIFY);
+		}
+	}
+}
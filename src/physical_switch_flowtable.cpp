@@ -8,10 +8,63 @@
 
 #include <fstream>
 
+void PhysicalSwitch::send_meter(uint32_t meter_id, int rate, uint16_t command) {
+	// Take over a meter left behind by a previous run
+	if( command == fluid_msg::of13::OFPMC_ADD && existing_meters.erase(meter_id) ) {
+		command = fluid_msg::of13::OFPMC_MODIFY;
+	}
+
+	fluid_msg::of13::MeterMod meter_mod;
+	meter_mod.command(command);
+	meter_mod.flags(fluid_msg::of13::OFPMF_PKTPS);
+	meter_mod.meter_id(meter_id);
+	meter_mod.add_band(
+		new fluid_msg::of13::MeterBand(
+			fluid_msg::of13::OFPMBT_DROP,
+			rate,
+			0)); // Burst needs to be 0 unless flag burst is used
+
+	// Send the message
+	send_message(meter_mod);
+}
+
+void PhysicalSwitch::choose_table_layout() {
+	single_reserved_table =
+		features.n_tables <= hypervisor->get_single_table_max_tables();
+
+	// The outer tag of the double tag layout is removed in table 0
+	// before the inner tag is looked at, that needs a second table
+	if( single_reserved_table && VLANTag::double_tag ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " can't reserve a single table with double VLAN tags";
+		single_reserved_table = false;
+	}
+
+	BOOST_LOG_TRIVIAL(info) << *this << " reserves "
+		<< (int) get_reserved_tables() << " of its "
+		<< (int) features.n_tables << " tables";
+}
+
 void PhysicalSwitch::create_static_rules() {
 	// Create the topology discovery forward rule
 	make_topology_discovery_rule();
 
+	// Create the meters before the rules that use them, the meters
+	// of slices added later are created by add_slice
+	if( hypervisor->get_use_meters() ) {
+		// The meter for the packets hitting the error rules
+		if( hypervisor->get_error_packet_in_rate() > 0 ) {
+			send_meter(
+				error_meter_id,
+				hypervisor->get_error_packet_in_rate(),
+				fluid_msg::of13::OFPMC_ADD);
+		}
+
+		for( const Slice& slice : hypervisor->get_slices() ) {
+			send_slice_meters(slice, fluid_msg::of13::OFPMC_ADD);
+		}
+	}
+
 	// Create the error detection rules
 	{
 		// Create the flowmod
@@ -22,6 +75,14 @@ void PhysicalSwitch::create_static_rules() {
 		flowmod.table_id(0);
 		flowmod.buffer_id(OFP_NO_BUFFER);
 
+		// Limit the packets that are sent to the controller
+		if( hypervisor->get_use_meters() &&
+				hypervisor->get_error_packet_in_rate() > 0 ) {
+			flowmod.add_instruction(
+				new fluid_msg::of13::Meter(
+					error_meter_id));
+		}
+
 		// Create the actions
 		fluid_msg::of13::WriteActions write_actions;
 		write_actions.add_action(
@@ -31,17 +92,20 @@ void PhysicalSwitch::create_static_rules() {
 		flowmod.add_instruction(write_actions);
 
 		// Send the message
-		send_message(flowmod);
+		send_hypervisor_flow_mod(flowmod);
 
 		// Change the table number and do it again
-		flowmod.table_id(1);
-		flowmod.cookie(3);
-		send_message(flowmod);
+		if( !single_reserved_table ) {
+			flowmod.table_id(1);
+			flowmod.cookie(3);
+			send_hypervisor_flow_mod(flowmod);
+		}
 	}
 
 	// Create the rule forwarding packets that come from the
-	// controller as if they arrived over a shared link
-	{
+	// controller as if they arrived over a shared link, with a
+	// single reserved table they reach those rules without it
+	if( !single_reserved_table ) {
 		// Create the flowmod
 		fluid_msg::of13::FlowMod flowmod;
 		flowmod.command(fluid_msg::of13::OFPFC_ADD);
@@ -59,32 +123,13 @@ void PhysicalSwitch::create_static_rules() {
 			new fluid_msg::of13::GoToTable(1));
 
 		// Send the message
-		send_message(flowmod);
-	}
-
-	// Create the meters per slice
-	// TODO Doesn't work with slices created after this physical switch
-	if( hypervisor->get_use_meters() ) {
-		for( const Slice& slice : hypervisor->get_slices() ) {
-			fluid_msg::of13::MeterMod meter_mod;
-			meter_mod.command(fluid_msg::of13::OFPMC_ADD);
-			meter_mod.flags(fluid_msg::of13::OFPMF_PKTPS);
-			meter_mod.meter_id(slice.get_id()+1); // TODO Document this better, meter id's start at 1
-			meter_mod.add_band(
-				new fluid_msg::of13::MeterBand(
-					fluid_msg::of13::OFPMBT_DROP,
-					slice.get_max_rate(),
-					0)); // Burst needs to be 0 unless flag burst is used
-
-			// Send the message
-			send_message(meter_mod);
-		}
+		send_hypervisor_flow_mod(flowmod);
 	}
 
 	// Create the group that sends the packet back to the controller
 	{
 		fluid_msg::of13::GroupMod group_mod;
-		group_mod.command(fluid_msg::of13::OFPGC_ADD);
+		group_mod.command(group_create_command(0));
 		group_mod.group_type(fluid_msg::of13::OFPGT_INDIRECT);
 		group_mod.group_id(0);
 
@@ -106,9 +151,184 @@ void PhysicalSwitch::create_static_rules() {
 	// TODO Send a barrierrequest
 }
 
+void PhysicalSwitch::send_port_slice_rule(
+		uint32_t port_no,
+		uint32_t port_index,
+		Port::State state,
+		int slice_id,
+		uint16_t command) {
+	fluid_msg::of13::FlowMod flowmod;
+	flowmod.command(command);
+	flowmod.priority(10);
+	flowmod.cookie(port_no);
+	flowmod.table_id(get_transit_table());
+	flowmod.buffer_id(OFP_NO_BUFFER);
+
+	// Add the match to the flowmod
+	VLANTag vlan_tag;
+	vlan_tag.set_switch(id);
+	vlan_tag.set_port(port_index);
+	vlan_tag.set_slice(slice_id);
+	vlan_tag.add_to_match(flowmod);
+
+	// Set the actions for the flowmod
+	fluid_msg::of13::WriteActions write_actions;
+	if( state == Port::State::host_rule ) {
+		// Remove the VLAN Tag before forwarding to a host
+		write_actions.add_action(
+			new fluid_msg::of13::PopVLANAction());
+	}
+	else if( state == Port::State::link_rule ) {
+		// Rewrite the port VLAN Tag to a shared link tag
+		VLANTag vlan_tag;
+		vlan_tag.set_switch(VLANTag::max_switch_id);
+		vlan_tag.set_port(VLANTag::max_port_id);
+		vlan_tag.set_slice(slice_id);
+		vlan_tag.add_to_actions(write_actions);
+	}
+	// TODO What about drop rule?
+	write_actions.add_action(
+		new fluid_msg::of13::OutputAction(
+			port_no,
+			fluid_msg::of13::OFPCML_NO_BUFFER));
+	flowmod.add_instruction(write_actions);
+
+	// Send the flowmod
+	send_hypervisor_flow_mod(flowmod);
+}
+
+void PhysicalSwitch::update_port_slice_rules(uint32_t port_no, Port& port, bool state_changed) {
+	// Only the ports a virtual switch outputs to have an index
+	uint32_t port_index;
+	if( !get_port_index(port_no, port_index) ) {
+		return;
+	}
+
+	uint16_t command;
+	if( !port.slice_rules_installed ) {
+		command = fluid_msg::of13::OFPFC_ADD;
+	}
+	else if( state_changed ) {
+		command = fluid_msg::of13::OFPFC_MODIFY_STRICT;
+	}
+	else {
+		return;
+	}
+
+	// The rule in table 1 needs to be duplicated for each slice in the Hypervisor
+	for( const Slice& slice : hypervisor->get_slices() ) {
+		send_port_slice_rule(
+			port_no,
+			port_index,
+			port.state,
+			slice.get_id(),
+			command);
+	}
+
+	port.slice_rules_installed = true;
+	port.slice_rules_index     = port_index;
+}
+
+void PhysicalSwitch::send_slice_meters(const Slice& slice, uint16_t command) {
+	if( !hypervisor->get_use_meters() ) {
+		return;
+	}
+
+	// The meter for all packets of the slice
+	send_meter(
+		slice.get_meter_id(),
+		slice.get_max_rate(),
+		command);
+
+	// The meter for the packets the slice sends to its
+	// controller, this drops a PacketIn storm in the switch
+	// before it reaches the hypervisor
+	if( slice.get_packet_in_rate() > 0 ) {
+		send_meter(
+			slice.get_controller_meter_id(),
+			slice.get_packet_in_rate(),
+			command);
+	}
+}
+
+void PhysicalSwitch::add_slice(const Slice& slice) {
+	send_slice_meters(slice, fluid_msg::of13::OFPMC_ADD);
+
+	// Add the rules outputting the packets of this slice
+	// for the ports that already have rules
+	for( const auto& port_pair : ports ) {
+		if( !port_pair.second.slice_rules_installed ) continue;
+
+		send_port_slice_rule(
+			port_pair.first,
+			port_pair.second.slice_rules_index,
+			port_pair.second.state,
+			slice.get_id(),
+			fluid_msg::of13::OFPFC_ADD);
+	}
+}
+
+void PhysicalSwitch::update_slice(const Slice& slice) {
+	send_slice_meters(slice, fluid_msg::of13::OFPMC_MODIFY);
+}
+
+void PhysicalSwitch::remove_slice(const Slice& slice) {
+	for( const auto& port_pair : ports ) {
+		if( !port_pair.second.slice_rules_installed ) continue;
+
+		send_port_slice_rule(
+			port_pair.first,
+			port_pair.second.slice_rules_index,
+			port_pair.second.state,
+			slice.get_id(),
+			fluid_msg::of13::OFPFC_DELETE_STRICT);
+	}
+
+	// The virtual switches of the slice are already stopped,
+	// so no flows use these meters anymore
+	send_slice_meters(slice, fluid_msg::of13::OFPMC_DELETE);
+}
+
 void PhysicalSwitch::update_dynamic_rules() {
+	// The rules are created when the features are known
+	// and reconciling is finished
+	if( reconciling || state != registered ) {
+		return;
+	}
+
 	BOOST_LOG_TRIVIAL(info) << *this << " updating dynamic flow rules";
 
+	// Remove the rules in table 1 of the ports that lost their index
+	// first, a freed index can already be given to another port
+	for( auto& port_pair : ports ) {
+		Port& port = port_pair.second;
+		if( !port.slice_rules_installed ) continue;
+
+		uint32_t port_index;
+		if( get_port_index(port_pair.first, port_index) &&
+				port_index == port.slice_rules_index ) {
+			continue;
+		}
+
+		for( const Slice& slice : hypervisor->get_slices() ) {
+			send_port_slice_rule(
+				port_pair.first,
+				port.slice_rules_index,
+				port.state,
+				slice.get_id(),
+				fluid_msg::of13::OFPFC_DELETE_STRICT);
+		}
+		port.slice_rules_installed = false;
+	}
+
+	// In the single reserved table layout the packets arriving over
+	// a link fall through to the rules forwarding tagged packets, so
+	// the ports with a link don't have a rule of their own
+	auto has_port_rule = [this](Port::State state) {
+		return state != Port::State::no_rule &&
+			!( single_reserved_table && state == Port::State::link_rule );
+	};
+
 	// Update the port rules, there are 2 set of rules that are maintained
 	// here. The rules in table 0 with priority 10 determining what to do
 	// with packets that arrive over a certain link and the rules in table 1
@@ -121,19 +341,14 @@ void PhysicalSwitch::update_dynamic_rules() {
 
 		// Start building the message to update table 0
 		fluid_msg::of13::FlowMod flowmod_0;
-		flowmod_0.priority(10);
+		flowmod_0.priority(
+			single_reserved_table ?
+				single_table_port_priority :
+				10);
 		flowmod_0.cookie(port_no);
 		flowmod_0.table_id(0);
 		flowmod_0.buffer_id(OFP_NO_BUFFER);
 
-		// If there is no rule about this port add a rule
-		// in table 1
-		fluid_msg::of13::FlowMod flowmod_1;
-		flowmod_1.priority(10);
-		flowmod_1.cookie(port_no);
-		flowmod_1.table_id(1);
-		flowmod_1.buffer_id(OFP_NO_BUFFER);
-
 		// Determine what the current state of the forwarding rule
 		// should be.
 		Port::State current_state;
@@ -175,18 +390,23 @@ void PhysicalSwitch::update_dynamic_rules() {
 			<< " curr=" << Port::state_to_string(current_state)
 			<< " for port " << port_no;
 
-		if( prev_state == Port::State::no_rule ) {
+		// If the state hasn't changed don't send any flowmod, the
+		// rules in table 1 can still be missing for a new index
+		if( prev_state == current_state ) {
+			update_port_slice_rules(port_no, port, false);
+			continue;
+		}
+
+		if( !has_port_rule(prev_state) ) {
 			// There is no rule known about this port
 			flowmod_0.command(fluid_msg::of13::OFPFC_ADD);
-			flowmod_1.command(fluid_msg::of13::OFPFC_ADD);
+		}
+		else if( !has_port_rule(current_state) ) {
+			// The port got a link in the single reserved table layout
+			flowmod_0.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
 		}
 		else {
-			// If the state hasn't changed don't send any flowmod
-			if( prev_state == current_state ) {
-				continue;
-			}
 			flowmod_0.command(fluid_msg::of13::OFPFC_MODIFY_STRICT);
-			flowmod_1.command(fluid_msg::of13::OFPFC_MODIFY_STRICT);
 		}
 
 		// Save the updated state
@@ -200,7 +420,10 @@ void PhysicalSwitch::update_dynamic_rules() {
 			new fluid_msg::of13::InPort(port_no));
 
 		// Add the necessary actions to flowmod_0
-		if( current_state == Port::State::link_rule ) {
+		if( !has_port_rule(current_state) ) {
+			// The rule is removed, it doesn't need any actions
+		}
+		else if( current_state == Port::State::link_rule ) {
 			flowmod_0.add_instruction(
 				new fluid_msg::of13::GoToTable(1));
 		}
@@ -213,7 +436,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 			}
 			// Goto the tenant tables
 			flowmod_0.add_instruction(
-				new fluid_msg::of13::GoToTable(2));
+				new fluid_msg::of13::GoToTable(get_physical_table(0)));
 			// Add the metadata write instruction
 			MetadataTag metadata_tag;
 			metadata_tag.set_group(false);
@@ -225,45 +448,44 @@ void PhysicalSwitch::update_dynamic_rules() {
 		}
 
 		// Send the first message
-		send_message(flowmod_0);
+		if( has_port_rule(prev_state) || has_port_rule(current_state) ) {
+			send_hypervisor_flow_mod(flowmod_0);
+		}
 
-		// Flowmod 1 needs to be duplicated for each slice in the Hypervisor
-		for( const Slice& slice : hypervisor->get_slices() ) {
-			// Copy the already constructed message for each slice
-			fluid_msg::of13::FlowMod flowmod_1_copy(flowmod_1);
+		// In the double tag layout packets for this switch arrive over
+		// a link with the outer tag, remove it before table 1 looks
+		// at the port tag
+		if( VLANTag::double_tag &&
+				( current_state == Port::State::link_rule ||
+				  prev_state == Port::State::link_rule ) ) {
+			fluid_msg::of13::FlowMod flowmod;
+			flowmod.command(
+				current_state == Port::State::link_rule ?
+					fluid_msg::of13::OFPFC_ADD :
+					fluid_msg::of13::OFPFC_DELETE_STRICT);
+			flowmod.priority(11);
+			flowmod.cookie(port_no);
+			flowmod.table_id(0);
+			flowmod.buffer_id(OFP_NO_BUFFER);
 
-			// Add the match to flowmod_1_copy
-			VLANTag vlan_tag;
-			vlan_tag.set_switch(id);
-			vlan_tag.set_port(port_no);
-			vlan_tag.set_slice(slice.get_id());
-			vlan_tag.add_to_match(flowmod_1_copy);
+			flowmod.add_oxm_field(
+				new fluid_msg::of13::InPort(port_no));
+			SwitchVLANTag switch_tag;
+			switch_tag.set_switch(id);
+			switch_tag.add_to_match(flowmod);
 
-			// Set the actions for flowmod_1_copy
-			fluid_msg::of13::WriteActions write_actions;
-			if( current_state == Port::State::host_rule ) {
-				// Remove the VLAN Tag before forwarding to a host
-				write_actions.add_action(
-					new fluid_msg::of13::PopVLANAction());
-			}
-			else if( current_state == Port::State::link_rule ) {
-				// Rewrite the port VLAN Tag to a shared link tag
-				VLANTag vlan_tag;
-				vlan_tag.set_switch(VLANTag::max_switch_id);
-				vlan_tag.set_port(VLANTag::max_port_id);
-				vlan_tag.set_slice(slice.get_id());
-				vlan_tag.add_to_actions(write_actions);
-			}
-			// TODO What about drop rule?
-			write_actions.add_action(
-				new fluid_msg::of13::OutputAction(
-					port_no,
-					fluid_msg::of13::OFPCML_NO_BUFFER));
-			flowmod_1_copy.add_instruction(write_actions);
+			fluid_msg::of13::ApplyActions apply_actions;
+			apply_actions.add_action(
+				new fluid_msg::of13::PopVLANAction());
+			flowmod.add_instruction(apply_actions);
+			flowmod.add_instruction(
+				new fluid_msg::of13::GoToTable(1));
 
-			// Send the flowmods
-			send_message(flowmod_1_copy);
+			send_hypervisor_flow_mod(flowmod);
 		}
+
+		// Update the rules in table 1 outputting to this port
+		update_port_slice_rules(port_no, port, true);
 	}
 
 	// Update shared link forwarding rules, the rules in table 1 with id 30
@@ -283,7 +505,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 
 			// Start building the flowmod
 			fluid_msg::of13::FlowMod flowmod;
-			flowmod.table_id(1);
+			flowmod.table_id(get_transit_table());
 			flowmod.priority(30);
 			flowmod.buffer_id(OFP_NO_BUFFER);
 
@@ -330,10 +552,10 @@ void PhysicalSwitch::update_dynamic_rules() {
 			metadata_tag.set_virtual_switch(needed_port.virtual_switch->get_id());
 			metadata_tag.add_to_instructions(flowmod);
 			flowmod.add_instruction(
-				new fluid_msg::of13::GoToTable(2));
+				new fluid_msg::of13::GoToTable(get_physical_table(0)));
 
 			// Send the message
-			send_message(flowmod);
+			send_hypervisor_flow_mod(flowmod);
 		}
 	}
 
@@ -362,7 +584,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 		// If we arrived here we need to update something in the switch.
 		// Create the flowmod
 		fluid_msg::of13::FlowMod flowmod;
-		flowmod.table_id(1);
+		flowmod.table_id(get_transit_table());
 		flowmod.priority(20);
 		flowmod.buffer_id(OFP_NO_BUFFER);
 
@@ -378,7 +600,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 
 		if( next_exists ) {
 			// Add the vlantag match field
-			VLANTag vlan_tag;
+			SwitchVLANTag vlan_tag;
 			vlan_tag.set_switch(other_id);
 			vlan_tag.add_to_match(flowmod);
 
@@ -392,7 +614,44 @@ void PhysicalSwitch::update_dynamic_rules() {
 		}
 
 		// Send the message
-		send_message(flowmod);
+		send_hypervisor_flow_mod(flowmod);
+
+		// In the double tag layout the outer tag is added by a group
+		// per physical switch, the output groups refer to it
+		if( VLANTag::double_tag ) {
+			fluid_msg::of13::GroupMod group_mod;
+			group_mod.command(
+				current_exists ?
+					fluid_msg::of13::OFPGC_MODIFY :
+					group_create_command(make_switch_group_id(other_id)));
+			group_mod.group_type(fluid_msg::of13::OFPGT_INDIRECT);
+			group_mod.group_id(make_switch_group_id(other_id));
+
+			// An unreachable switch keeps the group without a bucket so
+			// it drops the packets, output groups can still refer to it
+			if( next_exists ) {
+				fluid_msg::of13::Bucket bucket;
+				bucket.weight(0);
+				bucket.watch_port(fluid_msg::of13::OFPP_ANY);
+				bucket.watch_group(fluid_msg::of13::OFPG_ANY);
+
+				fluid_msg::ActionSet action_set;
+				action_set.add_action(
+					new fluid_msg::of13::PushVLANAction(0x8100));
+				SwitchVLANTag switch_tag;
+				switch_tag.set_switch(other_id);
+				switch_tag.add_to_actions(action_set);
+				action_set.add_action(
+					new fluid_msg::of13::OutputAction(
+						next_it->second,
+						fluid_msg::of13::OFPCML_NO_BUFFER));
+
+				bucket.actions(action_set);
+				group_mod.add_bucket(bucket);
+			}
+
+			send_message(group_mod);
+		}
 	}
 
 	// Loop over all virtual switches for which we have rewrite data
@@ -424,6 +683,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 			// Determine what state this rule should have
 			OutputGroup::State new_state;
 			uint32_t new_output_port;
+			uint32_t new_foreign_port_index = 0;
 
 			// If it is a port on this switch
 			if( physical_dpid == features.datapath_id ) {
@@ -447,12 +707,32 @@ void PhysicalSwitch::update_dynamic_rules() {
 			else {
 				new_state       = OutputGroup::State::switch_rule;
 				new_output_port = next.at(physical_switch->get_id());
+
+				// The tag carries the index of the port on the foreign
+				// switch, it is known once that switch registered the
+				// interest of this virtual switch
+				uint32_t foreign_output_port =
+					virtual_switch
+						->get_port_map(physical_dpid)
+							.get_physical(virtual_port);
+				if( !physical_switch->get_port_index(
+						foreign_output_port,
+						new_foreign_port_index) ) {
+					BOOST_LOG_TRIVIAL(warning) << *this
+						<< " no port index for port " << foreign_output_port
+						<< " on " << *physical_switch;
+					continue;
+				}
 			}
 
 			// If the states and output ports are the same the group doesn't
-			// need to be updated
+			// need to be updated, a rule to another switch also needs to
+			// output to the same switch and port index
 			if( output_group.state==new_state &&
-				output_group.output_port==new_output_port ) {
+				output_group.output_port==new_output_port &&
+				( new_state!=OutputGroup::State::switch_rule || (
+					output_group.foreign_switch_id==physical_switch->get_id() &&
+					output_group.foreign_port_index==new_foreign_port_index ) ) ) {
 				continue;
 			}
 
@@ -460,7 +740,7 @@ void PhysicalSwitch::update_dynamic_rules() {
 			fluid_msg::of13::GroupMod group_mod;
 			// If this group doesn't exist it is an add command
 			if( output_group.state == OutputGroup::State::no_rule ) {
-				group_mod.command(fluid_msg::of13::OFPGC_ADD);
+				group_mod.command(group_create_command(output_group.group_id));
 			}
 			// Otherwise it is an edit command
 			else {
@@ -470,8 +750,10 @@ void PhysicalSwitch::update_dynamic_rules() {
 			group_mod.group_id(output_group.group_id);
 
 			// Update the state and output port in the output_group
-			output_group.state       = new_state;
-			output_group.output_port = new_output_port;
+			output_group.state              = new_state;
+			output_group.output_port        = new_output_port;
+			output_group.foreign_switch_id  = physical_switch->get_id();
+			output_group.foreign_port_index = new_foreign_port_index;
 
 			// Create the bucket to add to the group mod
 			fluid_msg::of13::Bucket bucket;
@@ -511,24 +793,27 @@ void PhysicalSwitch::update_dynamic_rules() {
 				action_set.add_action(
 					new fluid_msg::of13::PushVLANAction(0x8100));
 
-				// Get the port id on the foreign switch
-				uint32_t foreign_output_port =
-					virtual_switch
-						->get_port_map(physical_dpid)
-							.get_physical(virtual_port);
-
 				// Set the data in the VLAN Tag
 				VLANTag vlan_tag;
 				vlan_tag.set_switch(physical_switch->get_id());
-				vlan_tag.set_port(foreign_output_port);
+				vlan_tag.set_port(new_foreign_port_index);
 				vlan_tag.set_slice(virtual_switch->get_slice()->get_id());
 				vlan_tag.add_to_actions(action_set);
 
-				// Output the packet over the proper port
-				action_set.add_action(
-					new fluid_msg::of13::OutputAction(
-						new_output_port,
-						fluid_msg::of13::OFPCML_NO_BUFFER));
+				if( VLANTag::double_tag ) {
+					// An action set can't push a tag twice, the
+					// switch group adds the outer tag
+					action_set.add_action(
+						new fluid_msg::of13::GroupAction(
+							make_switch_group_id(physical_switch->get_id())));
+				}
+				else {
+					// Output the packet over the proper port
+					action_set.add_action(
+						new fluid_msg::of13::OutputAction(
+							new_output_port,
+							fluid_msg::of13::OFPCML_NO_BUFFER));
+				}
 			}
 
 			// Add the bucket
@@ -540,6 +825,9 @@ void PhysicalSwitch::update_dynamic_rules() {
 		}
 	}
 
+	// The flood tree groups refer to the output groups
+	update_flood_tree_rules();
+
 	// TODO Remove this section
 	if( state == registered ) {
 		std::ostringstream string_stream;
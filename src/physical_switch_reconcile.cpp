@@ -0,0 +1,305 @@
+#include "physical_switch.hpp"
+#include "virtual_switch.hpp"
+#include "hypervisor.hpp"
+#include "flow_table.hpp"
+#include "tag.hpp"
+
+#include <iterator>
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// How long to wait before removing the rules that are left over
+	/**
+	 * The rules of the links are only installed after the links
+	 * are discovered again, removing the old rules before that
+	 * would interrupt the traffic between switches.
+	 */
+	constexpr int left_over_delay = 4*topology::period;
+
+	/// Create the key that identifies a rule in a flow table
+	/**
+	 * A rule is identified by its table, priority and match,
+	 * this works for both FlowMod and FlowStats messages. The
+	 * key is made from the parsed fields like in the mirror, a
+	 * switch can reply with the fields in a different order.
+	 */
+	template<class Rule>
+	std::string make_rule_key(Rule& rule) {
+		return FlowTable::make_key(rule.table_id(), rule.priority(), rule.match());
+	}
+
+	/// Check if the rules of a virtual switch in a physical switch can be kept
+	/**
+	 * The rules carry the id of the virtual switch that pushed them,
+	 * only a virtual switch that got the same id as in the previous
+	 * run pushed them. It also needs ports on the physical switch.
+	 */
+	bool owns_rules_on(const VirtualSwitch* virtual_switch, uint64_t datapath_id) {
+		if( virtual_switch == nullptr || !virtual_switch->has_restored_id() ) {
+			return false;
+		}
+		for( const auto& port_pair : virtual_switch->get_port_to_physical_switch() ) {
+			if( port_pair.second == datapath_id ) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+void PhysicalSwitch::send_hypervisor_flow_mod(fluid_msg::of13::FlowMod& flowmod) {
+	if( flowmod.command() == fluid_msg::of13::OFPFC_DELETE_STRICT ) {
+		hypervisor_flows.erase(make_rule_key(flowmod));
+	}
+	else {
+		hypervisor_flows.insert(make_rule_key(flowmod));
+	}
+
+	send_message(flowmod);
+}
+
+void PhysicalSwitch::start_reconcile() {
+	BOOST_LOG_TRIVIAL(info) << *this << " reconciling the rules in the switch";
+
+	reconciling = true;
+	reconcile_features_received = false;
+	existing_groups.clear();
+	existing_meters.clear();
+	pending_descriptions.clear();
+
+	// Request all groups in the switch
+	{
+		fluid_msg::of13::MultipartRequestGroupDesc request(
+			0,  // The xid will be set by send_message
+			0); // The only flag is the more flag indicating more messages follow
+		pending_descriptions.insert(send_message(request));
+	}
+
+	// Request all meters in the switch
+	if( hypervisor->get_use_meters() ) {
+		fluid_msg::of13::MultipartRequestMeterConfig request(
+			0, // The xid will be set by send_message
+			0, // The only flag is the more flag indicating more messages follow
+			fluid_msg::of13::OFPM_ALL);
+		pending_descriptions.insert(send_message(request));
+	}
+}
+
+void PhysicalSwitch::check_reconcile_complete() {
+	if( reconciling &&
+			reconcile_features_received &&
+			pending_descriptions.empty() ) {
+		finish_reconcile();
+	}
+}
+
+void PhysicalSwitch::finish_reconcile() {
+	reconciling = false;
+
+	// Remove the groups that can't be taken over. The id's of the
+	// groups of the controllers are only known by the previous run,
+	// the flows using them are removed by the switch. The groups of
+	// the hypervisor are kept for the virtual switches that got
+	// their id from the state journal and still have ports on this
+	// switch, the flows of those virtual switches keep working
+	// until their controller connects again.
+	auto group_it = existing_groups.begin();
+	while( group_it != existing_groups.end() ) {
+		uint32_t group_id = group_it->first;
+
+		bool keep = group_id == 0;
+		if( VLANTag::double_tag && group_id != 0 && group_id <= make_switch_group_id(SwitchVLANTag::max_switch_id) ) {
+			// The switch groups are updated when the routes are calculated
+			keep = true;
+		}
+		else if( group_id != 0 && group_id < first_tenant_group_id ) {
+			const VirtualSwitch* virtual_switch =
+				hypervisor->get_virtual_switch(group_id >> 16);
+			keep = owns_rules_on(virtual_switch, features.datapath_id);
+
+			// The flood groups are updated when the routes are
+			// calculated, an output group has to output to the port
+			// it is for now. Deleting it also removes the flows
+			// that would send their packets to the wrong port.
+			uint32_t group_index = group_id & 0xffff;
+			if( keep && group_index != 0 && group_index != 0xffff ) {
+				keep = is_current_output_group(group_id, virtual_switch);
+			}
+		}
+
+		if( keep ) {
+			++group_it;
+		}
+		else {
+			delete_group(group_id);
+			group_it = existing_groups.erase(group_it);
+		}
+	}
+
+	// Install the static rules over the existing ones, this takes
+	// over the meters and groups that are still needed
+	create_static_rules();
+
+	// Remove the meters of slices that don't exist anymore
+	for( uint32_t meter_id : existing_meters ) {
+		send_meter(meter_id, 0, fluid_msg::of13::OFPMC_DELETE);
+	}
+	existing_meters.clear();
+
+	BOOST_LOG_TRIVIAL(info) << *this << " reconciled groups and meters";
+
+	// Now the switch can be used by virtual switches, this also
+	// installs the dynamic rules
+	hypervisor->register_physical_switch(features.datapath_id,id);
+	state = registered;
+	restore_links();
+	hypervisor->calculate_routes();
+
+	// Remove the flows that weren't installed again after
+	// the links had the time to be discovered
+	reconcile_timer.expires_from_now(
+		boost::posix_time::milliseconds(left_over_delay));
+	reconcile_timer.async_wait(
+		boost::bind(
+			&PhysicalSwitch::request_left_over_flows,
+			shared_from_this(),
+			boost::asio::placeholders::error));
+}
+
+void PhysicalSwitch::request_left_over_flows(const boost::system::error_code& error) {
+	if( error.value() == boost::asio::error::operation_aborted ) {
+		return;
+	}
+	else if( error ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " reconcile timer error: " << error.message();
+		return;
+	}
+
+	// Make sure the flows are requested after all rules are installed
+	fluid_msg::of13::BarrierRequest barrier;
+	send_message(barrier);
+
+	get_flow_stats(
+		boost::bind(
+			&PhysicalSwitch::delete_left_over_flows,
+			shared_from_this(),
+			_1));
+}
+
+void PhysicalSwitch::delete_left_over_flows(
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats) {
+	int deleted = 0;
+
+	for( fluid_msg::of13::FlowStats flow : flow_stats ) {
+		bool keep;
+		if( flow.table_id() < get_reserved_tables() ) {
+			// The hypervisor rules that weren't installed again
+			keep = hypervisor_flows.count(make_rule_key(flow)) > 0;
+		}
+		else {
+			// The flows of the virtual switches that pushed them and
+			// still have ports on this switch, their controller
+			// manages them
+			fluid_msg::of13::Match match = flow.match();
+			MetadataTag metadata_tag;
+			keep = false;
+			if( metadata_tag.remove_from_match(match) ) {
+				keep = owns_rules_on(
+					hypervisor->get_virtual_switch(metadata_tag.get_virtual_switch()),
+					features.datapath_id);
+			}
+		}
+		if( keep ) continue;
+
+		fluid_msg::of13::FlowMod flowmod;
+		flowmod.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
+		flowmod.table_id(flow.table_id());
+		flowmod.priority(flow.priority());
+		flowmod.out_port(fluid_msg::of13::OFPP_ANY);
+		flowmod.out_group(fluid_msg::of13::OFPG_ANY);
+		flowmod.buffer_id(OFP_NO_BUFFER);
+		flowmod.match(flow.match());
+		send_message(flowmod);
+		++deleted;
+	}
+
+	BOOST_LOG_TRIVIAL(info) << *this << " removed " << deleted
+		<< " left over flows of " << flow_stats.size();
+}
+
+bool PhysicalSwitch::is_current_output_group(
+		uint32_t group_id,
+		const VirtualSwitch* virtual_switch) const {
+	auto group_it = existing_groups.find(group_id);
+	const auto& ports = virtual_switch->get_port_to_physical_switch();
+	size_t port_position = (group_id & 0xffff) - 1;
+	if( group_it == existing_groups.end() || port_position >= ports.size() ) {
+		return false;
+	}
+
+	// The group of a port on another switch carries the index of
+	// the port in that switch, these are given out again so the
+	// group can't be checked
+	auto port_it = ports.begin();
+	std::advance(port_it, port_position);
+	if( port_it->second != features.datapath_id ) {
+		return false;
+	}
+
+	// The group of a local port outputs to it directly
+	uint32_t physical_port =
+		virtual_switch
+			->get_port_map(features.datapath_id)
+				.get_physical(port_it->first);
+	return group_it->second == std::set<uint32_t>{physical_port};
+}
+
+void PhysicalSwitch::handle_multipart_reply_group_desc(fluid_msg::of13::MultipartReplyGroupDesc& multipart_reply_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart reply group desc";
+
+	if( pending_descriptions.count(multipart_reply_message.xid()) == 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested group description";
+		return;
+	}
+
+	for( fluid_msg::of13::GroupDesc& group_desc : multipart_reply_message.desc() ) {
+		std::set<uint32_t>& output_ports = existing_groups[group_desc.group_id()];
+		for( fluid_msg::of13::Bucket& bucket : group_desc.buckets() ) {
+			fluid_msg::ActionSet action_set = bucket.get_actions();
+			for( fluid_msg::Action* action : action_set.action_set() ) {
+				if( action->type() == fluid_msg::of13::OFPAT_OUTPUT ) {
+					output_ports.insert(
+						((fluid_msg::of13::OutputAction*) action)->port());
+				}
+			}
+		}
+	}
+
+	// The last part doesn't have the more flag set
+	if( !(multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE) ) {
+		pending_descriptions.erase(multipart_reply_message.xid());
+		check_reconcile_complete();
+	}
+}
+
+void PhysicalSwitch::handle_multipart_reply_meter_config(fluid_msg::of13::MultipartReplyMeterConfig& multipart_reply_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart reply meter config";
+
+	if( pending_descriptions.count(multipart_reply_message.xid()) == 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested meter configuration";
+		return;
+	}
+
+	for( fluid_msg::of13::MeterConfig& meter_config : multipart_reply_message.meter_config() ) {
+		existing_meters.insert(meter_config.meter_id());
+	}
+
+	// The last part doesn't have the more flag set
+	if( !(multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE) ) {
+		pending_descriptions.erase(multipart_reply_message.xid());
+		check_reconcile_complete();
+	}
+}
@@ -1,10 +1,59 @@
 #include "physical_switch.hpp"
 #include "virtual_switch.hpp"
+#include "hypervisor.hpp"
+#include "slice.hpp"
 
 #include "tag.hpp"
 
 #include <boost/log/trivial.hpp>
 
+namespace {
+	/// Check if a tenant instruction set only sends packets to the controller
+	/**
+	 * Only these rules can be metered without also dropping the
+	 * packets the tenant forwards in the data plane, a meter
+	 * instruction drops the packet for the whole pipeline.
+	 */
+	bool only_outputs_to_controller(fluid_msg::of13::InstructionSet& instruction_set) {
+		bool controller_found = false;
+		bool other_found      = false;
+
+		auto check_action = [&](fluid_msg::Action* action) {
+			if( action->type() == fluid_msg::of13::OFPAT_OUTPUT &&
+					((fluid_msg::of13::OutputAction*) action)->port() == fluid_msg::of13::OFPP_CONTROLLER ) {
+				controller_found = true;
+			}
+			else if( action->type() == fluid_msg::of13::OFPAT_OUTPUT ||
+					action->type() == fluid_msg::of13::OFPAT_GROUP ) {
+				other_found = true;
+			}
+		};
+
+		for( fluid_msg::of13::Instruction* instruction : instruction_set.instruction_set() ) {
+			if( instruction->type() == fluid_msg::of13::OFPIT_GOTO_TABLE ) {
+				// The next tables could forward the packet
+				other_found = true;
+			}
+			else if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_ACTIONS ) {
+				fluid_msg::ActionSet action_set =
+					((fluid_msg::of13::WriteActions*) instruction)->actions();
+				for( fluid_msg::Action* action : action_set.action_set() ) {
+					check_action(action);
+				}
+			}
+			else if( instruction->type() == fluid_msg::of13::OFPIT_APPLY_ACTIONS ) {
+				fluid_msg::ActionList action_list =
+					((fluid_msg::of13::ApplyActions*) instruction)->actions();
+				for( fluid_msg::Action* action : action_list.action_list() ) {
+					check_action(action);
+				}
+			}
+		}
+
+		return controller_found && !other_found;
+	}
+}
+
 bool PhysicalSwitch::rewrite_instruction_set(
 		fluid_msg::of13::InstructionSet& old_instruction_set,
 		fluid_msg::of13::InstructionSet& instruction_set_with_output,
@@ -20,13 +69,18 @@ bool PhysicalSwitch::rewrite_instruction_set(
 			fluid_msg::of13::GoToTable* goto_table =
 				(fluid_msg::of13::GoToTable*) instruction;
 
-			// TODO Check if goto_table->table_id()+2 is within physical
-			// switch capabilities
+			// The table has to be mapped onto a table of this switch
+			if( goto_table->table_id() >= get_tenant_table_count() ) {
+				BOOST_LOG_TRIVIAL(warning) << *this
+					<< " received flowmod with goto a table that isn't mapped";
+				return false;
+			}
+			uint8_t table_id = get_physical_table(goto_table->table_id());
 
 			instruction_set_with_output.add_instruction(
-				new fluid_msg::of13::GoToTable(goto_table->table_id()+2));
+				new fluid_msg::of13::GoToTable(table_id));
 			instruction_set_without_output.add_instruction(
-				new fluid_msg::of13::GoToTable(goto_table->table_id()+2));
+				new fluid_msg::of13::GoToTable(table_id));
 		}
 		else if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_METADATA ) {
 			fluid_msg::of13::WriteMetadata* write_metadata =
@@ -128,6 +182,21 @@ bool PhysicalSwitch::rewrite_instruction_set(
 		}
 	}
 
+	// Rules that only send packets to the controller are limited by
+	// the controller meter of the slice so PacketIn storms are
+	// dropped in the switch
+	const Slice* slice = virtual_switch->get_slice();
+	if( hypervisor->get_use_meters() &&
+			slice->get_packet_in_rate() > 0 &&
+			only_outputs_to_controller(old_instruction_set) ) {
+		instruction_set_with_output.add_instruction(
+			new fluid_msg::of13::Meter(
+				slice->get_controller_meter_id()));
+		instruction_set_without_output.add_instruction(
+			new fluid_msg::of13::Meter(
+				slice->get_controller_meter_id()));
+	}
+
 	// If any information was set in the metadata mask we need to add
 	// the metadata instruction to both instruction sets
 	if( metadata_mask != 0 ) {
@@ -325,3 +394,181 @@ bool PhysicalSwitch::rewrite_match(
 	}
 	return true;
 }
+
+fluid_msg::Action* PhysicalSwitch::restore_action(
+		fluid_msg::Action* action,
+		const VirtualSwitch* virtual_switch) {
+	// Only group actions are changed by the rewriting
+	if( action->type() != fluid_msg::of13::OFPAT_GROUP ) {
+		return action->clone();
+	}
+
+	fluid_msg::of13::GroupAction* group_action =
+		(fluid_msg::of13::GroupAction*) action;
+	uint32_t group_id = group_action->group_id();
+
+	const RewriteEntry& rewrite_entry = rewrite_map.at(virtual_switch->get_id());
+
+	// The reserved groups were output actions in the virtual switch,
+	// the max_len of a controller output is not kept in the physical
+	// switch so it can't be restored
+	if( group_id == 0 ) {
+		return new fluid_msg::of13::OutputAction(
+			fluid_msg::of13::OFPP_CONTROLLER,
+			fluid_msg::of13::OFPCML_NO_BUFFER);
+	}
+	if( group_id == rewrite_entry.flood_group_id ) {
+		return new fluid_msg::of13::OutputAction(
+			fluid_msg::of13::OFPP_FLOOD,
+			0);
+	}
+	for( const auto& output_group_pair : rewrite_entry.output_groups ) {
+		if( output_group_pair.second.group_id == group_id ) {
+			return new fluid_msg::of13::OutputAction(
+				output_group_pair.first,
+				0);
+		}
+	}
+
+	// Otherwise it is a group created by the virtual switch
+	if( rewrite_entry.group_id_map.has_physical(group_id) ) {
+		return new fluid_msg::of13::GroupAction(
+			rewrite_entry.group_id_map.get_virtual(group_id));
+	}
+
+	BOOST_LOG_TRIVIAL(warning) << *this
+		<< " unknown group id while restoring action";
+	return action->clone();
+}
+
+bool PhysicalSwitch::restore_match(
+		fluid_msg::of13::Match& match,
+		bool& group_copy,
+		const VirtualSwitch* virtual_switch) {
+	// Remove the metadata tag and check if this flow was
+	// actually pushed by this virtual switch
+	MetadataTag metadata_tag;
+	if( !metadata_tag.remove_from_match(match) ||
+			metadata_tag.get_virtual_switch() != virtual_switch->get_id() ) {
+		return false;
+	}
+	group_copy = metadata_tag.get_group();
+
+	// Rewrite the in_port back to the virtual port
+	fluid_msg::of13::InPort* in_port = match.in_port();
+	if( in_port != nullptr ) {
+		const auto& port_map = virtual_switch->get_port_map(features.datapath_id);
+		if( !port_map.has_physical(in_port->value()) ) {
+			return false;
+		}
+		in_port->value(port_map.get_virtual(in_port->value()));
+	}
+	return true;
+}
+
+bool PhysicalSwitch::restore_flow_removed(
+		fluid_msg::of13::FlowRemoved& flow_removed,
+		bool& group_copy,
+		const VirtualSwitch* virtual_switch) {
+	// Only the mapped tables are used by the controllers
+	uint8_t tenant_table;
+	if( !get_tenant_table(flow_removed.table_id(), tenant_table) ) {
+		return false;
+	}
+
+	fluid_msg::of13::Match match = flow_removed.match();
+	if( !restore_match(match, group_copy, virtual_switch) ) {
+		return false;
+	}
+	flow_removed.match(match);
+
+	flow_removed.table_id(tenant_table);
+	flow_removed.cookie(CookieTag(flow_removed.cookie()).get_tenant_cookie());
+	return true;
+}
+
+bool PhysicalSwitch::restore_flow_stats(
+		fluid_msg::of13::FlowStats& flow_stats,
+		bool& group_copy,
+		const VirtualSwitch* virtual_switch) {
+	// Only the mapped tables are used by the controllers
+	uint8_t tenant_table;
+	if( !get_tenant_table(flow_stats.table_id(), tenant_table) ) {
+		return false;
+	}
+
+	fluid_msg::of13::Match match = flow_stats.match();
+	if( !restore_match(match, group_copy, virtual_switch) ) {
+		return false;
+	}
+	flow_stats.match(match);
+
+	// Move the table id back
+	flow_stats.table_id(tenant_table);
+
+	// Remove the hypervisor bits from the cookie
+	flow_stats.cookie(CookieTag(flow_stats.cookie()).get_tenant_cookie());
+
+	// Restore the instructions
+	constexpr int total_bits = MetadataTag::num_virtual_switch_bits + 1;
+	fluid_msg::of13::InstructionSet old_instruction_set = flow_stats.instructions();
+	fluid_msg::of13::InstructionSet new_instruction_set;
+	for( fluid_msg::of13::Instruction* instruction : old_instruction_set.instruction_set() ) {
+		if( instruction->type() == fluid_msg::of13::OFPIT_GOTO_TABLE ) {
+			fluid_msg::of13::GoToTable* goto_table =
+				(fluid_msg::of13::GoToTable*) instruction;
+			uint8_t goto_tenant_table;
+			if( get_tenant_table(goto_table->table_id(), goto_tenant_table) ) {
+				new_instruction_set.add_instruction(
+					new fluid_msg::of13::GoToTable(goto_tenant_table));
+			}
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_METADATA ) {
+			fluid_msg::of13::WriteMetadata* write_metadata =
+				(fluid_msg::of13::WriteMetadata*) instruction;
+
+			// Only keep the instruction if the tenant wrote metadata itself
+			uint64_t metadata_mask = write_metadata->metadata_mask() >> total_bits;
+			if( metadata_mask != 0 ) {
+				new_instruction_set.add_instruction(
+					new fluid_msg::of13::WriteMetadata(
+						write_metadata->metadata() >> total_bits,
+						metadata_mask));
+			}
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_ACTIONS ) {
+			fluid_msg::of13::WriteActions* write_actions =
+				(fluid_msg::of13::WriteActions*) instruction;
+
+			fluid_msg::ActionSet old_action_set = write_actions->actions();
+			fluid_msg::ActionSet new_action_set;
+			for( fluid_msg::Action* action : old_action_set.action_set() ) {
+				new_action_set.add_action(restore_action(action, virtual_switch));
+			}
+			new_instruction_set.add_instruction(
+				new fluid_msg::of13::WriteActions(new_action_set));
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_APPLY_ACTIONS ) {
+			fluid_msg::of13::ApplyActions* apply_actions =
+				(fluid_msg::of13::ApplyActions*) instruction;
+
+			fluid_msg::ActionList old_action_list = apply_actions->actions();
+			fluid_msg::ActionList new_action_list;
+			for( fluid_msg::Action* action : old_action_list.action_list() ) {
+				new_action_list.add_action(restore_action(action, virtual_switch));
+			}
+			new_instruction_set.add_instruction(
+				new fluid_msg::of13::ApplyActions(new_action_list));
+		}
+		else if( instruction->type() == fluid_msg::of13::OFPIT_METER ) {
+			// Tenants can't use meters, this is the controller meter
+			continue;
+		}
+		else {
+			new_instruction_set.add_instruction(instruction->clone());
+		}
+	}
+	flow_stats.instructions(new_instruction_set);
+
+	return true;
+}
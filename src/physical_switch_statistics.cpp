@@ -0,0 +1,228 @@
+#include "physical_switch.hpp"
+#include "hypervisor.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// Check if the cached statistics are recent enough to be used
+	template<class Cache>
+	bool cache_is_fresh(const Cache& cache, int max_age) {
+		return !cache.updated.is_not_a_date_time() &&
+			boost::posix_time::microsec_clock::universal_time() - cache.updated <=
+				boost::posix_time::milliseconds(max_age);
+	}
+
+	/// Give the waiting callbacks the current entries in the cache
+	template<class Cache>
+	void notify_waiting(Cache& cache) {
+		// Callbacks can request statistics again, so
+		// move them out of the cache before calling them
+		auto waiting = std::move(cache.waiting);
+		cache.waiting.clear();
+		for( auto& callback : waiting ) {
+			callback(cache.entries);
+		}
+	}
+
+	/// Store the statistics of a completed poll
+	template<class Cache>
+	void complete_poll(Cache& cache) {
+		cache.entries.swap(cache.incoming);
+		cache.incoming.clear();
+		cache.updated = boost::posix_time::microsec_clock::universal_time();
+		cache.polling = false;
+
+		notify_waiting(cache);
+	}
+}
+
+void PhysicalSwitch::schedule_statistics_poll() {
+	int period = hypervisor->get_statistics_poll_period();
+
+	// A period of 0 means statistics are only polled on demand
+	if( period <= 0 ) {
+		return;
+	}
+
+	statistics_timer.expires_from_now(
+		boost::posix_time::milliseconds(period));
+	statistics_timer.async_wait(
+		boost::bind(
+			&PhysicalSwitch::poll_statistics,
+			shared_from_this(),
+			boost::asio::placeholders::error));
+}
+
+void PhysicalSwitch::poll_statistics(const boost::system::error_code& error) {
+	if( error.value() == boost::asio::error::operation_aborted ) {
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " statistics timer cancelled";
+		return;
+	}
+	else if( error ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " statistics timer error: " << error.message();
+		return;
+	}
+
+	// Only poll the statistics some virtual switch is interested in,
+	// when nobody requests statistics the switch is left alone
+	if( flow_stats_cache.used ) {
+		flow_stats_cache.used = false;
+		send_flow_stats_poll();
+	}
+	if( port_stats_cache.used ) {
+		port_stats_cache.used = false;
+		send_port_stats_poll();
+	}
+	// The table statistics are only needed to admit new rules
+	if( knows_table_capacity() ) {
+		send_table_stats_request();
+	}
+	// The flow cache evicts the rules that didn't match packets lately
+	// and the rules with an idle timeout expire when they aren't used
+	if( needs_flow_usage() ) {
+		get_flow_stats(
+			boost::bind(
+				&PhysicalSwitch::update_flow_usage,
+				shared_from_this(),
+				_1));
+	}
+
+	schedule_statistics_poll();
+}
+
+void PhysicalSwitch::send_flow_stats_poll() {
+	if( flow_stats_cache.polling ) {
+		return;
+	}
+	flow_stats_cache.polling = true;
+	flow_stats_cache.incoming.clear();
+
+	// Request all flows in all tables at once
+	fluid_msg::of13::MultipartRequestFlow request(
+		0, // The xid will be set by send_message
+		0, // The only flag is the more flag indicating more messages follow
+		fluid_msg::of13::OFPTT_ALL,
+		fluid_msg::of13::OFPP_ANY,
+		fluid_msg::of13::OFPG_ANY,
+		0, // Cookie
+		0);// Cookie mask
+	flow_stats_cache.xid = send_message(request);
+}
+
+void PhysicalSwitch::send_port_stats_poll() {
+	if( port_stats_cache.polling ) {
+		return;
+	}
+	port_stats_cache.polling = true;
+	port_stats_cache.incoming.clear();
+
+	// Request all ports at once
+	fluid_msg::of13::MultipartRequestPortStats request(
+		0, // The xid will be set by send_message
+		0, // The only flag is the more flag indicating more messages follow
+		fluid_msg::of13::OFPP_ANY);
+	port_stats_cache.xid = send_message(request);
+}
+
+void PhysicalSwitch::abort_statistics_poll(uint32_t xid) {
+	if( flow_stats_cache.polling && flow_stats_cache.xid == xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " flow statistics poll failed";
+		flow_stats_cache.polling = false;
+		notify_waiting(flow_stats_cache);
+	}
+	if( port_stats_cache.polling && port_stats_cache.xid == xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " port statistics poll failed";
+		port_stats_cache.polling = false;
+		notify_waiting(port_stats_cache);
+	}
+	if( table_stats_polling && table_stats_xid == xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " table statistics request failed";
+		table_stats_polling = false;
+	}
+}
+
+void PhysicalSwitch::stop_statistics_polls() {
+	flow_stats_cache.polling = false;
+	notify_waiting(flow_stats_cache);
+	port_stats_cache.polling = false;
+	notify_waiting(port_stats_cache);
+	table_stats_polling = false;
+}
+
+void PhysicalSwitch::get_flow_stats(FlowStatsCallback callback) {
+	flow_stats_cache.used = true;
+
+	if( cache_is_fresh(flow_stats_cache, hypervisor->get_statistics_max_age()) ) {
+		callback(flow_stats_cache.entries);
+		return;
+	}
+
+	// Wait for the poll in progress or start a new one
+	flow_stats_cache.waiting.push_back(callback);
+	send_flow_stats_poll();
+}
+
+void PhysicalSwitch::get_port_stats(PortStatsCallback callback) {
+	port_stats_cache.used = true;
+
+	if( cache_is_fresh(port_stats_cache, hypervisor->get_statistics_max_age()) ) {
+		callback(port_stats_cache.entries);
+		return;
+	}
+
+	// Wait for the poll in progress or start a new one
+	port_stats_cache.waiting.push_back(callback);
+	send_port_stats_poll();
+}
+
+bool PhysicalSwitch::is_port_shared(uint32_t port_no) const {
+	auto it = needed_ports.find(port_no);
+	return it != needed_ports.end() && it->second.size() > 1;
+}
+
+void PhysicalSwitch::handle_multipart_reply_flow(fluid_msg::of13::MultipartReplyFlow& multipart_reply_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart reply flow";
+
+	if( !flow_stats_cache.polling || multipart_reply_message.xid() != flow_stats_cache.xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested flow statistics";
+		return;
+	}
+
+	// Add this part of the reply to the poll in progress
+	std::vector<fluid_msg::of13::FlowStats> flow_stats =
+		multipart_reply_message.flow_stats();
+	flow_stats_cache.incoming.insert(
+		flow_stats_cache.incoming.end(),
+		flow_stats.begin(),
+		flow_stats.end());
+
+	// The last part doesn't have the more flag set
+	if( !(multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE) ) {
+		complete_poll(flow_stats_cache);
+	}
+}
+
+void PhysicalSwitch::handle_multipart_reply_port_stats(fluid_msg::of13::MultipartReplyPortStats& multipart_reply_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart reply port stats";
+
+	if( !port_stats_cache.polling || multipart_reply_message.xid() != port_stats_cache.xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested port statistics";
+		return;
+	}
+
+	// Add this part of the reply to the poll in progress
+	std::vector<fluid_msg::of13::PortStats> port_stats =
+		multipart_reply_message.port_stats();
+	port_stats_cache.incoming.insert(
+		port_stats_cache.incoming.end(),
+		port_stats.begin(),
+		port_stats.end());
+
+	// The last part doesn't have the more flag set
+	if( !(multipart_reply_message.flags() & fluid_msg::of13::OFPMPF_REPLY_MORE) ) {
+		complete_poll(port_stats_cache);
+	}
+}
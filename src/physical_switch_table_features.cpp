@@ -0,0 +1,200 @@
+#include "physical_switch.hpp"
+#include "hypervisor.hpp"
+
+#include "tag.hpp"
+
+#include <algorithm>
+
+#include <boost/log/trivial.hpp>
+
+uint8_t PhysicalSwitch::get_tenant_table_count() const {
+	return tenant_tables.size();
+}
+
+uint8_t PhysicalSwitch::get_physical_table(uint8_t tenant_table) const {
+	if( tenant_table < tenant_tables.size() ) {
+		return tenant_tables[tenant_table];
+	}
+	return features.n_tables;
+}
+
+bool PhysicalSwitch::get_tenant_table(uint8_t physical_table, uint8_t& tenant_table) const {
+	// The mapped tables are in order
+	auto table_it = std::lower_bound(
+		tenant_tables.begin(),
+		tenant_tables.end(),
+		physical_table);
+	if( table_it == tenant_tables.end() || *table_it != physical_table ) {
+		return false;
+	}
+	tenant_table = table_it - tenant_tables.begin();
+	return true;
+}
+
+const TableFeatures* PhysicalSwitch::get_table_features(uint8_t table_id) const {
+	auto table_it = table_features.find(table_id);
+	return table_it == table_features.end() ? nullptr : &table_it->second;
+}
+
+bool PhysicalSwitch::get_tenant_table_features(uint8_t tenant_table, TableFeatures& table) const {
+	if( tenant_table >= tenant_tables.size() ) {
+		return false;
+	}
+	const TableFeatures* physical_table = get_table_features(tenant_tables[tenant_table]);
+	if( physical_table == nullptr ) {
+		return false;
+	}
+	table = *physical_table;
+	table.table_id = tenant_table;
+
+	// The bits of the hypervisor are below the bits of the controllers
+	constexpr int total_bits = MetadataTag::num_virtual_switch_bits + 1;
+	table.metadata_match >>= total_bits;
+	table.metadata_write >>= total_bits;
+
+	// Every rule takes multiple entries
+	table.max_entries /= entries_per_tenant_flow;
+
+	for( auto& property_pair : table.properties ) {
+		std::set<uint32_t>& ids = property_pair.second;
+		switch( property_pair.first ) {
+		case fluid_msg::of13::OFPTFPT_INSTRUCTIONS:
+		case fluid_msg::of13::OFPTFPT_INSTRUCTIONS_MISS:
+			// The meters are used by the hypervisor itself
+			ids.erase(fluid_msg::of13::OFPIT_METER);
+			break;
+		case fluid_msg::of13::OFPTFPT_NEXT_TABLES:
+		case fluid_msg::of13::OFPTFPT_NEXT_TABLES_MISS:
+			{
+				// Only the tables of the controllers can be reached
+				std::set<uint32_t> tenant_ids;
+				for( uint32_t physical_id : ids ) {
+					uint8_t tenant_id;
+					if( get_tenant_table(physical_id, tenant_id) ) {
+						tenant_ids.insert(tenant_id);
+					}
+				}
+				ids = tenant_ids;
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
+void PhysicalSwitch::map_tenant_tables() {
+	tenant_tables.clear();
+
+	// The hypervisor matches on these bits in every rule of a controller
+	constexpr int total_bits = MetadataTag::num_virtual_switch_bits + 1;
+	constexpr uint64_t hypervisor_bits = (uint64_t(1)<<total_bits) - 1;
+
+	// The first table is reached from the rules of the ports
+	uint8_t previous_table = get_transit_table();
+	for( uint16_t table_id=get_reserved_tables(); table_id<features.n_tables; ++table_id ) {
+		const TableFeatures* table = get_table_features(table_id);
+		if( table != nullptr ) {
+			const TableFeatures* previous = get_table_features(previous_table);
+			bool usable =
+				table->max_entries > 0 &&
+				(table->metadata_match & hypervisor_bits) == hypervisor_bits &&
+				table->can_match(fluid_msg::of13::OFPXMT_OFB_METADATA, true) &&
+				(previous == nullptr || previous->supports(fluid_msg::of13::OFPTFPT_NEXT_TABLES, table_id));
+			if( !usable ) {
+				BOOST_LOG_TRIVIAL(info) << *this << " can't use table "
+					<< table_id << " (" << table->name << ") for the controllers";
+				continue;
+			}
+		}
+
+		tenant_tables.push_back(table_id);
+		previous_table = table_id;
+	}
+
+	BOOST_LOG_TRIVIAL(info) << *this << " maps " << tenant_tables.size()
+		<< " tables of the controllers, starting at table "
+		<< (tenant_tables.empty() ? 0 : (int) tenant_tables.front());
+}
+
+void PhysicalSwitch::start_using_switch() {
+	if( !features_received || table_features_pending ) {
+		return;
+	}
+
+	// The layout has to be known before any rule is installed
+	choose_table_layout();
+	map_tenant_tables();
+
+	// The port rules send the packets of the hosts to the first
+	// table of the controllers, without one this isn't going to work
+	if( tenant_tables.empty() ) {
+		BOOST_LOG_TRIVIAL(error) << *this
+			<< " has no table the controllers can use, closing the connection";
+		stop();
+		return;
+	}
+
+	// Find the entries that are already in the tables
+	if( knows_table_capacity() ) {
+		send_table_stats_request();
+	}
+
+	// Virtual switches can't use this switch before the
+	// rules are reconciled, so register it afterwards
+	if( reconciling ) {
+		reconcile_features_received = true;
+		check_reconcile_complete();
+		return;
+	}
+
+	// Create the initial rules, the dynamic rules are
+	// created when the routes are calculated below
+	create_static_rules();
+
+	// Register this physical switch at the hypervisor
+	hypervisor->register_physical_switch(features.datapath_id,id);
+	state = registered;
+	restore_links();
+
+	// This can potentially allow a virtual switch that only depends
+	// on this switch to come online. Execute check_online for all
+	// virtual switches.
+	//for( Slice& s : hypervisor->get_slices() ) s.check_online();
+	hypervisor->calculate_routes();
+}
+
+void PhysicalSwitch::handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_reply_message) {
+	BOOST_LOG_TRIVIAL(trace) << *this << " received multipart reply table features";
+
+	if( !table_features_pending ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested table features";
+		return;
+	}
+
+	uint32_t xid;
+	uint16_t flags;
+	std::vector<TableFeatures> tables;
+	if( !parse_table_features_message(multipart_reply_message, xid, flags, tables) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " sent malformed table features, assuming all tables fit";
+		table_features_pending = false;
+		table_features.clear();
+		start_using_switch();
+		return;
+	}
+	if( xid != table_features_xid ) {
+		BOOST_LOG_TRIVIAL(warning) << *this << " received unrequested table features";
+		return;
+	}
+
+	for( TableFeatures& table : tables ) {
+		table_features[table.table_id] = table;
+	}
+
+	// The last part doesn't have the more flag set
+	if( !(flags & fluid_msg::of13::OFPMPF_REPLY_MORE) ) {
+		table_features_pending = false;
+		start_using_switch();
+	}
+}
@@ -5,6 +5,7 @@
 #include "tag.hpp"
 
 #include <vector>
+#include <cstddef>
 
 #include <boost/make_shared.hpp>
 #include <boost/log/trivial.hpp>
@@ -15,7 +16,12 @@ void PhysicalSwitch::make_topology_discovery_rule() {
 	flowmod.command(fluid_msg::of13::OFPFC_ADD);
 	flowmod.table_id(0);
 	flowmod.cookie(1);
-	flowmod.priority(20);
+	// Links are found on the ports of hosts as well, so the rule
+	// needs a higher priority than the port rules
+	flowmod.priority(
+		single_reserved_table ?
+			single_table_topology_priority :
+			20);
 	flowmod.buffer_id(OFP_NO_BUFFER);
 
 	// Create the match
@@ -32,7 +38,7 @@ void PhysicalSwitch::make_topology_discovery_rule() {
 	flowmod.add_instruction(write_actions);
 
 	// Send the message
-	send_message(flowmod);
+	send_hypervisor_flow_mod(flowmod);
 }
 
 void PhysicalSwitch::schedule_topology_discovery_message() {
@@ -55,7 +61,34 @@ void PhysicalSwitch::schedule_topology_discovery_message() {
 			boost::asio::placeholders::error));
 }
 
+namespace {
+	/// The start of a topology discovery packet
+	struct TopologyDiscoveryHeader {
+		uint8_t mac_dst[6];
+		uint8_t mac_src[6];
+		uint8_t ether_type[2];
+		uint8_t vlan_tag[2];
+		uint8_t inner_ether_type[2];
+		uint8_t inner_vlan_tag[2];
+		/// The length and the LLC/SNAP header
+		uint8_t llc_snap[8];
+		/// The ARP ethertype and the fixed part of the ARP header
+		uint8_t arp_header[10];
+		uint8_t arp_sender_mac[6];
+		uint8_t arp_sender_ip[4];
+	};
+	// The packet below is written and read with these offsets
+	static_assert(
+		offsetof(TopologyDiscoveryHeader, vlan_tag) == 14 &&
+		offsetof(TopologyDiscoveryHeader, inner_vlan_tag) == 18 &&
+		offsetof(TopologyDiscoveryHeader, arp_sender_ip) == 44,
+		"the topology discovery header doesn't match the packet");
+}
+
 // A random ARP packet with a VLAN tag. The VLAN id=0
+// The sender protocol address (bytes 44-47) carries the
+// full number of the port the packet is sent over, the
+// VLAN tag only has room for the index of needed ports
 std::vector<uint8_t> topology_discovery_packet = {
 	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x05,
 	0x02, 0x71, 0xfc, 0xdb, 0x81, 0x00, 0x00, 0x10, 0x81, 0x00, 0x00, 0x10,
@@ -88,15 +121,31 @@ void PhysicalSwitch::send_topology_discovery_message(
 	for( int i=0; i<topology_discovery_port; ++i ) ++it;
 	uint32_t port_number = it->first;
 
-	// Create the data and mask with the slice/switch/port information
+	// Create the data and mask with the slice/switch information
+	TopologyDiscoveryHeader* packet =
+		(TopologyDiscoveryHeader*) &topology_discovery_packet[0];
 	VLANTag vlan_tag;
 	vlan_tag.set_switch(id);
-	vlan_tag.set_port(port_number);
 	vlan_tag.set_slice(VLANTag::max_slice_id);
 	uint16_t vlan_tag_raw = vlan_tag.make_raw();
 	// Set the vlan values in the packet
-	topology_discovery_packet[14] = (vlan_tag_raw>>8) & 0xff;
-	topology_discovery_packet[15] = vlan_tag_raw & 0xff;
+	packet->vlan_tag[0] = (vlan_tag_raw>>8) & 0xff;
+	packet->vlan_tag[1] = vlan_tag_raw & 0xff;
+
+	// The switch is in the inner tag in the double tag layout
+	if( VLANTag::double_tag ) {
+		SwitchVLANTag switch_tag;
+		switch_tag.set_switch(id);
+		uint16_t switch_tag_raw = switch_tag.make_raw();
+		packet->inner_vlan_tag[0] = (switch_tag_raw>>8) & 0xff;
+		packet->inner_vlan_tag[1] = switch_tag_raw & 0xff;
+	}
+
+	// Set the port number in the ARP payload
+	packet->arp_sender_ip[0] = (port_number>>24) & 0xff;
+	packet->arp_sender_ip[1] = (port_number>>16) & 0xff;
+	packet->arp_sender_ip[2] = (port_number>>8) & 0xff;
+	packet->arp_sender_ip[3] = port_number & 0xff;
 
 	// Create the packet out message
 	fluid_msg::of13::PacketOut packet_out;
@@ -128,20 +177,27 @@ void PhysicalSwitch::handle_topology_discovery_packet_in(
 	uint32_t in_port = in_port_tlv->value();
 
 	// Try to parse the packet to see if it has a VLAN tag
-	struct EthernetHeader {
-		uint8_t mac_dst[6];
-		uint8_t mac_src[6];
-		uint8_t ether_type[2];
-		uint8_t vlan_tag[2];
-	};
-	EthernetHeader * packet = (EthernetHeader*) packet_in_message.data();
+	if( packet_in_message.data_len() < sizeof(TopologyDiscoveryHeader) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received truncated topology discovery packet";
+		return;
+	}
+	TopologyDiscoveryHeader * packet =
+		(TopologyDiscoveryHeader*) packet_in_message.data();
 	// Interpret the vlan tag disregarding endianness
 	uint16_t vlan_id_raw = packet->vlan_tag[0]*256+packet->vlan_tag[1];
 	VLANTag vlan_id(vlan_id_raw);
 
-	// Extract the relevant information from the VLAN tag
-	uint32_t port  = vlan_id.get_port();
+	// Extract the relevant information from the VLAN tag and payload
+	uint32_t port  =
+		(packet->arp_sender_ip[0]<<24) | (packet->arp_sender_ip[1]<<16) |
+		(packet->arp_sender_ip[2]<<8)  |  packet->arp_sender_ip[3];
 	int switch_num = vlan_id.get_switch();
+	if( VLANTag::double_tag ) {
+		uint16_t switch_tag_raw =
+			packet->inner_vlan_tag[0]*256+packet->inner_vlan_tag[1];
+		switch_num = SwitchVLANTag(switch_tag_raw).get_switch();
+	}
 
 	// Extract the slice id to see if this is for topology discovery
 	BOOST_LOG_TRIVIAL(trace) << *this
@@ -149,31 +205,29 @@ void PhysicalSwitch::handle_topology_discovery_packet_in(
 	BOOST_LOG_TRIVIAL(trace) << *this
 		<< "\t sw=" << switch_num << " p=" << port;
 
-	// Determine if this link already exists
+	// Determine if this link already exists, a link restored
+	// from the state journal can lead somewhere else now
 	auto it = ports.find(in_port);
-	if( it->second.link == nullptr ) {
-		// Create a discovered link
-		auto discovered_link = boost::make_shared<DiscoveredLink>(
-			socket.get_io_service(),
-			hypervisor,
-			id,
-			in_port,
-			switch_num,
-			port);
+	if( it->second.link != nullptr &&
+			!it->second.link->connects(id, in_port, switch_num, port) ) {
+		BOOST_LOG_TRIVIAL(info) << *this << " link on port "
+			<< in_port << " changed";
+		it->second.link->remove();
+	}
 
+	if( it->second.link == nullptr ) {
 		// Add the link to the switches
 		auto switch_2_pointer = hypervisor
 			->get_physical_switch(switch_num);
 		if( switch_2_pointer == nullptr ) {
-			BOOST_LOG_TRIVIAL(error) << discovered_link <<
+			BOOST_LOG_TRIVIAL(error) << *this <<
 				" cannot construct link to not existing switch";
 			return;
 		}
-		this->add_link( discovered_link );
-		switch_2_pointer->add_link(discovered_link);
-
-		// Start the timer on the link
-		discovered_link->reset_timer();
+		if( !create_link(in_port, switch_2_pointer, port) ) {
+			return;
+		}
+		hypervisor->record_link(id, in_port, switch_num, port);
 
 		// Recalculate the routes with this extra link
 		hypervisor->calculate_routes();
@@ -186,6 +240,68 @@ void PhysicalSwitch::handle_topology_discovery_packet_in(
 	}
 }
 
+bool PhysicalSwitch::create_link(
+		uint32_t port_number,
+		PhysicalSwitch::pointer other_switch,
+		uint32_t other_port_number) {
+	// The other switch has to know the port as well
+	if( other_switch->get_ports().count(other_port_number) == 0 ) {
+		BOOST_LOG_TRIVIAL(error) << *this <<
+			" cannot construct link to not existing port";
+		return false;
+	}
+
+	// Create a discovered link
+	auto discovered_link = boost::make_shared<DiscoveredLink>(
+		socket.get_io_service(),
+		hypervisor,
+		id,
+		port_number,
+		other_switch->get_id(),
+		other_port_number);
+
+	// Add the link to the switches
+	this->add_link( discovered_link );
+	other_switch->add_link(discovered_link);
+
+	// Start the timer on the link
+	discovered_link->reset_timer();
+	return true;
+}
+
+bool PhysicalSwitch::restore_links() {
+	if( state != registered ) {
+		return false;
+	}
+
+	bool restored = false;
+	for( auto& port_pair : ports ) {
+		if( port_pair.second.link != nullptr ) continue;
+
+		auto other_ends = hypervisor->get_journaled_links(
+			features.datapath_id,
+			port_pair.first);
+		for( const auto& other_end : other_ends ) {
+			// The other switch has to be registered as well
+			auto other_switch = hypervisor
+				->get_physical_switch_by_datapath_id(other_end.first);
+			if( other_switch == nullptr ) continue;
+
+			// And the port on the other switch can't be in use
+			auto other_port = other_switch->get_ports().find(other_end.second);
+			if( other_port == other_switch->get_ports().end() ||
+					other_port->second.link != nullptr ) continue;
+
+			if( create_link(port_pair.first, other_switch, other_end.second) ) {
+				BOOST_LOG_TRIVIAL(info) << *this << " restored link to " << *other_switch;
+				restored = true;
+				break;
+			}
+		}
+	}
+	return restored;
+}
+
 void PhysicalSwitch::add_link(boost::shared_ptr<DiscoveredLink> discovered_link) {
 	uint32_t discovered_port = discovered_link->get_port_number(id);
 	auto it = ports.find(discovered_port);
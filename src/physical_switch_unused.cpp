@@ -271,7 +271,7 @@ void PhysicalSwitch::handle_multipart_request_meter_features(fluid_msg::of13::Mu
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_request_message);
 }
-void PhysicalSwitch::handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message) {
+void PhysicalSwitch::handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request table features it shouldn't";
 
 	// Send an error explaining this message is unsupported
@@ -308,15 +308,6 @@ void PhysicalSwitch::handle_multipart_reply_desc(fluid_msg::of13::MultipartReply
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_reply_message);
 }
-void PhysicalSwitch::handle_multipart_reply_flow(fluid_msg::of13::MultipartReplyFlow& multipart_reply_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply flow it shouldn't";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_reply_message);
-}
 void PhysicalSwitch::handle_multipart_reply_aggregate(fluid_msg::of13::MultipartReplyAggregate& multipart_reply_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply aggregate it shouldn't";
 
@@ -326,24 +317,6 @@ void PhysicalSwitch::handle_multipart_reply_aggregate(fluid_msg::of13::Multipart
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_reply_message);
 }
-void PhysicalSwitch::handle_multipart_reply_table(fluid_msg::of13::MultipartReplyTable& multipart_reply_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply table it shouldn't";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_reply_message);
-}
-void PhysicalSwitch::handle_multipart_reply_port_stats(fluid_msg::of13::MultipartReplyPortStats& multipart_reply_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply ports stats it shouldn't";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_reply_message);
-}
 void PhysicalSwitch::handle_multipart_reply_queue(fluid_msg::of13::MultipartReplyQueue& multipart_reply_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply queue it shouldn't";
 
@@ -362,15 +335,6 @@ void PhysicalSwitch::handle_multipart_reply_group(fluid_msg::of13::MultipartRepl
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_reply_message);
 }
-void PhysicalSwitch::handle_multipart_reply_group_desc(fluid_msg::of13::MultipartReplyGroupDesc& multipart_reply_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply group desc it shouldn't";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_reply_message);
-}
 void PhysicalSwitch::handle_multipart_reply_meter(fluid_msg::of13::MultipartReplyMeter& multipart_reply_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply meter it shouldn't";
 
@@ -380,24 +344,6 @@ void PhysicalSwitch::handle_multipart_reply_meter(fluid_msg::of13::MultipartRepl
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_reply_message);
 }
-void PhysicalSwitch::handle_multipart_reply_meter_config(fluid_msg::of13::MultipartReplyMeterConfig& multipart_reply_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply meter config it shouldn't";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_reply_message);
-}
-void PhysicalSwitch::handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_reply_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply table features it shouldn't";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_reply_message);
-}
 void PhysicalSwitch::handle_multipart_reply_experimenter(fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply experimenter  it shouldn't";
 
@@ -0,0 +1,513 @@
+#include <map>
+#include <set>
+#include <queue>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "configuration.hpp"
+#include "tag.hpp"
+
+/// The filename of the configuration file
+std::string configuration_file;
+/// The filename of the topology description
+std::string topology_file;
+
+/// A physical switch as the planner sees it
+struct PlannedSwitch {
+	/// The ports of the switch from the topology description
+	std::set<uint32_t> ports;
+	/// The ports with a link to another switch, port -> other switch
+	std::map<uint32_t,uint64_t> link_ports;
+	/// The switches with a link to this switch
+	std::set<uint64_t> neighbours;
+	/// The amount of tables the switch advertises
+	int n_tables;
+	/// The ports virtual switches output to, port -> amount of virtual switches
+	std::map<uint32_t,int> needed_ports;
+	/// The amount of ports of every virtual switch with ports on this switch
+	std::vector<size_t> virtual_switch_ports;
+	/// The distance to every switch that can be reached, including itself
+	std::map<uint64_t,int> distances;
+	/// The port of the first link towards every other switch that can be reached
+	std::map<uint64_t,uint32_t> next_ports;
+	/// The amount of flood trees this switch is part of
+	size_t flood_trees;
+};
+
+/// The predicted rules of a single physical switch
+struct SwitchPlan {
+	/// If the switch gets the single reserved table layout
+	bool single_table;
+	size_t table_0_flows;
+	size_t table_1_flows;
+	size_t groups;
+	size_t meters;
+};
+
+/// Parse the command line arguments
+/**
+ * The options are stored in global variables.
+ * \param argc The argument count as passed to main
+ * \param argv The arguments as passed to main
+ * \return If the parsing was successful
+ */
+bool parse_arguments(int argc, char* argv[]) {
+	// Define the command line options
+	boost::program_options::options_description desc("Allowed options");
+	desc.add_options()
+		("help,h", "Produce this help message")
+		("config_file,f", boost::program_options::value<std::string>(&configuration_file), "Configuration file path")
+		("topology_file,t", boost::program_options::value<std::string>(&topology_file), "Topology description file path");
+
+	// The configuration and topology can be passed without naming them
+	boost::program_options::positional_options_description p;
+	p.add("config_file", 1);
+	p.add("topology_file", 1);
+
+	// Try to parse the command line options
+	boost::program_options::variables_map vm;
+	try {
+		boost::program_options::store(
+			boost::program_options::command_line_parser(argc, argv)
+				.options(desc)
+				.positional(p)
+				.run(),
+			vm);
+		boost::program_options::notify(vm);
+	}
+	catch( const boost::program_options::error& e ) {
+		std::cerr << e.what() << std::endl << std::endl;
+		std::cout << desc << std::endl;
+		return false;
+	}
+
+	// Print a help message if needed
+	if( vm.count("help")) {
+		std::cout << desc << std::endl;
+		return false;
+	}
+
+	// Check if both files were passed
+	if( !vm.count("config_file") || !vm.count("topology_file") ) {
+		std::cerr << "A config file and a topology file must be passed" << std::endl << std::endl;
+		std::cout << desc << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/// Read the switches and links from a topology description
+/**
+ * The description lists every switch with its ports and the links
+ * between them, the same way they are discovered by the hypervisor.
+ * A switch can list the amount of tables it advertises.
+ */
+std::map<uint64_t,PlannedSwitch> parse_topology(
+		const boost::property_tree::ptree& topology_tree) {
+	std::map<uint64_t,PlannedSwitch> switches;
+
+	for( const auto& switch_pair : topology_tree.get_child("switches") ) {
+		auto& switch_ptree = switch_pair.second;
+
+		PlannedSwitch& planned_switch =
+			switches[switch_ptree.get<uint64_t>("datapath_id")];
+		for( const auto& port_pair : switch_ptree.get_child("ports") ) {
+			planned_switch.ports.insert(port_pair.second.get_value<uint32_t>());
+		}
+		planned_switch.n_tables    = switch_ptree.get<int>("n_tables", 255);
+		planned_switch.flood_trees = 0;
+	}
+
+	for( const auto& link_pair : topology_tree.get_child("links") ) {
+		auto& link_ptree = link_pair.second;
+
+		uint64_t datapath_id_1 = link_ptree.get<uint64_t>("datapath_id_1");
+		uint32_t port_1        = link_ptree.get<uint32_t>("port_1");
+		uint64_t datapath_id_2 = link_ptree.get<uint64_t>("datapath_id_2");
+		uint32_t port_2        = link_ptree.get<uint32_t>("port_2");
+
+		auto it_1 = switches.find(datapath_id_1);
+		auto it_2 = switches.find(datapath_id_2);
+		if( it_1 == switches.end() || it_2 == switches.end() ||
+				it_1->second.ports.count(port_1) == 0 ||
+				it_2->second.ports.count(port_2) == 0 ) {
+			throw std::runtime_error(
+				"Link between " + std::to_string(datapath_id_1) +
+				" and " + std::to_string(datapath_id_2) +
+				" uses a port that isn't in the topology");
+		}
+
+		it_1->second.link_ports[port_1] = datapath_id_2;
+		it_1->second.neighbours.insert(datapath_id_2);
+		it_2->second.link_ports[port_2] = datapath_id_1;
+		it_2->second.neighbours.insert(datapath_id_1);
+	}
+
+	// Every switch gets a forwarding rule for the switches it can
+	// reach, the routes are the shortest paths like the hypervisor
+	// calculates them
+	for( auto& switch_pair : switches ) {
+		PlannedSwitch& planned_switch = switch_pair.second;
+		planned_switch.distances[switch_pair.first] = 0;
+		std::queue<uint64_t> queue;
+		queue.push(switch_pair.first);
+		while( !queue.empty() ) {
+			uint64_t current = queue.front();
+			queue.pop();
+			for( const auto& link_pair : switches.at(current).link_ports ) {
+				uint64_t neighbour = link_pair.second;
+				if( planned_switch.distances.count(neighbour) > 0 ) continue;
+
+				planned_switch.distances[neighbour] =
+					planned_switch.distances.at(current) + 1;
+				planned_switch.next_ports[neighbour] =
+					current == switch_pair.first ?
+						link_pair.first :
+						planned_switch.next_ports.at(current);
+				queue.push(neighbour);
+			}
+		}
+	}
+
+	return switches;
+}
+
+/// Find the switches of the tree a virtual switch floods over
+/**
+ * This follows VirtualSwitch::get_flood_switch and
+ * VirtualSwitch::calculate_flood_tree, the root is the switch with
+ * ports that is closest to the other switches with ports and every
+ * other switch with ports joins the tree over its route to the root.
+ * \return The switches in the tree, empty if the virtual switch
+ *   floods to every port separately
+ */
+std::set<uint64_t> plan_flood_tree(
+		const std::map<uint64_t,PlannedSwitch>& switches,
+		const std::set<uint64_t>& dependent_switches) {
+	// The switches that can't reach each other are counted as far away
+	const int unreachable = switches.size();
+	auto distance = [&](uint64_t from, uint64_t to) {
+		const auto& distances = switches.at(from).distances;
+		auto distance_it = distances.find(to);
+		return distance_it == distances.end() ? unreachable : distance_it->second;
+	};
+
+	std::set<uint64_t> tree;
+	if( dependent_switches.empty() ) return tree;
+
+	uint64_t root = 0;
+	int root_distance = 0;
+	for( uint64_t datapath_id : dependent_switches ) {
+		int sum = 0;
+		for( uint64_t other_datapath_id : dependent_switches ) {
+			sum += distance(datapath_id, other_datapath_id);
+		}
+		if( datapath_id == *dependent_switches.begin() || sum < root_distance ) {
+			root          = datapath_id;
+			root_distance = sum;
+		}
+	}
+
+	tree.insert(root);
+
+	for( uint64_t datapath_id : dependent_switches ) {
+		uint64_t current = datapath_id;
+		while( tree.count(current) == 0 ) {
+			// A switch that can't reach the root can't get floods
+			const PlannedSwitch& planned_switch = switches.at(current);
+			auto next_it = planned_switch.next_ports.find(root);
+			if( next_it == planned_switch.next_ports.end() ) {
+				return std::set<uint64_t>();
+			}
+			tree.insert(current);
+			current = planned_switch.link_ports.at(next_it->second);
+		}
+	}
+
+	// With a single switch flooding to every port is the same
+	if( tree.size() == 1 ) {
+		tree.clear();
+	}
+	return tree;
+}
+
+/// Predict the rules the hypervisor installs in a physical switch
+/**
+ * This follows PhysicalSwitch::choose_table_layout,
+ * PhysicalSwitch::create_static_rules,
+ * PhysicalSwitch::register_interest,
+ * PhysicalSwitch::update_dynamic_rules and
+ * PhysicalSwitch::update_flood_tree_rules with all virtual switches
+ * online. The rules of the controllers in the tenant tables are
+ * not included.
+ */
+SwitchPlan plan_switch(
+		const PlannedSwitch& planned_switch,
+		const std::vector<SliceConfiguration>& configurations,
+		bool use_meters,
+		int error_packet_in_rate,
+		int single_table_max_tables) {
+	SwitchPlan plan;
+	plan.single_table =
+		planned_switch.n_tables <= single_table_max_tables &&
+		!VLANTag::double_tag;
+
+	// The rules of the transit table, it is table 0 itself in the
+	// single reserved table layout
+	size_t transit_flows;
+
+	// The topology discovery and error rules, with 2 reserved tables
+	// the second table also gets an error rule and table 0 a rule
+	// for the packets from the controller
+	if( plan.single_table ) {
+		plan.table_0_flows = 2;
+		transit_flows      = 0;
+	}
+	else {
+		plan.table_0_flows = 3;
+		transit_flows      = 1;
+	}
+	// The group to the controller
+	plan.groups = 1;
+
+	// A rule per port in table 0, the links also get a rule that
+	// removes the outer tag in the double tag layout. In the single
+	// reserved table layout the links don't have a rule.
+	plan.table_0_flows += planned_switch.ports.size();
+	if( plan.single_table ) {
+		plan.table_0_flows -= planned_switch.link_ports.size();
+	}
+	if( VLANTag::double_tag ) {
+		plan.table_0_flows += planned_switch.link_ports.size();
+	}
+
+	for( const auto& needed_port_pair : planned_switch.needed_ports ) {
+		// A needed port that doesn't exist has no rules
+		if( planned_switch.ports.count(needed_port_pair.first) == 0 ) continue;
+
+		// The rules outputting to the port index, one per slice
+		transit_flows += configurations.size();
+
+		// The rules accepting packets from a shared link, one per
+		// virtual switch that uses the port
+		if( planned_switch.link_ports.count(needed_port_pair.first) > 0 ) {
+			transit_flows += needed_port_pair.second;
+		}
+	}
+
+	// The rules forwarding to other switches, the double tag layout
+	// also has a group per switch that adds the outer tag
+	size_t reachable_switches = planned_switch.distances.size()-1;
+	transit_flows += reachable_switches;
+	if( VLANTag::double_tag ) {
+		plan.groups += reachable_switches;
+	}
+
+	// A flood group and an output group per virtual port for every
+	// virtual switch with ports on this switch
+	for( size_t num_ports : planned_switch.virtual_switch_ports ) {
+		plan.groups += 1 + num_ports;
+	}
+
+	// The group and rule of every flood tree this switch is part of,
+	// also the trees it only passes through
+	plan.groups   += planned_switch.flood_trees;
+	transit_flows += planned_switch.flood_trees;
+
+	if( plan.single_table ) {
+		plan.table_0_flows += transit_flows;
+		plan.table_1_flows  = 0;
+	}
+	else {
+		plan.table_1_flows = transit_flows;
+	}
+
+	// The meters of the error rules and the slices
+	plan.meters = 0;
+	if( use_meters ) {
+		if( error_packet_in_rate > 0 ) {
+			++plan.meters;
+		}
+		for( const auto& slice : configurations ) {
+			plan.meters += slice.packet_in_rate > 0 ? 2 : 1;
+		}
+	}
+
+	return plan;
+}
+
+/// Print a count and flag it if it is over the limit
+void print_usage(
+		const std::string& name,
+		size_t count,
+		size_t limit,
+		std::vector<std::string>& problems) {
+	std::cout << "\t" << name << ": " << count << " of " << limit;
+	if( count > limit ) {
+		std::cout << " OVERFLOW";
+		problems.push_back("Too many " + name + ", the limit is " + std::to_string(limit));
+	}
+	std::cout << std::endl;
+}
+
+/// Main entry point of the planner
+/**
+ * \param argc Amount of command line arguments passed
+ * \param argv Argument values passed
+ * \return 0 if the configuration fits, 1 otherwise
+ */
+int main(int argc, char* argv[]) {
+	// Try to parse the arguments
+	if( !parse_arguments(argc, argv) )
+		return 1;
+
+	// Read the configuration and topology like the hypervisor does
+	std::vector<SliceConfiguration> configurations;
+	std::map<uint64_t,PlannedSwitch> switches;
+	bool use_meters;
+	int error_packet_in_rate;
+	int single_table_max_tables;
+	try {
+		boost::property_tree::ptree config_tree;
+		boost::property_tree::json_parser::read_json(configuration_file, config_tree);
+		configurations       = parse_slice_configurations(config_tree);
+		use_meters           = config_tree.get<bool>("use_meters");
+		error_packet_in_rate = config_tree.get<int>("error_packet_in_rate", 100);
+		single_table_max_tables = config_tree.get<int>("single_table_max_tables", 0);
+
+		boost::property_tree::ptree topology_tree;
+		boost::property_tree::json_parser::read_json(topology_file, topology_tree);
+		switches = parse_topology(topology_tree);
+	}
+	catch( const std::exception& e ) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	// Register the ports of the virtual switches at the physical switches
+	std::vector<std::string> problems = check_tag_limits(configurations);
+	size_t num_virtual_switches = 0;
+	// The switches of the flood tree of every virtual switch, (datapath id, switches)
+	std::vector<std::pair<uint64_t,std::set<uint64_t>>> flood_trees;
+	for( const auto& slice : configurations ) {
+		for( const auto& virtual_switch : slice.virtual_switches ) {
+			++num_virtual_switches;
+
+			std::set<uint64_t> dependent_switches;
+			for( const auto& port_pair : virtual_switch.ports ) {
+				uint64_t datapath_id = port_pair.second.first;
+				uint32_t port_no     = port_pair.second.second;
+
+				auto switch_it = switches.find(datapath_id);
+				if( switch_it == switches.end() ) {
+					problems.push_back(
+						"Virtual switch " + std::to_string(virtual_switch.datapath_id) +
+						" uses switch " + std::to_string(datapath_id) +
+						" that isn't in the topology");
+					continue;
+				}
+				if( switch_it->second.ports.count(port_no) == 0 ) {
+					problems.push_back(
+						"Virtual switch " + std::to_string(virtual_switch.datapath_id) +
+						" uses port " + std::to_string(port_no) +
+						" that switch " + std::to_string(datapath_id) + " doesn't have");
+				}
+				++switch_it->second.needed_ports[port_no];
+				dependent_switches.insert(datapath_id);
+			}
+
+			for( uint64_t datapath_id : dependent_switches ) {
+				switches.at(datapath_id).virtual_switch_ports.push_back(
+					virtual_switch.ports.size());
+			}
+			flood_trees.push_back(std::make_pair(
+				virtual_switch.datapath_id,
+				plan_flood_tree(switches, dependent_switches)));
+		}
+	}
+
+	// Every switch in a tree takes a port index after the ports got
+	// theirs, a tree with a switch that has none left isn't used and
+	// the virtual switch floods to every port separately
+	for( const auto& flood_tree_pair : flood_trees ) {
+		bool fits = true;
+		for( uint64_t datapath_id : flood_tree_pair.second ) {
+			const PlannedSwitch& planned_switch = switches.at(datapath_id);
+			if( planned_switch.needed_ports.size() + planned_switch.flood_trees >=
+					VLANTag::max_port_id ) {
+				fits = false;
+			}
+		}
+		if( !fits ) {
+			problems.push_back(
+				"Virtual switch " + std::to_string(flood_tree_pair.first) +
+				" can't flood over a tree, a switch in it has no port index left");
+			continue;
+		}
+		for( uint64_t datapath_id : flood_tree_pair.second ) {
+			++switches.at(datapath_id).flood_trees;
+		}
+	}
+
+	// Print the use of the tags, the highest value of every field is reserved
+	std::cout << "Tag layout (" << (VLANTag::double_tag ? "double" : "single") << " tag)" << std::endl;
+	print_usage("physical switches", switches.size(), SwitchVLANTag::max_switch_id, problems);
+	print_usage("slices", configurations.size(), VLANTag::max_slice_id-1, problems);
+	print_usage("virtual switches", num_virtual_switches, MetadataTag::max_virtual_switch_id, problems);
+	std::cout << std::endl;
+
+	// Print the predicted rules per physical switch
+	SwitchPlan total = {0, 0, 0, 0};
+	for( const auto& switch_pair : switches ) {
+		const PlannedSwitch& planned_switch = switch_pair.second;
+		SwitchPlan plan = plan_switch(
+			planned_switch,
+			configurations,
+			use_meters,
+			error_packet_in_rate,
+			single_table_max_tables);
+
+		std::cout << "Physical switch " << switch_pair.first << std::endl;
+		std::cout << "\tports: " << planned_switch.ports.size()
+			<< " (" << planned_switch.link_ports.size() << " links)" << std::endl;
+		std::cout << "\treserved tables: " << (plan.single_table ? 1 : 2) << std::endl;
+		print_usage(
+			"port indices",
+			planned_switch.needed_ports.size() + planned_switch.flood_trees,
+			VLANTag::max_port_id,
+			problems);
+		std::cout << "\ttable 0 flows: " << plan.table_0_flows << std::endl;
+		std::cout << "\ttable 1 flows: " << plan.table_1_flows << std::endl;
+		std::cout << "\tgroups: " << plan.groups << std::endl;
+		std::cout << "\tmeters: " << plan.meters << std::endl;
+		std::cout << std::endl;
+
+		total.table_0_flows += plan.table_0_flows;
+		total.table_1_flows += plan.table_1_flows;
+		total.groups        += plan.groups;
+		total.meters        += plan.meters;
+	}
+
+	std::cout << "Total" << std::endl;
+	std::cout << "\tflows: " << total.table_0_flows+total.table_1_flows << std::endl;
+	std::cout << "\tgroups: " << total.groups << std::endl;
+	std::cout << "\tmeters: " << total.meters << std::endl;
+	std::cout << "The rules of the controllers in the tenant tables are not included" << std::endl;
+
+	if( !problems.empty() ) {
+		std::cout << std::endl << "Problems" << std::endl;
+		for( const std::string& problem : problems ) {
+			std::cout << "\t" << problem << std::endl;
+		}
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,214 @@
+#include "raw_packet_in.hpp"
+
+namespace {
+	/// The offsets of the fixed fields in a PacketIn
+	constexpr size_t length_offset    = 2;
+	constexpr size_t buffer_id_offset = 8;
+	constexpr size_t reason_offset    = 14;
+	constexpr size_t cookie_offset    = 16;
+	constexpr size_t match_offset     = 24;
+	/// The size of the type and length of the match
+	constexpr size_t match_header_length = 4;
+	/// The size of the header of an OXM field
+	constexpr size_t oxm_header_length = 4;
+	/// The padding between the match and the packet data
+	constexpr size_t data_padding = 2;
+
+	/// The OXM values of the fields used by the hypervisor
+	constexpr uint16_t oxm_class_openflow_basic = 0x8000;
+	constexpr uint8_t oxm_field_in_port  = 0;
+	constexpr uint8_t oxm_field_metadata = 2;
+	/// The match type that contains OXM fields
+	constexpr uint16_t match_type_oxm = 1;
+
+	/// The offsets and values of the packet headers used in the flow hash
+	constexpr size_t ethernet_header_length = 14;
+	constexpr size_t vlan_header_length     = 4;
+	constexpr uint16_t ethertype_vlan  = 0x8100;
+	constexpr uint16_t ethertype_qinq  = 0x88a8;
+	constexpr uint16_t ethertype_ipv4  = 0x0800;
+	constexpr size_t ipv4_header_length = 20;
+	constexpr uint8_t ip_proto_tcp = 6;
+	constexpr uint8_t ip_proto_udp = 17;
+
+	/// Add bytes to a FNV-1a hash
+	uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t length) {
+		for( size_t i=0; i<length; ++i ) {
+			hash = (hash ^ data[i]) * 16777619u;
+		}
+		return hash;
+	}
+}
+
+RawPacketIn::RawPacketIn(std::vector<uint8_t>& message) :
+	message(message),
+	in_port_offset(0),
+	metadata_offset(0),
+	metadata_has_mask(false),
+	data_offset(0) {
+}
+
+uint64_t RawPacketIn::read(size_t offset, size_t bytes) const {
+	uint64_t value = 0;
+	for( size_t i=0; i<bytes; ++i ) {
+		value = (value<<8) | message[offset+i];
+	}
+	return value;
+}
+
+void RawPacketIn::write(size_t offset, size_t bytes, uint64_t value) {
+	for( size_t i=bytes; i>0; --i ) {
+		message[offset+i-1] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+bool RawPacketIn::parse() {
+	if( message.size() < match_offset + match_header_length ) {
+		return false;
+	}
+
+	size_t match_type   = read(match_offset, 2);
+	size_t match_length = read(match_offset+2, 2);
+	if( match_type != match_type_oxm || match_length < match_header_length ) {
+		return false;
+	}
+
+	// The match is padded to a multiple of 8 bytes
+	size_t padded_match_length = ((match_length+7)/8)*8;
+	data_offset = match_offset + padded_match_length + data_padding;
+	if( data_offset > message.size() ) {
+		return false;
+	}
+
+	// Walk over the OXM fields to find the ones we need
+	size_t offset    = match_offset + match_header_length;
+	size_t match_end = match_offset + match_length;
+	while( offset + oxm_header_length <= match_end ) {
+		uint16_t oxm_class  = read(offset, 2);
+		uint8_t  oxm_field  = message[offset+2] >> 1;
+		bool     has_mask   = message[offset+2] & 1;
+		uint8_t  oxm_length = message[offset+3];
+
+		if( offset + oxm_header_length + oxm_length > match_end ) {
+			return false;
+		}
+
+		if( oxm_class == oxm_class_openflow_basic ) {
+			if( oxm_field == oxm_field_in_port && oxm_length == 4 ) {
+				in_port_offset = offset + oxm_header_length;
+			}
+			else if( oxm_field == oxm_field_metadata &&
+					oxm_length == (has_mask ? 16 : 8) ) {
+				metadata_offset   = offset + oxm_header_length;
+				metadata_has_mask = has_mask;
+			}
+		}
+
+		offset += oxm_header_length + oxm_length;
+	}
+
+	return true;
+}
+
+uint8_t RawPacketIn::get_reason() const {
+	return message[reason_offset];
+}
+
+uint32_t RawPacketIn::get_buffer_id() const {
+	return read(buffer_id_offset, 4);
+}
+
+void RawPacketIn::set_buffer_id(uint32_t buffer_id) {
+	write(buffer_id_offset, 4, buffer_id);
+}
+
+uint64_t RawPacketIn::get_cookie() const {
+	return read(cookie_offset, 8);
+}
+
+void RawPacketIn::set_cookie(uint64_t cookie) {
+	write(cookie_offset, 8, cookie);
+}
+
+bool RawPacketIn::has_in_port() const {
+	return in_port_offset != 0;
+}
+
+uint32_t RawPacketIn::get_in_port() const {
+	return read(in_port_offset, 4);
+}
+
+void RawPacketIn::set_in_port(uint32_t in_port) {
+	write(in_port_offset, 4, in_port);
+}
+
+bool RawPacketIn::has_metadata() const {
+	return metadata_offset != 0;
+}
+
+uint64_t RawPacketIn::get_metadata() const {
+	return read(metadata_offset, 8);
+}
+
+uint64_t RawPacketIn::get_metadata_mask() const {
+	return metadata_has_mask ? read(metadata_offset+8, 8) : UINT64_MAX;
+}
+
+size_t RawPacketIn::get_data_length() const {
+	return message.size() - data_offset;
+}
+
+const uint8_t* RawPacketIn::get_data() const {
+	return message.data() + data_offset;
+}
+
+void RawPacketIn::truncate_data(size_t max_length) {
+	if( get_data_length() <= max_length ) {
+		return;
+	}
+	message.resize(data_offset + max_length);
+	write(length_offset, 2, message.size());
+}
+
+uint32_t RawPacketIn::get_flow_hash() const {
+	const uint8_t* data = get_data();
+	size_t length       = get_data_length();
+	uint32_t hash       = 2166136261u;
+
+	if( length < ethernet_header_length ) {
+		return hash;
+	}
+	// The destination and source mac address
+	hash = fnv1a(hash, data, 12);
+
+	// Skip over the vlan tags to find the ethertype
+	size_t offset      = 12;
+	uint16_t ethertype = (data[offset]<<8) | data[offset+1];
+	while( (ethertype == ethertype_vlan || ethertype == ethertype_qinq) &&
+			offset + vlan_header_length + 2 <= length ) {
+		offset   += vlan_header_length;
+		ethertype = (data[offset]<<8) | data[offset+1];
+	}
+	offset += 2;
+	hash = fnv1a(hash, data+offset-2, 2);
+
+	if( ethertype != ethertype_ipv4 || offset + ipv4_header_length > length ) {
+		return hash;
+	}
+	const uint8_t* ip = data + offset;
+	// The protocol, source and destination address
+	hash = fnv1a(hash, ip+9, 1);
+	hash = fnv1a(hash, ip+12, 8);
+
+	// Only the first fragment contains the transport header
+	size_t ip_header_length = (ip[0] & 0x0f) * 4;
+	bool is_fragment        = ((ip[6] & 0x1f) | ip[7]) != 0;
+	if( (ip[9] != ip_proto_tcp && ip[9] != ip_proto_udp) ||
+			is_fragment ||
+			offset + ip_header_length + 4 > length ) {
+		return hash;
+	}
+	// The source and destination port
+	return fnv1a(hash, ip+ip_header_length, 4);
+}
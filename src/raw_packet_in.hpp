@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/// Access the fields of a packed PacketIn message in place
+/**
+ * Forwarding a PacketIn only requires changing a few fields,
+ * unpacking and repacking the complete message including the
+ * packet data with libfluid is a lot of work for that. This
+ * class finds the fields in the buffer as it was received
+ * and changes them there.
+ */
+class RawPacketIn {
+private:
+	/// The message as it goes over the wire
+	std::vector<uint8_t>& message;
+
+	/// The offsets of the OXM values, 0 if not present
+	size_t in_port_offset;
+	size_t metadata_offset;
+	/// If the metadata OXM has a mask
+	bool metadata_has_mask;
+	/// The offset of the packet data
+	size_t data_offset;
+
+	/// Read a big endian value from the message
+	uint64_t read(size_t offset, size_t bytes) const;
+	/// Write a big endian value in the message
+	void write(size_t offset, size_t bytes, uint64_t value);
+
+public:
+	/// Wrap a buffer containing a complete PacketIn message
+	explicit RawPacketIn(std::vector<uint8_t>& message);
+
+	/// Find the fields in the message
+	/**
+	 * Returns false if the message is malformed.
+	 */
+	bool parse();
+
+	uint8_t get_reason() const;
+
+	uint32_t get_buffer_id() const;
+	void set_buffer_id(uint32_t buffer_id);
+
+	uint64_t get_cookie() const;
+	void set_cookie(uint64_t cookie);
+
+	bool has_in_port() const;
+	uint32_t get_in_port() const;
+	void set_in_port(uint32_t in_port);
+
+	bool has_metadata() const;
+	uint64_t get_metadata() const;
+	uint64_t get_metadata_mask() const;
+
+	/// Return the amount of packet bytes in the message
+	size_t get_data_length() const;
+	/// Return a pointer to the packet bytes
+	const uint8_t* get_data() const;
+	/// Cut the packet data to at most max_length bytes
+	void truncate_data(size_t max_length);
+
+	/// Hash the addresses and ports of the packet
+	/**
+	 * Packets of the same flow have the same hash, this looks
+	 * at the ethernet, IPv4 and TCP/UDP headers when present.
+	 */
+	uint32_t get_flow_hash() const;
+};
@@ -1,9 +1,17 @@
 #include "slice.hpp"
+#include "tag.hpp"
 
 #include <string>
+#include <algorithm>
 
 #include <boost/asio.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// The maximum amount of PacketIns queued per slice
+	constexpr size_t max_packet_in_queue = 1024;
+}
 
 Slice::Slice(
 		int id,
@@ -16,7 +24,13 @@ Slice::Slice(
 		max_rate(max_rate),
 		controller_endpoint(boost::asio::ip::address_v4::from_string(ip_address), port),
 		hypervisor(hypervisor),
-		started(false) {
+		started(false),
+		packet_in_deficit(0),
+		packet_in_rate(0),
+		packet_in_forwarded(0),
+		packet_in_dropped(0),
+		auxiliary_connections(0),
+		max_flows(0) {
 }
 
 int Slice::get_id() const {
@@ -27,6 +41,24 @@ int Slice::get_max_rate() const {
 	return max_rate;
 }
 
+void Slice::set_max_rate(int max_rate) {
+	this->max_rate = max_rate;
+}
+
+int Slice::get_packet_in_rate() const {
+	return packet_in_rate;
+}
+
+uint32_t Slice::get_meter_id() const {
+	// Meter id's start at 1 and meter 1 is used by the hypervisor
+	return id+1;
+}
+
+uint32_t Slice::get_controller_meter_id() const {
+	// Place the controller meters after the data plane meters
+	return id+1+VLANTag::max_slice_id;
+}
+
 void Slice::add_new_virtual_switch(
 		boost::asio::io_service& io,
 		uint64_t datapath_id) {
@@ -37,15 +69,25 @@ void Slice::add_new_virtual_switch(
 			hypervisor,
 			this);
 
-	// Check directly if this switch could go online, this only
-	// makes sense if this slice has already been started but the
-	// check_online function itself checks that.
-	ptr->check_online();
+	// The switch has no ports yet, the caller checks if it can
+	// go online after the ports are added
 
 	// Store the new switch in the list
 	virtual_switches[datapath_id] = ptr;
 }
 
+void Slice::remove_virtual_switch(uint64_t datapath_id) {
+	auto it = virtual_switches.find(datapath_id);
+	if( it == virtual_switches.end() ) {
+		return;
+	}
+
+	// Close the controller connection and remove the
+	// rules of this switch from the physical switches
+	it->second->go_down();
+	virtual_switches.erase(it);
+}
+
 VirtualSwitch::pointer Slice::get_virtual_switch_by_datapath_id(uint64_t datapath_id) {
 	auto it = virtual_switches.find(datapath_id);
 	if( it == virtual_switches.end() ) {
@@ -64,6 +106,23 @@ const boost::asio::ip::tcp::endpoint& Slice::get_controller_endpoint() {
 	return controller_endpoint;
 }
 
+void Slice::set_auxiliary_connections(int auxiliary_connections) {
+	// Auxiliary ids are a single byte and 0 is the main connection
+	this->auxiliary_connections = std::max(0, std::min(auxiliary_connections, 255));
+}
+
+int Slice::get_auxiliary_connections() const {
+	return auxiliary_connections;
+}
+
+void Slice::set_max_flows(int max_flows) {
+	this->max_flows = std::max(0, max_flows);
+}
+
+int Slice::get_max_flows() const {
+	return max_flows;
+}
+
 void Slice::start() {
 	started = true;
 
@@ -79,6 +138,10 @@ void Slice::start() {
 void Slice::stop() {
 	started = false;
 
+	// The controller connections are closed, drop the waiting PacketIns
+	packet_in_queue.clear();
+	packet_in_deficit = 0;
+
 	// Stop all virtual switches in this slice
 	for( auto& sw : virtual_switches ) {
 		sw.second->go_down();
@@ -98,3 +161,62 @@ void Slice::check_online() {
 		sw.second->check_online();
 	}
 }
+
+void Slice::set_packet_in_limit(int rate, int burst) {
+	packet_in_rate = rate;
+	packet_in_bucket.configure(rate, burst);
+}
+
+bool Slice::enqueue_packet_in(
+		VirtualSwitch::pointer virtual_switch,
+		std::vector<uint8_t> message) {
+	if( packet_in_queue.size() >= max_packet_in_queue ||
+			!packet_in_bucket.consume() ) {
+		++packet_in_dropped;
+		BOOST_LOG_TRIVIAL(trace) << "Slice " << id
+			<< " dropped packet_in because of rate limit";
+		return false;
+	}
+
+	packet_in_queue.push_back(
+		PendingPacketIn{virtual_switch, std::move(message)});
+	return true;
+}
+
+bool Slice::forward_packet_ins(size_t quantum) {
+	if( packet_in_queue.empty() ) {
+		return false;
+	}
+
+	// The cost of a PacketIn is the amount of bytes it
+	// carries, so a slice sending large packets can't
+	// use more of the hypervisor than other slices
+	packet_in_deficit += quantum;
+	while( !packet_in_queue.empty() ) {
+		PendingPacketIn& pending = packet_in_queue.front();
+		size_t cost = pending.message.size();
+		if( cost > packet_in_deficit ) {
+			break;
+		}
+		packet_in_deficit -= cost;
+
+		pending.virtual_switch->forward_packet_in(pending.message);
+		++packet_in_forwarded;
+		packet_in_queue.pop_front();
+	}
+
+	// An empty queue can't save up deficit for later rounds
+	if( packet_in_queue.empty() ) {
+		packet_in_deficit = 0;
+		return false;
+	}
+	return true;
+}
+
+uint64_t Slice::get_packet_in_forwarded() const {
+	return packet_in_forwarded;
+}
+
+uint64_t Slice::get_packet_in_dropped() const {
+	return packet_in_dropped;
+}
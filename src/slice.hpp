@@ -1,11 +1,14 @@
 #pragma once
 
+#include <deque>
+#include <vector>
 #include <unordered_map>
 #include <string>
 
 #include <boost/asio.hpp>
 
 #include "virtual_switch.hpp"
+#include "token_bucket.hpp"
 
 class Slice {
 private:
@@ -26,6 +29,31 @@ private:
 	/// If this slice has been started
 	bool started;
 
+	/// A PacketIn waiting to be forwarded to the controller
+	struct PendingPacketIn {
+		VirtualSwitch::pointer virtual_switch;
+		/// The packed PacketIn message
+		std::vector<uint8_t> message;
+	};
+	/// The PacketIns of this slice waiting to be forwarded
+	std::deque<PendingPacketIn> packet_in_queue;
+	/// The bytes this slice can still forward in this round
+	size_t packet_in_deficit;
+	/// Limits the rate of PacketIns of the whole slice
+	TokenBucket packet_in_bucket;
+	/// The maximum amount of PacketIns per second, 0 is unlimited
+	int packet_in_rate;
+	/// The amount of PacketIns forwarded to the controller
+	uint64_t packet_in_forwarded;
+	/// The amount of PacketIns dropped because of the rate limit
+	uint64_t packet_in_dropped;
+
+	/// The amount of auxiliary connections per virtual switch
+	int auxiliary_connections;
+
+	/// The amount of rules the slice can have in a physical switch, 0 is unlimited
+	int max_flows;
+
 public:
 	/// Construct a new slice
 	Slice(
@@ -37,9 +65,19 @@ public:
 
 	int get_id() const;
 	int get_max_rate() const;
+	/// Change the maximum rate, the meters need to be updated separately
+	void set_max_rate(int max_rate);
+	int get_packet_in_rate() const;
+
+	/// The meter limiting the packets of this slice in the data plane
+	uint32_t get_meter_id() const;
+	/// The meter limiting the packets this slice sends to the controller
+	uint32_t get_controller_meter_id() const;
 
 	/// Add a new virtual switch to this slice
 	void add_new_virtual_switch(boost::asio::io_service& io, uint64_t datapath_id);
+	/// Stop and remove a virtual switch from this slice
+	void remove_virtual_switch(uint64_t datapath_id);
 	/// Retreive a virtual switch
 	VirtualSwitch::pointer get_virtual_switch_by_datapath_id(uint64_t datapath_id);
 
@@ -49,6 +87,15 @@ public:
 	 * their socket.
 	 */
 	const boost::asio::ip::tcp::endpoint& get_controller_endpoint();
+	/// Set the amount of auxiliary connections per virtual switch
+	void set_auxiliary_connections(int auxiliary_connections);
+	/// Get the amount of auxiliary connections per virtual switch
+	int get_auxiliary_connections() const;
+	/// Set the amount of rules the slice can have in a physical switch
+	void set_max_flows(int max_flows);
+	/// Get the amount of rules the slice can have in a physical switch
+	int get_max_flows() const;
+
 	/// Get the virtual switches
 	const std::unordered_map<uint64_t,VirtualSwitch::pointer>& get_virtual_switches() const;
 
@@ -61,4 +108,24 @@ public:
 
 	/// For all the virtual switches in this slice check_online
 	void check_online();
+
+	/// Limit the amount of PacketIns per second of this slice
+	void set_packet_in_limit(int rate, int burst);
+	/// Queue a PacketIn to be forwarded to the controller
+	/**
+	 * Returns false if the PacketIn was dropped because
+	 * the slice exceeded its rate or the queue is full.
+	 */
+	bool enqueue_packet_in(
+		VirtualSwitch::pointer virtual_switch,
+		std::vector<uint8_t> message);
+	/// Forward queued PacketIns for one deficit round robin round
+	/**
+	 * Returns if there are still PacketIns queued.
+	 */
+	bool forward_packet_ins(size_t quantum);
+	/// Return the amount of PacketIns forwarded to the controller
+	uint64_t get_packet_in_forwarded() const;
+	/// Return the amount of PacketIns dropped by the rate limit
+	uint64_t get_packet_in_dropped() const;
 };
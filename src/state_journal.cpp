@@ -0,0 +1,410 @@
+#include "state_journal.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/log/trivial.hpp>
+
+constexpr uint32_t StateJournal::magic;
+constexpr uint32_t StateJournal::version;
+
+StateJournal::StateJournal() :
+	fd(-1),
+	memory(nullptr),
+	memory_size(0),
+	capacity(0) {
+}
+
+StateJournal::~StateJournal() {
+	close();
+}
+
+StateJournal::Header* StateJournal::header() {
+	return (Header*) memory;
+}
+
+uint8_t* StateJournal::records() {
+	return memory + sizeof(Header);
+}
+
+StateJournal::Link StateJournal::make_link(LinkEnd end_1, LinkEnd end_2) {
+	if( end_2 < end_1 ) {
+		return Link(end_2, end_1);
+	}
+	return Link(end_1, end_2);
+}
+
+std::vector<uint8_t> StateJournal::make_link_payload(const Link& link) {
+	LinkRecord record;
+	std::memset(&record, 0, sizeof(record));
+	record.datapath_id_1 = link.first.first;
+	record.port_number_1 = link.first.second;
+	record.datapath_id_2 = link.second.first;
+	record.port_number_2 = link.second.second;
+
+	const uint8_t* bytes = (const uint8_t*) &record;
+	return std::vector<uint8_t>(bytes, bytes+sizeof(record));
+}
+
+std::vector<uint8_t> StateJournal::make_rule_payload(
+		const RuleId& rule,
+		const std::vector<uint8_t>& data) {
+	RuleRecord record;
+	std::memset(&record, 0, sizeof(record));
+	record.datapath_id = std::get<0>(rule);
+	record.kind        = std::get<1>(rule);
+	record.key_length  = std::get<2>(rule).size();
+	record.data_length = data.size();
+
+	const uint8_t* bytes = (const uint8_t*) &record;
+	std::vector<uint8_t> payload(bytes, bytes+sizeof(record));
+	payload.insert(payload.end(), std::get<2>(rule).begin(), std::get<2>(rule).end());
+	payload.insert(payload.end(), data.begin(), data.end());
+	return payload;
+}
+
+std::vector<uint8_t> StateJournal::make_binding_payload(
+		uint8_t kind,
+		uint64_t datapath_id,
+		int id) {
+	BindingRecord record;
+	std::memset(&record, 0, sizeof(record));
+	record.datapath_id = datapath_id;
+	record.id          = id;
+	record.kind        = kind;
+
+	const uint8_t* bytes = (const uint8_t*) &record;
+	return std::vector<uint8_t>(bytes, bytes+sizeof(record));
+}
+
+void StateJournal::apply_binding(uint8_t kind, uint64_t datapath_id, int id) {
+	// A datapath id that had this id before lost it
+	for( auto binding_it = bindings.begin(); binding_it != bindings.end(); ) {
+		if( binding_it->first.first == kind && binding_it->second == id ) {
+			binding_it = bindings.erase(binding_it);
+		}
+		else {
+			++binding_it;
+		}
+	}
+	bindings[std::make_pair(kind, datapath_id)] = id;
+}
+
+bool StateJournal::open(const std::string& filename, size_t size) {
+	close();
+
+	fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if( fd == -1 ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not open state journal "
+			<< filename << ": " << std::strerror(errno);
+		return false;
+	}
+
+	// Grow the file if it is too small, the file is never
+	// shrunk so a larger journal from before is kept intact
+	struct stat file_stat;
+	if( fstat(fd, &file_stat) == -1 ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not stat state journal "
+			<< filename << ": " << std::strerror(errno);
+		close();
+		return false;
+	}
+	bool existed = file_stat.st_size >= (off_t) sizeof(Header);
+	size = std::max(
+		(size_t) file_stat.st_size,
+		sizeof(Header) + size);
+	if( (size_t) file_stat.st_size < size && ftruncate(fd, size) == -1 ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not resize state journal "
+			<< filename << ": " << std::strerror(errno);
+		close();
+		return false;
+	}
+
+	void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if( mapped == MAP_FAILED ) {
+		BOOST_LOG_TRIVIAL(error) << "Could not map state journal "
+			<< filename << ": " << std::strerror(errno);
+		close();
+		return false;
+	}
+	memory           = (uint8_t*) mapped;
+	memory_size      = size;
+	capacity         = size-sizeof(Header);
+
+	// Start a new journal if the file doesn't contain one
+	if( !existed ||
+			header()->magic != magic ||
+			header()->version != version ||
+			header()->used > capacity ) {
+		if( existed ) {
+			BOOST_LOG_TRIVIAL(warning) << "Ignoring invalid state journal " << filename;
+		}
+		header()->magic        = magic;
+		header()->version      = version;
+		header()->used    = 0;
+	}
+
+	replay();
+
+	BOOST_LOG_TRIVIAL(info) << "Restored " << links.size()
+		<< " links, " << rules.size()
+		<< " rules and " << bindings.size()
+		<< " switch ids from state journal " << filename;
+	return true;
+}
+
+void StateJournal::close() {
+	if( memory != nullptr ) {
+		msync(memory, memory_size, MS_SYNC);
+		munmap(memory, memory_size);
+		memory      = nullptr;
+		memory_size = 0;
+		capacity    = 0;
+	}
+	if( fd != -1 ) {
+		::close(fd);
+		fd = -1;
+	}
+	links.clear();
+	rules.clear();
+	bindings.clear();
+}
+
+bool StateJournal::is_open() const {
+	return memory != nullptr;
+}
+
+void StateJournal::replay() {
+	links.clear();
+	rules.clear();
+	bindings.clear();
+
+	uint64_t offset = 0;
+	while( offset + sizeof(RecordHeader) <= header()->used ) {
+		const RecordHeader* record = (const RecordHeader*) (records() + offset);
+		if( record->length < sizeof(RecordHeader) ||
+				record->length % 8 != 0 ||
+				offset + record->length > header()->used ) {
+			BOOST_LOG_TRIVIAL(warning) << "Ignoring the end of the state journal "
+				<< "after a malformed record";
+			break;
+		}
+		const uint8_t* payload = records() + offset + sizeof(RecordHeader);
+		size_t payload_length  = record->length - sizeof(RecordHeader);
+		offset += record->length;
+
+		if( record->type == RecordHeader::link_up ||
+				record->type == RecordHeader::link_down ) {
+			if( payload_length < sizeof(LinkRecord) ) continue;
+			const LinkRecord* link_record = (const LinkRecord*) payload;
+			Link link = make_link(
+				LinkEnd(link_record->datapath_id_1, link_record->port_number_1),
+				LinkEnd(link_record->datapath_id_2, link_record->port_number_2));
+
+			if( record->type == RecordHeader::link_up ) {
+				links.insert(link);
+			}
+			else {
+				links.erase(link);
+			}
+		}
+		else if( record->type == RecordHeader::rule_set ||
+				record->type == RecordHeader::rule_remove ) {
+			if( payload_length < sizeof(RuleRecord) ) continue;
+			const RuleRecord* rule_record = (const RuleRecord*) payload;
+			if( sizeof(RuleRecord) + rule_record->key_length + rule_record->data_length > payload_length ) {
+				continue;
+			}
+			const char* key     = (const char*) payload + sizeof(RuleRecord);
+			const uint8_t* data = payload + sizeof(RuleRecord) + rule_record->key_length;
+			RuleId rule(
+				rule_record->datapath_id,
+				rule_record->kind,
+				std::string(key, rule_record->key_length));
+
+			if( record->type == RecordHeader::rule_set ) {
+				rules[rule].assign(data, data + rule_record->data_length);
+			}
+			else {
+				rules.erase(rule);
+			}
+		}
+		else if( record->type == RecordHeader::id_binding ) {
+			if( payload_length < sizeof(BindingRecord) ) continue;
+			const BindingRecord* binding_record = (const BindingRecord*) payload;
+			apply_binding(
+				binding_record->kind,
+				binding_record->datapath_id,
+				binding_record->id);
+		}
+	}
+}
+
+bool StateJournal::write(RecordHeader::Type type, const std::vector<uint8_t>& payload) {
+	size_t length = (sizeof(RecordHeader) + payload.size() + 7) / 8 * 8;
+	if( header()->used + length > capacity ) {
+		return false;
+	}
+
+	RecordHeader record;
+	std::memset(&record, 0, sizeof(record));
+	record.length = length;
+	record.type   = type;
+
+	// Write the record before it is counted, a crash in between
+	// only loses this record
+	uint8_t* destination = records() + header()->used;
+	std::memset(destination, 0, length);
+	std::memcpy(destination, &record, sizeof(record));
+	std::memcpy(destination + sizeof(record), payload.data(), payload.size());
+	header()->used += length;
+	return true;
+}
+
+void StateJournal::append(RecordHeader::Type type, const std::vector<uint8_t>& payload) {
+	if( write(type, payload) ) {
+		return;
+	}
+
+	// Compacting doesn't help if the live state fills the journal
+	compact();
+	if( !write(type, payload) ) {
+		BOOST_LOG_TRIVIAL(error) << "State journal is full, dropping record";
+	}
+}
+
+void StateJournal::compact() {
+	// A crash while compacting loses the state written over, the
+	// links are discovered again like without a journal
+	header()->used = 0;
+	for( const Link& link : links ) {
+		if( !write(RecordHeader::link_up, make_link_payload(link)) ) return;
+	}
+	for( const auto& rule_pair : rules ) {
+		if( !write(RecordHeader::rule_set, make_rule_payload(rule_pair.first, rule_pair.second)) ) return;
+	}
+	for( const auto& binding_pair : bindings ) {
+		if( !write(RecordHeader::id_binding, make_binding_payload(
+				binding_pair.first.first,
+				binding_pair.first.second,
+				binding_pair.second)) ) return;
+	}
+}
+
+void StateJournal::add_link(LinkEnd end_1, LinkEnd end_2) {
+	if( !is_open() ) return;
+
+	Link link = make_link(end_1, end_2);
+	if( links.insert(link).second ) {
+		append(RecordHeader::link_up, make_link_payload(link));
+	}
+}
+
+void StateJournal::remove_link(LinkEnd end_1, LinkEnd end_2) {
+	if( !is_open() ) return;
+
+	Link link = make_link(end_1, end_2);
+	if( links.erase(link) > 0 ) {
+		append(RecordHeader::link_down, make_link_payload(link));
+	}
+}
+
+std::vector<StateJournal::LinkEnd> StateJournal::get_links(LinkEnd end) const {
+	std::vector<LinkEnd> other_ends;
+	for( const Link& link : links ) {
+		if( link.first == end ) {
+			other_ends.push_back(link.second);
+		}
+		else if( link.second == end ) {
+			other_ends.push_back(link.first);
+		}
+	}
+	return other_ends;
+}
+
+void StateJournal::set_rule(
+		uint64_t datapath_id,
+		RuleKind kind,
+		const std::string& key,
+		const std::vector<uint8_t>& data) {
+	if( !is_open() ) return;
+
+	// Restoring a rule sets it again without changing it
+	RuleId rule(datapath_id, kind, key);
+	auto rule_it = rules.find(rule);
+	if( rule_it != rules.end() && rule_it->second == data ) {
+		return;
+	}
+
+	rules[rule] = data;
+	append(RecordHeader::rule_set, make_rule_payload(rule, data));
+}
+
+void StateJournal::remove_rule(
+		uint64_t datapath_id,
+		RuleKind kind,
+		const std::string& key) {
+	if( !is_open() ) return;
+
+	RuleId rule(datapath_id, kind, key);
+	if( rules.erase(rule) > 0 ) {
+		append(RecordHeader::rule_remove, make_rule_payload(rule, std::vector<uint8_t>()));
+	}
+}
+
+std::vector<std::vector<uint8_t>> StateJournal::get_rules(
+		uint64_t datapath_id,
+		RuleKind kind) const {
+	std::vector<std::vector<uint8_t>> datas;
+	auto rule_it = rules.lower_bound(RuleId(datapath_id, kind, std::string()));
+	while( rule_it != rules.end() &&
+			std::get<0>(rule_it->first) == datapath_id &&
+			std::get<1>(rule_it->first) == kind ) {
+		datas.push_back(rule_it->second);
+		++rule_it;
+	}
+	return datas;
+}
+
+void StateJournal::set_binding(BindingKind kind, uint64_t datapath_id, int id) {
+	if( !is_open() ) return;
+
+	if( get_binding(kind, datapath_id) == id ) {
+		return;
+	}
+
+	apply_binding(kind, datapath_id, id);
+	append(RecordHeader::id_binding, make_binding_payload(kind, datapath_id, id));
+}
+
+int StateJournal::get_binding(BindingKind kind, uint64_t datapath_id) const {
+	auto binding_it = bindings.find(std::make_pair((uint8_t) kind, datapath_id));
+	if( binding_it == bindings.end() ) {
+		return -1;
+	}
+	return binding_it->second;
+}
+
+bool StateJournal::is_bound(BindingKind kind, int id) const {
+	for( const auto& binding_pair : bindings ) {
+		if( binding_pair.first.first == kind && binding_pair.second == id ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void StateJournal::sync() {
+	if( !is_open() ) return;
+
+	if( msync(memory, memory_size, MS_ASYNC) == -1 ) {
+		BOOST_LOG_TRIVIAL(warning) << "Could not sync state journal: "
+			<< std::strerror(errno);
+	}
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <utility>
+
+/// A journal of the state of the hypervisor that survives a crash
+/**
+ * The links between the physical switches are normally only known
+ * after they are discovered again, which takes multiple topology
+ * discovery periods after a restart. This journal keeps the known
+ * links in a memory-mapped file so they can be restored as soon as
+ * both switches of a link are connected again. A restored link that
+ * doesn't exist anymore simply times out.
+ *
+ * The journal also keeps the mirrors of the rules and groups of the
+ * controllers, so a virtual switch can take them over when its
+ * controller connects after a restart.
+ *
+ * The file contains a header followed by records that are only
+ * appended, writing a record is a copy into the mapped memory. Every
+ * record starts with its length, rounded up to 8 bytes. When the
+ * file is full the live state is written again from the start of
+ * the file.
+ *
+ * Links are stored by datapath id and rules by the datapath id of
+ * their virtual switch. The internal switch id's are kept as a
+ * binding to the datapath id, so a switch gets the same id in the
+ * next run and the cookies, groups and tags it left in the physical
+ * switches still refer to it.
+ */
+class StateJournal {
+public:
+	/// One end of a link, (datapath id, port number)
+	typedef std::pair<uint64_t,uint32_t> LinkEnd;
+	/// A link, the lowest end is always first
+	typedef std::pair<LinkEnd,LinkEnd> Link;
+
+	/// The kinds of rules of the controllers kept in the journal
+	enum RuleKind : uint8_t {
+		flow_rule  = 1,
+		group_rule = 2
+	};
+	/// The kinds of internal id's bound to a datapath id
+	enum BindingKind : uint8_t {
+		virtual_switch_binding  = 1,
+		physical_switch_binding = 2
+	};
+
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		/// The amount of bytes of records written after the header
+		uint64_t used;
+	};
+	struct RecordHeader {
+		enum Type : uint8_t {
+			link_up     = 1,
+			link_down   = 2,
+			rule_set    = 3,
+			rule_remove = 4,
+			id_binding  = 5
+		};
+		/// The length of the record including this header
+		uint32_t length;
+		uint8_t  type;
+		uint8_t  padding[3];
+	};
+	struct LinkRecord {
+		uint64_t datapath_id_1;
+		uint64_t datapath_id_2;
+		uint32_t port_number_1;
+		uint32_t port_number_2;
+	};
+	/// Followed by the key and for rule_set the packed message
+	struct RuleRecord {
+		uint64_t datapath_id;
+		uint32_t key_length;
+		uint32_t data_length;
+		uint8_t  kind;
+		uint8_t  padding[7];
+	};
+
+	struct BindingRecord {
+		uint64_t datapath_id;
+		uint32_t id;
+		uint8_t  kind;
+		uint8_t  padding[3];
+	};
+
+	/// A rule, (virtual switch datapath id, kind, key)
+	typedef std::tuple<uint64_t,uint8_t,std::string> RuleId;
+
+	static constexpr uint32_t magic   = 0x44565346; // "DVSF"
+	static constexpr uint32_t version = 2;
+
+	/// The file descriptor of the journal, -1 if not open
+	int fd;
+	/// The mapped memory of the file
+	uint8_t* memory;
+	/// The size of the mapped memory
+	size_t memory_size;
+	/// The amount of bytes of records that fit in the file
+	size_t capacity;
+
+	/// The links as they are currently known
+	std::set<Link> links;
+	/// The rules as they are currently known, rule -> packed message
+	std::map<RuleId,std::vector<uint8_t>> rules;
+	/// The id bindings as they are currently known, (kind, datapath id) -> id
+	std::map<std::pair<uint8_t,uint64_t>,int> bindings;
+
+	Header* header();
+	uint8_t* records();
+
+	/// Normalize a link so both directions result in the same key
+	static Link make_link(LinkEnd end_1, LinkEnd end_2);
+
+	/// Create the payload of a link record
+	static std::vector<uint8_t> make_link_payload(const Link& link);
+	/// Create the payload of a rule record
+	static std::vector<uint8_t> make_rule_payload(
+		const RuleId& rule,
+		const std::vector<uint8_t>& data);
+
+	/// Create the payload of a binding record
+	static std::vector<uint8_t> make_binding_payload(
+		uint8_t kind,
+		uint64_t datapath_id,
+		int id);
+	/// Bind an id to a datapath id, an id belongs to one datapath id
+	void apply_binding(uint8_t kind, uint64_t datapath_id, int id);
+
+	/// Write a record if it fits
+	/**
+	 * \return False if the journal has no room for it
+	 */
+	bool write(RecordHeader::Type type, const std::vector<uint8_t>& payload);
+	/// Append a record, compacts the journal if it is full
+	void append(RecordHeader::Type type, const std::vector<uint8_t>& payload);
+	/// Write only the live state to the journal
+	void compact();
+	/// Rebuild the known state from the records in the file
+	void replay();
+
+public:
+	/// Create a journal that is not backed by a file
+	StateJournal();
+	/// Unmap the journal
+	~StateJournal();
+
+	/// Open or create the journal file
+	/**
+	 * \param filename The file to store the journal in
+	 * \param size The size of the file in bytes
+	 * \return If the file could be opened, the journal is
+	 *   disabled otherwise
+	 */
+	bool open(const std::string& filename, size_t size);
+	/// Unmap and close the file
+	void close();
+	/// Return if the journal is backed by a file
+	bool is_open() const;
+
+	/// Record a discovered link
+	void add_link(LinkEnd end_1, LinkEnd end_2);
+	/// Record that a link disappeared
+	void remove_link(LinkEnd end_1, LinkEnd end_2);
+	/// Return the other ends of the known links at a port
+	std::vector<LinkEnd> get_links(LinkEnd end) const;
+
+	/// Record a rule of a controller as a packed message
+	/**
+	 * The key identifies the rule within the virtual switch, a
+	 * rule with the same key is replaced.
+	 */
+	void set_rule(
+		uint64_t datapath_id,
+		RuleKind kind,
+		const std::string& key,
+		const std::vector<uint8_t>& data);
+	/// Record that a rule of a controller was removed
+	void remove_rule(
+		uint64_t datapath_id,
+		RuleKind kind,
+		const std::string& key);
+	/// Return the packed messages of the rules of a virtual switch
+	std::vector<std::vector<uint8_t>> get_rules(
+		uint64_t datapath_id,
+		RuleKind kind) const;
+
+	/// Record the internal id of the switch with a datapath id
+	void set_binding(BindingKind kind, uint64_t datapath_id, int id);
+	/// Return the id bound to a datapath id, -1 if there is none
+	int get_binding(BindingKind kind, uint64_t datapath_id) const;
+	/// Return if an id is bound to a datapath id
+	bool is_bound(BindingKind kind, int id) const;
+
+	/// Start writing the changed pages to the file
+	/**
+	 * This doesn't wait for the write to complete, the kernel
+	 * writes the pages even if the hypervisor crashes.
+	 */
+	void sync();
+};
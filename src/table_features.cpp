@@ -0,0 +1,372 @@
+#include "table_features.hpp"
+
+#include <algorithm>
+
+#include <fluid/of13msg.hh>
+
+namespace {
+	/// The size of the header of a multipart message
+	constexpr size_t multipart_header_length = 16;
+	/// The maximum size of the body of a single multipart message
+	constexpr size_t max_multipart_body = UINT16_MAX - multipart_header_length;
+	/// The size of the fixed part of a table features entry
+	constexpr size_t table_header_length = 64;
+	/// The size of the name of a table
+	constexpr size_t table_name_length = 32;
+	/// The size of the header of a property
+	constexpr size_t property_header_length = 4;
+
+	/// The OXM class used by experimenter fields
+	constexpr uint16_t oxm_class_experimenter = 0xffff;
+	/// The has mask bit in an OXM header
+	constexpr uint32_t oxm_has_mask = 0x100;
+
+	/// How the ids in a property are encoded
+	enum PropertyKind {
+		instruction_ids,
+		table_ids,
+		action_ids,
+		oxm_ids,
+		unknown_ids
+	};
+
+	PropertyKind get_property_kind(uint16_t property_type) {
+		switch( property_type ) {
+		case fluid_msg::of13::OFPTFPT_INSTRUCTIONS:
+		case fluid_msg::of13::OFPTFPT_INSTRUCTIONS_MISS:
+			return instruction_ids;
+		case fluid_msg::of13::OFPTFPT_NEXT_TABLES:
+		case fluid_msg::of13::OFPTFPT_NEXT_TABLES_MISS:
+			return table_ids;
+		case fluid_msg::of13::OFPTFPT_WRITE_ACTIONS:
+		case fluid_msg::of13::OFPTFPT_WRITE_ACTIONS_MISS:
+		case fluid_msg::of13::OFPTFPT_APPLY_ACTIONS:
+		case fluid_msg::of13::OFPTFPT_APPLY_ACTIONS_MISS:
+			return action_ids;
+		case fluid_msg::of13::OFPTFPT_MATCH:
+		case fluid_msg::of13::OFPTFPT_WILDCARDS:
+		case fluid_msg::of13::OFPTFPT_WRITE_SETFIELD:
+		case fluid_msg::of13::OFPTFPT_WRITE_SETFIELD_MISS:
+		case fluid_msg::of13::OFPTFPT_APPLY_SETFIELD:
+		case fluid_msg::of13::OFPTFPT_APPLY_SETFIELD_MISS:
+			return oxm_ids;
+		default:
+			return unknown_ids;
+		}
+	}
+
+	/// Read a big endian value from a buffer
+	uint64_t read(const uint8_t* buffer, size_t bytes) {
+		uint64_t value = 0;
+		for( size_t i=0; i<bytes; ++i ) {
+			value = (value<<8) | buffer[i];
+		}
+		return value;
+	}
+
+	/// Append a big endian value to a buffer
+	void append(std::vector<uint8_t>& buffer, uint64_t value, size_t bytes) {
+		for( size_t i=bytes; i>0; --i ) {
+			buffer.push_back((value>>(8*(i-1))) & 0xff);
+		}
+	}
+
+	/// Write a big endian value in a buffer
+	void write(std::vector<uint8_t>& buffer, size_t offset, uint64_t value, size_t bytes) {
+		for( size_t i=bytes; i>0; --i ) {
+			buffer[offset+i-1] = value & 0xff;
+			value >>= 8;
+		}
+	}
+
+	/// Parse the ids in the body of a property
+	/**
+	 * \return False if the ids don't fit in the property
+	 */
+	bool parse_ids(
+			PropertyKind kind,
+			const uint8_t* data,
+			size_t length,
+			std::set<uint32_t>& ids) {
+		size_t offset = 0;
+		while( offset < length ) {
+			if( kind == table_ids ) {
+				ids.insert(data[offset]);
+				++offset;
+				continue;
+			}
+
+			if( offset + 4 > length ) {
+				return false;
+			}
+
+			if( kind == oxm_ids ) {
+				uint32_t header = read(&data[offset], 4);
+				if( (header>>16) == oxm_class_experimenter ) {
+					// The experimenter id follows the header
+					offset += 8;
+					continue;
+				}
+				uint8_t value_length = header & 0xff;
+				if( header & oxm_has_mask ) {
+					value_length /= 2;
+				}
+				ids.insert((header & ~0xffu) | value_length);
+				offset += 4;
+				continue;
+			}
+
+			// Instructions and actions have a type and a length, the
+			// experimenter ones are longer and are skipped
+			uint16_t type      = read(&data[offset], 2);
+			uint16_t id_length = read(&data[offset+2], 2);
+			if( type != fluid_msg::of13::OFPIT_EXPERIMENTER &&
+					type != fluid_msg::of13::OFPAT_EXPERIMENTER ) {
+				ids.insert(type);
+			}
+			offset += id_length < 4 ? 4 : id_length;
+		}
+		return offset == length;
+	}
+
+	/// Parse the table features entries in the body of a multipart message
+	bool parse_tables(
+			const uint8_t* body,
+			size_t length,
+			std::vector<TableFeatures>& tables) {
+		size_t offset = 0;
+		while( offset < length ) {
+			if( offset + table_header_length > length ) {
+				return false;
+			}
+			const uint8_t* data = &body[offset];
+			size_t table_length = read(data, 2);
+			if( table_length < table_header_length || offset + table_length > length ) {
+				return false;
+			}
+
+			TableFeatures table;
+			table.table_id = data[2];
+			const char* name = (const char*) &data[8];
+			size_t name_length = 0;
+			while( name_length < table_name_length && name[name_length] != '\0' ) {
+				++name_length;
+			}
+			table.name.assign(name, name_length);
+			table.metadata_match = read(&data[40], 8);
+			table.metadata_write = read(&data[48], 8);
+			table.config         = read(&data[56], 4);
+			table.max_entries    = read(&data[60], 4);
+
+			size_t property_offset = table_header_length;
+			while( property_offset < table_length ) {
+				if( property_offset + property_header_length > table_length ) {
+					return false;
+				}
+				uint16_t property_type   = read(&data[property_offset], 2);
+				size_t   property_length = read(&data[property_offset+2], 2);
+				if( property_length < property_header_length ||
+						property_offset + property_length > table_length ) {
+					return false;
+				}
+
+				PropertyKind kind = get_property_kind(property_type);
+				if( kind != unknown_ids &&
+						!parse_ids(
+							kind,
+							&data[property_offset+property_header_length],
+							property_length-property_header_length,
+							table.properties[property_type]) ) {
+					return false;
+				}
+
+				// The properties are padded to a multiple of 8 bytes
+				property_offset += ((property_length+7)/8)*8;
+			}
+
+			tables.push_back(table);
+			offset += table_length;
+		}
+		return true;
+	}
+
+	/// Append a table features entry as it goes over the wire
+	void pack_table(const TableFeatures& table, std::vector<uint8_t>& buffer) {
+		size_t start = buffer.size();
+
+		append(buffer, 0, 2); // The length is set below
+		append(buffer, table.table_id, 1);
+		append(buffer, 0, 5);
+		std::string name = table.name.substr(0, table_name_length-1);
+		buffer.insert(buffer.end(), name.begin(), name.end());
+		append(buffer, 0, table_name_length-name.size());
+		append(buffer, table.metadata_match, 8);
+		append(buffer, table.metadata_write, 8);
+		append(buffer, table.config, 4);
+		append(buffer, table.max_entries, 4);
+
+		for( const auto& property_pair : table.properties ) {
+			PropertyKind kind = get_property_kind(property_pair.first);
+			size_t property_start = buffer.size();
+
+			append(buffer, property_pair.first, 2);
+			append(buffer, 0, 2); // The length is set below
+			for( uint32_t id : property_pair.second ) {
+				if( kind == table_ids ) {
+					append(buffer, id, 1);
+				}
+				else if( kind == oxm_ids ) {
+					uint8_t value_length = id & 0xff;
+					append(
+						buffer,
+						(id & ~0xffu) | (id & oxm_has_mask ? 2*value_length : value_length),
+						4);
+				}
+				else {
+					append(buffer, id, 2);
+					append(buffer, 4, 2);
+				}
+			}
+
+			write(buffer, property_start+2, buffer.size()-property_start, 2);
+			buffer.resize(property_start + ((buffer.size()-property_start+7)/8)*8, 0);
+		}
+
+		write(buffer, start, buffer.size()-start, 2);
+	}
+
+	/// Start a multipart message with a table features body
+	std::vector<uint8_t> make_multipart_header(uint8_t type, uint32_t xid, uint16_t flags) {
+		std::vector<uint8_t> message;
+		append(message, fluid_msg::of13::OFP_VERSION, 1);
+		append(message, type, 1);
+		append(message, multipart_header_length, 2);
+		append(message, xid, 4);
+		append(message, fluid_msg::of13::OFPMP_TABLE_FEATURES, 2);
+		append(message, flags, 2);
+		append(message, 0, 4);
+		return message;
+	}
+}
+
+bool TableFeatures::supports(uint16_t property_type, uint32_t id) const {
+	auto property_it = properties.find(property_type);
+	return property_it == properties.end() || property_it->second.count(id) > 0;
+}
+
+bool TableFeatures::can_match(uint8_t field, bool masked) const {
+	auto property_it = properties.find(fluid_msg::of13::OFPTFPT_MATCH);
+	if( property_it == properties.end() ) {
+		return true;
+	}
+
+	// The value length isn't known here, look at the class and field
+	uint32_t class_field = make_oxm_id(field, false, 0) >> 9;
+	for( uint32_t id : property_it->second ) {
+		if( (id>>9) == class_field && (!masked || (id & oxm_has_mask)) ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t make_oxm_id(uint8_t field, bool has_mask, uint8_t value_length) {
+	return
+		(uint32_t(fluid_msg::of13::OFPXMC_OPENFLOW_BASIC)<<16) |
+		(uint32_t(field)<<9) |
+		(has_mask ? oxm_has_mask : 0) |
+		value_length;
+}
+
+bool parse_table_features_message(
+		const std::vector<uint8_t>& message,
+		uint32_t& xid,
+		uint16_t& flags,
+		std::vector<TableFeatures>& tables) {
+	if( message.size() < multipart_header_length ||
+			read(&message[2], 2) != message.size() ) {
+		return false;
+	}
+
+	xid   = read(&message[4], 4);
+	flags = read(&message[10], 2);
+	return parse_tables(
+		&message[multipart_header_length],
+		message.size()-multipart_header_length,
+		tables);
+}
+
+std::vector<std::vector<uint8_t>> pack_table_features_reply(
+		uint32_t xid,
+		const std::vector<TableFeatures>& tables) {
+	std::vector<std::vector<uint8_t>> messages;
+	std::vector<uint8_t> body;
+	for( const TableFeatures& table : tables ) {
+		std::vector<uint8_t> packed_table;
+		pack_table(table, packed_table);
+
+		if( !body.empty() && body.size() + packed_table.size() > max_multipart_body ) {
+			messages.push_back(body);
+			body.clear();
+		}
+		body.insert(body.end(), packed_table.begin(), packed_table.end());
+	}
+	messages.push_back(body);
+
+	// All but the last message have the more flag set
+	std::vector<std::vector<uint8_t>> replies;
+	for( size_t i=0; i<messages.size(); ++i ) {
+		std::vector<uint8_t> reply = make_multipart_header(
+			fluid_msg::of13::OFPT_MULTIPART_REPLY,
+			xid,
+			i+1<messages.size() ? fluid_msg::of13::OFPMPF_REPLY_MORE : 0);
+		reply.insert(reply.end(), messages[i].begin(), messages[i].end());
+		write(reply, 2, reply.size(), 2);
+		replies.push_back(reply);
+	}
+	return replies;
+}
+
+std::vector<uint8_t> make_table_features_request() {
+	return make_multipart_header(
+		fluid_msg::of13::OFPT_MULTIPART_REQUEST,
+		0,
+		0);
+}
+
+TableFeatures intersect_table_features(
+		const TableFeatures& table_1,
+		const TableFeatures& table_2) {
+	TableFeatures table = table_1;
+	table.metadata_match = table_1.metadata_match & table_2.metadata_match;
+	table.metadata_write = table_1.metadata_write & table_2.metadata_write;
+	table.max_entries    = std::min(table_1.max_entries, table_2.max_entries);
+
+	for( const auto& property_pair : table_2.properties ) {
+		auto property_it = table.properties.find(property_pair.first);
+		if( property_it == table.properties.end() ) {
+			table.properties.insert(property_pair);
+			continue;
+		}
+
+		const std::set<uint32_t>& ids_2 = property_pair.second;
+		bool oxm = get_property_kind(property_pair.first) == oxm_ids;
+		std::set<uint32_t> ids;
+		for( uint32_t id : property_it->second ) {
+			if( !oxm ) {
+				if( ids_2.count(id) > 0 ) ids.insert(id);
+				continue;
+			}
+
+			// A field can only be masked if it can be masked in both
+			uint32_t unmasked = id & ~oxm_has_mask;
+			bool masked_2     = ids_2.count(unmasked | oxm_has_mask) > 0;
+			if( ids_2.count(unmasked) > 0 || masked_2 ) {
+				ids.insert((id & oxm_has_mask) && masked_2 ? id : unmasked);
+			}
+		}
+		property_it->second = ids;
+	}
+
+	return table;
+}
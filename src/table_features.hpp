@@ -0,0 +1,74 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/// The capabilities of a flow table as in a table features message
+/**
+ * libfluid crashes on the properties of a table features message,
+ * so these messages are parsed and packed by hand.
+ */
+struct TableFeatures {
+	uint8_t     table_id;
+	std::string name;
+	uint64_t    metadata_match;
+	uint64_t    metadata_write;
+	uint32_t    config;
+	uint32_t    max_entries;
+	/// The ids in the properties, property type -> ids
+	/**
+	 * The ids are instruction types, table ids, action types or
+	 * OXM headers. The length of an OXM header is the length of
+	 * the value without the mask, a match field that can be masked
+	 * has the has mask bit set in the match property. Experimenter
+	 * ids and experimenter properties are skipped.
+	 */
+	std::map<uint16_t,std::set<uint32_t>> properties;
+
+	/// Check if a property is present and contains an id
+	/**
+	 * A switch can leave out properties, a missing property
+	 * is treated as containing every id.
+	 */
+	bool supports(uint16_t property_type, uint32_t id) const;
+	/// Check if a field of the openflow basic class can be matched on
+	bool can_match(uint8_t field, bool masked) const;
+};
+
+/// Create the id of a field of the openflow basic class
+uint32_t make_oxm_id(uint8_t field, bool has_mask, uint8_t value_length);
+
+/// Parse a table features multipart request or reply
+/**
+ * The tables in the message are added to tables.
+ * \return False if the message is malformed
+ */
+bool parse_table_features_message(
+	const std::vector<uint8_t>& message,
+	uint32_t& xid,
+	uint16_t& flags,
+	std::vector<TableFeatures>& tables);
+
+/// Pack table features replies, split over messages that fit
+std::vector<std::vector<uint8_t>> pack_table_features_reply(
+	uint32_t xid,
+	const std::vector<TableFeatures>& tables);
+
+/// Create a table features request that doesn't change the tables
+/**
+ * The xid is set when the message is sent.
+ */
+std::vector<uint8_t> make_table_features_request();
+
+/// Return the capabilities both tables have
+/**
+ * The table id, name and config of the first table are kept. A
+ * property only one of the tables has is kept as it is.
+ */
+TableFeatures intersect_table_features(
+	const TableFeatures& table_1,
+	const TableFeatures& table_2);
@@ -23,24 +23,24 @@ Tag<tag_type_t>::Tag() :
 	mask(0) {
 }
 
-VLANTag::VLANTag() :
+VLANTagBase::VLANTagBase() :
 	Tag<uint16_t>::Tag() {
 }
 
-VLANTag::VLANTag(uint16_t raw) {
+VLANTagBase::VLANTagBase(uint16_t raw) {
 	mask = make_mask(15);
 	tag  = (raw&make_mask(12)) |
 		((raw>>1)&(make_mask(3)<<12));
 }
 
-uint16_t VLANTag::make_raw() const {
+uint16_t VLANTagBase::make_raw() const {
 	// This assumes tag&mask==tag
 	return (tag&make_mask(12)) |
 		(1<<12) |
 		((tag&(make_mask(3)<<12))<<1);
 }
 
-void VLANTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
+void VLANTagBase::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
 	uint16_t vid_tag  = tag        & make_mask(12);
 	uint16_t vid_mask = mask       & make_mask(12);
 	uint16_t pcp_tag  = (tag>>12)  & make_mask( 3);
@@ -63,7 +63,7 @@ void VLANTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
 }
 
 template<class ActionSet>
-void VLANTag::add_to_actions(ActionSet& action_set) const {
+void VLANTagBase::add_to_actions(ActionSet& action_set) const {
 	uint16_t vid_tag = tag       & make_mask(12);
 	uint16_t pcp_tag = (tag>>12) & make_mask( 3);
 
@@ -78,42 +78,92 @@ void VLANTag::add_to_actions(ActionSet& action_set) const {
 			new fluid_msg::of13::VLANPcp(pcp_tag)));
 }
 
-void VLANTag::set_switch(unsigned int switch_id) {
+template<class Layout>
+BasicVLANTag<Layout>::BasicVLANTag() :
+	VLANTagBase::VLANTagBase() {
+	// The highest bit tells the port tag apart from the switch tag
+	if( double_tag ) {
+		set_value<1,14>(1);
+	}
+}
+
+template<class Layout>
+BasicVLANTag<Layout>::BasicVLANTag(uint16_t raw) :
+	VLANTagBase::VLANTagBase(raw) {
+}
+
+template<class Layout>
+void BasicVLANTag<Layout>::set_switch(unsigned int switch_id) {
 	set_value<
-		VLANTag::num_switch_bits,
+		num_switch_bits,
 		0>(switch_id);
 }
 
-unsigned int VLANTag::get_switch() const {
+template<class Layout>
+unsigned int BasicVLANTag<Layout>::get_switch() const {
 	return get_value<
-		VLANTag::num_switch_bits,
+		num_switch_bits,
 		0>();
 }
 
-void VLANTag::set_port(unsigned int port_id) {
+template<class Layout>
+void BasicVLANTag<Layout>::set_port(unsigned int port_id) {
 	set_value<
-		VLANTag::num_port_bits,
-		VLANTag::num_switch_bits>(port_id);
+		num_port_bits,
+		num_switch_bits>(port_id);
 }
 
-unsigned int VLANTag::get_port() const {
+template<class Layout>
+unsigned int BasicVLANTag<Layout>::get_port() const {
 	return get_value<
-		VLANTag::num_port_bits,
-		VLANTag::num_switch_bits>();
+		num_port_bits,
+		num_switch_bits>();
 }
 
-void VLANTag::set_slice(unsigned int slice_id) {
+template<class Layout>
+void BasicVLANTag<Layout>::set_slice(unsigned int slice_id) {
 	set_value<
-		VLANTag::num_slice_bits,
-		VLANTag::num_switch_bits+VLANTag::num_port_bits>(slice_id);
+		num_slice_bits,
+		num_switch_bits+num_port_bits>(slice_id);
 }
 
-unsigned int VLANTag::get_slice() const {
+template<class Layout>
+unsigned int BasicVLANTag<Layout>::get_slice() const {
 	return get_value<
-		VLANTag::num_slice_bits,
-		VLANTag::num_switch_bits+VLANTag::num_port_bits>();
+		num_slice_bits,
+		num_switch_bits+num_port_bits>();
+}
+
+template<class Layout>
+BasicSwitchVLANTag<Layout>::BasicSwitchVLANTag() :
+	VLANTagBase::VLANTagBase() {
+	// The highest bit is 0 for a switch tag
+	set_value<1,14>(0);
+}
+
+template<class Layout>
+BasicSwitchVLANTag<Layout>::BasicSwitchVLANTag(uint16_t raw) :
+	VLANTagBase::VLANTagBase(raw) {
+}
+
+template<class Layout>
+void BasicSwitchVLANTag<Layout>::set_switch(unsigned int switch_id) {
+	set_value<
+		num_switch_bits,
+		0>(switch_id);
+}
+
+template<class Layout>
+unsigned int BasicSwitchVLANTag<Layout>::get_switch() const {
+	return get_value<
+		num_switch_bits,
+		0>();
 }
 
+// Only the selected layout is compiled
+template class BasicVLANTag<SelectedVLANTagLayout>;
+template class BasicSwitchVLANTag<SelectedVLANTagLayout>;
+
 namespace {
 	// Force versions of add_to_actions<> using write or apply
 	// actions to be available during linking
@@ -155,13 +205,26 @@ int MetadataTag::get_virtual_switch() const {
 }
 
 bool MetadataTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
+	// Retreive the match structure from the flowmod
+	fluid_msg::of13::Match match = flowmod.match();
+
+	// Add the metadata to the match structure
+	if( !add_to_match(match) ) {
+		return false;
+	}
+
+	// Overwrite the match structure in the flowmod
+	flowmod.match(match);
+
+	// Return that everything went ok
+	return true;
+}
+
+bool MetadataTag::add_to_match(fluid_msg::of13::Match& match) const {
 	// The variables to save the existing match values in
 	uint64_t existing_tag  = 0;
 	uint64_t existing_mask = 0;
 
-	// Retreive the match structure from the flowmod
-	fluid_msg::of13::Match old_match = flowmod.match();
-
 	// Create a new match structure
 	fluid_msg::of13::Match new_match;
 
@@ -170,7 +233,7 @@ bool MetadataTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
 	// the new match unless it is a match on metadata. If it
 	// is a match on metadata save the old values.
 	for( size_t i=0; i<OXM_NUM; ++i ) {
-		fluid_msg::of13::OXMTLV* oxm = flowmod.get_oxm_field(i);
+		fluid_msg::of13::OXMTLV* oxm = match.oxm_field(i);
 		if( oxm != nullptr ) {
 			if( i == fluid_msg::of13::OFPXMT_OFB_METADATA ) {
 				fluid_msg::of13::Metadata* existing_metadata =
@@ -213,13 +276,58 @@ bool MetadataTag::add_to_match(fluid_msg::of13::FlowMod& flowmod) const {
 				new_tag,
 				new_mask));
 
-	// Overwrite the match structure in the flowmod
-	flowmod.match(new_match);
+	// Overwrite the match structure
+	match = new_match;
 
 	// Return that everything went ok
 	return true;
 }
 
+bool MetadataTag::remove_from_match(fluid_msg::of13::Match& match) {
+	// The total amount of bits used by the hypervisor
+	constexpr int total_bits = num_virtual_switch_bits + 1;
+
+	// Copy all fields except the metadata match
+	bool found_metadata = false;
+	fluid_msg::of13::Match new_match;
+	for( size_t i=0; i<OXM_NUM; ++i ) {
+		fluid_msg::of13::OXMTLV* oxm = match.oxm_field(i);
+		if( oxm == nullptr ) {
+			continue;
+		}
+		if( i == fluid_msg::of13::OFPXMT_OFB_METADATA ) {
+			fluid_msg::of13::Metadata* metadata =
+				(fluid_msg::of13::Metadata*) oxm;
+			uint64_t value    = metadata->value();
+			uint64_t mask_val = metadata->has_mask() ?
+				metadata->mask() :
+				UINT64_MAX;
+
+			// Save the hypervisor part in this tag
+			tag  = value    & make_mask(total_bits);
+			mask = mask_val & make_mask(total_bits);
+			found_metadata = true;
+
+			// If the tenant matched on metadata itself put
+			// it back where the tenant expects it
+			if( (mask_val >> total_bits) != 0 ) {
+				new_match.add_oxm_field(
+					new fluid_msg::of13::Metadata(
+						value    >> total_bits,
+						mask_val >> total_bits));
+			}
+		}
+		else {
+			new_match.add_oxm_field(oxm->clone());
+		}
+	}
+
+	// Overwrite the match structure
+	match = new_match;
+
+	return found_metadata;
+}
+
 bool MetadataTag::add_to_instructions(fluid_msg::of13::FlowMod& flowmod) const {
 	// Look if there already is a write_metadata instruction
 	// in the flowmod message
@@ -273,3 +381,55 @@ bool MetadataTag::add_to_instructions(fluid_msg::of13::FlowMod& flowmod) const {
 	// Return that everything went ok
 	return true;
 }
+
+CookieTag::CookieTag() :
+	Tag<uint64_t>::Tag() {
+}
+
+CookieTag::CookieTag(uint64_t cookie) :
+	Tag<uint64_t>::Tag() {
+	tag  = cookie;
+	mask = UINT64_MAX;
+}
+
+void CookieTag::set_virtual_switch(int switch_id) {
+	set_value<1,63>(1);
+	set_value<MetadataTag::num_virtual_switch_bits,num_tenant_cookie_bits>(switch_id);
+}
+int CookieTag::get_virtual_switch() const {
+	return get_value<MetadataTag::num_virtual_switch_bits,num_tenant_cookie_bits>();
+}
+bool CookieTag::is_virtual_switch() const {
+	return get_value<1,63>();
+}
+
+uint64_t CookieTag::get_tenant_cookie() const {
+	return tag & max_tenant_cookie;
+}
+
+uint64_t CookieTag::get_cookie() const {
+	return tag;
+}
+uint64_t CookieTag::get_cookie_mask() const {
+	return mask;
+}
+
+bool CookieTag::add_to_flow_mod(fluid_msg::of13::FlowMod& flowmod) const {
+	uint64_t tenant_cookie      = flowmod.cookie();
+	uint64_t tenant_cookie_mask = flowmod.cookie_mask();
+
+	flowmod.cookie(
+		(tag & ~max_tenant_cookie) |
+		(tenant_cookie & max_tenant_cookie));
+	flowmod.cookie_mask(
+		(mask & ~max_tenant_cookie) |
+		(tenant_cookie_mask & max_tenant_cookie));
+
+	// Adding a rule sets the whole cookie, the other commands
+	// only filter on the bits in the mask
+	uint64_t used_bits = tenant_cookie;
+	if( flowmod.command() != fluid_msg::of13::OFPFC_ADD ) {
+		used_bits &= tenant_cookie_mask;
+	}
+	return (used_bits & ~max_tenant_cookie) == 0;
+}
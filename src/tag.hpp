@@ -1,5 +1,7 @@
 #pragma once
 
+#include <type_traits>
+
 #include <fluid/of13msg.hh>
 
 /**
@@ -11,7 +13,9 @@
 
 /// Create a mask consisting of a variable amount of bits
 constexpr uint64_t make_mask(int mask_bits) {
-	return (mask_bits==1) ?
+	return (mask_bits<=0) ?
+		0 :
+		(mask_bits==1) ?
 		1 :
 		(make_mask(mask_bits-1)<<1 | 1 );
 }
@@ -37,26 +41,76 @@ protected:
 	unsigned int get_value() const;
 };
 
-/// A base VLANTag that shouldn't be
-class VLANTag : public Tag<uint16_t> {
-protected:
+/// The division of the VLAN tag bits over the fields
+/**
+ * The VLAN VID and PCP together have 15 bits, the layout decides
+ * how many of them identify the switch, the port and the slice.
+ * The highest value of every field is reserved, so a field of n
+ * bits holds 2^n-1 switches, ports or slices.
+ */
+template<int switch_bits, int slice_bits, int port_bits>
+struct VLANTagLayout {
+	static_assert(
+		switch_bits + slice_bits + port_bits <= 15,
+		"The VLAN VID and PCP only have 15 bits");
 
-	/// The amount of bits per field
-	static constexpr int num_switch_bits = 7;
-	static constexpr int num_slice_bits  = 4;
-	static constexpr int num_port_bits   = 4;
+	/// All fields are in a single VLAN tag
+	static constexpr bool double_tag = false;
 
-	/// Create a tag from raw bytes going over the wire
-	static uint16_t parse_from_raw(uint16_t raw);
-public:
-	static constexpr uint16_t max_slice_id  = make_mask(num_slice_bits);
-	static constexpr uint16_t max_switch_id = make_mask(num_switch_bits);
-	static constexpr uint16_t max_port_id   = make_mask(num_port_bits);
+	static constexpr int num_switch_bits = switch_bits;
+	static constexpr int num_slice_bits  = slice_bits;
+	static constexpr int num_port_bits   = port_bits;
+	/// The amount of switch bits in the tag with the port
+	static constexpr int num_port_tag_switch_bits = switch_bits;
+};
+
+/// The double VLAN tag layout described in the design document
+/**
+ * Packets going to another switch get 2 VLAN tags, the outer tag
+ * contains the switch and the inner tag the port and slice. The
+ * highest bit tells the tags apart. The destination switch removes
+ * the outer tag when the packet arrives.
+ */
+struct DoubleVLANTagLayout {
+	static constexpr bool double_tag = true;
+
+	static constexpr int num_switch_bits = 14;
+	static constexpr int num_slice_bits  = 7;
+	static constexpr int num_port_bits   = 7;
+	static constexpr int num_port_tag_switch_bits = 0;
+};
 
+/// The layouts that can be selected with DELFTVISOR_TAG_LAYOUT
+/**
+ * The default layout allows 127 switches with 15 ports and 15
+ * slices, the ports layout allows 31 switches with 127 ports and
+ * 7 slices and the switches layout allows 511 switches with 7
+ * ports and 7 slices. The double layout allows 16383 switches
+ * with 127 ports and 127 slices.
+ */
+typedef VLANTagLayout<7,4,4> DefaultVLANTagLayout;
+typedef VLANTagLayout<5,3,7> PortsVLANTagLayout;
+typedef VLANTagLayout<9,3,3> SwitchesVLANTagLayout;
+
+#if defined(DELFTVISOR_TAG_LAYOUT_PORTS)
+typedef PortsVLANTagLayout SelectedVLANTagLayout;
+#elif defined(DELFTVISOR_TAG_LAYOUT_SWITCHES)
+typedef SwitchesVLANTagLayout SelectedVLANTagLayout;
+#elif defined(DELFTVISOR_TAG_LAYOUT_DOUBLE)
+typedef DoubleVLANTagLayout SelectedVLANTagLayout;
+#else
+typedef DefaultVLANTagLayout SelectedVLANTagLayout;
+#endif
+
+/// The encoding of a VLAN tag shared by all layouts
+class VLANTagBase : public Tag<uint16_t> {
+protected:
 	/// Create a vlan tag without a tag or mask set
-	VLANTag();
+	VLANTagBase();
 	/// Initialize a vlan tag from raw bytes
-	VLANTag(uint16_t raw);
+	VLANTagBase(uint16_t raw);
+
+public:
 	/// Make the raw bytes as they go over the wire
 	uint16_t make_raw() const;
 
@@ -69,8 +123,36 @@ public:
 	 */
 	template<class ActionSet>
 	void add_to_actions(ActionSet& action_set) const;
+};
+
+/// The VLAN tag with the port and slice a packet is sent to
+template<class Layout>
+class BasicVLANTag : public VLANTagBase {
+protected:
+
+	/// The amount of bits per field
+	static constexpr int num_switch_bits = Layout::num_port_tag_switch_bits;
+	static constexpr int num_slice_bits  = Layout::num_slice_bits;
+	static constexpr int num_port_bits   = Layout::num_port_bits;
+
+public:
+	/// If the switch is in a separate outer tag
+	static constexpr bool double_tag = Layout::double_tag;
+
+	static constexpr uint16_t max_slice_id  = make_mask(Layout::num_slice_bits);
+	static constexpr uint16_t max_switch_id = make_mask(Layout::num_switch_bits);
+	static constexpr uint16_t max_port_id   = make_mask(Layout::num_port_bits);
+
+	/// Create a vlan tag without a tag or mask set
+	BasicVLANTag();
+	/// Initialize a vlan tag from raw bytes
+	BasicVLANTag(uint16_t raw);
 
 	/// Set the switch value
+	/**
+	 * The switch is not part of this tag in the double tag
+	 * layout, setting it does nothing then.
+	 */
 	void set_switch(unsigned int switch_id);
 	/// Get the switch value
 	unsigned int get_switch() const;
@@ -84,6 +166,38 @@ public:
 	unsigned int get_slice() const;
 };
 
+/// The outer VLAN tag with the switch in the double tag layout
+template<class Layout>
+class BasicSwitchVLANTag : public VLANTagBase {
+protected:
+	static constexpr int num_switch_bits = Layout::num_switch_bits;
+
+public:
+	static constexpr uint16_t max_switch_id = make_mask(Layout::num_switch_bits);
+
+	/// Create a switch tag without the switch set
+	BasicSwitchVLANTag();
+	/// Initialize a switch tag from raw bytes
+	BasicSwitchVLANTag(uint16_t raw);
+
+	/// Set the switch value
+	void set_switch(unsigned int switch_id);
+	/// Get the switch value
+	unsigned int get_switch() const;
+};
+
+/// The VLAN tag with the layout selected at build time
+typedef BasicVLANTag<SelectedVLANTagLayout> VLANTag;
+/// The tag that routes a packet to a switch
+/**
+ * In the single tag layouts this is the normal tag, in the
+ * double tag layout this is the outer tag.
+ */
+typedef std::conditional<
+	SelectedVLANTagLayout::double_tag,
+	BasicSwitchVLANTag<SelectedVLANTagLayout>,
+	VLANTag>::type SwitchVLANTag;
+
 class MetadataTag : public Tag<uint64_t> {
 public:
 	/// The amount of bits used to describe
@@ -116,6 +230,23 @@ public:
 	 * \return If adding the match was successful
 	 */
 	bool add_to_match(fluid_msg::of13::FlowMod& flowmod) const;
+	/// Add a match to this metadata to a match structure
+	/**
+	 * Works the same as the FlowMod version, this version is
+	 * used for messages that don't carry a complete FlowMod
+	 * such as a flow statistics request.
+	 * \return If adding the match was successful
+	 */
+	bool add_to_match(fluid_msg::of13::Match& match) const;
+
+	/// Remove the hypervisor metadata from a match structure
+	/**
+	 * This is the reverse of add_to_match, the hypervisor bits
+	 * are stored in this tag and the remaining metadata is
+	 * shifted back to the place the tenant expects it.
+	 * \return If the match contained a metadata match
+	 */
+	bool remove_from_match(fluid_msg::of13::Match& match);
 
 	/// Add a metadata tag instruction to this flowmod
 	/**
@@ -125,3 +256,55 @@ public:
 	 */
 	bool add_to_instructions(fluid_msg::of13::FlowMod& flowmod) const;
 };
+
+/// The cookie of the rules the virtual switches push
+/**
+ * Every rule of a virtual switch in a physical switch carries a
+ * cookie that tells which virtual switch pushed it, this allows
+ * removing all rules of a virtual switch with a single delete.
+ * The highest bit marks the rule as a rule of a virtual switch,
+ * the rules of the hypervisor itself never have it set. The next
+ * bits contain the virtual switch id, the remaining bits contain
+ * the cookie the controller set.
+ */
+class CookieTag : public Tag<uint64_t> {
+public:
+	/// The amount of bits left for the cookie of the controller
+	static constexpr int num_tenant_cookie_bits =
+		63 - MetadataTag::num_virtual_switch_bits;
+	static constexpr uint64_t max_tenant_cookie = make_mask(num_tenant_cookie_bits);
+
+	/// Create an empty cookie tag
+	CookieTag();
+	/// Create a cookie tag from a cookie in a physical switch
+	CookieTag(uint64_t cookie);
+
+	/// Set the virtual switch id in this tag
+	/**
+	 * This also marks the cookie as belonging to a virtual switch.
+	 */
+	void set_virtual_switch(int switch_id);
+	/// Get the virtual switch id from this tag
+	int get_virtual_switch() const;
+	/// Check if this cookie belongs to a rule of a virtual switch
+	bool is_virtual_switch() const;
+
+	/// Get the cookie as the controller set it
+	uint64_t get_tenant_cookie() const;
+
+	/// Get the cookie and mask that select all rules of the virtual switch
+	uint64_t get_cookie() const;
+	uint64_t get_cookie_mask() const;
+
+	/// Put the cookie and cookie mask of a controller in this tag
+	/**
+	 * The cookie and cookie mask of the flowmod are masked to the
+	 * bits left for the controller and combined with this tag,
+	 * this works for adding rules as well as for the filter of
+	 * modify and delete requests.
+	 * \return False if the cookie of an added rule doesn't fit, or
+	 *   if the filter of a request requires bits that don't fit to
+	 *   be set. Such a filter doesn't match any rule that fits.
+	 */
+	bool add_to_flow_mod(fluid_msg::of13::FlowMod& flowmod) const;
+};
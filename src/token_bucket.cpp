@@ -0,0 +1,41 @@
+#include "token_bucket.hpp"
+
+#include <algorithm>
+
+TokenBucket::TokenBucket() :
+	rate(0),
+	burst(0),
+	tokens(0) {
+}
+
+void TokenBucket::configure(double rate, double burst) {
+	this->rate  = rate;
+	this->burst = std::max(burst, 1.0);
+
+	// Start with a full bucket
+	tokens      = this->burst;
+	last_update = boost::posix_time::microsec_clock::universal_time();
+}
+
+bool TokenBucket::is_limited() const {
+	return rate > 0;
+}
+
+bool TokenBucket::consume() {
+	if( !is_limited() ) {
+		return true;
+	}
+
+	// Add the tokens for the time since the last update
+	boost::posix_time::ptime now =
+		boost::posix_time::microsec_clock::universal_time();
+	double elapsed = (now - last_update).total_microseconds() / 1e6;
+	tokens      = std::min(burst, tokens + elapsed*rate);
+	last_update = now;
+
+	if( tokens < 1 ) {
+		return false;
+	}
+	tokens -= 1;
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+/// A token bucket to limit the rate of events
+/**
+ * The bucket is refilled with rate tokens per second up to
+ * burst tokens. A bucket with a rate of 0 is not limited.
+ */
+class TokenBucket {
+private:
+	/// The amount of tokens added per second
+	double rate;
+	/// The maximum amount of tokens in the bucket
+	double burst;
+	/// The current amount of tokens in the bucket
+	double tokens;
+	/// The last time tokens were added
+	boost::posix_time::ptime last_update;
+
+public:
+	/// Create a bucket without a limit
+	TokenBucket();
+
+	/// Set the limit of this bucket, a rate of 0 removes the limit
+	void configure(double rate, double burst);
+	/// Return if this bucket limits anything
+	bool is_limited() const;
+
+	/// Take a token from the bucket, returns false if it is empty
+	bool consume();
+};
@@ -1,15 +1,56 @@
+#include <set>
+
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/log/trivial.hpp>
 
 #include "slice.hpp"
 #include "hypervisor.hpp"
 #include "virtual_switch.hpp"
 #include "physical_switch.hpp"
+#include "discoveredlink.hpp"
+#include "raw_packet_in.hpp"
+#include "auxiliary_connection.hpp"
 
 // Start virtual switch id's at 1 so the metadata field
 // is always set in PacketIn messages.
 IdAllocator<1,MetadataTag::max_virtual_switch_id> virtual_switch_id_allocator;
 
+/// Allocate the id of a virtual switch, preferring the journaled one
+/**
+ * The cookies and hypervisor groups a virtual switch left in the
+ * physical switches contain its id, so it gets the same id as in
+ * the previous run. The journaled id's of other virtual switches
+ * are only given out when nothing else is left.
+ * \param restored Set to if the journaled id was taken
+ */
+static int allocate_virtual_switch_id(
+		Hypervisor* hypervisor,
+		uint64_t datapath_id,
+		bool& restored) {
+	int id = hypervisor->get_journaled_id(
+		StateJournal::virtual_switch_binding,
+		datapath_id);
+	restored = id != -1 && virtual_switch_id_allocator.reserve_id(id);
+	if( restored ) {
+		return id;
+	}
+
+	id = virtual_switch_id_allocator.new_id(
+		[hypervisor](int id) {
+			return hypervisor->is_journaled_id(StateJournal::virtual_switch_binding, id);
+		});
+	hypervisor->record_id(StateJournal::virtual_switch_binding, datapath_id, id);
+	return id;
+}
+
+namespace {
+	/// The default amount of bytes of a packet sent to the controller
+	constexpr uint16_t default_miss_send_len = 128;
+	/// The largest packet that can be buffered, large enough for jumbo frames
+	constexpr size_t packet_buffer_slot_size = 9216;
+}
+
 VirtualSwitch::VirtualSwitch(
 		boost::asio::io_service& io,
 		uint64_t datapath_id,
@@ -18,17 +59,38 @@ VirtualSwitch::VirtualSwitch(
 	:
 		OpenflowConnection::OpenflowConnection(io),
 		connection_backoff_timer(io),
-		id(virtual_switch_id_allocator.new_id()),
+		reconnect_grace_timer(io),
+		waiting_for_switches(false),
 		datapath_id(datapath_id),
 		hypervisor(hypervisor),
 		slice(slice),
-		state(down) {
+		state(down),
+		config_flags(0),
+		miss_send_len(default_miss_send_len),
+		packet_in_dropped(0),
+		cache_clock(0) {
+	id = allocate_virtual_switch_id(hypervisor, datapath_id, id_restored);
+	reset_async_masks();
+	flow_table.set_listener(
+		boost::bind(&VirtualSwitch::journal_flow, this, _1, _2));
+	packet_buffer.configure(
+		std::max(0, hypervisor->get_packet_buffer_slots()),
+		packet_buffer_slot_size,
+		hypervisor->get_packet_buffer_ttl());
+}
+
+VirtualSwitch::~VirtualSwitch() {
+	virtual_switch_id_allocator.free_id(id);
 }
 
 int VirtualSwitch::get_id() const {
 	return id;
 }
 
+bool VirtualSwitch::has_restored_id() const {
+	return id_restored;
+}
+
 const Slice* VirtualSwitch::get_slice() const {
 	return slice;
 }
@@ -111,19 +173,46 @@ void VirtualSwitch::start() {
 		OpenflowConnection::start();
 		state = connected;
 
+		// A new controller connection starts with the default configuration
+		config_flags  = 0;
+		miss_send_len = default_miss_send_len;
+		reset_async_masks();
+
 		// Register this virtual switch with the physical switches
-		for( const auto& dep_sw : dependent_switches ) {
+		for( auto& dep_sw : dependent_switches ) {
 			auto sw_ptr =
 				hypervisor->
 					get_physical_switch_by_datapath_id(dep_sw.first);
 
 			sw_ptr->register_interest(shared_from_this());
+			dep_sw.second.physical_switch = sw_ptr;
+		}
 
-			// Update the rules in the physical switch to forward
-			// packets from those ports to the actual flow tables
-			sw_ptr->update_dynamic_rules();
+		// Update the rules in the physical switches to forward
+		// packets from those ports to the actual flow tables, this
+		// is done after all switches gave the ports an index so the
+		// output groups can refer to the ports on other switches
+		for( auto& dep_sw : dependent_switches ) {
+			hypervisor->
+				get_physical_switch_by_datapath_id(dep_sw.first)
+					->update_dynamic_rules();
 		}
 
+		// Open the auxiliary connections, PacketIns use the
+		// main connection until they are connected
+		for( int i=1; i<=slice->get_auxiliary_connections(); ++i ) {
+			auto aux_ptr = boost::make_shared<AuxiliaryConnection>(
+				socket.get_io_service(),
+				shared_from_this(),
+				i);
+			aux_ptr->connect(slice->get_controller_endpoint());
+			auxiliary_connections.push_back(aux_ptr);
+		}
+
+		// Take over the rules a previous run of the hypervisor
+		// installed for this controller
+		restore_journaled_rules();
+
 		BOOST_LOG_TRIVIAL(info) << *this << " started";
 	}
 }
@@ -135,6 +224,38 @@ void VirtualSwitch::stop() {
 	// Stop any work in the backoff timer
 	connection_backoff_timer.cancel();
 
+	// Stop waiting on physical switches
+	bool was_waiting_for_switches = waiting_for_switches;
+	reconnect_grace_timer.cancel();
+	waiting_for_switches = false;
+
+	// The auxiliary connections can't outlive the main connection
+	for( auto& aux_ptr : auxiliary_connections ) {
+		aux_ptr->close();
+	}
+	auxiliary_connections.clear();
+
+	// The outstanding requests will never be answered anymore
+	outstanding_barriers.clear();
+	outstanding_flow_stats.clear();
+	outstanding_port_stats.clear();
+
+	// The buffer_ids are meaningless for the next connection
+	packet_buffer.clear();
+
+	// Removing the interest removes the rules from the physical switches
+	flow_table.clear();
+	flow_removed_requested.clear();
+	idle_flows.clear();
+	for( auto& group_pair : group_table ) {
+		journal_group(group_pair.first, nullptr);
+	}
+	group_table.clear();
+	for( auto& dep_sw : dependent_switches ) {
+		dep_sw.second.cached_flows.clear();
+		dep_sw.second.cache_miss_rule = false;
+	}
+
 	// Remove registration of this virtual switch with the physical switches
 	for( const auto& dep_sw : dependent_switches ) {
 		auto sw_ptr =
@@ -158,6 +279,14 @@ void VirtualSwitch::stop() {
 		}
 	}
 
+	// A physical switch is still gone, check_online connects
+	// again when it returns
+	if( state==connected && was_waiting_for_switches ) {
+		BOOST_LOG_TRIVIAL(info) << *this <<
+			" connection dropped while waiting for physical switches";
+		state = down;
+	}
+
 	// If we the connection was stopped by the controller
 	// immediately try again
 	if( state==connected ) {
@@ -223,11 +352,75 @@ void VirtualSwitch::check_online() {
 	if( all_online_and_reachable && state==down ) {
 		try_connect();
 	}
+	else if( all_online_and_reachable && waiting_for_switches ) {
+		restore_physical_switches();
+	}
+	else if( !all_online_and_reachable &&
+			state==connected &&
+			hypervisor->get_reconnect_grace_period() > 0 ) {
+		start_reconnect_grace();
+	}
 	else if( !all_online_and_reachable && state!=down ) {
 		go_down();
 	}
 }
 
+void VirtualSwitch::start_reconnect_grace() {
+	if( waiting_for_switches ) return;
+	waiting_for_switches = true;
+
+	BOOST_LOG_TRIVIAL(info) << *this << " waiting "
+		<< hypervisor->get_reconnect_grace_period()
+		<< "ms for the physical switches to return";
+
+	reconnect_grace_timer.expires_from_now(
+		boost::posix_time::milliseconds(
+			hypervisor->get_reconnect_grace_period()));
+	reconnect_grace_timer.async_wait(
+		boost::bind(
+			&VirtualSwitch::reconnect_grace_expired,
+			shared_from_this(),
+			boost::asio::placeholders::error));
+}
+
+void VirtualSwitch::reconnect_grace_expired(const boost::system::error_code& error) {
+	if( error.value() == boost::asio::error::operation_aborted ) {
+		return;
+	}
+	else if( error ) {
+		BOOST_LOG_TRIVIAL(error) << *this << " reconnect grace timer error " << error.message();
+		return;
+	}
+
+	if( waiting_for_switches ) {
+		BOOST_LOG_TRIVIAL(info) << *this << " physical switches didn't return in time";
+		waiting_for_switches = false;
+		go_down();
+	}
+}
+
+void VirtualSwitch::restore_physical_switches() {
+	waiting_for_switches = false;
+	reconnect_grace_timer.cancel();
+
+	for( auto& dep_sw : dependent_switches ) {
+		auto sw_ptr =
+			hypervisor->
+				get_physical_switch_by_datapath_id(dep_sw.first);
+
+		// Only a physical switch that reconnected lost the rules
+		if( sw_ptr == dep_sw.second.physical_switch.lock() ) continue;
+		dep_sw.second.physical_switch = sw_ptr;
+
+		BOOST_LOG_TRIVIAL(info) << *this << " restoring rules in " << *sw_ptr;
+
+		sw_ptr->register_interest(shared_from_this());
+		replay_groups(sw_ptr);
+		replay_flows(sw_ptr);
+		sw_ptr->update_dynamic_rules();
+	}
+}
+
 VirtualSwitch::pointer VirtualSwitch::shared_from_this() {
 	return boost::static_pointer_cast<VirtualSwitch>(
 			OpenflowConnection::shared_from_this());
@@ -243,10 +436,22 @@ void VirtualSwitch::handle_error(fluid_msg::of13::Error& error_message) {
 		<< " Code=" << error_message.code();
 }
 
-void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message) {
+uint8_t VirtualSwitch::get_n_tables() const {
+	// Every physical switch maps its own amount of tables
+	uint8_t n_tables = UINT8_MAX;
+	for( auto& dep_sw : dependent_switches ) {
+		auto phy_sw = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+		if( phy_sw == nullptr ) continue;
+
+		n_tables = std::min(n_tables, phy_sw->get_tenant_table_count());
+	}
+	return n_tables;
+}
+
+fluid_msg::of13::FeaturesReply VirtualSwitch::make_features_reply(
+		uint32_t xid,
+		uint8_t auxiliary_id) {
 	// Lookup the features of all switches below
-	uint32_t n_buffers    = UINT32_MAX;
-	uint8_t n_tables      = UINT8_MAX;
 	uint32_t capabilities = UINT32_MAX;
 
 	for( auto& dep_sw : dependent_switches ) {
@@ -260,26 +465,31 @@ void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& fe
 		}
 
 		const auto& features = phy_sw->get_features();
-		n_buffers     = std::min( n_buffers, features.n_buffers );
-		n_tables      = std::min( n_tables, features.n_tables );
 		capabilities &= features.capabilities;
 	}
 
-	// We reserve 2 tables for the hypervisor
-	n_tables -= 2;
-	// Statistics are not supported in this version of the hypervisor
-	capabilities &= fluid_msg::of13::OFPC_IP_REASM | fluid_msg::of13::OFPC_PORT_BLOCKED;
-	// Buffers are also not available
-	n_buffers = 0;
-
-	// Create the response message
-	fluid_msg::of13::FeaturesReply features_reply(
-		features_request_message.xid(),
+	// Only flow and port statistics are supported in this version of the hypervisor
+	capabilities &=
+		fluid_msg::of13::OFPC_FLOW_STATS |
+		fluid_msg::of13::OFPC_PORT_STATS |
+		fluid_msg::of13::OFPC_IP_REASM |
+		fluid_msg::of13::OFPC_PORT_BLOCKED;
+	// Packets are buffered in the hypervisor, not the physical switches
+	uint32_t n_buffers = packet_buffer.size();
+
+	return fluid_msg::of13::FeaturesReply(
+		xid,
 		datapath_id,
 		n_buffers,
-		n_tables,
-		0, // Auxiliary id
+		get_n_tables(),
+		auxiliary_id,
 		capabilities);
+}
+
+void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& features_request_message) {
+	// The main connection always has auxiliary id 0
+	fluid_msg::of13::FeaturesReply features_reply =
+		make_features_reply(features_request_message.xid(), 0);
 
 	// Send the message response
 	send_message_response(features_reply);
@@ -287,39 +497,368 @@ void VirtualSwitch::handle_features_request(fluid_msg::of13::FeaturesRequest& fe
 	BOOST_LOG_TRIVIAL(info) << *this << " received features_request";
 }
 
+void VirtualSwitch::handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received get_config_request";
+
+	fluid_msg::of13::GetConfigReply config_reply(
+		config_request_message.xid(),
+		config_flags,
+		miss_send_len);
+	send_message_response(config_reply);
+}
+
+void VirtualSwitch::handle_set_config(fluid_msg::of13::SetConfig& set_config_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received set_config";
+
+	// The fragment handling is done by the physical switches,
+	// only store the flags so they can be reported back
+	config_flags  = set_config_message.flags();
+	miss_send_len = set_config_message.miss_send_len();
+}
+
+void VirtualSwitch::reset_async_masks() {
+	// The defaults from the openflow specification, a master
+	// receives everything except PacketIns because of an invalid
+	// ttl and a slave only receives PortStatus messages
+	packet_in_mask[0]    =
+		(1 << fluid_msg::of13::OFPR_NO_MATCH) |
+		(1 << fluid_msg::of13::OFPR_ACTION);
+	packet_in_mask[1]    = 0;
+	port_status_mask[0]  =
+		(1 << fluid_msg::of13::OFPPR_ADD) |
+		(1 << fluid_msg::of13::OFPPR_DELETE) |
+		(1 << fluid_msg::of13::OFPPR_MODIFY);
+	port_status_mask[1]  = port_status_mask[0];
+	flow_removed_mask[0] =
+		(1 << fluid_msg::of13::OFPRR_IDLE_TIMEOUT) |
+		(1 << fluid_msg::of13::OFPRR_HARD_TIMEOUT) |
+		(1 << fluid_msg::of13::OFPRR_DELETE) |
+		(1 << fluid_msg::of13::OFPRR_GROUP_DELETE);
+	flow_removed_mask[1] = 0;
+}
+
+bool VirtualSwitch::wants_packet_in(uint8_t reason) const {
+	return reason < 32 && (packet_in_mask[0] & (1u << reason));
+}
+
+bool VirtualSwitch::wants_port_status(uint8_t reason) const {
+	return reason < 32 && (port_status_mask[0] & (1u << reason));
+}
+
+bool VirtualSwitch::wants_flow_removed(uint8_t reason) const {
+	return reason < 32 && (flow_removed_mask[0] & (1u << reason));
+}
+
+void VirtualSwitch::handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received get_async_request";
+
+	fluid_msg::of13::GetAsyncReply async_reply(
+		async_request_message.xid(),
+		packet_in_mask[0],
+		packet_in_mask[1],
+		port_status_mask[0],
+		port_status_mask[1],
+		flow_removed_mask[0],
+		flow_removed_mask[1]);
+	send_message_response(async_reply);
+}
+
+void VirtualSwitch::handle_set_async(fluid_msg::of13::SetAsync& set_async_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received set_async";
+
+	packet_in_mask[0]    = set_async_message.master_packet_in_mask();
+	packet_in_mask[1]    = set_async_message.slave_packet_in_mask();
+	port_status_mask[0]  = set_async_message.master_port_status_mask();
+	port_status_mask[1]  = set_async_message.slave_port_status_mask();
+	flow_removed_mask[0] = set_async_message.master_flow_removed_mask();
+	flow_removed_mask[1] = set_async_message.slave_flow_removed_mask();
+}
+
+void VirtualSwitch::set_packet_in_limit(int rate, int burst) {
+	packet_in_bucket.configure(rate, burst);
+}
+
+void VirtualSwitch::set_cache_miss_limit(int rate) {
+	cache_miss_bucket.configure(rate, rate);
+}
+
+uint64_t VirtualSwitch::get_packet_in_dropped() const {
+	return packet_in_dropped;
+}
+
+void VirtualSwitch::send_packet_in(fluid_msg::of13::PacketIn& packet_in_message) {
+	send_raw_packet_in(pack_message(packet_in_message));
+}
+
+void VirtualSwitch::send_raw_packet_in(std::vector<uint8_t> message) {
+	if( !packet_in_bucket.consume() ) {
+		++packet_in_dropped;
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " dropped packet_in because of rate limit";
+		return;
+	}
+
+	// Wait for the hypervisor to forward the PacketIn
+	if( slice->enqueue_packet_in(shared_from_this(), std::move(message)) ) {
+		hypervisor->schedule_packet_in_forwarding();
+	}
+}
+
+void VirtualSwitch::forward_packet_in(std::vector<uint8_t>& message) {
+	// The controller connection could have gone down while queued
+	if( !is_connected() ) {
+		return;
+	}
+
+	RawPacketIn packet_in(message);
+	if( !packet_in.parse() ) {
+		BOOST_LOG_TRIVIAL(error) << *this << " tried to forward malformed packet_in";
+		return;
+	}
+
+	// The physical switches never buffer packets, it becomes difficult
+	// to keep track on what physical switch a packet is buffered
+	packet_in.set_buffer_id(OFP_NO_BUFFER);
+
+	// Hash before the packet is truncated and the headers are lost
+	uint32_t flow_hash = packet_in.get_flow_hash();
+
+	size_t data_len = packet_in.get_data_length();
+	if( miss_send_len != fluid_msg::of13::OFPCML_NO_BUFFER &&
+			data_len > miss_send_len &&
+			packet_in.has_in_port() ) {
+		// If the buffer is full the complete packet is sent
+		uint32_t buffer_id = packet_buffer.store(
+			packet_in.get_data(),
+			data_len,
+			packet_in.get_in_port());
+		if( buffer_id != PacketBuffer::no_buffer ) {
+			packet_in.set_buffer_id(buffer_id);
+			packet_in.truncate_data(miss_send_len);
+		}
+	}
+
+	// Keep the packets of a flow on the same auxiliary
+	// connection so they arrive at the controller in order
+	auto aux_ptr = select_auxiliary_connection(flow_hash);
+	if( aux_ptr != nullptr ) {
+		aux_ptr->send_raw_message(std::move(message));
+	}
+	else {
+		send_raw_message(std::move(message));
+	}
+}
+
+boost::shared_ptr<AuxiliaryConnection> VirtualSwitch::select_auxiliary_connection(
+		uint32_t flow_hash) const {
+	std::vector<boost::shared_ptr<AuxiliaryConnection>> usable;
+	for( const auto& aux_ptr : auxiliary_connections ) {
+		if( aux_ptr->is_connected() ) {
+			usable.push_back(aux_ptr);
+		}
+	}
+
+	if( usable.empty() ) {
+		return nullptr;
+	}
+	return usable[flow_hash % usable.size()];
+}
+
+bool VirtualSwitch::send_buffered_packet(uint32_t buffer_id) {
+	std::vector<uint8_t> data;
+	uint32_t in_port;
+	if( !packet_buffer.retrieve(buffer_id, data, in_port) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " unknown buffer_id " << buffer_id << " in flow_mod";
+		return false;
+	}
+
+	// The packet has to be injected on the switch it was received
+	auto port_it = port_to_dependent_switch.find(in_port);
+	if( port_it == port_to_dependent_switch.end() ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " buffered packet wasn't received on a port of this switch";
+		return true;
+	}
+	auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(port_it->second);
+	if( ps_ptr == nullptr ) {
+		return true;
+	}
+
+	// Output to the table so the packet is classified
+	// by the hypervisor rules as a packet from in_port
+	fluid_msg::of13::PacketOut packet_out;
+	packet_out.buffer_id(OFP_NO_BUFFER);
+	packet_out.in_port(
+		dependent_switches
+			.at(port_it->second)
+			.port_map.get_physical(in_port));
+	packet_out.data(data.data(), data.size());
+	packet_out.add_action(
+		new fluid_msg::of13::OutputAction(
+			fluid_msg::of13::OFPP_TABLE,
+			fluid_msg::of13::OFPCML_NO_BUFFER));
+	ps_ptr->send_message(packet_out);
+	return true;
+}
+
 void VirtualSwitch::handle_barrier_request(fluid_msg::of13::BarrierRequest& barrier_request_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received barrier_request";
-	// TODO
+
+	// Collect the physical switches the barrier has to pass through
+	std::vector<PhysicalSwitch::pointer> physical_switches;
+	for( auto& dep_sw : dependent_switches ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+		if( ps_ptr != nullptr ) {
+			physical_switches.push_back(ps_ptr);
+		}
+	}
+
+	// If there is no physical switch to wait for answer directly
+	if( physical_switches.empty() ) {
+		fluid_msg::of13::BarrierReply barrier_reply(
+			barrier_request_message.xid());
+		send_message_response(barrier_reply);
+		return;
+	}
+
+	// Start the countdown before forwarding so a fast reply
+	// can always find it
+	OutstandingBarrier& barrier_request = outstanding_barriers[barrier_request_message.xid()];
+	barrier_request.connection = reply_connection;
+	for( auto& ps_ptr : physical_switches ) {
+		barrier_request.waiting.insert(ps_ptr->get_id());
+	}
+
+	// Forward the barrier to all physical switches, the xid is
+	// stored in the physical switch so the reply can find its way back
+	for( auto& ps_ptr : physical_switches ) {
+		fluid_msg::of13::BarrierRequest barrier(barrier_request_message.xid());
+		ps_ptr->send_request_message(barrier, shared_from_this());
+	}
+}
+
+void VirtualSwitch::handle_physical_barrier_reply(uint32_t xid, int physical_switch_id) {
+	if( outstanding_barriers.count(xid) == 0 ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received barrier_reply for unknown barrier xid=" << xid;
+		return;
+	}
+
+	complete_physical_barrier(xid, physical_switch_id);
+}
+
+void VirtualSwitch::handle_physical_switch_stopped(int physical_switch_id) {
+	// Collect the xid's first, completing a barrier erases it
+	std::vector<uint32_t> xids;
+	for( const auto& barrier_pair : outstanding_barriers ) {
+		if( barrier_pair.second.waiting.count(physical_switch_id) > 0 ) {
+			xids.push_back(barrier_pair.first);
+		}
+	}
+
+	for( uint32_t xid : xids ) {
+		BOOST_LOG_TRIVIAL(info) << *this << " stops waiting for barrier xid="
+			<< xid << " of stopped switch " << physical_switch_id;
+		complete_physical_barrier(xid, physical_switch_id);
+	}
+}
+
+void VirtualSwitch::complete_physical_barrier(uint32_t xid, int physical_switch_id) {
+	auto it = outstanding_barriers.find(xid);
+	if( it == outstanding_barriers.end() ) {
+		return;
+	}
+
+	// Send the BarrierReply when the last physical switch answered
+	it->second.waiting.erase(physical_switch_id);
+	if( it->second.waiting.empty() ) {
+		auto connection = it->second.connection;
+		outstanding_barriers.erase(it);
+
+		respond_on(connection, [this,xid]() {
+			fluid_msg::of13::BarrierReply barrier_reply(xid);
+			send_message_response(barrier_reply);
+		});
+	}
+}
+
+void VirtualSwitch::respond_on(
+		boost::weak_ptr<OpenflowConnection> connection,
+		std::function<void()> respond) {
+	// This can be called while handling a message of
+	// another connection, so restore its connection after
+	auto handled_connection = reply_connection;
+	reply_connection = connection;
+	respond();
+	reply_connection = handled_connection;
+}
+
+void VirtualSwitch::set_reply_connection(
+		boost::shared_ptr<OpenflowConnection> connection) {
+	reply_connection = connection;
+}
+
+void VirtualSwitch::send_message_response(fluid_msg::OFMsg& message) {
+	auto connection = reply_connection.lock();
+	if( connection != nullptr ) {
+		connection->send_message_response(message);
+	}
+	else {
+		OpenflowConnection::send_message_response(message);
+	}
+}
+
+void VirtualSwitch::send_raw_message_response(std::vector<uint8_t> message) {
+	auto connection = reply_connection.lock();
+	if( connection != nullptr ) {
+		connection->send_raw_message_response(std::move(message));
+	}
+	else {
+		OpenflowConnection::send_raw_message_response(std::move(message));
+	}
 }
 
 void VirtualSwitch::handle_packet_out(fluid_msg::of13::PacketOut& packet_out_message) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received packet_out";
 
-	// The physicalswitch to send the packet to
-	PhysicalSwitch::pointer ps_ptr;
+	// Fill in the packet if the controller refers to a buffered packet
+	if( packet_out_message.buffer_id() != OFP_NO_BUFFER ) {
+		std::vector<uint8_t> data;
+		uint32_t in_port;
+		if( !packet_buffer.retrieve(packet_out_message.buffer_id(), data, in_port) ) {
+			send_error_response(
+				fluid_msg::of13::OFPET_BAD_REQUEST,
+				fluid_msg::of13::OFPBRC_BUFFER_UNKNOWN,
+				packet_out_message);
+			return;
+		}
+		packet_out_message.buffer_id(OFP_NO_BUFFER);
+		packet_out_message.data(data.data(), data.size());
+	}
 
+	// A packet from the controller can be sent from any switch
 	if( packet_out_message.in_port() == fluid_msg::of13::OFPP_CONTROLLER ) {
-		// TODO Find a better switch to output over, scan action list to
-		// see what port it would be output to and send it to that switch
-
-		// Send the packet to the first found switch
-		ps_ptr = hypervisor->get_physical_switch_by_datapath_id(
-				dependent_switches.begin()->first);
+		send_controller_packet_out(packet_out_message);
+		return;
 	}
-	else {
-		uint64_t dependent_switch_dpid = port_to_dependent_switch.at(packet_out_message.in_port());
-		// If the in_port isn't controller this packet_out has to be sent
-		// to the switch that contains the port in in_port.
-		ps_ptr = hypervisor->get_physical_switch_by_datapath_id(
-				dependent_switch_dpid);
-
-		// Rewrite the in_port
-		packet_out_message.in_port(
-			dependent_switches
-				.at(dependent_switch_dpid)
-				.port_map.get_physical(packet_out_message.in_port()));
+
+	// If the in_port isn't controller this packet_out has to be sent
+	// to the switch that contains the port in in_port.
+	uint64_t dependent_switch_dpid = port_to_dependent_switch.at(packet_out_message.in_port());
+	PhysicalSwitch::pointer ps_ptr = hypervisor->get_physical_switch_by_datapath_id(
+			dependent_switch_dpid);
+	if( ps_ptr == nullptr ) {
+		// The physical switch is reconnecting
+		return;
 	}
 
+	// Rewrite the in_port
+	packet_out_message.in_port(
+		dependent_switches
+			.at(dependent_switch_dpid)
+			.port_map.get_physical(packet_out_message.in_port()));
+
 	// Rewrite the action list
 	fluid_msg::ActionList old_action_list = packet_out_message.actions();
 	fluid_msg::ActionList new_action_list;
@@ -339,137 +878,993 @@ void VirtualSwitch::handle_packet_out(fluid_msg::of13::PacketOut& packet_out_mes
 	ps_ptr->send_message(packet_out_message);
 }
 
-void VirtualSwitch::handle_flow_mod(fluid_msg::of13::FlowMod& flow_mod_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received flow_mod";
+PhysicalSwitch::pointer VirtualSwitch::get_flood_switch() const {
+	PhysicalSwitch::pointer flood_switch;
+	int flood_switch_distance = 0;
 
-	// Increase the table id with 2
-	flow_mod_message.table_id(flow_mod_message.table_id()+2);
+	for( const auto& dep_sw : dependent_switches ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+		if( ps_ptr == nullptr ) continue;
+
+		// Sum the distances to the other switches with ports
+		int distance = 0;
+		for( const auto& other_dep_sw : dependent_switches ) {
+			auto other_ps_ptr = hypervisor->get_physical_switch_by_datapath_id(other_dep_sw.first);
+			if( other_ps_ptr == nullptr ) continue;
+			distance += ps_ptr->get_distance(other_ps_ptr->get_id());
+		}
 
-	for( auto& ps_pair : dependent_switches ) {
-		// Fetch a shared pointer to the dependent switch
-		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
+		if( flood_switch == nullptr || distance < flood_switch_distance ) {
+			flood_switch          = ps_ptr;
+			flood_switch_distance = distance;
+		}
+	}
 
-		// Rewrite match in_port
-		fluid_msg::of13::Match match = flow_mod_message.match();
-		if( !ps_ptr->rewrite_match(match,this) ) {
-			// If the flowmod matches on an in_port that is not on this physical
-			// switch it can never trigger on this switch, so don't push it to
-			// the physical switch.
-			BOOST_LOG_TRIVIAL(trace) << *this
-				<< " in_port not on physical switch " << *ps_ptr;
-			continue;
+	return flood_switch;
+}
+
+void VirtualSwitch::calculate_flood_tree() {
+	flood_tree.clear();
+
+	if( is_down() ) return;
+
+	PhysicalSwitch::pointer root = get_flood_switch();
+	if( root == nullptr ) return;
+	flood_tree[root->get_id()];
+
+	// Follow the route of every switch with ports towards the root
+	// until it reaches a switch that is already in the tree
+	std::set<int> joined = { root->get_id() };
+	for( const auto& dep_sw : dependent_switches ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+		while( ps_ptr != nullptr && joined.count(ps_ptr->get_id()) == 0 ) {
+			// A switch that can't reach the root can't get floods
+			const auto& ports = ps_ptr->get_ports();
+			auto port_it = ports.end();
+			if( ps_ptr->get_distance(root->get_id()) != topology::infinite ) {
+				port_it = ports.find(ps_ptr->get_next(root->get_id()));
+			}
+			if( port_it == ports.end() || port_it->second.link == nullptr ) {
+				BOOST_LOG_TRIVIAL(warning) << *this << " can't flood over a tree, "
+					<< *ps_ptr << " has no route to " << *root;
+				flood_tree.clear();
+				return;
+			}
+
+			int parent_id = port_it->second.link->get_other_switch_id(ps_ptr->get_id());
+			flood_tree[ps_ptr->get_id()].insert(port_it->first);
+			flood_tree[parent_id].insert(port_it->second.link->get_port_number(parent_id));
+			joined.insert(ps_ptr->get_id());
+
+			ps_ptr = hypervisor->get_physical_switch(parent_id);
+		}
+	}
+
+	// With a single switch flooding to every port is the same
+	if( flood_tree.size() == 1 ) {
+		flood_tree.clear();
+	}
+}
+
+void VirtualSwitch::check_flood_tree() {
+	for( const auto& tree_pair : flood_tree ) {
+		auto ps_ptr = hypervisor->get_physical_switch(tree_pair.first);
+		uint32_t flood_index;
+		if( ps_ptr == nullptr || !ps_ptr->get_flood_index(id, flood_index) ) {
+			BOOST_LOG_TRIVIAL(warning) << *this << " can't flood over a tree, "
+				<< "switch " << tree_pair.first << " has no flood index";
+			flood_tree.clear();
+			return;
 		}
-		flow_mod_message.match(match);
+	}
+}
+
+const std::set<uint32_t>* VirtualSwitch::get_flood_tree_ports(int physical_switch_id) const {
+	auto tree_it = flood_tree.find(physical_switch_id);
+	return tree_it == flood_tree.end() ? nullptr : &tree_it->second;
+}
 
-		// 2 rules need to be pushed to the physical switch
-		fluid_msg::of13::FlowMod flowmod_copy_1(flow_mod_message);
-		fluid_msg::of13::FlowMod flowmod_copy_2(flow_mod_message);
+void VirtualSwitch::send_controller_packet_out(fluid_msg::of13::PacketOut& packet_out_message) {
+	fluid_msg::ActionList action_list = packet_out_message.actions();
+
+	// Collect the switches that own an output port, outputs to
+	// reserved ports and groups are done by the flood switch
+	std::set<uint64_t> physical_datapath_ids;
+	bool needs_flood_switch = false;
+	for( fluid_msg::Action* action : action_list.action_list() ) {
+		if( action->type() == fluid_msg::of13::OFPAT_OUTPUT ) {
+			uint32_t port = ((fluid_msg::of13::OutputAction*) action)->port();
+			auto port_it = port_to_dependent_switch.find(port);
+			if( port_it != port_to_dependent_switch.end() ) {
+				physical_datapath_ids.insert(port_it->second);
+			}
+			else {
+				needs_flood_switch = true;
+			}
+		}
+		else if( action->type() == fluid_msg::of13::OFPAT_GROUP ) {
+			needs_flood_switch = true;
+		}
+	}
 
-		// Add the match to both flowmods
-		MetadataTag metadata_tag;
-		metadata_tag.set_group(false);
-		metadata_tag.set_virtual_switch(id);
-		if( !metadata_tag.add_to_match(flowmod_copy_1) ) {
-			// TODO Handle case where metadata is already present
+	uint64_t flood_datapath_id = 0;
+	if( needs_flood_switch ) {
+		PhysicalSwitch::pointer flood_switch = get_flood_switch();
+		if( flood_switch == nullptr ) {
 			BOOST_LOG_TRIVIAL(warning) << *this
-				<< " received flowmod with problematic metadata match field";
+				<< " no physical switch online to send packet_out";
 			return;
 		}
-		metadata_tag.set_group(true);
-		metadata_tag.add_to_match(flowmod_copy_2);
+		flood_datapath_id = flood_switch->get_features().datapath_id;
+		physical_datapath_ids.insert(flood_datapath_id);
+	}
 
-		// Rewrite the instructions
-		fluid_msg::of13::InstructionSet old_instruction_set =
-				flow_mod_message.instructions();
-		fluid_msg::of13::InstructionSet
-			output_instruction_set,
-			group_instruction_set;
-		bool has_write_action_group = false;
-		if( !ps_ptr->rewrite_instruction_set(
-				old_instruction_set,
-				output_instruction_set,
-				group_instruction_set,
-				has_write_action_group,
+	for( uint64_t physical_datapath_id : physical_datapath_ids ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_datapath_id);
+		if( ps_ptr == nullptr ) continue;
+		bool is_flood_switch =
+			needs_flood_switch && physical_datapath_id == flood_datapath_id;
+
+		// Keep all actions in order except the outputs done by
+		// other switches, so the header rewrites stay the same
+		fluid_msg::ActionList switch_action_list;
+		for( fluid_msg::Action* action : action_list.action_list() ) {
+			if( action->type() == fluid_msg::of13::OFPAT_OUTPUT ) {
+				uint32_t port = ((fluid_msg::of13::OutputAction*) action)->port();
+				auto port_it = port_to_dependent_switch.find(port);
+				bool is_local = port_it != port_to_dependent_switch.end() ?
+					port_it->second == physical_datapath_id :
+					is_flood_switch;
+				if( !is_local ) continue;
+			}
+			else if( action->type() == fluid_msg::of13::OFPAT_GROUP && !is_flood_switch ) {
+				continue;
+			}
+			switch_action_list.add_action(action->clone());
+		}
+
+		// Rewrite the action list
+		fluid_msg::ActionList new_action_list;
+		if( !ps_ptr->rewrite_action_list(
+				switch_action_list,
+				new_action_list,
 				this) ) {
 			BOOST_LOG_TRIVIAL(warning) << *this
-				<< " received flowmod with problematic instruction set";
+				<< " found problematic action in packet out message";
 			return;
 		}
 
-		// Add the rewritten instructions to the flowmods
-		if( has_write_action_group ) {
-			flowmod_copy_1.instructions(group_instruction_set);
+		fluid_msg::of13::PacketOut switch_packet_out(packet_out_message);
+		switch_packet_out.actions(new_action_list);
+		ps_ptr->send_message(switch_packet_out);
+	}
+}
+
+bool VirtualSwitch::update_flow_table(
+		fluid_msg::of13::FlowMod& flow_mod_message,
+		bool& send) {
+	size_t affected = 0;
+	bool is_new = false;
+
+	// Only the tables mapped in all physical switches can be used
+	if( flow_mod_message.table_id() != fluid_msg::of13::OFPTT_ALL &&
+			flow_mod_message.table_id() >= get_n_tables() ) {
+		send_error_response(
+			fluid_msg::of13::OFPET_FLOW_MOD_FAILED,
+			fluid_msg::of13::OFPFMFC_BAD_TABLE_ID,
+			flow_mod_message);
+		return false;
+	}
+
+	// A goto has to go forward to a table that is mapped in all
+	// physical switches, checked before the mirror is changed. The
+	// instructions of a delete are ignored.
+	bool is_delete =
+		flow_mod_message.command() == fluid_msg::of13::OFPFC_DELETE ||
+		flow_mod_message.command() == fluid_msg::of13::OFPFC_DELETE_STRICT;
+	fluid_msg::of13::InstructionSet instruction_set = flow_mod_message.instructions();
+	for( fluid_msg::of13::Instruction* instruction : instruction_set.instruction_set() ) {
+		if( is_delete || instruction->type() != fluid_msg::of13::OFPIT_GOTO_TABLE ) continue;
+
+		uint8_t goto_table_id = ((fluid_msg::of13::GoToTable*) instruction)->table_id();
+		if( goto_table_id >= get_n_tables() ||
+				goto_table_id <= flow_mod_message.table_id() ) {
+			BOOST_LOG_TRIVIAL(info) << *this
+				<< " rejected flow_mod with a goto to table " << (int) goto_table_id;
+			send_error_response(
+				fluid_msg::of13::OFPET_BAD_INSTRUCTION,
+				fluid_msg::of13::OFPBIC_BAD_TABLE_ID,
+				flow_mod_message);
+			return false;
 		}
-		else {
-			flowmod_copy_1.instructions(output_instruction_set);
+	}
+
+	switch( flow_mod_message.command() ) {
+	case fluid_msg::of13::OFPFC_ADD:
+		// The physical switches only have room for part of the cookie
+		if( flow_mod_message.cookie() & ~CookieTag::max_tenant_cookie ) {
+			BOOST_LOG_TRIVIAL(info) << *this
+				<< " rejected flow_mod with a cookie that doesn't fit";
+			send_error_response(
+				fluid_msg::of13::OFPET_FLOW_MOD_FAILED,
+				fluid_msg::of13::OFPFMFC_EPERM,
+				flow_mod_message);
+			return false;
+		}
+		// A rule that replaces an identical rule doesn't take more space
+		is_new = !flow_table.contains(flow_mod_message);
+		if( is_new && !has_room_for_flow(flow_mod_message) ) {
+			send_error_response(
+				fluid_msg::of13::OFPET_FLOW_MOD_FAILED,
+				fluid_msg::of13::OFPFMFC_TABLE_FULL,
+				flow_mod_message);
+			return false;
+		}
+		if( !flow_table.add(flow_mod_message) ) {
+			BOOST_LOG_TRIVIAL(info) << *this << " rejected overlapping flow_mod";
+			send_error_response(
+				fluid_msg::of13::OFPET_FLOW_MOD_FAILED,
+				fluid_msg::of13::OFPFMFC_OVERLAP,
+				flow_mod_message);
+			return false;
 		}
-		flowmod_copy_2.instructions(group_instruction_set);
+		// The new copies start with new timeouts
+		flow_removed_requested.erase(FlowTable::make_key(flow_mod_message));
+		track_idle_flow(flow_mod_message);
+		if( is_new && !is_cached_table(flow_mod_message.table_id()) ) {
+			count_flow(flow_mod_message, 1);
+		}
+		send = true;
+		return true;
+	case fluid_msg::of13::OFPFC_MODIFY:
+	case fluid_msg::of13::OFPFC_MODIFY_STRICT:
+		affected = flow_table.modify(
+			flow_mod_message,
+			flow_mod_message.command() == fluid_msg::of13::OFPFC_MODIFY_STRICT);
+		break;
+	case fluid_msg::of13::OFPFC_DELETE:
+	case fluid_msg::of13::OFPFC_DELETE_STRICT:
+		affected = flow_table.remove(
+			flow_mod_message,
+			flow_mod_message.command() == fluid_msg::of13::OFPFC_DELETE_STRICT,
+			[this](fluid_msg::of13::FlowMod& removed) {
+				forget_removed_flow(removed);
+				if( removed.flags() & fluid_msg::of13::OFPFF_SEND_FLOW_REM ) {
+					flow_removed_requested.insert(FlowTable::make_key(removed));
+				}
+			});
+		break;
+	default:
+		send_error_response(
+			fluid_msg::of13::OFPET_FLOW_MOD_FAILED,
+			fluid_msg::of13::OFPFMFC_BAD_COMMAND,
+			flow_mod_message);
+		return false;
+	}
 
-		// Send the message to the virtual switch
-		// TODO Use send_response function so xid is saved
-		ps_ptr->send_message(flowmod_copy_1);
-		ps_ptr->send_message(flowmod_copy_2);
+	// When rules are reconciled the physical switches can contain
+	// rules from a previous run the mirror doesn't know about
+	send = affected > 0 || hypervisor->get_reconcile_flows();
+	return true;
+}
+
+bool VirtualSwitch::rewrite_flow_mod(
+		PhysicalSwitch::pointer ps_ptr,
+		fluid_msg::of13::FlowMod flow_mod_message,
+		std::vector<fluid_msg::of13::FlowMod>& physical_flow_mods,
+		uint16_t& err_type,
+		uint16_t& err_code) {
+	// Move the table to the table it is mapped onto, a
+	// delete can apply to all tables
+	if( flow_mod_message.table_id() != fluid_msg::of13::OFPTT_ALL ) {
+		flow_mod_message.table_id(
+			ps_ptr->get_physical_table(flow_mod_message.table_id()));
+	}
+
+	// Rewrite match in_port
+	fluid_msg::of13::Match match = flow_mod_message.match();
+	if( !ps_ptr->rewrite_match(match,this) ) {
+		// If the flowmod matches on an in_port that is not on this physical
+		// switch it can never trigger on this switch, so don't push it to
+		// the physical switch.
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " in_port not on physical switch " << *ps_ptr;
+		return true;
 	}
+	flow_mod_message.match(match);
+
+	// Tag the cookie so the rules can be found again when
+	// this virtual switch is removed
+	CookieTag cookie_tag;
+	cookie_tag.set_virtual_switch(id);
+	if( !cookie_tag.add_to_flow_mod(flow_mod_message) ) {
+		// Added rules with a cookie that doesn't fit are refused, so
+		// a filter on those bits doesn't apply to any rule here
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " cookie filter can't match a rule in " << *ps_ptr;
+		return true;
+	}
+
+	// Every copy only sees part of the packets, the idle timeout
+	// is kept by the hypervisor for all copies together
+	flow_mod_message.idle_timeout(0);
+
+	// 2 rules need to be pushed to the physical switch
+	fluid_msg::of13::FlowMod flowmod_copy_1(flow_mod_message);
+	fluid_msg::of13::FlowMod flowmod_copy_2(flow_mod_message);
+
+	// Add the match to both flowmods
+	MetadataTag metadata_tag;
+	metadata_tag.set_group(false);
+	metadata_tag.set_virtual_switch(id);
+	if( !metadata_tag.add_to_match(flowmod_copy_1) ) {
+		// TODO Handle case where metadata is already present
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received flowmod with problematic metadata match field";
+		err_type = fluid_msg::of13::OFPET_BAD_MATCH;
+		err_code = fluid_msg::of13::OFPBMC_BAD_FIELD;
+		return false;
+	}
+	metadata_tag.set_group(true);
+	metadata_tag.add_to_match(flowmod_copy_2);
+
+	// Rewrite the instructions
+	fluid_msg::of13::InstructionSet old_instruction_set =
+			flow_mod_message.instructions();
+	fluid_msg::of13::InstructionSet
+		output_instruction_set,
+		group_instruction_set;
+	bool has_write_action_group = false;
+	if( !ps_ptr->rewrite_instruction_set(
+			old_instruction_set,
+			output_instruction_set,
+			group_instruction_set,
+			has_write_action_group,
+			this) ) {
+		BOOST_LOG_TRIVIAL(warning) << *this
+			<< " received flowmod with problematic instruction set";
+		err_type = fluid_msg::of13::OFPET_BAD_INSTRUCTION;
+		err_code = fluid_msg::of13::OFPBIC_UNSUP_INST;
+		return false;
+	}
+
+	// Add the rewritten instructions to the flowmods
+	if( has_write_action_group ) {
+		flowmod_copy_1.instructions(group_instruction_set);
+	}
+	else {
+		flowmod_copy_1.instructions(output_instruction_set);
+	}
+	flowmod_copy_2.instructions(group_instruction_set);
+
+	// The mirror has to know when a rule expires, even if the
+	// controller doesn't want to know. Only the copy without the
+	// group bit is used for this.
+	if( flow_mod_message.hard_timeout() != 0 ) {
+		flowmod_copy_1.flags(
+			flowmod_copy_1.flags() | fluid_msg::of13::OFPFF_SEND_FLOW_REM);
+		flowmod_copy_2.flags(
+			flowmod_copy_2.flags() & ~fluid_msg::of13::OFPFF_SEND_FLOW_REM);
+	}
+
+	physical_flow_mods.push_back(flowmod_copy_1);
+	physical_flow_mods.push_back(flowmod_copy_2);
+	return true;
 }
 
-void VirtualSwitch::handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received group_mod";
+bool VirtualSwitch::send_flow_mod(
+		PhysicalSwitch::pointer ps_ptr,
+		fluid_msg::of13::FlowMod flow_mod_message) {
+	std::vector<fluid_msg::of13::FlowMod> physical_flow_mods;
+	uint16_t err_type, err_code;
+	if( !rewrite_flow_mod(ps_ptr, flow_mod_message, physical_flow_mods, err_type, err_code) ) {
+		return false;
+	}
+
+	// Send the message to the virtual switch
+	// TODO Use send_response function so xid is saved
+	for( auto& physical_flow_mod : physical_flow_mods ) {
+		ps_ptr->send_message(physical_flow_mod);
+	}
+	return true;
+}
+
+bool VirtualSwitch::is_installed_in(
+		PhysicalSwitch::pointer ps_ptr,
+		fluid_msg::of13::FlowMod& flow_mod_message) {
+	fluid_msg::of13::Match match = flow_mod_message.match();
+	return ps_ptr->rewrite_match(match,this);
+}
+
+bool VirtualSwitch::has_room_for_flow(fluid_msg::of13::FlowMod& flow_mod_message) {
+	// The flow cache makes room itself
+	if( is_cached_table(flow_mod_message.table_id()) ) {
+		return true;
+	}
 
 	for( auto& ps_pair : dependent_switches ) {
-		// Fetch a shared pointer to the dependent switch
 		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
 
-		fluid_msg::of13::GroupMod group_mod(group_mod_message);
-
-		// Rewrite the group id for the physical switch
-		group_mod.group_id(
-			ps_ptr->get_rewritten_group_id(
-				group_mod.group_id(),
-				this) );
-
-		// Loop over the buckets rewriting the action set
-		std::vector<fluid_msg::of13::Bucket> new_buckets;
-		for( fluid_msg::of13::Bucket& bucket : group_mod.buckets() ) {
-			fluid_msg::ActionSet old_action_set = bucket.get_actions();
-			fluid_msg::ActionSet output_action_set, group_action_set;
-			bool has_group = false;
-
-			// Do the actual rewriting
-			if( !ps_ptr->rewrite_action_set(
-					old_action_set,
-					output_action_set,
-					group_action_set,
-					has_group,
+		// A reconnecting physical switch is checked when it is back
+		if( ps_ptr == nullptr ) continue;
+
+		if( is_installed_in(ps_ptr, flow_mod_message) &&
+				!ps_ptr->has_room_for_tenant_flow(
+					ps_ptr->get_physical_table(flow_mod_message.table_id()),
 					this) ) {
-				BOOST_LOG_TRIVIAL(warning) << *this
-					<< " received groupmod with problematic action set";
+			BOOST_LOG_TRIVIAL(info) << *this << " rejected flow_mod, "
+				<< *ps_ptr << " is full";
+			return false;
+		}
+	}
+	return true;
+}
+
+void VirtualSwitch::count_flow(fluid_msg::of13::FlowMod& flow_mod_message, int change) {
+	// The flow cache counts the rules it installs itself, a
+	// removed rule only counts if it was installed
+	bool cached = is_cached_table(flow_mod_message.table_id());
+	std::string key;
+	if( cached ) {
+		key = FlowTable::make_key(flow_mod_message);
+	}
+
+	for( auto& ps_pair : dependent_switches ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
+
+		// A reconnecting physical switch counts the rules when they are replayed
+		if( ps_ptr == nullptr ) continue;
+
+		uint8_t table_id = ps_ptr->get_physical_table(flow_mod_message.table_id());
+		if( cached ) {
+			if( change < 0 && ps_pair.second.cached_flows.erase(key) > 0 ) {
+				ps_ptr->count_tenant_flows(table_id, id, change);
+			}
+		}
+		else if( is_installed_in(ps_ptr, flow_mod_message) ) {
+			ps_ptr->count_tenant_flows(table_id, id, change);
+		}
+	}
+}
+
+void VirtualSwitch::handle_flow_mod(fluid_msg::of13::FlowMod& flow_mod_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received flow_mod";
+
+	// The buffered packet is sent separately after the rules are
+	// pushed, the physical switches don't know the buffer_id
+	uint32_t buffer_id = flow_mod_message.buffer_id();
+	flow_mod_message.buffer_id(OFP_NO_BUFFER);
+
+	// Rewrite the rule for the physical switches before the mirror
+	// is changed, a rule one of them can't take is refused entirely
+	std::vector<std::pair<
+		PhysicalSwitch::pointer,
+		std::vector<fluid_msg::of13::FlowMod>>> physical_flow_mods;
+	for( auto& ps_pair : dependent_switches ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
+
+		// A reconnecting physical switch gets the rules from the mirror
+		if( ps_ptr == nullptr ) continue;
+
+		physical_flow_mods.emplace_back(
+			ps_ptr,
+			std::vector<fluid_msg::of13::FlowMod>());
+		uint16_t err_type, err_code;
+		if( !rewrite_flow_mod(
+				ps_ptr,
+				flow_mod_message,
+				physical_flow_mods.back().second,
+				err_type,
+				err_code) ) {
+			flow_mod_message.buffer_id(buffer_id);
+			send_error_response(err_type, err_code, flow_mod_message);
+			return;
+		}
+	}
+
+	// Modify and delete requests that don't apply to any rule
+	// don't have to be sent to the physical switches
+	bool send = false;
+	if( !update_flow_table(flow_mod_message, send) ) {
+		return;
+	}
+	if( send &&
+			flow_mod_message.command() == fluid_msg::of13::OFPFC_ADD &&
+			is_cached_table(flow_mod_message.table_id()) ) {
+		// The flow cache decides if the rule is installed
+		for( auto& ps_pair : dependent_switches ) {
+			auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
+			if( ps_ptr == nullptr ) continue;
+
+			if( is_installed_in(ps_ptr, flow_mod_message) ) {
+				add_cached_flow(ps_ptr, ps_pair.second, flow_mod_message);
+			}
+		}
+	}
+	else if( send ) {
+		// TODO Use send_response function so xid is saved
+		for( auto& ps_pair : physical_flow_mods ) {
+			for( auto& physical_flow_mod : ps_pair.second ) {
+				ps_pair.first->send_message(physical_flow_mod);
+			}
+		}
+	}
+
+	// The rule stays, only the buffer is refused
+	if( buffer_id != OFP_NO_BUFFER && !send_buffered_packet(buffer_id) ) {
+		flow_mod_message.buffer_id(buffer_id);
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_BUFFER_UNKNOWN,
+			flow_mod_message);
+	}
+}
+
+void VirtualSwitch::replay_flows(PhysicalSwitch::pointer physical_switch) {
+	BOOST_LOG_TRIVIAL(info) << *this << " installing " << flow_table.size()
+		<< " rules again in " << *physical_switch;
+
+	// The copies installed again count their packets from 0
+	for( auto& idle_pair : idle_flows ) {
+		idle_pair.second.packet_counts.erase(physical_switch->get_features().datapath_id);
+		idle_pair.second.byte_counts.erase(physical_switch->get_features().datapath_id);
+	}
+
+	flow_table.for_each(
+		[this,&physical_switch](fluid_msg::of13::FlowMod& flow_mod) {
+			// The cached rules are installed below
+			if( is_cached_table(flow_mod.table_id()) ) {
 				return;
 			}
+			if( is_installed_in(physical_switch, flow_mod) ) {
+				physical_switch->count_tenant_flows(
+					physical_switch->get_physical_table(flow_mod.table_id()),
+					id,
+					1);
+			}
+			send_flow_mod(physical_switch, flow_mod);
+		});
+
+	if( hypervisor->get_flow_cache() != no_flow_cache ) {
+		replay_cached_flows(
+			physical_switch,
+			dependent_switches.at(physical_switch->get_features().datapath_id));
+	}
+}
+
+void VirtualSwitch::send_flow_removed(
+		fluid_msg::of13::FlowRemoved& flow_removed_message,
+		bool group_copy,
+		uint64_t physical_datapath_id) {
+	// Only the copy without the group bit reports a timeout
+	if( group_copy ) {
+		return;
+	}
+
+	// The rule as the controller knows it
+	fluid_msg::of13::FlowMod flow_mod_message;
+	flow_mod_message.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
+	flow_mod_message.table_id(flow_removed_message.table_id());
+	flow_mod_message.priority(flow_removed_message.priority());
+	flow_mod_message.cookie(flow_removed_message.cookie());
+	flow_mod_message.cookie_mask(0);
+	flow_mod_message.out_port(fluid_msg::of13::OFPP_ANY);
+	flow_mod_message.out_group(fluid_msg::of13::OFPG_ANY);
+	flow_mod_message.buffer_id(OFP_NO_BUFFER);
+	flow_mod_message.match(flow_removed_message.match());
+
+	uint8_t reason = flow_removed_message.reason();
+	if( reason == fluid_msg::of13::OFPRR_IDLE_TIMEOUT ||
+			reason == fluid_msg::of13::OFPRR_HARD_TIMEOUT ) {
+		// The copies that time out after the rule is removed
+		// aren't in the mirror anymore
+		if( !flow_table.contains(flow_mod_message) ) {
+			return;
+		}
+
+		// All copies time out at the same hard timeout, the copies
+		// are installed without the idle timeout
+		bool requested = false;
+		flow_table.remove(
+			flow_mod_message,
+			true,
+			[this,&requested](fluid_msg::of13::FlowMod& removed_flow_mod) {
+				forget_removed_flow(removed_flow_mod);
+				requested = removed_flow_mod.flags() & fluid_msg::of13::OFPFF_SEND_FLOW_REM;
+			});
+
+		// Remove the other copies so the rule is gone everywhere
+		for( auto& dep_sw : dependent_switches ) {
+			auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+			if( ps_ptr == nullptr ) continue;
+			send_flow_mod(ps_ptr, flow_mod_message);
+		}
+
+		// The physical switches report every rule with a timeout
+		if( !requested ) {
+			return;
+		}
+	}
+	else {
+		// A rule evicted from the flow cache is still in the mirror
+		if( flow_table.contains(flow_mod_message) ) {
+			return;
+		}
 
-			// Add the bucket to the list of new buckets, if the bucket contains
-			// a group action take the action set without the output actions otherwise
-			// take the action set without the group actions
-			if( has_group ) {
-				new_buckets.emplace_back(
-					bucket.weight(),
-					bucket.watch_port(),  // TODO Rewrite watch_port
-					bucket.watch_group(), // TODO Rewrite watch_group
-					group_action_set);
+		// The controller removed the rule or the group it uses, it
+		// was already removed from the mirror. The controllers can't
+		// use meters, so the switches don't remove rules for a
+		// deleted meter. Only the copy in a single physical switch is
+		// reported, the switch with the in_port or the connected
+		// physical switch with the lowest datapath id.
+		fluid_msg::of13::Match match = flow_removed_message.match();
+		fluid_msg::of13::InPort* in_port = match.in_port();
+		uint64_t reporting_datapath_id = 0;
+		if( in_port != nullptr ) {
+			auto port_it = port_to_dependent_switch.find(in_port->value());
+			if( port_it == port_to_dependent_switch.end() ) {
+				return;
 			}
-			else {
-				new_buckets.emplace_back(
-					bucket.weight(),
-					bucket.watch_port(),  // TODO Rewrite watch_port
-					bucket.watch_group(), // TODO Rewrite watch_group
-					output_action_set);
+			reporting_datapath_id = port_it->second;
+		}
+		else {
+			bool found = false;
+			for( auto& dep_sw : dependent_switches ) {
+				if( hypervisor->get_physical_switch_by_datapath_id(dep_sw.first) == nullptr ) {
+					continue;
+				}
+				if( !found || dep_sw.first < reporting_datapath_id ) {
+					reporting_datapath_id = dep_sw.first;
+					found = true;
+				}
 			}
 		}
-		// Actually set the new buckets in the message
-		group_mod.buckets(new_buckets);
+		if( reporting_datapath_id != physical_datapath_id ) {
+			return;
+		}
+		if( flow_removed_requested.erase(FlowTable::make_key(flow_mod_message)) == 0 ) {
+			return;
+		}
+	}
 
-		// Send the message to the virtual switch
-		// TODO Use send_response function so xid is saved
-		ps_ptr->send_message(group_mod);
+	if( !wants_flow_removed(reason) ) {
+		return;
+	}
+	BOOST_LOG_TRIVIAL(trace) << *this << " send flow_removed";
+	send_message(flow_removed_message);
+}
+
+void VirtualSwitch::forget_removed_flow(fluid_msg::of13::FlowMod& flow_mod_message) {
+	count_flow(flow_mod_message, -1);
+	idle_flows.erase(FlowTable::make_key(flow_mod_message));
+}
+
+void VirtualSwitch::track_idle_flow(fluid_msg::of13::FlowMod& flow_mod_message) {
+	std::string key = FlowTable::make_key(flow_mod_message);
+	if( flow_mod_message.idle_timeout() == 0 ) {
+		idle_flows.erase(key);
+		return;
+	}
+
+	boost::posix_time::ptime now =
+		boost::posix_time::microsec_clock::universal_time();
+	IdleFlow& idle_flow = idle_flows[key];
+	idle_flow.flow_mod  = flow_mod_message;
+	idle_flow.added     = now;
+	idle_flow.last_used = now;
+	idle_flow.packet_counts.clear();
+	idle_flow.byte_counts.clear();
+}
+
+bool VirtualSwitch::has_idle_flows() const {
+	return !idle_flows.empty();
+}
+
+void VirtualSwitch::update_idle_flows(
+		PhysicalSwitch::pointer ps_ptr,
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats) {
+	uint64_t datapath_id = ps_ptr->get_features().datapath_id;
+
+	// Both copies of a rule match packets of the rule
+	std::unordered_map<std::string,std::pair<uint64_t,uint64_t>> counts;
+	for( fluid_msg::of13::FlowStats flow : flow_stats ) {
+		bool group_copy = false;
+		if( !ps_ptr->restore_flow_stats(flow, group_copy, this) ) {
+			continue;
+		}
+
+		fluid_msg::of13::FlowMod flow_mod;
+		flow_mod.table_id(flow.table_id());
+		flow_mod.priority(flow.priority());
+		flow_mod.match(flow.match());
+		std::pair<uint64_t,uint64_t>& count = counts[FlowTable::make_key(flow_mod)];
+		count.first  += flow.packet_count();
+		count.second += flow.byte_count();
+	}
+
+	boost::posix_time::ptime now =
+		boost::posix_time::microsec_clock::universal_time();
+	for( auto& count_pair : counts ) {
+		auto idle_it = idle_flows.find(count_pair.first);
+		if( idle_it == idle_flows.end() ) continue;
+
+		// A copy installed again counts from 0, the packet that
+		// made the flow cache install it already counted as use
+		IdleFlow& idle_flow = idle_it->second;
+		if( count_pair.second.first > idle_flow.packet_counts[datapath_id] ) {
+			idle_flow.last_used = now;
+		}
+		idle_flow.packet_counts[datapath_id] = count_pair.second.first;
+		idle_flow.byte_counts[datapath_id]   = count_pair.second.second;
+	}
+
+	expire_idle_flows();
+}
+
+void VirtualSwitch::expire_idle_flows() {
+	boost::posix_time::ptime now =
+		boost::posix_time::microsec_clock::universal_time();
+
+	std::vector<std::string> expired;
+	for( auto& idle_pair : idle_flows ) {
+		IdleFlow& idle_flow = idle_pair.second;
+		if( now - idle_flow.last_used >=
+				boost::posix_time::seconds(idle_flow.flow_mod.idle_timeout()) ) {
+			expired.push_back(idle_pair.first);
+		}
+	}
+
+	for( const std::string& key : expired ) {
+		// Removing the rule forgets its usage
+		IdleFlow idle_flow = idle_flows.at(key);
+
+		fluid_msg::of13::FlowMod flow_mod_message(idle_flow.flow_mod);
+		flow_mod_message.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
+		flow_mod_message.cookie_mask(0);
+		flow_mod_message.out_port(fluid_msg::of13::OFPP_ANY);
+		flow_mod_message.out_group(fluid_msg::of13::OFPG_ANY);
+		flow_mod_message.buffer_id(OFP_NO_BUFFER);
+
+		BOOST_LOG_TRIVIAL(trace) << *this << " rule timed out idle";
+		flow_table.remove(
+			flow_mod_message,
+			true,
+			[this](fluid_msg::of13::FlowMod& removed_flow_mod) {
+				forget_removed_flow(removed_flow_mod);
+			});
+		for( auto& dep_sw : dependent_switches ) {
+			auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+			if( ps_ptr == nullptr ) continue;
+			send_flow_mod(ps_ptr, flow_mod_message);
+		}
+
+		if( !(idle_flow.flow_mod.flags() & fluid_msg::of13::OFPFF_SEND_FLOW_REM) ||
+				!wants_flow_removed(fluid_msg::of13::OFPRR_IDLE_TIMEOUT) ) {
+			continue;
+		}
+
+		// The counters of the copies in all physical switches
+		uint64_t packet_count = 0;
+		uint64_t byte_count   = 0;
+		for( auto& count_pair : idle_flow.packet_counts ) {
+			packet_count += count_pair.second;
+		}
+		for( auto& count_pair : idle_flow.byte_counts ) {
+			byte_count += count_pair.second;
+		}
+		boost::posix_time::time_duration duration = now - idle_flow.added;
+
+		fluid_msg::of13::FlowRemoved flow_removed_message;
+		flow_removed_message.cookie(idle_flow.flow_mod.cookie());
+		flow_removed_message.priority(idle_flow.flow_mod.priority());
+		flow_removed_message.reason(fluid_msg::of13::OFPRR_IDLE_TIMEOUT);
+		flow_removed_message.table_id(idle_flow.flow_mod.table_id());
+		flow_removed_message.duration_sec(duration.total_seconds());
+		flow_removed_message.duration_nsec((duration.total_microseconds() % 1000000) * 1000);
+		flow_removed_message.idle_timeout(idle_flow.flow_mod.idle_timeout());
+		flow_removed_message.hard_timeout(idle_flow.flow_mod.hard_timeout());
+		flow_removed_message.packet_count(packet_count);
+		flow_removed_message.byte_count(byte_count);
+		flow_removed_message.match(idle_flow.flow_mod.match());
+		send_message(flow_removed_message);
+	}
+}
+
+void VirtualSwitch::remove_group_flows(uint32_t group_id) {
+	fluid_msg::of13::FlowMod flow_mod_message;
+	flow_mod_message.command(fluid_msg::of13::OFPFC_DELETE);
+	flow_mod_message.table_id(fluid_msg::of13::OFPTT_ALL);
+	flow_mod_message.cookie(0);
+	flow_mod_message.cookie_mask(0);
+	flow_mod_message.out_port(fluid_msg::of13::OFPP_ANY);
+	flow_mod_message.out_group(group_id);
+	flow_mod_message.buffer_id(OFP_NO_BUFFER);
+
+	flow_table.remove(
+		flow_mod_message,
+		false,
+		[this](fluid_msg::of13::FlowMod& removed) {
+			forget_removed_flow(removed);
+			if( removed.flags() & fluid_msg::of13::OFPFF_SEND_FLOW_REM ) {
+				flow_removed_requested.insert(FlowTable::make_key(removed));
+			}
+		});
+}
+
+bool VirtualSwitch::send_group_mod(
+		PhysicalSwitch::pointer ps_ptr,
+		fluid_msg::of13::GroupMod group_mod) {
+	// Rewrite the group id for the physical switch
+	group_mod.group_id(
+		ps_ptr->get_rewritten_group_id(
+			group_mod.group_id(),
+			this) );
+
+	// Loop over the buckets rewriting the action set
+	std::vector<fluid_msg::of13::Bucket> new_buckets;
+	for( fluid_msg::of13::Bucket& bucket : group_mod.buckets() ) {
+		fluid_msg::ActionSet old_action_set = bucket.get_actions();
+		fluid_msg::ActionSet output_action_set, group_action_set;
+		bool has_group = false;
+
+		// Do the actual rewriting
+		if( !ps_ptr->rewrite_action_set(
+				old_action_set,
+				output_action_set,
+				group_action_set,
+				has_group,
+				this) ) {
+			BOOST_LOG_TRIVIAL(warning) << *this
+				<< " received groupmod with problematic action set";
+			return false;
+		}
+
+		// Add the bucket to the list of new buckets, if the bucket contains
+		// a group action take the action set without the output actions otherwise
+		// take the action set without the group actions
+		if( has_group ) {
+			new_buckets.emplace_back(
+				bucket.weight(),
+				bucket.watch_port(),  // TODO Rewrite watch_port
+				bucket.watch_group(), // TODO Rewrite watch_group
+				group_action_set);
+		}
+		else {
+			new_buckets.emplace_back(
+				bucket.weight(),
+				bucket.watch_port(),  // TODO Rewrite watch_port
+				bucket.watch_group(), // TODO Rewrite watch_group
+				output_action_set);
+		}
+	}
+	// Actually set the new buckets in the message
+	group_mod.buckets(new_buckets);
+
+	// Send the message to the virtual switch
+	// TODO Use send_response function so xid is saved
+	ps_ptr->send_message(group_mod);
+	return true;
+}
+
+void VirtualSwitch::handle_group_mod(fluid_msg::of13::GroupMod& group_mod_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received group_mod";
+
+	// Remember the groups so they can be created again
+	if( group_mod_message.command() == fluid_msg::of13::OFPGC_DELETE ) {
+		// The rules using a deleted group are deleted as well
+		if( group_mod_message.group_id() == fluid_msg::of13::OFPG_ALL ) {
+			for( auto& group_pair : group_table ) {
+				remove_group_flows(group_pair.first);
+				journal_group(group_pair.first, nullptr);
+			}
+			group_table.clear();
+		}
+		else if( group_table.erase(group_mod_message.group_id()) > 0 ) {
+			remove_group_flows(group_mod_message.group_id());
+			journal_group(group_mod_message.group_id(), nullptr);
+		}
+	}
+	else {
+		auto group_it = group_table.find(group_mod_message.group_id());
+		if( group_it != group_table.end() ) {
+			group_table.erase(group_it);
+		}
+		fluid_msg::of13::GroupMod& group_mod =
+			group_table.emplace(group_mod_message.group_id(), group_mod_message)
+				.first->second;
+		group_mod.command(fluid_msg::of13::OFPGC_ADD);
+		journal_group(group_mod_message.group_id(), &group_mod);
+	}
+
+	for( auto& ps_pair : dependent_switches ) {
+		// Fetch a shared pointer to the dependent switch
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(ps_pair.first);
+
+		// A reconnecting physical switch gets the groups from the mirror
+		if( ps_ptr == nullptr ) continue;
+
+		if( !send_group_mod(ps_ptr, group_mod_message) ) {
+			return;
+		}
+	}
+}
+
+void VirtualSwitch::replay_groups(PhysicalSwitch::pointer physical_switch) {
+	// Groups can refer to each other, so first create all groups
+	// without buckets and then add the buckets
+	for( auto& group_pair : group_table ) {
+		fluid_msg::of13::GroupMod group_mod(group_pair.second);
+		group_mod.buckets(std::vector<fluid_msg::of13::Bucket>());
+		send_group_mod(physical_switch, group_mod);
+	}
+	for( auto& group_pair : group_table ) {
+		fluid_msg::of13::GroupMod group_mod(group_pair.second);
+		group_mod.command(fluid_msg::of13::OFPGC_MODIFY);
+		send_group_mod(physical_switch, group_mod);
+	}
+}
+
+void VirtualSwitch::journal_flow(fluid_msg::of13::FlowMod& flow_mod, bool removed) {
+	if( removed ) {
+		hypervisor->forget_rule(
+			datapath_id,
+			StateJournal::flow_rule,
+			FlowTable::make_key(flow_mod));
+	}
+	else {
+		hypervisor->record_rule(
+			datapath_id,
+			StateJournal::flow_rule,
+			FlowTable::make_key(flow_mod),
+			flow_mod);
+	}
+}
+
+void VirtualSwitch::journal_group(uint32_t group_id, fluid_msg::of13::GroupMod* group_mod) {
+	std::string key((const char*) &group_id, sizeof(group_id));
+	if( group_mod == nullptr ) {
+		hypervisor->forget_rule(datapath_id, StateJournal::group_rule, key);
+	}
+	else {
+		hypervisor->record_rule(datapath_id, StateJournal::group_rule, key, *group_mod);
+	}
+}
+
+void VirtualSwitch::restore_journaled_rules() {
+	for( std::vector<uint8_t>& data :
+			hypervisor->get_journaled_rules(datapath_id, StateJournal::group_rule) ) {
+		fluid_msg::of13::GroupMod group_mod;
+		if( group_mod.unpack(data.data()) ) {
+			BOOST_LOG_TRIVIAL(warning) << *this << " can't restore a journaled group";
+			continue;
+		}
+		group_table[group_mod.group_id()] = group_mod;
+	}
+	for( std::vector<uint8_t>& data :
+			hypervisor->get_journaled_rules(datapath_id, StateJournal::flow_rule) ) {
+		fluid_msg::of13::FlowMod flow_mod;
+		if( flow_mod.unpack(data.data()) ) {
+			BOOST_LOG_TRIVIAL(warning) << *this << " can't restore a journaled rule";
+			continue;
+		}
+		flow_table.add(flow_mod);
+		track_idle_flow(flow_mod);
+	}
+	if( group_table.empty() && flow_table.size() == 0 ) {
+		return;
+	}
+
+	BOOST_LOG_TRIVIAL(info) << *this << " restoring " << flow_table.size()
+		<< " rules and " << group_table.size() << " groups from the state journal";
+
+	// The switches kept the rules when they were reconciled,
+	// installing them again makes sure they are all there
+	for( auto& dep_sw : dependent_switches ) {
+		auto sw_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+		if( sw_ptr == nullptr ) continue;
+
+		replay_groups(sw_ptr);
+		replay_flows(sw_ptr);
 	}
 }
 
@@ -504,11 +1899,14 @@ void VirtualSwitch::handle_multipart_request_port_desc(fluid_msg::of13::Multipar
 				.at(port_pair.second)
 					.port_map.get_physical(port_no);
 
-		// Get the physical ports from the physical switch
-		auto& phy_ports =
+		// Skip the ports of a physical switch that is reconnecting
+		auto phy_sw =
 			hypervisor->
-				get_physical_switch_by_datapath_id(port_pair.second)
-					->get_ports();
+				get_physical_switch_by_datapath_id(port_pair.second);
+		if( phy_sw == nullptr ) continue;
+
+		// Get the physical ports from the physical switch
+		auto& phy_ports = phy_sw->get_ports();
 
 		// If the port we need exists in the physical switch add
 		// it to the port description message
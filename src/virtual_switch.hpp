@@ -1,22 +1,34 @@
 #pragma once
 
 #include <map>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
 #include <unordered_map>
 
 #include <boost/asio.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "bidirectional_map.hpp"
+#include "flow_table.hpp"
+#include "packet_buffer.hpp"
+#include "token_bucket.hpp"
 
 #include "openflow_connection.hpp"
 
 class PhysicalSwitch;
 class Hypervisor;
 class Slice;
+class AuxiliaryConnection;
 
 class VirtualSwitch : public OpenflowConnection {
 private:
 	/// The global id for this virtual switch
 	int id;
+	/// If the id is the one this switch had in the previous run
+	bool id_restored;
 
 	/// The datpath id of this switch
 	uint64_t datapath_id;
@@ -34,9 +46,38 @@ private:
 		connected
 	} state;
 
+	/// A rule of the first table installed in a physical switch by the flow cache
+	struct CachedFlow {
+		/// The rule as the controller sent it
+		fluid_msg::of13::FlowMod flow_mod;
+		/// The packets the rule matched in the physical switch
+		uint64_t packet_count;
+		/// The value of cache_clock when the rule last matched a packet
+		uint64_t last_used;
+	};
+	/// Increased every time the usage of the cached rules is updated
+	uint64_t cache_clock;
+	/// Limits the rate of cache misses the hypervisor handles
+	TokenBucket cache_miss_bucket;
+
 	struct DependentSwitch {
 		/// The mapping virtual port id <-> physical port id
 		bidirectional_map<uint32_t,uint32_t> port_map;
+		/// The connection of the physical switch the rules are in
+		/**
+		 * A physical switch that reconnects gets a new connection
+		 * but keeps its id, this is used to find the switches that
+		 * lost the rules.
+		 */
+		boost::weak_ptr<PhysicalSwitch> physical_switch;
+		/// The rules of the first table that are installed, rule key -> rule
+		/**
+		 * Only used with the flow cache, the other rules of the
+		 * first table are only in the mirror.
+		 */
+		std::unordered_map<std::string,CachedFlow> cached_flows;
+		/// If the rule sending the misses of the flow cache to the hypervisor is installed
+		bool cache_miss_rule = false;
 	};
 	/// The map with all the port id's
 	/**
@@ -51,8 +92,359 @@ private:
 	 */
 	std::map<uint32_t,uint64_t> port_to_dependent_switch;
 
+	/// The switch configuration flags set by the controller
+	uint16_t config_flags;
+	/// The amount of bytes of a packet sent to the controller
+	uint16_t miss_send_len;
+
+	/// The asynchronous messages the controller wants to receive
+	/**
+	 * Every bit is a reason as in the SetAsync message, index 0
+	 * is the mask for the master and equal roles and index 1 for
+	 * the slave role. Roles are not supported so the controller
+	 * always has the equal role.
+	 */
+	uint32_t packet_in_mask[2];
+	uint32_t port_status_mask[2];
+	uint32_t flow_removed_mask[2];
+	/// Set the asynchronous message masks to the openflow defaults
+	void reset_async_masks();
+
+	/// The rules the controller installed in this virtual switch
+	FlowTable flow_table;
+	/// The removed rules whose removal the controller wants to hear about
+	/**
+	 * The rules with a timeout always report their removal so
+	 * the mirror knows when they expire, once a rule is removed
+	 * from the mirror this is the only place that remembers if
+	 * the controller asked for it. The keys are made by
+	 * FlowTable::make_key.
+	 */
+	std::set<std::string> flow_removed_requested;
+	/// The usage of a rule with an idle timeout
+	struct IdleFlow {
+		/// The rule as the controller added it
+		fluid_msg::of13::FlowMod flow_mod;
+		/// When the rule was added
+		boost::posix_time::ptime added;
+		/// When a copy of the rule last matched a packet
+		boost::posix_time::ptime last_used;
+		/// The packets counted by the copies in every physical switch, datapath id -> packets
+		std::map<uint64_t,uint64_t> packet_counts;
+		/// The bytes counted by the copies in every physical switch, datapath id -> bytes
+		std::map<uint64_t,uint64_t> byte_counts;
+	};
+	/// The rules with an idle timeout, rule key -> usage
+	/**
+	 * Every switch only sees part of the packets of a rule, so
+	 * the copies are installed without the idle timeout and the
+	 * rule expires when none of the copies matched a packet
+	 * during the timeout, according to the flow statistics.
+	 */
+	std::unordered_map<std::string,IdleFlow> idle_flows;
+	/// Start tracking the usage of a rule if it has an idle timeout
+	void track_idle_flow(fluid_msg::of13::FlowMod& flow_mod_message);
+	/// Remove the rules that weren't used during their idle timeout
+	void expire_idle_flows();
+	/// Forget the state of a rule that is removed from the mirror
+	void forget_removed_flow(fluid_msg::of13::FlowMod& flow_mod_message);
+	/// Remove the rules that use a group from the mirror
+	/**
+	 * The physical switches remove these rules themselves when
+	 * the group is deleted.
+	 */
+	void remove_group_flows(uint32_t group_id);
+	/// Update the mirror of the flow tables with a FlowMod
+	/**
+	 * \param send Set to if the FlowMod has to be sent to the
+	 *   physical switches
+	 * \return False if the FlowMod was rejected, an error is
+	 *   sent to the controller
+	 */
+	bool update_flow_table(
+		fluid_msg::of13::FlowMod& flow_mod_message,
+		bool& send);
+	/// The groups the controller created, group id -> add message
+	std::map<uint32_t,fluid_msg::of13::GroupMod> group_table;
+	/// Keep a changed rule of the mirror in the state journal
+	void journal_flow(fluid_msg::of13::FlowMod& flow_mod, bool removed);
+	/// Keep a changed group of the mirror in the state journal
+	/**
+	 * \param group_mod The new group, nullptr if the group is removed
+	 */
+	void journal_group(uint32_t group_id, fluid_msg::of13::GroupMod* group_mod);
+	/// Take over the rules and groups in the state journal
+	/**
+	 * These are left by a previous run of the hypervisor that
+	 * stopped while the controller was connected. They are added
+	 * to the mirror and installed in the physical switches.
+	 */
+	void restore_journaled_rules();
+	/// Send a GroupMod from the controller to a physical switch
+	/**
+	 * \return False if the GroupMod can't be rewritten
+	 */
+	bool send_group_mod(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		fluid_msg::of13::GroupMod group_mod);
+	/// Create the groups of the controller again in a physical switch
+	void replay_groups(boost::shared_ptr<PhysicalSwitch> physical_switch);
+	/// Send a FlowMod from the controller to a physical switch
+	/**
+	 * The table id, match, metadata and instructions are
+	 * rewritten for the physical switch.
+	 * \return False if the FlowMod can't be rewritten
+	 */
+	bool send_flow_mod(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		fluid_msg::of13::FlowMod flow_mod_message);
+	/// Rewrite a FlowMod from the controller for a physical switch
+	/**
+	 * \param physical_flow_mods The rewritten FlowMods are added to
+	 *   this, none if the rule isn't installed in the switch
+	 * \param err_type, err_code The error for the controller if
+	 *   the FlowMod can't be rewritten
+	 * \return False if the FlowMod can't be rewritten
+	 */
+	bool rewrite_flow_mod(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		fluid_msg::of13::FlowMod flow_mod_message,
+		std::vector<fluid_msg::of13::FlowMod>& physical_flow_mods,
+		uint16_t& err_type,
+		uint16_t& err_code);
+	/// Check if a rule of the controller is installed in a physical switch
+	/**
+	 * A rule matching on an in_port is only installed in the
+	 * physical switch with that port.
+	 */
+	bool is_installed_in(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		fluid_msg::of13::FlowMod& flow_mod_message);
+	/// Check if the physical switches have room for a new rule
+	bool has_room_for_flow(fluid_msg::of13::FlowMod& flow_mod_message);
+	/// Count a rule in the physical switches it is installed in
+	/**
+	 * \param change 1 if the rule is added, -1 if it is removed
+	 */
+	void count_flow(fluid_msg::of13::FlowMod& flow_mod_message, int change);
+
+	/// Check if the physical switches only get the used rules of a table
+	/**
+	 * With the flow cache only the first table is cached, the
+	 * packets reaching the later tables already took actions that
+	 * can't be undone when the packet is sent through the tables
+	 * again.
+	 */
+	bool is_cached_table(uint8_t table_id) const;
+	/// Install a rule of the first table and the rules it depends on
+	/**
+	 * A rule depends on the rules with a higher priority that
+	 * overlap it, if those aren't installed the packets matching
+	 * them would take the wrong rule. A rule with priority 0 would
+	 * overlap the rule catching the misses, so it depends on all
+	 * rules of the table.
+	 * \param evict If the least used rules can be evicted to make room
+	 * \return False if the rules don't fit
+	 */
+	bool install_cached_flow(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		DependentSwitch& dependent_switch,
+		fluid_msg::of13::FlowMod& flow_mod_message,
+		bool evict);
+	/// Collect the keys of the installed rules that depend on a rule
+	std::vector<std::string> find_dependent_flows(
+		DependentSwitch& dependent_switch,
+		fluid_msg::of13::FlowMod& flow_mod_message);
+	/// Remove installed rules and the installed rules that depend on them
+	void evict_cached_flows(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		DependentSwitch& dependent_switch,
+		std::vector<std::string> keys);
+	/// Make sure the misses of the first table are sent to the hypervisor
+	void install_cache_miss_rule(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		DependentSwitch& dependent_switch);
+	/// Put a new rule of the first table in the flow cache of a physical switch
+	/**
+	 * The rule is only installed if it fits, no rules are evicted
+	 * for it until it matches a packet.
+	 */
+	void add_cached_flow(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		DependentSwitch& dependent_switch,
+		fluid_msg::of13::FlowMod& flow_mod_message);
+	/// Install the rules of the first table again in a physical switch
+	void replay_cached_flows(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		DependentSwitch& dependent_switch);
+
+	/// The packets that can be referred to by buffer_id
+	PacketBuffer packet_buffer;
+	/// Send a buffered packet through the flow tables
+	/**
+	 * This is used when the controller sends a FlowMod with a
+	 * buffer_id, the packet is processed as if it was just received.
+	 * \return False if the buffer_id is unknown
+	 */
+	bool send_buffered_packet(uint32_t buffer_id);
+
+	/// Limits the rate of PacketIns of this virtual switch
+	TokenBucket packet_in_bucket;
+	/// The amount of PacketIns dropped because of the rate limit
+	uint64_t packet_in_dropped;
+
+	/// Find the physical switch to flood packets from
+	/**
+	 * This is the online dependent switch with the smallest
+	 * total distance to the other dependent switches, so a
+	 * flood crosses as few links as possible.
+	 */
+	boost::shared_ptr<PhysicalSwitch> get_flood_switch() const;
+	/// The spanning tree floods are sent over
+	/**
+	 * physical switch id -> the ports with a link in the tree
+	 *
+	 * The tree is rooted at the flood switch and contains the
+	 * routes of the other switches with ports towards it, so
+	 * every link in it is between neighbouring switches. A flood
+	 * crosses every link in the tree once. This is empty if the
+	 * flood is sent to every port separately.
+	 */
+	std::map<int,std::set<uint32_t>> flood_tree;
+	/// Send a PacketOut from the controller to the physical switches
+	/**
+	 * The packet is sent by the physical switches that own the
+	 * output ports, so it doesn't cross links between physical
+	 * switches. A PacketOut with outputs on multiple physical
+	 * switches is split into a PacketOut per switch.
+	 */
+	void send_controller_packet_out(fluid_msg::of13::PacketOut& packet_out_message);
+
+	/// The connection the message being handled was received on
+	/**
+	 * This is empty for the main connection. The responses to a
+	 * request go back over the connection it was received on.
+	 */
+	boost::weak_ptr<OpenflowConnection> reply_connection;
+	/// Send the responses of a deferred request over its connection
+	/**
+	 * The function is called with the reply connection set to
+	 * the connection the request was received on.
+	 */
+	void respond_on(
+		boost::weak_ptr<OpenflowConnection> connection,
+		std::function<void()> respond);
+
+	/// A barrier that is not yet answered by all physical switches
+	struct OutstandingBarrier {
+		/// The id's of the physical switches that still need to reply
+		std::set<int> waiting;
+		/// The connection the barrier was received on
+		boost::weak_ptr<OpenflowConnection> connection;
+	};
+	/// The barriers that are not yet answered by all physical switches
+	/**
+	 * barrier xid -> request
+	 *
+	 * Every physical switch answers the barriers in the order they
+	 * were send, so multiple barriers can be outstanding at the
+	 * same time and still be answered in order.
+	 */
+	std::unordered_map<uint32_t,OutstandingBarrier> outstanding_barriers;
+	/// Remove a physical switch from a barrier, answer it if it was the last
+	void complete_physical_barrier(uint32_t xid, int physical_switch_id);
+
+	/// A flow of the virtual switch merged from all physical copies
+	struct FlowStatsEntry {
+		/// The statistics with the summed counters
+		fluid_msg::of13::FlowStats flow_stats;
+		/// If the instructions come from the copy without the group bit
+		bool has_output_instructions;
+	};
+	/// A flow statistics request that waits on physical switches
+	struct FlowStatsRequest {
+		/// If the controller requested aggregate statistics
+		bool aggregate;
+		/// The amount of physical switches that still need to reply
+		int remaining;
+		/// The filters of the original request
+		uint8_t table_id;
+		uint32_t out_port;
+		uint32_t out_group;
+		uint64_t cookie;
+		uint64_t cookie_mask;
+		fluid_msg::of13::Match match;
+		/// The merged flows, flow key -> entry
+		std::map<std::string,FlowStatsEntry> flows;
+		/// The connection the request was received on
+		boost::weak_ptr<OpenflowConnection> connection;
+	};
+	/// The flow statistics requests that are not yet answered
+	/**
+	 * request xid -> request
+	 */
+	std::unordered_map<uint32_t,FlowStatsRequest> outstanding_flow_stats;
+	/// Collect the flow statistics from the physical switches
+	/**
+	 * Both flow and aggregate requests are handled by collecting
+	 * the individual flows, this is needed to merge the copies
+	 * of a rule before they are counted.
+	 */
+	void request_flow_stats(uint32_t xid, FlowStatsRequest request);
+	/// Send the merged flow statistics to the controller
+	void send_flow_stats(uint32_t xid, FlowStatsRequest& request);
+
+	/// A port statistics request that waits on physical switches
+	struct PortStatsRequest {
+		/// The port the controller requested, can be OFPP_ANY
+		uint32_t port_no;
+		/// The amount of physical switches that still need to reply
+		int remaining;
+		/// The port statistics with the virtual port numbers
+		std::vector<fluid_msg::of13::PortStats> port_stats;
+		/// The connection the request was received on
+		boost::weak_ptr<OpenflowConnection> connection;
+	};
+	/// The port statistics requests that are not yet answered
+	/**
+	 * request xid -> request
+	 */
+	std::unordered_map<uint32_t,PortStatsRequest> outstanding_port_stats;
+	/// Send the collected port statistics to the controller
+	void send_port_stats(uint32_t xid, PortStatsRequest& request);
+
+	/// The auxiliary connections to the controller
+	/**
+	 * PacketIns are sent over these connections and the responses
+	 * to the requests received on them, all other messages are
+	 * sent over the main connection.
+	 */
+	std::vector<boost::shared_ptr<AuxiliaryConnection>> auxiliary_connections;
+	/// Select the connected auxiliary connection for a flow
+	/**
+	 * Returns nullptr if no auxiliary connection is connected.
+	 */
+	boost::shared_ptr<AuxiliaryConnection> select_auxiliary_connection(
+		uint32_t flow_hash) const;
+
 	/// The timer used to backoff between connection attempts
 	boost::asio::deadline_timer connection_backoff_timer;
+
+	/// The timer that limits how long physical switches can be gone
+	boost::asio::deadline_timer reconnect_grace_timer;
+	/// If the controller connection is kept while physical switches are gone
+	bool waiting_for_switches;
+	/// Keep the controller connection while physical switches are gone
+	/**
+	 * The rules of the controller are installed again from the
+	 * mirror when the physical switches return, if they don't
+	 * return within the grace period this switch goes down.
+	 */
+	void start_reconnect_grace();
+	/// The callback when the physical switches didn't return in time
+	void reconnect_grace_expired(const boost::system::error_code& error);
+	/// Install the rules again in the physical switches that reconnected
+	void restore_physical_switches();
 	/// The function called when the timer expires
 	void backoff_expired(const boost::system::error_code& error);
 	/// Try to connect to the controller
@@ -77,8 +469,29 @@ public:
 		Hypervisor* hypervisor,
 		Slice* slice);
 
+	/// Return the id of this virtual switch
+	~VirtualSwitch();
+
+	/// Set the connection the responses to the handled message go over
+	/**
+	 * An auxiliary connection sets itself before it passes a
+	 * message on and resets it afterwards, nullptr selects the
+	 * main connection.
+	 */
+	void set_reply_connection(boost::shared_ptr<OpenflowConnection> connection);
+	/// Send a response over the connection of the handled message
+	void send_message_response(fluid_msg::OFMsg& message);
+	/// Send a packed response over the connection of the handled message
+	void send_raw_message_response(std::vector<uint8_t> message);
+
 	/// Get the unique id of this virtual switch
 	int get_id() const;
+	/// Return if the id was restored from the state journal
+	/**
+	 * Only then the rules left behind in the physical switches
+	 * with this id were pushed by this virtual switch.
+	 */
+	bool has_restored_id() const;
 	/// Get the slice this virtual switch is in
 	const Slice* get_slice() const;
 	/// Get all the ports on this switch
@@ -108,6 +521,19 @@ public:
 	 */
 	void check_online();
 
+	/// Calculate the spanning tree floods are sent over
+	/**
+	 * This is called after the routes are calculated.
+	 */
+	void calculate_flood_tree();
+	/// Stop flooding over the tree if a switch in it has no flood index
+	void check_flood_tree();
+	/// Get the ports in the flood tree of a physical switch
+	/**
+	 * \return nullptr if the physical switch isn't in the tree
+	 */
+	const std::set<uint32_t>* get_flood_tree_ports(int physical_switch_id) const;
+
 	/// Tell this virtual switch to go down
 	void go_down();
 	/// Returns if this switch is currently down
@@ -115,6 +541,128 @@ public:
 	/// Returns if this switch is currently connected
 	bool is_connected() const;
 
+	/// Install the rules of the controller again in a physical switch
+	/**
+	 * Only the rules that can apply to the ports on that physical
+	 * switch are installed.
+	 */
+	void replay_flows(boost::shared_ptr<PhysicalSwitch> physical_switch);
+
+	/// Send a FlowRemoved from a physical switch to the controller
+	/**
+	 * Every rule exists in multiple physical switches, the mirror
+	 * of the flow tables makes sure the controller is told only
+	 * once. A rule that timed out in one physical switch is
+	 * removed from the other physical switches as well.
+	 * \param group_copy If the removed rule was the copy that
+	 *   matches packets with the group bit set
+	 * \param physical_datapath_id The physical switch the rule was in
+	 */
+	void send_flow_removed(
+		fluid_msg::of13::FlowRemoved& flow_removed_message,
+		bool group_copy,
+		uint64_t physical_datapath_id);
+
+	/// Handle a packet that didn't match an installed rule of the first table
+	/**
+	 * The rule the packet matches in the mirror is installed,
+	 * evicting the least used rules if needed, and the packet
+	 * is sent through the tables again.
+	 */
+	void handle_cache_miss(
+		uint64_t physical_datapath_id,
+		fluid_msg::of13::PacketIn& packet_in_message);
+	/// Update the usage of the cached rules with the flows of a physical switch
+	void update_flow_cache_usage(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats);
+	/// Return if this virtual switch has rules with an idle timeout
+	bool has_idle_flows() const;
+	/// Update the usage of the rules with an idle timeout with the flows of a physical switch
+	/**
+	 * The rules none of the copies of matched a packet during
+	 * their idle timeout are removed.
+	 */
+	void update_idle_flows(
+		boost::shared_ptr<PhysicalSwitch> physical_switch,
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats);
+
+	/// Send a PacketIn from a physical switch to the controller
+	/**
+	 * The PacketIn is rate limited and queued in the slice, the
+	 * hypervisor forwards the queued PacketIns of all slices fairly.
+	 */
+	void send_packet_in(fluid_msg::of13::PacketIn& packet_in_message);
+	/// Send a packed PacketIn from a physical switch to the controller
+	/**
+	 * The in_port of the message should already be rewritten.
+	 */
+	void send_raw_packet_in(std::vector<uint8_t> message);
+	/// Forward a queued packed PacketIn to the controller
+	/**
+	 * The packet is stored in the packet buffer and truncated
+	 * to miss_send_len if it is larger than that.
+	 */
+	void forward_packet_in(std::vector<uint8_t>& message);
+
+	/// Check if the controller wants a PacketIn with this reason
+	/**
+	 * PacketIns, PortStatus and FlowRemoved messages the controller
+	 * filtered with SetAsync should be dropped before any work is
+	 * done on them.
+	 */
+	bool wants_packet_in(uint8_t reason) const;
+	/// Check if the controller wants a PortStatus with this reason
+	bool wants_port_status(uint8_t reason) const;
+	/// Check if the controller wants a FlowRemoved with this reason
+	bool wants_flow_removed(uint8_t reason) const;
+
+	/// Get the amount of tables the controller can use
+	/**
+	 * This is the smallest amount of tables mapped in the
+	 * physical switches this switch depends on.
+	 */
+	uint8_t get_n_tables() const;
+	/// Create the features reply for a connection of this switch
+	fluid_msg::of13::FeaturesReply make_features_reply(
+		uint32_t xid,
+		uint8_t auxiliary_id);
+
+	/// Limit the amount of PacketIns per second of this virtual switch
+	void set_packet_in_limit(int rate, int burst);
+	/// Return the amount of PacketIns dropped by the rate limit
+	uint64_t get_packet_in_dropped() const;
+	/// Limit the amount of cache misses per second of this virtual switch
+	void set_cache_miss_limit(int rate);
+
+	/// Handle a BarrierReply of a physical switch to a forwarded barrier
+	/**
+	 * Once all physical switches answered the barrier with
+	 * this xid the BarrierReply is send to the controller.
+	 */
+	void handle_physical_barrier_reply(uint32_t xid, int physical_switch_id);
+	/// Stop waiting for the barriers of a physical switch that stopped
+	/**
+	 * The messages before a barrier can't be processed anymore by
+	 * a stopped switch, so the barrier is complete for that switch.
+	 */
+	void handle_physical_switch_stopped(int physical_switch_id);
+
+	/// Handle the flow statistics of a physical switch
+	/**
+	 * The flows are restored to how this virtual switch knows
+	 * them and merged with the flows from other physical switches.
+	 */
+	void handle_physical_flow_stats(
+		uint32_t xid,
+		uint64_t physical_datapath_id,
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats);
+	/// Handle the port statistics of a physical switch
+	void handle_physical_port_stats(
+		uint32_t xid,
+		uint64_t physical_datapath_id,
+		const std::vector<fluid_msg::of13::PortStats>& port_stats);
+
 	/// Print this virtual switch to a stream
 	void print_to_stream(std::ostream& os) const;
 
@@ -164,7 +712,7 @@ public:
 	void handle_multipart_request_meter         (fluid_msg::of13::MultipartRequestMeter& multipart_request_message);
 	void handle_multipart_request_meter_config  (fluid_msg::of13::MultipartRequestMeterConfig& multipart_request_message);
 	void handle_multipart_request_meter_features(fluid_msg::of13::MultipartRequestMeterFeatures& multipart_request_message);
-	void handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message);
+	void handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message);
 	void handle_multipart_request_port_desc     (fluid_msg::of13::MultipartRequestPortDescription& multipart_request_message);
 	void handle_multipart_request_experimenter  (fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message);
 	void handle_multipart_reply_desc          (fluid_msg::of13::MultipartReplyDesc& multipart_request_message);
@@ -179,7 +727,7 @@ public:
 	void handle_multipart_reply_meter         (fluid_msg::of13::MultipartReplyMeter& multipart_request_message);
 	void handle_multipart_reply_meter_config  (fluid_msg::of13::MultipartReplyMeterConfig& multipart_request_message);
 	void handle_multipart_reply_meter_features(fluid_msg::of13::MultipartReplyMeterFeatures& multipart_request_message);
-	void handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message);
+	void handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_request_message);
 	void handle_multipart_reply_port_desc     (fluid_msg::of13::MultipartReplyPortDescription& multipart_request_message);
 	void handle_multipart_reply_experimenter  (fluid_msg::of13::MultipartReplyExperimenter& multipart_request_message);
 };
@@ -0,0 +1,425 @@
+#include "virtual_switch.hpp"
+#include "physical_switch.hpp"
+#include "hypervisor.hpp"
+
+#include "packet_fields.hpp"
+
+#include <map>
+#include <set>
+#include <algorithm>
+
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// Create a FlowMod that deletes exactly one rule
+	fluid_msg::of13::FlowMod make_delete_strict(fluid_msg::of13::FlowMod& flow_mod) {
+		fluid_msg::of13::FlowMod delete_flow_mod;
+		delete_flow_mod.command(fluid_msg::of13::OFPFC_DELETE_STRICT);
+		delete_flow_mod.table_id(flow_mod.table_id());
+		delete_flow_mod.priority(flow_mod.priority());
+		delete_flow_mod.cookie(0);
+		delete_flow_mod.cookie_mask(0);
+		delete_flow_mod.out_port(fluid_msg::of13::OFPP_ANY);
+		delete_flow_mod.out_group(fluid_msg::of13::OFPG_ANY);
+		delete_flow_mod.buffer_id(OFP_NO_BUFFER);
+		delete_flow_mod.match(flow_mod.match());
+		return delete_flow_mod;
+	}
+}
+
+bool VirtualSwitch::is_cached_table(uint8_t table_id) const {
+	return table_id == 0 && hypervisor->get_flow_cache() != no_flow_cache;
+}
+
+bool VirtualSwitch::install_cached_flow(
+		PhysicalSwitch::pointer ps_ptr,
+		DependentSwitch& dep_sw,
+		fluid_msg::of13::FlowMod& flow_mod_message,
+		bool evict) {
+	// Collect the rules this rule depends on, the rules that are
+	// missing have to be installed and the installed rules can't
+	// be evicted to make room
+	std::map<std::string,fluid_msg::of13::FlowMod> needed;
+	std::set<std::string> depended_on;
+	std::vector<fluid_msg::of13::FlowMod> unvisited;
+
+	auto visit = [&](fluid_msg::of13::FlowMod& flow_mod) {
+		std::string key = FlowTable::make_key(flow_mod);
+		if( needed.count(key) > 0 || depended_on.count(key) > 0 ) {
+			return;
+		}
+		if( dep_sw.cached_flows.count(key) > 0 ) {
+			depended_on.insert(key);
+		}
+		else {
+			needed.emplace(key, flow_mod);
+		}
+		unvisited.push_back(flow_mod);
+	};
+	visit(flow_mod_message);
+
+	while( !unvisited.empty() ) {
+		fluid_msg::of13::FlowMod flow_mod = unvisited.back();
+		unvisited.pop_back();
+
+		if( flow_mod.priority() == 0 ) {
+			flow_table.for_each(
+				[&](fluid_msg::of13::FlowMod& other) {
+					if( other.table_id() == flow_mod.table_id() &&
+							is_installed_in(ps_ptr, other) ) {
+						visit(other);
+					}
+				});
+		}
+		else {
+			flow_table.for_each_overlapping(
+				flow_mod,
+				[&](fluid_msg::of13::FlowMod& other) {
+					if( other.priority() > flow_mod.priority() &&
+							is_installed_in(ps_ptr, other) ) {
+						visit(other);
+					}
+				});
+		}
+	}
+
+	uint8_t table_id = ps_ptr->get_physical_table(flow_mod_message.table_id());
+	size_t room      = ps_ptr->get_room_for_tenant_flows(table_id, this);
+	if( room < needed.size() ) {
+		// Don't evict anything if the rules can't fit anyway
+		size_t evictable = dep_sw.cached_flows.size() - depended_on.size();
+		if( !evict || room + evictable < needed.size() ) {
+			return false;
+		}
+
+		FlowCachePolicy policy = hypervisor->get_flow_cache();
+		while( room < needed.size() ) {
+			// Find the least recently or least frequently used rule
+			auto victim = dep_sw.cached_flows.end();
+			for( auto it=dep_sw.cached_flows.begin(); it!=dep_sw.cached_flows.end(); ++it ) {
+				if( depended_on.count(it->first) > 0 ) continue;
+				if( victim == dep_sw.cached_flows.end() ) {
+					victim = it;
+					continue;
+				}
+
+				const CachedFlow& flow   = it->second;
+				const CachedFlow& chosen = victim->second;
+				bool less_used = policy == least_frequently_used ?
+					std::make_pair(flow.packet_count, flow.last_used) <
+						std::make_pair(chosen.packet_count, chosen.last_used) :
+					std::make_pair(flow.last_used, flow.packet_count) <
+						std::make_pair(chosen.last_used, chosen.packet_count);
+				if( less_used ) {
+					victim = it;
+				}
+			}
+			// The rules of other virtual switches can fill the table
+			if( victim == dep_sw.cached_flows.end() ) {
+				return false;
+			}
+
+			evict_cached_flows(ps_ptr, dep_sw, {victim->first});
+			room = ps_ptr->get_room_for_tenant_flows(table_id, this);
+		}
+	}
+
+	// Install the rules with the highest priority first, so
+	// packets never take a rule whose dependencies are missing
+	std::vector<std::pair<std::string,fluid_msg::of13::FlowMod>> ordered(
+		needed.begin(),
+		needed.end());
+	std::sort(
+		ordered.begin(),
+		ordered.end(),
+		[](std::pair<std::string,fluid_msg::of13::FlowMod>& pair_1,
+				std::pair<std::string,fluid_msg::of13::FlowMod>& pair_2) {
+			return pair_1.second.priority() > pair_2.second.priority();
+		});
+
+	bool installed_all = false;
+	for( auto& flow_pair : ordered ) {
+		fluid_msg::of13::FlowMod& flow_mod = flow_pair.second;
+		dep_sw.cached_flows[flow_pair.first] = CachedFlow{flow_mod, 0, cache_clock};
+		ps_ptr->count_tenant_flows(table_id, id, 1);
+		send_flow_mod(ps_ptr, flow_mod);
+
+		// A rule with priority 0 depends on all other rules
+		installed_all = installed_all || flow_mod.priority() == 0;
+	}
+
+	// Nothing can miss anymore, the rule catching the misses would
+	// overlap the rules with priority 0
+	if( installed_all && dep_sw.cache_miss_rule ) {
+		ps_ptr->send_cache_miss_rule(id, fluid_msg::of13::OFPFC_DELETE_STRICT);
+		dep_sw.cache_miss_rule = false;
+	}
+
+	BOOST_LOG_TRIVIAL(trace) << *this << " installed " << ordered.size()
+		<< " cached rules in " << *ps_ptr;
+	return true;
+}
+
+std::vector<std::string> VirtualSwitch::find_dependent_flows(
+		DependentSwitch& dep_sw,
+		fluid_msg::of13::FlowMod& flow_mod_message) {
+	std::vector<std::string> keys;
+
+	// The overlapping rules with a lower priority
+	if( flow_mod_message.priority() != 0 ) {
+		flow_table.for_each_overlapping(
+			flow_mod_message,
+			[&](fluid_msg::of13::FlowMod& other) {
+				if( other.priority() >= flow_mod_message.priority() ||
+						other.priority() == 0 ) {
+					return;
+				}
+				std::string key = FlowTable::make_key(other);
+				if( dep_sw.cached_flows.count(key) > 0 ) {
+					keys.push_back(key);
+				}
+			});
+	}
+
+	// The rules with priority 0 depend on all rules
+	for( auto& flow_pair : dep_sw.cached_flows ) {
+		if( flow_pair.second.flow_mod.priority() == 0 ) {
+			keys.push_back(flow_pair.first);
+		}
+	}
+
+	return keys;
+}
+
+void VirtualSwitch::evict_cached_flows(
+		PhysicalSwitch::pointer ps_ptr,
+		DependentSwitch& dep_sw,
+		std::vector<std::string> keys) {
+	size_t evicted = 0;
+
+	while( !keys.empty() ) {
+		std::string key = keys.back();
+		keys.pop_back();
+
+		auto flow_it = dep_sw.cached_flows.find(key);
+		if( flow_it == dep_sw.cached_flows.end() ) {
+			continue;
+		}
+		fluid_msg::of13::FlowMod flow_mod = flow_it->second.flow_mod;
+		dep_sw.cached_flows.erase(flow_it);
+		++evicted;
+
+		// The rule stays in the mirror, the FlowRemoved the switch
+		// sends for it is not forwarded to the controller
+		send_flow_mod(ps_ptr, make_delete_strict(flow_mod));
+		ps_ptr->count_tenant_flows(
+			ps_ptr->get_physical_table(flow_mod.table_id()),
+			id,
+			-1);
+
+		for( std::string& dependent_key : find_dependent_flows(dep_sw, flow_mod) ) {
+			keys.push_back(dependent_key);
+		}
+	}
+
+	if( evicted > 0 ) {
+		BOOST_LOG_TRIVIAL(trace) << *this << " evicted " << evicted
+			<< " cached rules from " << *ps_ptr;
+		install_cache_miss_rule(ps_ptr, dep_sw);
+	}
+}
+
+void VirtualSwitch::install_cache_miss_rule(
+		PhysicalSwitch::pointer ps_ptr,
+		DependentSwitch& dep_sw) {
+	if( !dep_sw.cache_miss_rule ) {
+		ps_ptr->send_cache_miss_rule(id, fluid_msg::of13::OFPFC_ADD);
+		dep_sw.cache_miss_rule = true;
+	}
+}
+
+void VirtualSwitch::add_cached_flow(
+		PhysicalSwitch::pointer ps_ptr,
+		DependentSwitch& dep_sw,
+		fluid_msg::of13::FlowMod& flow_mod_message) {
+	// A rule that replaces an installed rule is sent as is
+	auto flow_it = dep_sw.cached_flows.find(FlowTable::make_key(flow_mod_message));
+	if( flow_it != dep_sw.cached_flows.end() ) {
+		flow_it->second.flow_mod = flow_mod_message;
+		send_flow_mod(ps_ptr, flow_mod_message);
+		return;
+	}
+
+	if( !install_cached_flow(ps_ptr, dep_sw, flow_mod_message, false) ) {
+		// The installed rules below the new rule would take its packets
+		evict_cached_flows(
+			ps_ptr,
+			dep_sw,
+			find_dependent_flows(dep_sw, flow_mod_message));
+		install_cache_miss_rule(ps_ptr, dep_sw);
+	}
+}
+
+void VirtualSwitch::replay_cached_flows(
+		PhysicalSwitch::pointer ps_ptr,
+		DependentSwitch& dep_sw) {
+	// The physical switch lost the rules when it reconnected
+	dep_sw.cached_flows.clear();
+	dep_sw.cache_miss_rule = false;
+
+	std::vector<fluid_msg::of13::FlowMod> flow_mods;
+	flow_table.for_each(
+		[&](fluid_msg::of13::FlowMod& flow_mod) {
+			if( is_cached_table(flow_mod.table_id()) &&
+					is_installed_in(ps_ptr, flow_mod) ) {
+				flow_mods.push_back(flow_mod);
+			}
+		});
+
+	// Fill the table from the highest priority down, every rule
+	// then only depends on rules that are already installed
+	std::sort(
+		flow_mods.begin(),
+		flow_mods.end(),
+		[](fluid_msg::of13::FlowMod& flow_mod_1, fluid_msg::of13::FlowMod& flow_mod_2) {
+			return flow_mod_1.priority() > flow_mod_2.priority();
+		});
+	for( fluid_msg::of13::FlowMod& flow_mod : flow_mods ) {
+		if( dep_sw.cached_flows.count(FlowTable::make_key(flow_mod)) > 0 ) continue;
+		if( !install_cached_flow(ps_ptr, dep_sw, flow_mod, false) ) {
+			install_cache_miss_rule(ps_ptr, dep_sw);
+		}
+	}
+}
+
+void VirtualSwitch::handle_cache_miss(
+		uint64_t physical_datapath_id,
+		fluid_msg::of13::PacketIn& packet_in_message) {
+	auto dep_it = dependent_switches.find(physical_datapath_id);
+	auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_datapath_id);
+	if( dep_it == dependent_switches.end() || ps_ptr == nullptr ) {
+		return;
+	}
+	DependentSwitch& dep_sw = dep_it->second;
+
+	// Every miss costs a lookup and FlowMods, a flood of new
+	// flows is dropped instead of churning the cache
+	if( !cache_miss_bucket.consume() ) {
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " dropped cache miss because of rate limit";
+		return;
+	}
+
+	// Add the fields of the pipeline to the fields of the packet,
+	// the controller didn't write metadata yet in the first table
+	PacketFields fields = parse_packet_fields(
+		(const uint8_t*) packet_in_message.data(),
+		packet_in_message.data_len());
+	fields[make_basic_field_header(fluid_msg::of13::OFPXMT_OFB_METADATA)] =
+		std::string(8, '\0');
+
+	// Packets received over a link are tagged, those can't be
+	// classified as packets from that port again
+	fluid_msg::of13::InPort* in_port_tlv =
+		(fluid_msg::of13::InPort*) packet_in_message
+			.get_oxm_field(fluid_msg::of13::OFPXMT_OFB_IN_PORT);
+	bool from_port =
+		in_port_tlv != nullptr &&
+		dep_sw.port_map.has_physical(in_port_tlv->value());
+	if( from_port ) {
+		uint32_t in_port = dep_sw.port_map.get_virtual(in_port_tlv->value());
+		std::string& value =
+			fields[make_basic_field_header(fluid_msg::of13::OFPXMT_OFB_IN_PORT)];
+		value.push_back((in_port>>24) & 0xff);
+		value.push_back((in_port>>16) & 0xff);
+		value.push_back((in_port>> 8) & 0xff);
+		value.push_back( in_port      & 0xff);
+	}
+
+	// Without a matching rule the switch would have dropped the packet
+	fluid_msg::of13::FlowMod* match = flow_table.lookup(0, fields);
+	if( match == nullptr ) {
+		BOOST_LOG_TRIVIAL(trace) << *this << " cache miss without a matching rule";
+		return;
+	}
+	fluid_msg::of13::FlowMod flow_mod(*match);
+	if( !is_installed_in(ps_ptr, flow_mod) ) {
+		return;
+	}
+
+	// The packet matched the rule, even if its copy isn't installed
+	auto idle_it = idle_flows.find(FlowTable::make_key(flow_mod));
+	if( idle_it != idle_flows.end() ) {
+		idle_it->second.last_used =
+			boost::posix_time::microsec_clock::universal_time();
+	}
+
+	// A rule that is already installed can still miss while it is
+	// being installed, sending the packet again could loop
+	if( dep_sw.cached_flows.count(FlowTable::make_key(flow_mod)) > 0 ) {
+		return;
+	}
+
+	if( !install_cached_flow(ps_ptr, dep_sw, flow_mod, true) ) {
+		BOOST_LOG_TRIVIAL(info) << *this << " has no room for a cached rule in "
+			<< *ps_ptr << ", dropping the packet";
+		return;
+	}
+
+	if( !from_port ) {
+		return;
+	}
+
+	// Make sure the rules are installed before the packet is
+	// sent through the tables again
+	fluid_msg::of13::BarrierRequest barrier;
+	ps_ptr->send_message(barrier);
+
+	fluid_msg::of13::PacketOut packet_out;
+	packet_out.buffer_id(OFP_NO_BUFFER);
+	packet_out.in_port(in_port_tlv->value());
+	packet_out.data(packet_in_message.data(), packet_in_message.data_len());
+	packet_out.add_action(
+		new fluid_msg::of13::OutputAction(
+			fluid_msg::of13::OFPP_TABLE,
+			fluid_msg::of13::OFPCML_NO_BUFFER));
+	ps_ptr->send_message(packet_out);
+}
+
+void VirtualSwitch::update_flow_cache_usage(
+		PhysicalSwitch::pointer ps_ptr,
+		const std::vector<fluid_msg::of13::FlowStats>& flow_stats) {
+	auto dep_it = dependent_switches.find(ps_ptr->get_features().datapath_id);
+	if( dep_it == dependent_switches.end() ) {
+		return;
+	}
+	DependentSwitch& dep_sw = dep_it->second;
+
+	// Both copies of a rule match packets of the rule
+	std::unordered_map<std::string,uint64_t> packet_counts;
+	for( fluid_msg::of13::FlowStats flow : flow_stats ) {
+		bool group_copy = false;
+		if( !ps_ptr->restore_flow_stats(flow, group_copy, this) ||
+				!is_cached_table(flow.table_id()) ) {
+			continue;
+		}
+
+		fluid_msg::of13::FlowMod flow_mod;
+		flow_mod.table_id(flow.table_id());
+		flow_mod.priority(flow.priority());
+		flow_mod.match(flow.match());
+		packet_counts[FlowTable::make_key(flow_mod)] += flow.packet_count();
+	}
+
+	++cache_clock;
+	for( auto& count_pair : packet_counts ) {
+		auto flow_it = dep_sw.cached_flows.find(count_pair.first);
+		if( flow_it == dep_sw.cached_flows.end() ) continue;
+
+		CachedFlow& cached_flow = flow_it->second;
+		if( count_pair.second > cached_flow.packet_count ) {
+			cached_flow.last_used = cache_clock;
+		}
+		cached_flow.packet_count = count_pair.second;
+	}
+}
@@ -0,0 +1,538 @@
+#include "virtual_switch.hpp"
+#include "physical_switch.hpp"
+#include "hypervisor.hpp"
+
+#include "tag.hpp"
+
+#include <set>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace {
+	/// The maximum size of the body of a single multipart reply
+	constexpr size_t max_multipart_body = UINT16_MAX - 16;
+
+	/// The size of a port stats entry
+	constexpr size_t port_stats_length = 112;
+
+	/// The size of the fixed part of a flow stats entry
+	constexpr size_t flow_stats_header_length = 48;
+
+	/// The length of a match as it goes over the wire including padding
+	size_t padded_match_length(fluid_msg::of13::Match& match) {
+		return ((match.length()+7)/8)*8;
+	}
+
+	/// The size of a flow stats entry as it goes over the wire
+	size_t flow_stats_length(fluid_msg::of13::FlowStats& flow_stats) {
+		fluid_msg::of13::Match match = flow_stats.match();
+		fluid_msg::of13::InstructionSet instructions = flow_stats.instructions();
+		return flow_stats_header_length
+			+ padded_match_length(match)
+			+ instructions.length();
+	}
+
+	/// Create the key that identifies a tenant flow
+	/**
+	 * A flow in a flow table is identified by its table,
+	 * priority and match, the cookie is added to keep rules
+	 * that are pushed with a different cookie apart. The match
+	 * is parsed, since switches can reorder its fields.
+	 */
+	std::string make_flow_key(fluid_msg::of13::FlowStats& flow_stats) {
+		uint64_t cookie = flow_stats.cookie();
+
+		std::string key = FlowTable::make_key(
+			flow_stats.table_id(),
+			flow_stats.priority(),
+			flow_stats.match());
+		key.append((const char*) &cookie, sizeof(cookie));
+		return key;
+	}
+
+	/// Check if a flow passes the out_port and out_group filter
+	bool matches_output_filter(
+			fluid_msg::of13::FlowStats& flow_stats,
+			uint32_t out_port,
+			uint32_t out_group) {
+		bool port_found  = out_port  == fluid_msg::of13::OFPP_ANY;
+		bool group_found = out_group == fluid_msg::of13::OFPG_ANY;
+
+		auto check_action = [&](fluid_msg::Action* action) {
+			if( action->type() == fluid_msg::of13::OFPAT_OUTPUT &&
+					((fluid_msg::of13::OutputAction*) action)->port() == out_port ) {
+				port_found = true;
+			}
+			else if( action->type() == fluid_msg::of13::OFPAT_GROUP &&
+					((fluid_msg::of13::GroupAction*) action)->group_id() == out_group ) {
+				group_found = true;
+			}
+		};
+
+		fluid_msg::of13::InstructionSet instructions = flow_stats.instructions();
+		for( fluid_msg::of13::Instruction* instruction : instructions.instruction_set() ) {
+			if( instruction->type() == fluid_msg::of13::OFPIT_WRITE_ACTIONS ) {
+				fluid_msg::ActionSet action_set =
+					((fluid_msg::of13::WriteActions*) instruction)->actions();
+				for( fluid_msg::Action* action : action_set.action_set() ) {
+					check_action(action);
+				}
+			}
+			else if( instruction->type() == fluid_msg::of13::OFPIT_APPLY_ACTIONS ) {
+				fluid_msg::ActionList action_list =
+					((fluid_msg::of13::ApplyActions*) instruction)->actions();
+				for( fluid_msg::Action* action : action_list.action_list() ) {
+					check_action(action);
+				}
+			}
+		}
+
+		return port_found && group_found;
+	}
+
+	/// Split an OXM field in its value and mask bytes
+	void unpack_oxm_field(
+			fluid_msg::of13::OXMTLV* oxm,
+			std::vector<uint8_t>& value,
+			std::vector<uint8_t>& mask) {
+		// The header is 4 bytes and the payload at most 255 bytes
+		std::vector<uint8_t> buffer(4+255, 0);
+		oxm->pack(buffer.data());
+
+		bool has_mask       = buffer[2] & 1;
+		size_t value_length = has_mask ? buffer[3]/2 : buffer[3];
+
+		value.assign(
+			buffer.begin()+4,
+			buffer.begin()+4+value_length);
+		if( has_mask ) {
+			mask.assign(
+				buffer.begin()+4+value_length,
+				buffer.begin()+4+2*value_length);
+		}
+		else {
+			mask.assign(value_length, 0xff);
+		}
+	}
+
+	/// Check if a flow match is selected by a non-strict request match
+	/**
+	 * A flow is selected if it matches at least on all the fields
+	 * in the request and its matches on those fields are equal or
+	 * more specific.
+	 */
+	bool match_covers(
+			fluid_msg::of13::Match& request_match,
+			fluid_msg::of13::Match& flow_match) {
+		for( size_t i=0; i<OXM_NUM; ++i ) {
+			fluid_msg::of13::OXMTLV* request_oxm = request_match.oxm_field(i);
+			if( request_oxm == nullptr ) {
+				continue;
+			}
+			fluid_msg::of13::OXMTLV* flow_oxm = flow_match.oxm_field(i);
+			if( flow_oxm == nullptr ) {
+				return false;
+			}
+
+			std::vector<uint8_t> request_value, request_mask;
+			std::vector<uint8_t> flow_value, flow_mask;
+			unpack_oxm_field(request_oxm, request_value, request_mask);
+			unpack_oxm_field(flow_oxm, flow_value, flow_mask);
+			if( request_value.size() != flow_value.size() ) {
+				return false;
+			}
+
+			for( size_t b=0; b<request_value.size(); ++b ) {
+				// The flow has to match on all bits the request matches on
+				if( (flow_mask[b] & request_mask[b]) != request_mask[b] ) {
+					return false;
+				}
+				// and those bits need to have the same value
+				if( (flow_value[b] & request_mask[b]) != (request_value[b] & request_mask[b]) ) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+}
+
+void VirtualSwitch::request_flow_stats(uint32_t xid, FlowStatsRequest request) {
+	// Collect the physical switches to get the flows from
+	std::vector<PhysicalSwitch::pointer> physical_switches;
+	for( auto& dep_sw : dependent_switches ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+		if( ps_ptr != nullptr ) {
+			physical_switches.push_back(ps_ptr);
+		}
+	}
+
+	// Save the request so the statistics can be merged
+	request.remaining = physical_switches.size();
+	request.flows.clear();
+	request.connection = reply_connection;
+	outstanding_flow_stats[xid] = request;
+
+	// If there is no physical switch to wait for answer directly
+	if( physical_switches.empty() ) {
+		send_flow_stats(xid, outstanding_flow_stats.at(xid));
+		outstanding_flow_stats.erase(xid);
+		return;
+	}
+
+	// Get the flows of each physical switch, the physical switch answers
+	// from its cache so the filters of the request are applied here
+	for( auto& ps_ptr : physical_switches ) {
+		ps_ptr->get_flow_stats(
+			boost::bind(
+				&VirtualSwitch::handle_physical_flow_stats,
+				shared_from_this(),
+				xid,
+				ps_ptr->get_features().datapath_id,
+				_1));
+	}
+}
+
+void VirtualSwitch::handle_physical_flow_stats(
+		uint32_t xid,
+		uint64_t physical_datapath_id,
+		const std::vector<fluid_msg::of13::FlowStats>& physical_flow_stats) {
+	auto it = outstanding_flow_stats.find(xid);
+	if( it == outstanding_flow_stats.end() ) {
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " received flow stats for unknown request xid=" << xid;
+		return;
+	}
+	FlowStatsRequest& request = it->second;
+
+	auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_datapath_id);
+	for( fluid_msg::of13::FlowStats flow_stats : physical_flow_stats ) {
+		if( ps_ptr == nullptr ) {
+			break;
+		}
+
+		// Turn the flow back into the flow the controller pushed,
+		// this also drops the flows of other virtual switches
+		bool group_copy = false;
+		if( !ps_ptr->restore_flow_stats(flow_stats, group_copy, this) ) {
+			continue;
+		}
+
+		// Apply the filters of the request
+		if( request.table_id != fluid_msg::of13::OFPTT_ALL &&
+				flow_stats.table_id() != request.table_id ) {
+			continue;
+		}
+		if( (flow_stats.cookie() & request.cookie_mask) !=
+				(request.cookie & request.cookie_mask) ) {
+			continue;
+		}
+		fluid_msg::of13::Match flow_match = flow_stats.match();
+		if( !match_covers(request.match, flow_match) ) {
+			continue;
+		}
+
+		// Add the flow to the merged flows
+		std::string key = make_flow_key(flow_stats);
+		auto flow_it = request.flows.find(key);
+		if( flow_it == request.flows.end() ) {
+			request.flows.emplace(
+				key,
+				FlowStatsEntry{flow_stats, !group_copy});
+			continue;
+		}
+		FlowStatsEntry& entry = flow_it->second;
+
+		// Both copies of a rule in a physical switch and the copies
+		// in other physical switches count packets of the same rule
+		entry.flow_stats.packet_count(
+			entry.flow_stats.packet_count() + flow_stats.packet_count());
+		entry.flow_stats.byte_count(
+			entry.flow_stats.byte_count() + flow_stats.byte_count());
+
+		// The oldest copy tells how long the rule exists
+		if( flow_stats.duration_sec() > entry.flow_stats.duration_sec() ||
+				( flow_stats.duration_sec() == entry.flow_stats.duration_sec() &&
+				  flow_stats.duration_nsec() > entry.flow_stats.duration_nsec() ) ) {
+			entry.flow_stats.duration_sec(flow_stats.duration_sec());
+			entry.flow_stats.duration_nsec(flow_stats.duration_nsec());
+		}
+
+		// The copy without the group bit still has the output actions
+		// in the write-actions instruction
+		if( !group_copy && !entry.has_output_instructions ) {
+			entry.flow_stats.instructions(flow_stats.instructions());
+			entry.has_output_instructions = true;
+		}
+	}
+
+	// Answer the controller when all physical switches are done
+	if( --request.remaining == 0 ) {
+		respond_on(request.connection, [this,xid,&request]() {
+			send_flow_stats(xid, request);
+		});
+		outstanding_flow_stats.erase(it);
+	}
+}
+
+void VirtualSwitch::send_flow_stats(uint32_t xid, FlowStatsRequest& request) {
+	// The rules the flow cache didn't install in any physical
+	// switch are reported from the mirror without counters
+	if( hypervisor->get_flow_cache() != no_flow_cache ) {
+		flow_table.for_each(
+			[&request,this](fluid_msg::of13::FlowMod& flow_mod) {
+				if( !is_cached_table(flow_mod.table_id()) ||
+						(request.table_id != fluid_msg::of13::OFPTT_ALL &&
+						 flow_mod.table_id() != request.table_id) ) {
+					return;
+				}
+
+				fluid_msg::of13::FlowStats flow_stats;
+				flow_stats.table_id(flow_mod.table_id());
+				flow_stats.duration_sec(0);
+				flow_stats.duration_nsec(0);
+				flow_stats.priority(flow_mod.priority());
+				flow_stats.idle_timeout(flow_mod.idle_timeout());
+				flow_stats.hard_timeout(flow_mod.hard_timeout());
+				flow_stats.flags(flow_mod.flags());
+				flow_stats.cookie(CookieTag(flow_mod.cookie()).get_tenant_cookie());
+				flow_stats.packet_count(0);
+				flow_stats.byte_count(0);
+				flow_stats.match(flow_mod.match());
+				flow_stats.instructions(flow_mod.instructions());
+
+				if( (flow_stats.cookie() & request.cookie_mask) !=
+						(request.cookie & request.cookie_mask) ) {
+					return;
+				}
+				fluid_msg::of13::Match flow_match = flow_stats.match();
+				if( !match_covers(request.match, flow_match) ) {
+					return;
+				}
+
+				// The installed copies already have an entry
+				request.flows.emplace(
+					make_flow_key(flow_stats),
+					FlowStatsEntry{flow_stats, true});
+			});
+	}
+
+	if( request.aggregate ) {
+		uint64_t packet_count = 0;
+		uint64_t byte_count   = 0;
+		uint32_t flow_count   = 0;
+
+		for( auto& flow_pair : request.flows ) {
+			fluid_msg::of13::FlowStats& flow_stats = flow_pair.second.flow_stats;
+			if( !matches_output_filter(flow_stats, request.out_port, request.out_group) ) {
+				continue;
+			}
+			packet_count += flow_stats.packet_count();
+			byte_count   += flow_stats.byte_count();
+			++flow_count;
+		}
+
+		fluid_msg::of13::MultipartReplyAggregate aggregate_reply(
+			xid,
+			0,
+			packet_count,
+			byte_count,
+			flow_count);
+		send_message_response(aggregate_reply);
+		return;
+	}
+
+	// Divide the flows over multiple messages so each
+	// message stays within the maximum message size
+	std::vector<std::vector<fluid_msg::of13::FlowStats>> parts(1);
+	size_t body_length = 0;
+	for( auto& flow_pair : request.flows ) {
+		fluid_msg::of13::FlowStats& flow_stats = flow_pair.second.flow_stats;
+		if( !matches_output_filter(flow_stats, request.out_port, request.out_group) ) {
+			continue;
+		}
+
+		size_t length = flow_stats_length(flow_stats);
+		if( body_length + length > max_multipart_body && body_length > 0 ) {
+			parts.emplace_back();
+			body_length = 0;
+		}
+		parts.back().push_back(flow_stats);
+		body_length += length;
+	}
+
+	// Send the parts, all but the last one have the more flag set
+	for( size_t i=0; i<parts.size(); ++i ) {
+		fluid_msg::of13::MultipartReplyFlow flow_reply(
+			xid,
+			i+1<parts.size() ? fluid_msg::of13::OFPMPF_REPLY_MORE : 0);
+		for( fluid_msg::of13::FlowStats& flow_stats : parts[i] ) {
+			flow_reply.add_flow_stats(flow_stats);
+		}
+		send_message_response(flow_reply);
+	}
+
+	BOOST_LOG_TRIVIAL(trace) << *this << " send flow stats in "
+		<< parts.size() << " parts";
+}
+
+void VirtualSwitch::handle_multipart_request_flow(fluid_msg::of13::MultipartRequestFlow& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received multipart request flow";
+
+	FlowStatsRequest request;
+	request.aggregate   = false;
+	request.table_id    = multipart_request_message.table_id();
+	request.out_port    = multipart_request_message.out_port();
+	request.out_group   = multipart_request_message.out_group();
+	request.cookie      = multipart_request_message.cookie();
+	request.cookie_mask = multipart_request_message.cookie_mask();
+	request.match       = multipart_request_message.match();
+	request_flow_stats(multipart_request_message.xid(), request);
+}
+
+void VirtualSwitch::handle_multipart_request_aggregate(fluid_msg::of13::MultipartRequestAggregate& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received multipart request aggregate";
+
+	FlowStatsRequest request;
+	request.aggregate   = true;
+	request.table_id    = multipart_request_message.table_id();
+	request.out_port    = multipart_request_message.out_port();
+	request.out_group   = multipart_request_message.out_group();
+	request.cookie      = multipart_request_message.cookie();
+	request.cookie_mask = multipart_request_message.cookie_mask();
+	request.match       = multipart_request_message.match();
+	request_flow_stats(multipart_request_message.xid(), request);
+}
+
+void VirtualSwitch::handle_multipart_request_port_stats(fluid_msg::of13::MultipartRequestPortStats& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received multipart request port stats";
+
+	uint32_t port_no = multipart_request_message.port_no();
+
+	// Figure out which physical switches contain the requested ports
+	std::set<uint64_t> physical_datapath_ids;
+	if( port_no == fluid_msg::of13::OFPP_ANY ) {
+		for( const auto& port_pair : port_to_dependent_switch ) {
+			physical_datapath_ids.insert(port_pair.second);
+		}
+	}
+	else {
+		auto port_it = port_to_dependent_switch.find(port_no);
+		if( port_it == port_to_dependent_switch.end() ) {
+			send_error_response(
+				fluid_msg::of13::OFPET_BAD_REQUEST,
+				fluid_msg::of13::OFPBRC_BAD_PORT,
+				multipart_request_message);
+			return;
+		}
+		physical_datapath_ids.insert(port_it->second);
+	}
+
+	// Only wait for the physical switches that are online
+	std::vector<PhysicalSwitch::pointer> physical_switches;
+	for( uint64_t physical_datapath_id : physical_datapath_ids ) {
+		auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_datapath_id);
+		if( ps_ptr != nullptr ) {
+			physical_switches.push_back(ps_ptr);
+		}
+	}
+
+	// Save the request so the statistics can be collected
+	uint32_t xid = multipart_request_message.xid();
+	PortStatsRequest& request = outstanding_port_stats[xid];
+	request.port_no   = port_no;
+	request.remaining = physical_switches.size();
+	request.port_stats.clear();
+	request.connection = reply_connection;
+
+	// If there is no physical switch to wait for answer directly
+	if( physical_switches.empty() ) {
+		send_port_stats(xid, request);
+		outstanding_port_stats.erase(xid);
+		return;
+	}
+
+	for( auto& ps_ptr : physical_switches ) {
+		ps_ptr->get_port_stats(
+			boost::bind(
+				&VirtualSwitch::handle_physical_port_stats,
+				shared_from_this(),
+				xid,
+				ps_ptr->get_features().datapath_id,
+				_1));
+	}
+}
+
+void VirtualSwitch::handle_physical_port_stats(
+		uint32_t xid,
+		uint64_t physical_datapath_id,
+		const std::vector<fluid_msg::of13::PortStats>& physical_port_stats) {
+	auto it = outstanding_port_stats.find(xid);
+	if( it == outstanding_port_stats.end() ) {
+		BOOST_LOG_TRIVIAL(trace) << *this
+			<< " received port stats for unknown request xid=" << xid;
+		return;
+	}
+	PortStatsRequest& request = it->second;
+
+	auto ps_ptr = hypervisor->get_physical_switch_by_datapath_id(physical_datapath_id);
+	auto dep_sw_it = dependent_switches.find(physical_datapath_id);
+	if( ps_ptr != nullptr && dep_sw_it != dependent_switches.end() ) {
+		const auto& port_map = dep_sw_it->second.port_map;
+
+		for( fluid_msg::of13::PortStats port_stats : physical_port_stats ) {
+			// Only report the ports that are part of this virtual switch
+			if( !port_map.has_physical(port_stats.port_no()) ) {
+				continue;
+			}
+			uint32_t virtual_port_no = port_map.get_virtual(port_stats.port_no());
+			if( request.port_no != fluid_msg::of13::OFPP_ANY &&
+					request.port_no != virtual_port_no ) {
+				continue;
+			}
+
+			// The counters of a port used by multiple virtual switches
+			// contain the traffic of other slices, don't show them
+			if( ps_ptr->is_port_shared(port_stats.port_no()) ) {
+				fluid_msg::of13::PortStats shared_port_stats;
+				shared_port_stats.duration_sec(port_stats.duration_sec());
+				shared_port_stats.duration_nsec(port_stats.duration_nsec());
+				port_stats = shared_port_stats;
+			}
+
+			port_stats.port_no(virtual_port_no);
+			request.port_stats.push_back(port_stats);
+		}
+	}
+
+	// Answer the controller when all physical switches are done
+	if( --request.remaining == 0 ) {
+		respond_on(request.connection, [this,xid,&request]() {
+			send_port_stats(xid, request);
+		});
+		outstanding_port_stats.erase(it);
+	}
+}
+
+void VirtualSwitch::send_port_stats(uint32_t xid, PortStatsRequest& request) {
+	// Divide the ports over multiple messages so each
+	// message stays within the maximum message size
+	constexpr size_t ports_per_part = max_multipart_body / port_stats_length;
+	size_t num_parts = std::max<size_t>(
+		1,
+		(request.port_stats.size() + ports_per_part - 1) / ports_per_part);
+
+	for( size_t i=0; i<num_parts; ++i ) {
+		fluid_msg::of13::MultipartReplyPortStats port_stats_reply(
+			xid,
+			i+1<num_parts ? fluid_msg::of13::OFPMPF_REPLY_MORE : 0);
+		for( size_t j=i*ports_per_part;
+				j<std::min((i+1)*ports_per_part, request.port_stats.size());
+				++j ) {
+			port_stats_reply.add_port_stat(request.port_stats[j]);
+		}
+		send_message_response(port_stats_reply);
+	}
+}
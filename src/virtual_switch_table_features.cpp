@@ -0,0 +1,77 @@
+#include "virtual_switch.hpp"
+#include "physical_switch.hpp"
+#include "hypervisor.hpp"
+
+#include "table_features.hpp"
+
+#include <boost/log/trivial.hpp>
+
+void VirtualSwitch::handle_multipart_request_table_features(std::vector<uint8_t>& multipart_request_message) {
+	BOOST_LOG_TRIVIAL(info) << *this << " received multipart_request_table_features";
+
+	uint32_t xid;
+	uint16_t flags;
+	std::vector<TableFeatures> requested_tables;
+	if( !parse_table_features_message(multipart_request_message, xid, flags, requested_tables) ) {
+		send_error_response(
+			fluid_msg::of13::OFPET_BAD_REQUEST,
+			fluid_msg::of13::OFPBRC_BAD_LEN,
+			multipart_request_message);
+		return;
+	}
+
+	// The physical tables are shared with the other virtual
+	// switches, so the controller can't change them
+	if( !requested_tables.empty() || (flags & fluid_msg::of13::OFPMPF_REQ_MORE) ) {
+		send_error_response(
+			fluid_msg::of13::OFPET_TABLE_FEATURES_FAILED,
+			fluid_msg::of13::OFPTFFC_EPERM,
+			multipart_request_message);
+		return;
+	}
+
+	// A table can only do what it can do in all physical switches
+	std::vector<TableFeatures> tables;
+	uint8_t n_tables = get_n_tables();
+	for( uint8_t table_id=0; table_id<n_tables; ++table_id ) {
+		TableFeatures table;
+		bool first = true;
+		for( auto& dep_sw : dependent_switches ) {
+			auto phy_sw = hypervisor->get_physical_switch_by_datapath_id(dep_sw.first);
+			if( phy_sw == nullptr ) continue;
+
+			TableFeatures physical_table;
+			if( !phy_sw->get_tenant_table_features(table_id, physical_table) ) {
+				BOOST_LOG_TRIVIAL(info) << *this << " can't describe table "
+					<< (int) table_id << ", " << *phy_sw << " didn't describe it";
+				send_error_response(
+					fluid_msg::of13::OFPET_BAD_REQUEST,
+					fluid_msg::of13::OFPBRC_BAD_MULTIPART,
+					multipart_request_message);
+				return;
+			}
+
+			table = first ? physical_table : intersect_table_features(table, physical_table);
+			first = false;
+		}
+		if( first ) break;
+
+		// Some physical switches map more tables than others
+		for( uint16_t property_type : {
+				fluid_msg::of13::OFPTFPT_NEXT_TABLES,
+				fluid_msg::of13::OFPTFPT_NEXT_TABLES_MISS} ) {
+			auto property_it = table.properties.find(property_type);
+			if( property_it != table.properties.end() ) {
+				property_it->second.erase(
+					property_it->second.lower_bound(n_tables),
+					property_it->second.end());
+			}
+		}
+
+		tables.push_back(table);
+	}
+
+	for( std::vector<uint8_t>& reply : pack_table_features_reply(xid, tables) ) {
+		send_raw_message_response(std::move(reply));
+	}
+}
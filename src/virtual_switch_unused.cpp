@@ -199,7 +199,7 @@ void VirtualSwitch::handle_multipart_reply_meter_features(fluid_msg::of13::Multi
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_request_message);
 }
-void VirtualSwitch::handle_multipart_reply_table_features(fluid_msg::of13::MultipartReplyTableFeatures& multipart_request_message) {
+void VirtualSwitch::handle_multipart_reply_table_features(std::vector<uint8_t>& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart reply table features it shouldn't";
 
 	// Send an error explaining this message is unsupported
@@ -227,25 +227,6 @@ void VirtualSwitch::handle_multipart_reply_experimenter(fluid_msg::of13::Multipa
 		multipart_request_message);
 }
 
-void VirtualSwitch::handle_config_request(fluid_msg::of13::GetConfigRequest& config_request_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received get_config_request";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_TYPE,
-		config_request_message);
-}
-void VirtualSwitch::handle_set_config(fluid_msg::of13::SetConfig& set_config_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received set_config";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_TYPE,
-		set_config_message);
-}
-
 void VirtualSwitch::handle_queue_config_request(fluid_msg::of13::QueueGetConfigRequest& queue_config_request) {
 	BOOST_LOG_TRIVIAL(info) << *this << " received queue_get_config_request";
 
@@ -266,25 +247,6 @@ void VirtualSwitch::handle_role_request(fluid_msg::of13::RoleRequest& role_reque
 		role_request_message);
 }
 
-void VirtualSwitch::handle_get_async_request(fluid_msg::of13::GetAsyncRequest& async_request_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received get_async_request";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_TYPE,
-		async_request_message);
-}
-void VirtualSwitch::handle_set_async(fluid_msg::of13::SetAsync& set_async_message) {
-	BOOST_LOG_TRIVIAL(info) << *this << " received set_async";
-
-	// Send an error explaining this message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_TYPE,
-		set_async_message);
-}
-
 void VirtualSwitch::handle_multipart_request_desc(fluid_msg::of13::MultipartRequestDesc& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request desc it shouldn't";
 
@@ -295,26 +257,6 @@ void VirtualSwitch::handle_multipart_request_desc(fluid_msg::of13::MultipartRequ
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_request_message);
 }
-void VirtualSwitch::handle_multipart_request_flow(fluid_msg::of13::MultipartRequestFlow& multipart_request_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request flow it shouldn't";
-
-	// Send an error message explaining that his multipart
-	// message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_request_message);
-}
-void VirtualSwitch::handle_multipart_request_aggregate(fluid_msg::of13::MultipartRequestAggregate& multipart_request_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request aggregate it shouldn't";
-
-	// Send an error message explaining that his multipart
-	// message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_request_message);
-}
 void VirtualSwitch::handle_multipart_request_table(fluid_msg::of13::MultipartRequestTable& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request table it shouldn't";
 
@@ -325,16 +267,6 @@ void VirtualSwitch::handle_multipart_request_table(fluid_msg::of13::MultipartReq
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_request_message);
 }
-void VirtualSwitch::handle_multipart_request_port_stats(fluid_msg::of13::MultipartRequestPortStats& multipart_request_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request port stats it shouldn't";
-
-	// Send an error message explaining that his multipart
-	// message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_request_message);
-}
 void VirtualSwitch::handle_multipart_request_queue(fluid_msg::of13::MultipartRequestQueue& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request queue it shouldn't";
 
@@ -385,16 +317,6 @@ void VirtualSwitch::handle_multipart_request_meter_config(fluid_msg::of13::Multi
 		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
 		multipart_request_message);
 }
-void VirtualSwitch::handle_multipart_request_table_features(fluid_msg::of13::MultipartRequestTableFeatures& multipart_request_message) {
-	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request table features it shouldn't";
-
-	// Send an error message explaining that his multipart
-	// message is unsupported
-	send_error_response(
-		fluid_msg::of13::OFPET_BAD_REQUEST,
-		fluid_msg::of13::OFPBRC_BAD_MULTIPART,
-		multipart_request_message);
-}
 void VirtualSwitch::handle_multipart_request_experimenter(fluid_msg::of13::MultipartRequestExperimenter& multipart_request_message) {
 	BOOST_LOG_TRIVIAL(error) << *this << " received multipart request experimenter it shouldn't";
 